@@ -0,0 +1,213 @@
+// XapianLayer without HTTP: AddTaskToDB throughput and DoTextSearch,
+// DoTagSearch and DoGeoSearch latency on synthetic corpora of 10k, 100k
+// and 1M tasks (see SyntheticCorpus, seeded from dev/data/bullets.json).
+//
+// Each corpus is indexed once into $DOBRIKA_BENCH_DIR (default
+// <tmp>/dobrika_bench) and reused by later runs with the same seed
+// ($DOBRIKA_BENCH_SEED, default 1), so only the first run pays for
+// indexing the 1M corpus. $DOBRIKA_BENCH_SHARDS (default 1) shards the
+// index as DOBRIKA_SHARDS does. Searches report p50/p99 besides the
+// mean; for tracking across releases write JSON with
+//   --benchmark_out=bench.json --benchmark_out_format=json
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "synthetic_corpus.hpp"
+#include "tools/config_generator.hpp"
+#include "xapian_processor/xapian_processor.hpp"
+
+namespace {
+// Distinct queries cycled through by each search benchmark.
+constexpr size_t kQueries = 1024;
+constexpr size_t kIndexBatch = 10000;
+
+std::string EnvOr(const char *name, const std::string &def) {
+  const char *v = std::getenv(name);
+  return v && *v ? std::string(v) : def;
+}
+
+const SyntheticCorpus &Corpus() {
+  static const SyntheticCorpus corpus(
+      DOBRIKA_BENCH_DATA, std::stoull(EnvOr("DOBRIKA_BENCH_SEED", "1")));
+  return corpus;
+}
+
+// The layer over the corpus of `size` tasks, indexed on first use. Only
+// one corpus is open at a time.
+XapianLayer &Layer(size_t size) {
+  static std::mutex mutex;
+  static size_t open_size = 0;
+  static std::unique_ptr<XapianLayer> layer;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (layer && open_size == size)
+    return *layer;
+  layer.reset();
+
+  const std::filesystem::path dir = EnvOr(
+      "DOBRIKA_BENCH_DIR",
+      (std::filesystem::temp_directory_path() / "dobrika_bench").string());
+  const int shards = std::stoi(EnvOr("DOBRIKA_BENCH_SHARDS", "1"));
+  const std::string path =
+      (dir / ("corpus-" + std::to_string(size) + "-s" +
+              std::to_string(Corpus().Seed()) + "-x" +
+              std::to_string(shards)))
+          .string();
+  std::filesystem::create_directories(dir);
+  DobrikaServerConfig cfg = MakeServerConfig(path, 0, 0, 0, 20, 9);
+  cfg.mutable_sc()->set_shards(shards);
+  cfg.mutable_sc()->set_ingest_log(-1);
+  cfg.mutable_sc()->set_result_cache_max_mb(-1);
+  layer = std::make_unique<XapianLayer>(cfg);
+  open_size = size;
+
+  // Tasks [0, documents) survive from an earlier run.
+  size_t next = layer->GetIndexFootprint().documents;
+  if (next < size)
+    std::cerr << "indexing " << size - next << " tasks into " << path
+              << std::endl;
+  while (next < size) {
+    std::vector<DSIndexTask> batch;
+    for (; next < size && batch.size() < kIndexBatch; ++next)
+      batch.push_back(Corpus().Task(next));
+    layer->AddTasksToDBAsync(batch).get();
+  }
+  return *layer;
+}
+
+// Per-iteration latency percentiles, added as counters.
+class LatencyRecorder {
+public:
+  explicit LatencyRecorder(benchmark::State &state) : state(state) {}
+  ~LatencyRecorder() {
+    if (samples.empty())
+      return;
+    std::sort(samples.begin(), samples.end());
+    const auto at = [&](double q) {
+      return samples[static_cast<size_t>(q * (samples.size() - 1))];
+    };
+    state.counters["p50_us"] = at(0.50);
+    state.counters["p99_us"] = at(0.99);
+  }
+
+  template <typename Fn> void Time(Fn &&fn) {
+    const auto t0 = std::chrono::steady_clock::now();
+    fn();
+    samples.push_back(std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - t0)
+                          .count());
+  }
+
+private:
+  benchmark::State &state;
+  std::vector<double> samples;
+};
+
+template <typename Search, typename MakeQuery>
+void RunSearch(benchmark::State &state, Search &&search,
+               MakeQuery &&make_query) {
+  XapianLayer &layer = Layer(static_cast<size_t>(state.range(0)));
+  std::vector<DSearchRequest> queries;
+  for (size_t i = 0; i < kQueries; ++i)
+    queries.push_back(make_query(i));
+  size_t i = 0;
+  uint64_t hits = 0;
+  {
+    LatencyRecorder latency(state);
+    for (auto _ : state) {
+      latency.Time([&] {
+        const DSearchResult res = search(layer, queries[i++ % kQueries]);
+        hits += static_cast<uint64_t>(res.task_id_size());
+        benchmark::DoNotOptimize(res);
+      });
+    }
+  }
+  state.counters["hits"] = benchmark::Counter(
+      static_cast<double>(hits), benchmark::Counter::kAvgIterations);
+}
+
+// Re-indexes tasks of the corpus (same content, so the corpus stays as
+// generated); each call waits for its group commit. More threads share
+// commits.
+void BM_AddTaskToDB(benchmark::State &state) {
+  const size_t size = static_cast<size_t>(state.range(0));
+  XapianLayer &layer = Layer(size);
+  size_t i = static_cast<size_t>(state.thread_index()) * 7919;
+  for (auto _ : state)
+    layer.AddTaskToDB(Corpus().Task(i++ % size));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_AddTaskToDB)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Threads(1)
+    ->Threads(8)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_DoTextSearch(benchmark::State &state) {
+  RunSearch(
+      state,
+      [](XapianLayer &layer, const DSearchRequest &q) {
+        return layer.DoTextSearch(q);
+      },
+      [](size_t i) { return Corpus().TextQuery(i); });
+}
+BENCHMARK(BM_DoTextSearch)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_DoTagSearch(benchmark::State &state) {
+  RunSearch(
+      state,
+      [](XapianLayer &layer, const DSearchRequest &q) {
+        return layer.DoTagSearch(q);
+      },
+      [](size_t i) { return Corpus().TagQuery(i); });
+}
+BENCHMARK(BM_DoTagSearch)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+// Second argument: radius_km, 0 for nearest-first over the whole corpus.
+void BM_DoGeoSearch(benchmark::State &state) {
+  const double radius_km = static_cast<double>(state.range(1));
+  RunSearch(
+      state,
+      [](XapianLayer &layer, const DSearchRequest &q) {
+        return layer.DoGeoSearch(q);
+      },
+      [&](size_t i) { return Corpus().GeoQuery(i, radius_km); });
+}
+BENCHMARK(BM_DoGeoSearch)
+    ->ArgsProduct({{10000, 100000, 1000000}, {0, 5}})
+    ->Unit(benchmark::kMicrosecond);
+} // namespace
+
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  // Recorded in the JSON output's context.
+  benchmark::AddCustomContext("corpus_seed",
+                              std::to_string(Corpus().Seed()));
+  benchmark::AddCustomContext("corpus_source", DOBRIKA_BENCH_DATA);
+  benchmark::AddCustomContext("corpus_shards",
+                              EnvOr("DOBRIKA_BENCH_SHARDS", "1"));
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
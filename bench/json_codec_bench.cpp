@@ -0,0 +1,158 @@
+// JSON codec microbenchmark on bodies built from dev/data/bullets.json:
+// the streaming reader/writer in request_codec against a jsoncpp DOM
+// round-trip (what the handlers did before).
+#include <benchmark/benchmark.h>
+#include <json/json.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "server/request_codec.hpp"
+
+namespace {
+struct Corpus {
+  std::vector<std::string> tasks;
+  std::vector<std::string> searches;
+  DSearchResult result;
+};
+
+const Corpus &LoadCorpus() {
+  static const Corpus corpus = [] {
+    std::ifstream in(DOBRIKA_BENCH_DATA);
+    const std::string text((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    Json::Value records;
+    if (!Json::Reader().parse(text, records) || !records.isArray())
+      throw std::runtime_error("cannot read " DOBRIKA_BENCH_DATA);
+    Corpus c;
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    for (const auto &record : records) {
+      c.tasks.push_back(Json::writeString(writer, record));
+      Json::Value search;
+      search["user_query"] = record["task_desc"];
+      search["geo_data"] = record["geo_data"];
+      search["user_tags"].append(record["task_name"]);
+      search["user_tags"].append(record["task_type"]);
+      search["query_type"] = "QT_GeoTasks";
+      search["radius_km"] = 25;
+      search["limit"] = 20;
+      c.searches.push_back(Json::writeString(writer, search));
+      if (c.result.task_id_size() < 20)
+        c.result.add_task_id(record["task_id"].asString());
+    }
+    c.result.set_status("SearchOk");
+    c.result.set_estimated_total(records.size());
+    c.result.set_next_cursor("CJqy3dX4hYvUARIUAAAA");
+    return c;
+  }();
+  return corpus;
+}
+
+// The previous jsoncpp path: DOM parse, then copy field by field.
+DSIndexTask TaskFromDom(const std::string &body, Json::CharReader &reader) {
+  Json::Value json;
+  std::string err;
+  reader.parse(body.data(), body.data() + body.size(), &json, &err);
+  DSIndexTask task;
+  task.set_task_name(json["task_name"].asString());
+  task.set_task_desc(json["task_desc"].asString());
+  task.set_geo_data(json["geo_data"].asString());
+  task.set_task_id(json["task_id"].asString());
+  task.set_task_type(json["task_type"].asString());
+  for (const auto &t : json["task_tags"])
+    task.add_task_tags(t.asString());
+  return task;
+}
+
+DSearchRequest SearchFromDom(const std::string &body, Json::CharReader &reader) {
+  Json::Value json;
+  std::string err;
+  reader.parse(body.data(), body.data() + body.size(), &json, &err);
+  DSearchRequest req;
+  req.set_user_query(json["user_query"].asString());
+  req.set_geo_data(json["geo_data"].asString());
+  req.set_query_type(json["query_type"].asString());
+  req.set_radius_km(json["radius_km"].asDouble());
+  for (const auto &t : json["user_tags"])
+    req.add_user_tags(t.asString());
+  req.set_limit(json["limit"].asInt());
+  return req;
+}
+
+void BM_ParseTask_JsonCpp(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  std::unique_ptr<Json::CharReader> reader(
+      Json::CharReaderBuilder().newCharReader());
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(TaskFromDom(c.tasks[i++ % c.tasks.size()], *reader));
+  }
+}
+BENCHMARK(BM_ParseTask_JsonCpp);
+
+void BM_ParseTask_Reader(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  DSIndexTask task;
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseTaskJson(c.tasks[i++ % c.tasks.size()], task));
+  }
+}
+BENCHMARK(BM_ParseTask_Reader);
+
+void BM_ParseSearch_JsonCpp(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  std::unique_ptr<Json::CharReader> reader(
+      Json::CharReaderBuilder().newCharReader());
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        SearchFromDom(c.searches[i++ % c.searches.size()], *reader));
+  }
+}
+BENCHMARK(BM_ParseSearch_JsonCpp);
+
+void BM_ParseSearch_Reader(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  DSearchRequest req;
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        ParseSearchJson(c.searches[i++ % c.searches.size()], req));
+  }
+}
+BENCHMARK(BM_ParseSearch_Reader);
+
+void BM_WriteResult_JsonCpp(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  for (auto _ : state) {
+    Json::Value j;
+    j["status"] = c.result.status();
+    Json::Value ids(Json::arrayValue);
+    for (const auto &id : c.result.task_id())
+      ids.append(id);
+    j["task_id"] = std::move(ids);
+    j["estimated_total"] = Json::UInt64(c.result.estimated_total());
+    j["next_cursor"] = c.result.next_cursor();
+    benchmark::DoNotOptimize(Json::writeString(writer, j));
+  }
+}
+BENCHMARK(BM_WriteResult_JsonCpp);
+
+void BM_WriteResult_Direct(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ToJson(c.result));
+  }
+}
+BENCHMARK(BM_WriteResult_Direct);
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,159 @@
+// Query parsing and document term generation on texts from
+// dev/data/bullets.json: a QueryParser / TermGenerator built per call (what
+// the search and index paths did before) against the per-handle
+// QueryContext, with and without its parsed-query cache, and a reused
+// per-thread TermGenerator. "allocs" is heap allocations per iteration.
+#include <benchmark/benchmark.h>
+#include <json/json.h>
+#include <xapian.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "xapian_processor/query_context.hpp"
+
+namespace {
+std::atomic<uint64_t> g_allocations{0};
+} // namespace
+
+void *operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+// Queries repeat heavily in production; the hot set is the first
+// kHotQueries task names, well within the default 256-entry cache.
+constexpr size_t kHotQueries = 64;
+
+struct Corpus {
+  std::vector<std::string> queries;
+  std::vector<std::pair<std::string, std::string>> texts; // name, desc
+};
+
+const Corpus &LoadCorpus() {
+  static const Corpus corpus = [] {
+    std::ifstream in(DOBRIKA_BENCH_DATA);
+    const std::string text((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    Json::Value records;
+    if (!Json::Reader().parse(text, records) || !records.isArray())
+      throw std::runtime_error("cannot read " DOBRIKA_BENCH_DATA);
+    Corpus c;
+    for (const auto &record : records) {
+      if (c.queries.size() < kHotQueries)
+        c.queries.push_back(record["task_name"].asString());
+      c.texts.emplace_back(record["task_name"].asString(),
+                           record["task_desc"].asString());
+    }
+    return c;
+  }();
+  return corpus;
+}
+
+// Counts allocations made inside the timed loop only.
+class AllocationCounter {
+public:
+  explicit AllocationCounter(benchmark::State &state)
+      : state(state), start(g_allocations.load()) {}
+  ~AllocationCounter() {
+    state.counters["allocs"] = benchmark::Counter(
+        static_cast<double>(g_allocations.load() - start),
+        benchmark::Counter::kAvgIterations);
+  }
+
+private:
+  benchmark::State &state;
+  const uint64_t start;
+};
+
+void BM_ParseQuery_FreshParser(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  const Xapian::Database db;
+  size_t i = 0;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    Xapian::QueryParser qp;
+    qp.set_stemmer(Xapian::Stem("russian"));
+    qp.set_stemming_strategy(Xapian::QueryParser::STEM_SOME);
+    qp.set_database(db);
+    benchmark::DoNotOptimize(
+        qp.parse_query(c.queries[i++ % c.queries.size()],
+                       Xapian::QueryParser::FLAG_DEFAULT));
+  }
+}
+BENCHMARK(BM_ParseQuery_FreshParser);
+
+void BM_ParseQuery_Context(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  QueryCacheCounters counters;
+  QueryContext context(static_cast<size_t>(state.range(0)), counters);
+  context.Bind(Xapian::Database());
+  size_t i = 0;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        context.Parse(c.queries[i++ % c.queries.size()]));
+  }
+  const uint64_t hits = counters.hits.load();
+  const uint64_t parsed =
+      std::max<uint64_t>(1, hits + counters.misses.load());
+  state.counters["hit_rate"] =
+      static_cast<double>(hits) / static_cast<double>(parsed);
+}
+// 0 = parser reused, cache off.
+BENCHMARK(BM_ParseQuery_Context)->Arg(0)->Arg(256);
+
+void IndexTexts(Xapian::TermGenerator &termgen,
+                const std::pair<std::string, std::string> &texts) {
+  termgen.index_text(texts.first, 1, "T");
+  termgen.index_text(texts.first);
+  termgen.index_text(texts.second, 1, "T");
+  termgen.index_text(texts.second);
+}
+
+void BM_IndexText_FreshTermGenerator(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  size_t i = 0;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    Xapian::Document doc;
+    Xapian::TermGenerator termgen;
+    termgen.set_document(doc);
+    termgen.set_stemmer(Xapian::Stem("russian"));
+    IndexTexts(termgen, c.texts[i++ % c.texts.size()]);
+    benchmark::DoNotOptimize(doc);
+  }
+}
+BENCHMARK(BM_IndexText_FreshTermGenerator);
+
+void BM_IndexText_ReusedTermGenerator(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  Xapian::TermGenerator termgen;
+  termgen.set_stemmer(Xapian::Stem("russian"));
+  size_t i = 0;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    Xapian::Document doc;
+    termgen.set_document(doc);
+    IndexTexts(termgen, c.texts[i++ % c.texts.size()]);
+    termgen.set_document(Xapian::Document());
+    benchmark::DoNotOptimize(doc);
+  }
+}
+BENCHMARK(BM_IndexText_ReusedTermGenerator);
+} // namespace
+
+BENCHMARK_MAIN();
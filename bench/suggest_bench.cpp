@@ -0,0 +1,102 @@
+// /suggest lookups on an in-memory database of the texts in
+// dev/data/bullets.json (indexed as the server does, name and description
+// with and without the title prefix), for prefixes of 1..8 characters of
+// the task names. Also reports the trie's size and the Rebuild() time.
+#include <benchmark/benchmark.h>
+#include <json/json.h>
+#include <xapian.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "xapian_processor/suggest_index.hpp"
+
+namespace {
+struct Corpus {
+  Xapian::WritableDatabase db{std::string(), Xapian::DB_BACKEND_INMEMORY};
+  std::vector<std::string> names;
+};
+
+const Corpus &LoadCorpus() {
+  static const Corpus corpus = [] {
+    std::ifstream in(DOBRIKA_BENCH_DATA);
+    const std::string text((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    Json::Value records;
+    if (!Json::Reader().parse(text, records) || !records.isArray())
+      throw std::runtime_error("cannot read " DOBRIKA_BENCH_DATA);
+    Corpus c;
+    Xapian::TermGenerator termgen;
+    termgen.set_stemmer(Xapian::Stem("russian"));
+    for (const auto &record : records) {
+      const std::string name = record["task_name"].asString();
+      const std::string desc = record["task_desc"].asString();
+      Xapian::Document doc;
+      doc.set_data(name + '\n' + desc + '\n' +
+                   record["task_id"].asString());
+      termgen.set_document(doc);
+      termgen.index_text(name, 1, "T");
+      termgen.index_text(name);
+      termgen.index_text(desc, 1, "T");
+      termgen.index_text(desc);
+      c.db.add_document(doc);
+      c.names.push_back(name);
+    }
+    c.db.commit();
+    return c;
+  }();
+  return corpus;
+}
+
+// The first n UTF-8 characters of text.
+std::string Prefix(const std::string &text, size_t n) {
+  size_t end = 0;
+  for (; end < text.size() && n > 0; --n) {
+    ++end;
+    while (end < text.size() && (text[end] & 0xC0) == 0x80)
+      ++end;
+  }
+  return text.substr(0, end);
+}
+
+void BM_Rebuild(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  for (auto _ : state) {
+    SuggestIndex index(64 << 20);
+    index.Rebuild(c.db);
+    const SuggestStats stats = index.GetStats();
+    state.counters["keys"] = static_cast<double>(stats.words + stats.names);
+    state.counters["bytes"] = static_cast<double>(stats.bytes);
+  }
+}
+BENCHMARK(BM_Rebuild)->Unit(benchmark::kMillisecond);
+
+void BM_Suggest(benchmark::State &state) {
+  const Corpus &c = LoadCorpus();
+  SuggestIndex index(64 << 20);
+  index.Rebuild(c.db);
+  std::vector<std::string> queries;
+  for (const std::string &name : c.names)
+    queries.push_back(Prefix(name, static_cast<size_t>(state.range(0))));
+  size_t i = 0;
+  double worst_us = 0;
+  for (auto _ : state) {
+    const auto t0 = std::chrono::steady_clock::now();
+    benchmark::DoNotOptimize(index.Suggest(queries[i++ % queries.size()], 10));
+    worst_us = std::max(
+        worst_us, std::chrono::duration<double, std::micro>(
+                      std::chrono::steady_clock::now() - t0)
+                      .count());
+  }
+  state.counters["worst_us"] = worst_us;
+}
+// Characters typed so far.
+BENCHMARK(BM_Suggest)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,174 @@
+#include "synthetic_corpus.hpp"
+
+#include <json/json.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+constexpr size_t kVocabulary = 50000;
+constexpr size_t kTags = 1000;
+// ~10 km in latitude.
+constexpr double kTaskJitterDeg = 0.1;
+constexpr double kQueryJitterDeg = 0.05;
+
+constexpr uint64_t kTaskSalt = 0x7461736b;
+constexpr uint64_t kTextSalt = 0x74657874;
+constexpr uint64_t kTagSalt = 0x74616773;
+constexpr uint64_t kGeoSalt = 0x67656f;
+
+// Lowercased ASCII words of text; '_' separates words too.
+void SplitWords(const std::string &text, std::vector<std::string> &out) {
+  std::string word;
+  for (const char c : text + ' ') {
+    if (std::isalnum(static_cast<unsigned char>(c))) {
+      word += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    } else if (!word.empty()) {
+      out.push_back(std::move(word));
+      word.clear();
+    }
+  }
+}
+} // namespace
+
+class SyntheticCorpus::Rng {
+public:
+  explicit Rng(uint64_t state) : state(state) {}
+
+  // SplitMix64.
+  uint64_t Next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+  // [0, 1) with 53 random bits.
+  double Unit() { return static_cast<double>(Next() >> 11) * 0x1.0p-53; }
+  // [min, max].
+  size_t Between(size_t min, size_t max) {
+    return min + static_cast<size_t>(Next() % (max - min + 1));
+  }
+
+private:
+  uint64_t state;
+};
+
+SyntheticCorpus::Zipf::Zipf(size_t n) : cdf(n) {
+  double sum = 0;
+  for (size_t rank = 0; rank < n; ++rank)
+    cdf[rank] = sum += 1.0 / static_cast<double>(rank + 1);
+  for (double &p : cdf)
+    p /= sum;
+}
+
+size_t SyntheticCorpus::Zipf::Sample(Rng &rng) const {
+  const auto it = std::upper_bound(cdf.begin(), cdf.end(), rng.Unit());
+  return std::min<size_t>(static_cast<size_t>(it - cdf.begin()),
+                          cdf.size() - 1);
+}
+
+SyntheticCorpus::SyntheticCorpus(const std::string &seed_json, uint64_t seed)
+    : seed(seed), words(kVocabulary), tags(kTags) {
+  std::ifstream in(seed_json);
+  const std::string text((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  Json::Value records;
+  if (!Json::Reader().parse(text, records) || !records.isArray())
+    throw std::runtime_error("cannot read " + seed_json);
+  for (const auto &record : records) {
+    SplitWords(record["task_name"].asString(), head_words);
+    SplitWords(record["task_desc"].asString(), head_words);
+    double lat = 0, lon = 0;
+    char comma = 0;
+    std::istringstream geo(record["geo_data"].asString());
+    if (geo >> lat >> comma >> lon && comma == ',')
+      points.emplace_back(lat, lon);
+  }
+  // First occurrence order, so the file order decides the ranks.
+  std::vector<std::string> unique;
+  for (auto &word : head_words) {
+    if (std::find(unique.begin(), unique.end(), word) == unique.end())
+      unique.push_back(std::move(word));
+  }
+  head_words = std::move(unique);
+  if (head_words.empty() || points.empty())
+    throw std::runtime_error("no words or geo points in " + seed_json);
+}
+
+SyntheticCorpus::Rng SyntheticCorpus::Stream(uint64_t salt, size_t i) const {
+  return Rng(Rng(seed ^ salt).Next() ^
+             (static_cast<uint64_t>(i) * 0xd1342543de82ef95ull));
+}
+
+std::string SyntheticCorpus::Word(Rng &rng) const {
+  const size_t rank = words.Sample(rng);
+  if (rank < head_words.size())
+    return head_words[rank];
+  return "w" + std::to_string(rank);
+}
+
+std::string SyntheticCorpus::Words(Rng &rng, size_t min, size_t max) const {
+  std::string out;
+  for (size_t n = rng.Between(min, max); n > 0; --n) {
+    if (!out.empty())
+      out += ' ';
+    out += Word(rng);
+  }
+  return out;
+}
+
+std::string SyntheticCorpus::Tag(Rng &rng) const {
+  return "tag" + std::to_string(tags.Sample(rng));
+}
+
+std::string SyntheticCorpus::Point(Rng &rng, double jitter_deg) const {
+  const auto &[lat, lon] = points[rng.Between(0, points.size() - 1)];
+  char buf[64];
+  std::snprintf(buf, sizeof buf, "%.6f,%.6f",
+                lat + (rng.Unit() * 2 - 1) * jitter_deg,
+                lon + (rng.Unit() * 2 - 1) * jitter_deg);
+  return buf;
+}
+
+DSIndexTask SyntheticCorpus::Task(size_t i) const {
+  Rng rng = Stream(kTaskSalt, i);
+  DSIndexTask task;
+  task.set_task_id("synthetic-" + std::to_string(i));
+  task.set_task_name(Words(rng, 2, 4));
+  task.set_task_desc(Words(rng, 8, 24));
+  task.set_geo_data(Point(rng, kTaskJitterDeg));
+  task.set_task_type(rng.Next() % 2 ? "TT_OnlineTask" : "TT_OfflineTask");
+  for (size_t n = rng.Between(1, 5); n > 0; --n)
+    task.add_task_tags(Tag(rng));
+  return task;
+}
+
+DSearchRequest SyntheticCorpus::TextQuery(size_t i) const {
+  Rng rng = Stream(kTextSalt, i);
+  DSearchRequest req;
+  req.set_user_query(Words(rng, 1, 2));
+  return req;
+}
+
+DSearchRequest SyntheticCorpus::TagQuery(size_t i) const {
+  Rng rng = Stream(kTagSalt, i);
+  DSearchRequest req;
+  req.set_query_type("QT_TagTasks");
+  for (size_t n = rng.Between(1, 3); n > 0; --n)
+    req.add_user_tags(Tag(rng));
+  return req;
+}
+
+DSearchRequest SyntheticCorpus::GeoQuery(size_t i, double radius_km) const {
+  Rng rng = Stream(kGeoSalt, i);
+  DSearchRequest req;
+  req.set_query_type("QT_GeoTasks");
+  req.set_geo_data(Point(rng, kQueryJitterDeg));
+  req.set_radius_km(radius_km);
+  return req;
+}
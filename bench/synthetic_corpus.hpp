@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DSRequest.pb.h"
+
+// Deterministic tasks and queries for benchmarks at any corpus size.
+//
+// Words, task names and locations are seeded from a bullets.json-style
+// file: its words are the most frequent head of a Zipf vocabulary (tail
+// words are "w<n>"), tags follow a Zipf distribution over "tag<n>", and
+// every task lies within ~10 km of one of its geo points. Task i and
+// query i depend only on the seed and i (SplitMix64, no <random>
+// distributions), so runs on different machines and standard libraries
+// see the same corpus.
+class SyntheticCorpus {
+public:
+  // Throws std::runtime_error if the file has no usable records.
+  SyntheticCorpus(const std::string &seed_json, uint64_t seed);
+
+  DSIndexTask Task(size_t i) const;
+
+  // 1-2 words, as typed into the search box (no query_type).
+  DSearchRequest TextQuery(size_t i) const;
+  // 1-3 tags, any of which matches.
+  DSearchRequest TagQuery(size_t i) const;
+  // Nearest tasks to a point near a seed location; radius_km 0 orders
+  // the whole corpus by distance.
+  DSearchRequest GeoQuery(size_t i, double radius_km) const;
+
+  uint64_t Seed() const { return seed; }
+
+private:
+  class Rng;
+  // Inverse CDF of a Zipf(1) distribution over n ranks.
+  class Zipf {
+  public:
+    explicit Zipf(size_t n);
+    size_t Sample(Rng &rng) const;
+
+  private:
+    std::vector<double> cdf;
+  };
+
+  Rng Stream(uint64_t salt, size_t i) const;
+  std::string Word(Rng &rng) const;
+  std::string Words(Rng &rng, size_t min, size_t max) const;
+  std::string Tag(Rng &rng) const;
+  std::string Point(Rng &rng, double jitter_deg) const;
+
+  const uint64_t seed;
+  std::vector<std::string> head_words;
+  std::vector<std::pair<double, double>> points; // lat, lon
+  Zipf words;
+  Zipf tags;
+};
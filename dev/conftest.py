@@ -84,6 +84,50 @@ def _forward_process_output(proc: subprocess.Popen[str]) -> tuple[Deque[str], De
     return stdout_buf, stderr_buf
 
 
+def _spawn_server(binary_path: Path, env: dict, base_url: str) -> subprocess.Popen[str]:
+    """Starts the server binary with env and waits until base_url is healthy."""
+    proc = subprocess.Popen(
+        [str(binary_path)],
+        env=env,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+        cwd=str(binary_path.parent),
+        start_new_session=True,  # allow killing the whole process group
+    )
+    stdout_buf, stderr_buf = _forward_process_output(proc)
+
+    try:
+        _wait_for_health(base_url, timeout_s=20.0)
+    except Exception:
+        # Dump some logs to help debugging before killing
+        try:
+            if stderr_buf:
+                print("Dobrika server stderr (tail):", file=sys.stderr)
+                for line in stderr_buf:
+                    print(line, file=sys.stderr)
+            if stdout_buf:
+                print("Dobrika server stdout (tail):")
+                for line in stdout_buf:
+                    print(line)
+        finally:
+            os.killpg(proc.pid, signal.SIGTERM)
+            proc.wait(timeout=5)
+        raise
+    return proc
+
+
+def _stop_server(proc: subprocess.Popen[str]) -> None:
+    try:
+        os.killpg(proc.pid, signal.SIGTERM)
+        proc.wait(timeout=10)
+    except Exception:
+        try:
+            os.killpg(proc.pid, signal.SIGKILL)
+        except Exception:
+            pass
+
+
 @pytest.fixture(scope="session")
 def server_url(tmp_path_factory: pytest.TempPathFactory) -> str:
     """
@@ -137,50 +181,17 @@ def server_url(tmp_path_factory: pytest.TempPathFactory) -> str:
     env.setdefault("DOBRIKA_GEO_INDEX", "9")
     env.setdefault("DOBRIKA_LOG_REQUESTS", "0")
 
-    proc = subprocess.Popen(
-        [str(binary_path)],
-        env=env,
-        stdout=subprocess.PIPE,
-        stderr=subprocess.PIPE,
-        text=True,
-        cwd=str(binary_path.parent),
-        start_new_session=True,  # allow killing the whole process group
-    )
-    stdout_buf, stderr_buf = _forward_process_output(proc)
-
-    try:
-        _wait_for_health(base_url, timeout_s=20.0)
-    except Exception:
-        # Dump some logs to help debugging before killing
-        try:
-            if stderr_buf:
-                print("Dobrika server stderr (tail):", file=sys.stderr)
-                for line in stderr_buf:
-                    print(line, file=sys.stderr)
-            if stdout_buf:
-                print("Dobrika server stdout (tail):")
-                for line in stdout_buf:
-                    print(line)
-        finally:
-            os.killpg(proc.pid, signal.SIGTERM)
-            proc.wait(timeout=5)
-        raise
+    proc = _spawn_server(binary_path, env, base_url)
 
     yield base_url
 
-    # Teardown
-    try:
-        os.killpg(proc.pid, signal.SIGTERM)
-        proc.wait(timeout=10)
-    except Exception:
-        try:
-            os.killpg(proc.pid, signal.SIGKILL)
-        except Exception:
-            pass
+    _stop_server(proc)
     if cleanup_db:
-        try:
-            shutil.rmtree(db_path, ignore_errors=True)
-        except Exception:
-            pass
+        # The ingest log and backups live next to the database directory.
+        for path in (db_path, db_path + "_wal", db_path + "_backup"):
+            try:
+                shutil.rmtree(path, ignore_errors=True)
+            except Exception:
+                pass
 
 
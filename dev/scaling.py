@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Search throughput of dobrika_server_main on 1..N cores.
+
+For each core count k the server is started pinned to CPUs 0..k-1 with k
+event loops (SO_REUSEPORT) and 2k search workers, and dobrika_loadgen,
+pinned to the remaining CPUs, raises the offered rate until p99 leaves
+the SLO or requests fail. The table lists the highest rate each k
+sustained:
+
+  python3 scaling.py --binary ../build/dobrika_server_main \\
+      --loadgen ../build/dobrika_loadgen --cores 1,2,4,8
+
+The corpus (--tasks synthetic tasks built from data/bullets.json) is
+indexed once into --db and reused; the result cache is off so every
+search reaches Xapian.
+"""
+import argparse
+import json
+import os
+import random
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+from contextlib import closing
+from pathlib import Path
+
+import requests
+
+DATA = Path(__file__).parent / "data" / "bullets.json"
+
+
+def _free_port():
+    with closing(socket.socket(socket.AF_INET, socket.SOCK_STREAM)) as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def _corpus(n, rng):
+    seed = json.loads(DATA.read_text())
+    words = sorted({w for t in seed for w in f"{t['task_name']} {t['task_desc']}".replace("_", " ").split()})
+    tasks = []
+    for i in range(n):
+        base = seed[i % len(seed)]
+        lat, lon = (float(x) for x in base["geo_data"].split(","))
+        tasks.append({
+            "task_id": f"scale_{i}",
+            "task_name": " ".join(rng.choices(words, k=2)),
+            "task_desc": " ".join(rng.choices(words, k=8)),
+            "geo_data": f"{lat + rng.uniform(-0.1, 0.1):.5f},{lon + rng.uniform(-0.1, 0.1):.5f}",
+            "task_tags": [f"tag{rng.randrange(200)}"],
+        })
+    return tasks, words, seed
+
+
+def _capture(path, words, seed, rng):
+    lines = []
+    for _ in range(2000):
+        kind = rng.random()
+        if kind < 0.5:
+            lines.append({"user_query": " ".join(rng.choices(words, k=2)), "limit": 20})
+        elif kind < 0.8:
+            lines.append({"query_type": "QT_TagTasks", "user_tags": [f"tag{rng.randrange(200)}"], "limit": 20})
+        else:
+            lines.append({"query_type": "QT_GeoTasks", "geo_data": rng.choice(seed)["geo_data"], "limit": 20})
+    path.write_text("\n".join(json.dumps(line) for line in lines) + "\n")
+
+
+def _start(args, k, port):
+    env = dict(os.environ,
+               DOBRIKA_PORT=str(port), DOBRIKA_DB_PATH=args.db, DOBRIKA_BACKUP_DIR="",
+               DOBRIKA_RESULT_CACHE_MB="-1", DOBRIKA_IO_THREADS=str(k), DOBRIKA_REUSEPORT="1",
+               DOBRIKA_SEARCH_MAX_IN_FLIGHT=str(2 * k), DOBRIKA_INDEX_WORKERS=str(4 * k),
+               DOBRIKA_PIN_CORES=f"0-{k - 1}", DOBRIKA_ACCESS_LOG_SAMPLE="-1")
+    proc = subprocess.Popen(["taskset", "-c", f"0-{k - 1}", args.binary], env=env,
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    url = f"http://127.0.0.1:{port}"
+    for _ in range(120):
+        try:
+            if requests.get(f"{url}/healthz", timeout=1).status_code == 200:
+                return proc, url
+        except requests.RequestException:
+            pass
+        time.sleep(0.25)
+    proc.kill()
+    raise RuntimeError("server did not become healthy")
+
+
+def _run_loadgen(args, k, url, capture, rps, report):
+    cpus = f"{k}-{os.cpu_count() - 1}"
+    subprocess.run(["taskset", "-c", cpus, args.loadgen, f"--url={url}", f"--rps={rps}",
+                    f"--duration={args.duration}", f"--connections={args.connections}",
+                    "--index-ratio=0", f"--json={report}", str(capture)],
+                   check=True, stdout=subprocess.DEVNULL, timeout=args.duration + 120)
+    return json.loads(report.read_text())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", required=True)
+    parser.add_argument("--loadgen", required=True)
+    parser.add_argument("--cores", default="1,2,4")
+    parser.add_argument("--db", default=os.path.join(tempfile.gettempdir(), "dobrika_scaling_db"))
+    parser.add_argument("--tasks", type=int, default=100000)
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--connections", type=int, default=64)
+    parser.add_argument("--slo-ms", type=float, default=50)
+    parser.add_argument("--start-rps", type=float, default=200)
+    args = parser.parse_args()
+
+    cores = [int(c) for c in args.cores.split(",")]
+    if max(cores) >= os.cpu_count():
+        sys.exit("leave at least one CPU for dobrika_loadgen")
+    rng = random.Random(1)
+    tasks, words, seed = _corpus(args.tasks, rng)
+    work = Path(tempfile.mkdtemp(prefix="dobrika_scaling_"))
+    capture = work / "capture.jsonl"
+    _capture(capture, words, seed, rng)
+
+    rows = []
+    for k in cores:
+        proc, url = _start(args, k, _free_port())
+        try:
+            if not rows:
+                ndjson = "\n".join(json.dumps(t) for t in tasks).encode()
+                requests.post(f"{url}/index/bulk", data=ndjson, timeout=3600,
+                              headers={"Content-Type": "application/x-ndjson"}).raise_for_status()
+            best, rps = None, args.start_rps
+            while True:
+                report = _run_loadgen(args, k, url, capture, rps, work / f"report-{k}-{int(rps)}.json")
+                achieved = report["requests"] / report["elapsed_sec"]
+                ok = (report["errors"] == 0 and report["latency"]["p99_ms"] <= args.slo_ms
+                      and achieved >= 0.95 * rps)
+                print(f"cores={k} rps={rps:.0f} achieved={achieved:.0f} "
+                      f"p99={report['latency']['p99_ms']:.1f}ms errors={report['errors']}", file=sys.stderr)
+                if not ok:
+                    break
+                best = (rps, report["latency"])
+                rps *= 1.25
+        finally:
+            proc.terminate()
+            proc.wait(timeout=30)
+        rows.append((k, best))
+
+    print(f"| cores | max rps (p99 <= {args.slo_ms:g} ms) | p50 ms | p99 ms | speedup |")
+    print("|---|---|---|---|---|")
+    base = rows[0][1][0] if rows[0][1] else None
+    for k, best in rows:
+        if not best:
+            print(f"| {k} | below {args.start_rps:g} | - | - | - |")
+            continue
+        rps, lat = best
+        speedup = f"{rps / base:.2f}x" if base else "-"
+        print(f"| {k} | {rps:.0f} | {lat['p50_ms']:.2f} | {lat['p99_ms']:.2f} | {speedup} |")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Search admission control on a dedicated server with one search slot.
+
+Needs RUN_SERVER=1 and DOBRIKA_BINARY; the test starts its own server with
+DOBRIKA_SEARCH_MAX_IN_FLIGHT=1 and no queue, so any search arriving while
+another runs is shed with 503.
+"""
+import concurrent.futures
+import json
+import os
+from pathlib import Path
+
+import pytest
+import requests
+
+from conftest import _get_env_bool, _pick_free_port, _spawn_server, _stop_server
+
+pytestmark = pytest.mark.skipif(
+    not (_get_env_bool("RUN_SERVER") and os.environ.get("DOBRIKA_BINARY")),
+    reason="starts its own server; set RUN_SERVER=1 and DOBRIKA_BINARY",
+)
+
+
+def _rejected(url, reason):
+    series = f'dobrika_search_rejected_total{{reason="{reason}"}} '
+    for line in requests.get(f"{url}/metrics", timeout=5.0).text.splitlines():
+        if line.startswith(series):
+            return float(line.split()[-1])
+    raise AssertionError(f"{series.strip()} not exported")
+
+
+@pytest.fixture(scope="module")
+def server(tmp_path_factory):
+    binary = Path(os.environ["DOBRIKA_BINARY"]).resolve()
+    root = tmp_path_factory.mktemp("admission")
+    port = _pick_free_port()
+    url = f"http://127.0.0.1:{port}"
+    env = os.environ.copy()
+    env.pop("DOBRIKA_REPLICA_OF", None)
+    env.update({
+        "DOBRIKA_ADDR": "127.0.0.1",
+        "DOBRIKA_PORT": str(port),
+        "DOBRIKA_DB_PATH": str(root / "db"),
+        "DOBRIKA_BACKUP_DIR": "",
+        "DOBRIKA_GEO_INDEX": "9",
+        "DOBRIKA_LOG_REQUESTS": "0",
+        "DOBRIKA_SEARCH_MAX_IN_FLIGHT": "1",
+        "DOBRIKA_SEARCH_QUEUE": "-1",
+        # Every search has to run, none is answered from the cache.
+        "DOBRIKA_RESULT_CACHE_MB": "-1",
+    })
+    proc = _spawn_server(binary, env, url)
+    # Enough tasks that a distance-sorted page takes a while.
+    lines = [
+        json.dumps({
+            "task_id": f"adm_{i}",
+            "task_name": "Admission",
+            "task_type": "TT_OfflineTask",
+            "geo_data": f"{55.7 + (i % 100) * 0.001},{37.6 + (i // 100) * 0.001}",
+            "task_tags": ["adm_tag"],
+        })
+        for i in range(2000)
+    ]
+    resp = requests.post(
+        f"{url}/index/bulk",
+        data="\n".join(lines).encode("utf-8"),
+        headers={"Content-Type": "application/x-ndjson"},
+        timeout=60.0,
+    )
+    assert resp.status_code == 200
+    yield url
+    _stop_server(proc)
+
+
+class TestLoadShedding:
+    """With one slot and no queue a concurrent burst is partly shed"""
+
+    def test_burst_is_shed_and_counted(self, server):
+        before = _rejected(server, "queue_full")
+        statuses = []
+        with requests.Session() as session:
+            with concurrent.futures.ThreadPoolExecutor(max_workers=16) as pool:
+                # Rounds until one overlaps a running search; the first
+                # nearly always does.
+                for _ in range(10):
+                    futures = [
+                        pool.submit(session.post, f"{server}/search", json={
+                            "query_type": "QT_GeoTasks", "geo_data": "55.75,37.65", "limit": 1000,
+                        }, timeout=10.0)
+                        for _ in range(32)
+                    ]
+                    statuses += [f.result() for f in futures]
+                    if any(r.status_code == 503 for r in statuses):
+                        break
+
+        shed = [r for r in statuses if r.status_code == 503]
+        assert shed, "no search was shed"
+        for resp in shed:
+            assert resp.headers["Retry-After"] == "1"
+            assert resp.json()["error"] == "SearchOverloaded"
+        assert all(r.status_code in (200, 503) for r in statuses)
+        assert _rejected(server, "queue_full") == before + len(shed)
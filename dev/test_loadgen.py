@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""dobrika_loadgen against the test server: replay, mix and the report.
+
+Needs DOBRIKA_LOADGEN (path to the binary) besides the usual server setup.
+"""
+import json
+import os
+import subprocess
+
+import pytest
+
+pytestmark = pytest.mark.skipif(
+    not os.environ.get("DOBRIKA_LOADGEN"),
+    reason="set DOBRIKA_LOADGEN to the dobrika_loadgen binary",
+)
+
+
+def _run(server_url, capture, *args):
+    out = capture.parent / "report.json"
+    proc = subprocess.run(
+        [os.environ["DOBRIKA_LOADGEN"], f"--url={server_url}", f"--json={out}", *args, str(capture)],
+        capture_output=True, text=True, timeout=60,
+    )
+    assert proc.returncode == 0, proc.stderr
+    return json.loads(out.read_text())
+
+
+@pytest.fixture
+def capture(tmp_path):
+    lines = [
+        {"task_id": f"lg_{i}", "task_name": "Load", "task_tags": ["lg_tag"]} for i in range(5)
+    ] + [
+        {"query_type": "QT_TagTasks", "user_tags": ["lg_tag"]},
+        {"user_query": "load"},
+        {"path": "/healthz", "method": "GET"},
+    ]
+    path = tmp_path / "capture.jsonl"
+    path.write_text("\n".join(json.dumps(line) for line in lines) + "\n")
+    return path
+
+
+def _series(report):
+    return {(s["endpoint"], s.get("query_type", "")): s for s in report["series"]}
+
+
+def test_replays_at_target_rate(server_url, capture):
+    report = _run(server_url, capture, "--rps=100", "--duration=2", "--connections=4")
+    assert abs(report["scheduled"] - 200) <= 1
+    assert report["requests"] == report["scheduled"]
+    assert report["errors"] == 0
+    series = _series(report)
+    assert {("/index", ""), ("/search", "QT_TagTasks"), ("/search", "unknown"), ("/healthz", "")} <= set(series)
+    for s in series.values():
+        assert 0 < s["latency"]["p50_ms"] <= s["latency"]["p99_ms"] <= s["latency"]["p999_ms"] <= s["latency"]["max_ms"]
+        assert s["statuses"] == {"200": s["requests"]}
+
+
+def test_index_ratio(server_url, capture):
+    report = _run(server_url, capture, "--rps=200", "--duration=1", "--index-ratio=0", "--poisson")
+    assert all(s["endpoint"] != "/index" for s in report["series"])
+
+
+def test_transport_errors_are_counted(capture):
+    report = _run("http://127.0.0.1:9", capture, "--rps=20", "--duration=0.5", "--timeout=1")
+    assert report["errors"] == report["requests"] == report["scheduled"]
@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+"""/delete, expires_at, background compaction and backups on dedicated servers.
+
+Needs RUN_SERVER=1 and DOBRIKA_BINARY; the tests start their own servers with
+one-second sweep, compaction and backup periods.
+"""
+import json
+import os
+import shutil
+import time
+from pathlib import Path
+
+import pytest
+import requests
+
+from conftest import _get_env_bool, _pick_free_port, _spawn_server, _stop_server
+
+pytestmark = pytest.mark.skipif(
+    not (_get_env_bool("RUN_SERVER") and os.environ.get("DOBRIKA_BINARY")),
+    reason="starts its own server; set RUN_SERVER=1 and DOBRIKA_BINARY",
+)
+
+
+def _task(prefix, i, tag, **extra):
+    return dict({
+        "task_id": f"{prefix}_{i}",
+        "task_name": "Maintenance",
+        "task_type": "TT_OnlineTask",
+        "geo_data": f"{62 + i * 0.001},{32 + i * 0.001}",
+        "task_tags": [tag],
+    }, **extra)
+
+
+def _tag_ids(url, tag, limit=1000):
+    resp = requests.post(f"{url}/search", json={
+        "query_type": "QT_TagTasks", "user_tags": [tag], "limit": limit,
+    }, timeout=5.0)
+    assert resp.status_code == 200
+    return sorted(resp.json()["task_id"])
+
+
+def _wait_until(predicate, timeout_s=15.0):
+    deadline = time.time() + timeout_s
+    while time.time() < deadline:
+        if predicate():
+            return True
+        time.sleep(0.2)
+    return predicate()
+
+
+def _metrics(url):
+    values = {}
+    for line in requests.get(f"{url}/metrics", timeout=5.0).text.splitlines():
+        if line and not line.startswith("#"):
+            name, value = line.rsplit(" ", 1)
+            values[name] = float(value)
+    return values
+
+
+def _delete(url, task_id):
+    return requests.post(f"{url}/delete", json={"task_id": task_id}, timeout=5.0)
+
+
+def _start(db_path, **overrides):
+    port = _pick_free_port()
+    url = f"http://127.0.0.1:{port}"
+    env = os.environ.copy()
+    env.pop("DOBRIKA_REPLICA_OF", None)
+    env.update({
+        "DOBRIKA_ADDR": "127.0.0.1",
+        "DOBRIKA_PORT": str(port),
+        "DOBRIKA_DB_PATH": str(db_path),
+        "DOBRIKA_BACKUP_DIR": "",
+        "DOBRIKA_GEO_INDEX": "9",
+        "DOBRIKA_LOG_REQUESTS": "0",
+        "DOBRIKA_SHARDS": "2",
+    }, **overrides)
+    proc = _spawn_server(Path(os.environ["DOBRIKA_BINARY"]).resolve(), env, url)
+    return url, proc
+
+
+@pytest.fixture(scope="module")
+def server(tmp_path_factory):
+    root = tmp_path_factory.mktemp("maintenance")
+    url, proc = _start(
+        root / "db",
+        DOBRIKA_EXPIRY_SWEEP_SEC="1",
+        DOBRIKA_COMPACTION_CHECK_SEC="1",
+        DOBRIKA_COMPACTION_DELETED_PCT="30",
+    )
+    yield url
+    _stop_server(proc)
+
+
+BACKUP_KEEP = 2
+
+
+@pytest.fixture(scope="module")
+def backup_server(tmp_path_factory):
+    """Hot backups every second; nothing else commits in the background"""
+    root = tmp_path_factory.mktemp("backup")
+    url, proc = _start(
+        root / "db",
+        DOBRIKA_BACKUP_DIR=str(root / "backup"),
+        DOBRIKA_BACKUP_SEC="1",
+        DOBRIKA_BACKUP_KEEP=str(BACKUP_KEEP),
+        DOBRIKA_COLD_MIN="0",
+        DOBRIKA_HOT_MIN="1",
+        DOBRIKA_EXPIRY_SWEEP_SEC="-1",
+        DOBRIKA_COMPACTION_CHECK_SEC="-1",
+    )
+    yield url, root
+    _stop_server(proc)
+
+
+class TestDelete:
+    """POST /delete removes a task and is idempotent"""
+
+    def test_deleted_task_disappears(self, server):
+        for i in range(3):
+            resp = requests.post(f"{server}/index?wait=1", json=_task("del", i, "del_tag"), timeout=5.0)
+            assert resp.status_code == 200
+        resp = _delete(server, "del_1")
+        assert resp.status_code == 200
+        assert resp.json()["status"] == "SearchDeleteOk"
+        assert _tag_ids(server, "del_tag") == ["del_0", "del_2"]
+
+    def test_missing_task_is_ok(self, server):
+        resp = _delete(server, "never_indexed")
+        assert resp.status_code == 200
+        assert resp.json()["status"] == "SearchDeleteOk"
+
+    def test_missing_task_id_is_rejected(self, server):
+        resp = requests.post(f"{server}/delete", json={}, timeout=5.0)
+        assert resp.status_code == 400
+        resp = requests.post(f"{server}/delete", data="{", timeout=5.0)
+        assert resp.status_code == 400
+
+    def test_delete_after_unwaited_index(self, server):
+        """The deletion queues behind the indexing of the same task"""
+        resp = requests.post(f"{server}/index", json=_task("race", 0, "race_tag"), timeout=5.0)
+        assert resp.status_code == 200
+        assert _delete(server, "race_0").status_code == 200
+        assert _tag_ids(server, "race_tag") == []
+
+    def test_reindex_after_delete(self, server):
+        task = _task("again", 0, "again_tag")
+        assert requests.post(f"{server}/index?wait=1", json=task, timeout=5.0).status_code == 200
+        assert _delete(server, "again_0").status_code == 200
+        assert requests.post(f"{server}/index?wait=1", json=task, timeout=5.0).status_code == 200
+        assert _tag_ids(server, "again_tag") == ["again_0"]
+
+    def test_api_deletions_are_counted(self, server):
+        assert _metrics(server)['dobrika_documents_deleted_total{reason="api"}'] >= 3
+
+
+class TestExpiry:
+    """Tasks with expires_at are swept within the sweep period"""
+
+    def test_expired_tasks_are_removed(self, server):
+        soon = int(time.time()) + 1
+        tasks = [
+            _task("exp", 0, "exp_tag", expires_at=soon),
+            _task("exp", 1, "exp_tag", expires_at=soon),
+            _task("exp", 2, "exp_tag", expires_at=int(time.time()) + 3600),
+            _task("exp", 3, "exp_tag"),
+        ]
+        for task in tasks:
+            assert requests.post(f"{server}/index?wait=1", json=task, timeout=5.0).status_code == 200
+        assert _wait_until(lambda: _tag_ids(server, "exp_tag") == ["exp_2", "exp_3"])
+        metrics = _metrics(server)
+        assert metrics['dobrika_documents_deleted_total{reason="expired"}'] >= 2
+        assert metrics["dobrika_expiry_sweeps_total"] >= 1
+
+    def test_reindex_without_expiry_keeps_task(self, server):
+        task = _task("keep", 0, "keep_tag", expires_at=int(time.time()) + 2)
+        assert requests.post(f"{server}/index?wait=1", json=task, timeout=5.0).status_code == 200
+        task.pop("expires_at")
+        assert requests.post(f"{server}/index?wait=1", json=task, timeout=5.0).status_code == 200
+        time.sleep(4)
+        assert _tag_ids(server, "keep_tag") == ["keep_0"]
+
+
+class TestCompaction:
+    """Shards with many deletions are compacted in the background"""
+
+    def test_compaction_after_deletions(self, server):
+        lines = [json.dumps(_task("cmp", i, "cmp_tag")) for i in range(400)]
+        resp = requests.post(
+            f"{server}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+        runs = _metrics(server)["dobrika_compaction_runs_total"]
+        for i in range(0, 400, 2):
+            assert _delete(server, f"cmp_{i}").status_code == 200
+
+        assert _wait_until(lambda: _metrics(server)["dobrika_compaction_runs_total"] > runs, timeout_s=30.0)
+        expected = sorted(f"cmp_{i}" for i in range(1, 400, 2))
+        assert _tag_ids(server, "cmp_tag") == expected
+        metrics = _metrics(server)
+        assert metrics["dobrika_compaction_last_success_timestamp_seconds"] > 0
+        assert metrics["dobrika_index_size_bytes"] > 0
+
+    def test_writes_after_compaction(self, server):
+        task = _task("cmp", 1000, "cmp_tag")
+        assert requests.post(f"{server}/index?wait=1", json=task, timeout=5.0).status_code == 200
+        assert "cmp_1000" in _tag_ids(server, "cmp_tag")
+        assert _delete(server, "cmp_1").status_code == 200
+        assert "cmp_1" not in _tag_ids(server, "cmp_tag")
+
+
+def _hot_runs(url):
+    return _metrics(url)['dobrika_backup_runs_total{kind="hot"}']
+
+
+def _hot_generations(root):
+    hot = root / "backup" / "hot"
+    return sorted(p for p in hot.iterdir() if not p.name.startswith(".")) if hot.exists() else []
+
+
+class TestBackup:
+    """Scheduled hot backups are restorable, rotated and incremental"""
+
+    def test_generation_restores(self, backup_server, tmp_path):
+        url, root = backup_server
+        for i in range(5):
+            resp = requests.post(f"{url}/index?wait=1", json=_task("bak", i, "bak_tag"), timeout=5.0)
+            assert resp.status_code == 200
+        # The second run after the writes started after them.
+        runs = _hot_runs(url)
+        assert _wait_until(lambda: _hot_runs(url) >= runs + 2, timeout_s=30.0)
+
+        newest = _hot_generations(root)[-1]
+        name, _, revision = newest.name.partition("-r")
+        assert len(name) == len("20260101T000000Z") and revision.split("-")[0].isdigit()
+        restored = tmp_path / "restored"
+        shutil.copytree(newest, restored)
+        (restored / "DOBRIKA_BACKUP").unlink()
+        restored_url, proc = _start(restored, DOBRIKA_INGEST_LOG="-1")
+        try:
+            assert _tag_ids(restored_url, "bak_tag") == [f"bak_{i}" for i in range(5)]
+        finally:
+            _stop_server(proc)
+
+    def test_old_generations_removed(self, backup_server):
+        url, root = backup_server
+        assert _wait_until(lambda: _hot_runs(url) > BACKUP_KEEP, timeout_s=30.0)
+        assert 1 <= len(_hot_generations(root)) <= BACKUP_KEEP
+
+    def test_unchanged_files_are_linked(self, backup_server):
+        """A run with no commits since the previous one hardlinks its files"""
+        url, _ = backup_server
+        runs = _hot_runs(url)
+        assert _wait_until(lambda: _hot_runs(url) >= runs + 2, timeout_s=30.0)
+        metrics = _metrics(url)
+        assert metrics['dobrika_backup_last_linked_bytes{kind="hot"}'] > 0
+        assert metrics['dobrika_backup_failures_total{kind="hot"}'] == 0
@@ -192,3 +192,148 @@ class TestSearchPerformance:
         result = benchmark(batch_search)
         assert result == 200  # 100 iterations * 2 query types
 
+
+
+class TestPerHitCost:
+    """Cost of turning MSet hits into task_ids.
+
+    Run against a server started with a large DOBRIKA_SEARCH_LIMIT (e.g.
+    1000) to see the per-hit part dominate; compare extra_info["us_per_hit"]
+    between builds.
+    """
+
+    CORPUS = 2000
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        lines = [
+            json.dumps({
+                "task_id": f"per_hit_{i}",
+                "task_name": f"Per hit benchmark task {i}",
+                "task_desc": "Long enough description to make the stored data blob realistic " * 4,
+                "task_tags": ["per_hit_bench"],
+            })
+            for i in range(self.CORPUS)
+        ]
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=60.0,
+        )
+        assert resp.status_code == 200
+
+    def test_tag_search_large_limit(self, server_url, benchmark):
+        counter = iter(range(10**9))
+        session = requests.Session()
+
+        def search():
+            # A never-matching extra tag keeps the result cache out of it.
+            resp = session.post(
+                f"{server_url}/search",
+                json={
+                    "query_type": "QT_TagTasks",
+                    "user_tags": ["per_hit_bench", f"per_hit_miss_{next(counter)}"],
+                },
+                timeout=5.0,
+            )
+            assert resp.status_code == 200
+            return resp.json().get("task_id", [])
+
+        hits = benchmark(search)
+        assert hits
+        benchmark.extra_info["hits"] = len(hits)
+        benchmark.extra_info["us_per_hit"] = benchmark.stats.stats.mean * 1e6 / len(hits)
+
+
+class TestTagSearchPaths:
+    """QT_TagTasks latency, bitmap index vs. the Xapian matcher.
+
+    Run once with the server started with DOBRIKA_TAG_BITMAPS=-1 and
+    --benchmark-save=xapian, then with the default and
+    --benchmark-compare to compare the two paths.
+    """
+
+    TAGS = [f"path_tag_{i}" for i in range(8)]
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        lines = [
+            json.dumps({
+                "task_id": f"path_{i}",
+                "task_name": "Tag path benchmark",
+                "task_tags": [t for j, t in enumerate(self.TAGS) if (i >> j) & 1],
+            })
+            for i in range(5000)
+        ]
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=60.0,
+        )
+        assert resp.status_code == 200
+
+    def test_tag_or_ranked(self, server_url, benchmark):
+        counter = iter(range(10**9))
+        session = requests.Session()
+
+        def search():
+            # A never-matching extra tag keeps the result cache out of it.
+            resp = session.post(f"{server_url}/search", json={
+                "query_type": "QT_TagTasks",
+                "user_tags": self.TAGS[:4] + [f"path_miss_{next(counter)}"],
+                "limit": 100,
+            }, timeout=5.0)
+            assert resp.status_code == 200
+            return resp.json()
+
+        data = benchmark(search)
+        assert len(data["task_id"]) == 100
+        metrics = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        benchmark.extra_info["tag_bitmaps"] = "dobrika_tag_bitmap_terms 0" not in metrics
+
+
+class TestTransport:
+    """/search throughput, JSON vs. binary protobuf bodies (same query)"""
+
+    QUERY = {"query_type": "QT_TagTasks", "user_tags": ["transport_tag"], "limit": 50}
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        lines = [
+            json.dumps({"task_id": f"transport_{i}", "task_name": "Transport",
+                        "task_tags": ["transport_tag"]})
+            for i in range(200)
+        ]
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=60.0,
+        )
+        assert resp.status_code == 200
+
+    def test_search_json(self, server_url, benchmark):
+        session = requests.Session()
+
+        def search():
+            resp = session.post(f"{server_url}/search", json=self.QUERY, timeout=5.0)
+            assert resp.status_code == 200
+            return len(resp.json()["task_id"])
+
+        assert benchmark(search) == 50
+
+    def test_search_protobuf(self, server_url, benchmark):
+        from test_quality import _pb_decode, _pb_search_request
+
+        session = requests.Session()
+        body = _pb_search_request(self.QUERY)
+        headers = {"Content-Type": "application/x-protobuf"}
+
+        def search():
+            resp = session.post(f"{server_url}/search", data=body, headers=headers, timeout=5.0)
+            assert resp.status_code == 200
+            return len(_pb_decode(resp.content)[1])
+
+        assert benchmark(search) == 50
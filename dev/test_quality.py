@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
 """Quality tests for Dobrika search server"""
+import concurrent.futures
+import json
 import time
 
 import pytest
@@ -13,7 +15,7 @@ class TestTagSearch:
     def setup(self, server_url):
         """Index test tasks before each test"""
         self.base_url = server_url
-        self.url_index = f"{server_url}/index"
+        self.url_index = f"{server_url}/index?wait=1"
         self.url_search = f"{server_url}/search"
         
         self.test_tasks = [
@@ -110,7 +112,7 @@ class TestGeoSearch:
     def setup(self, server_url):
         """Index test tasks before each test"""
         self.base_url = server_url
-        self.url_index = f"{server_url}/index"
+        self.url_index = f"{server_url}/index?wait=1"
         self.url_search = f"{server_url}/search"
         
         self.test_tasks = [
@@ -193,6 +195,34 @@ class TestGeoSearch:
         
         assert len(geo_test_ids) >= 1, "Geo search should return results"
 
+    def test_geo_search_radius(self):
+        """radius_km should cut off tasks farther than the radius"""
+        resp = requests.post(self.url_search, json={
+            "query_type": "QT_GeoTasks",
+            "geo_data": "55.7558,37.6173",
+            "radius_km": 50
+        }, timeout=5.0)
+
+        assert resp.status_code == 200
+        task_ids = resp.json().get("task_id", [])
+        geo_test_ids = [t for t in task_ids if t.startswith("geo_test_")]
+
+        assert "geo_test_1" in geo_test_ids
+        assert "geo_test_4" not in geo_test_ids, f"SPB is ~630 km away: {geo_test_ids}"
+
+    def test_geo_search_orders_by_distance(self):
+        """Nearest task comes first even when it sits in a neighbouring cell"""
+        resp = requests.post(self.url_search, json={
+            "query_type": "QT_GeoTasks",
+            "geo_data": "55.8706,37.6349"
+        }, timeout=5.0)
+
+        assert resp.status_code == 200
+        task_ids = resp.json().get("task_id", [])
+        geo_test_ids = [t for t in task_ids if t.startswith("geo_test_")]
+
+        assert geo_test_ids[:2] == ["geo_test_3", "geo_test_1"], geo_test_ids
+
 
 class TestHealthCheck:
     """Basic server health checks"""
@@ -221,7 +251,7 @@ class TestTextSearch:
     def setup(self, server_url):
         """Index test tasks before each test"""
         self.base_url = server_url
-        self.url_index = f"{server_url}/index"
+        self.url_index = f"{server_url}/index?wait=1"
         self.url_search = f"{server_url}/search"
 
         self.test_tasks = [
@@ -292,3 +322,1034 @@ class TestTextSearch:
         assert resp.status_code == 200
         task_ids = resp.json().get("task_id", [])
         assert "text_test_2" in task_ids, f"Expected text_test_2 in results, got: {task_ids}"
+
+
+class TestGroupCommit:
+    """Concurrent /index calls share group commits and are durable on ack"""
+
+    def test_concurrent_index_visible_on_ack(self, server_url):
+        """With wait=1 every acknowledged task is searchable right away"""
+        tasks = [
+            {
+                "task_id": f"group_commit_{i}",
+                "task_name": f"Group commit task {i}",
+                "task_desc": "Concurrent ingest",
+                "task_type": "TT_OnlineTask",
+                "task_tags": ["group_commit_tag"],
+            }
+            for i in range(16)
+        ]
+        with requests.Session() as session:
+            with concurrent.futures.ThreadPoolExecutor(max_workers=8) as pool:
+                futures = [
+                    pool.submit(session.post, f"{server_url}/index?wait=1", json=task, timeout=5.0)
+                    for task in tasks
+                ]
+                for fut in concurrent.futures.as_completed(futures):
+                    assert fut.result().status_code == 200
+
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks",
+            "user_tags": ["group_commit_tag"]
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        task_ids = resp.json().get("task_id", [])
+        found = [t for t in task_ids if t.startswith("group_commit_")]
+        assert len(found) == len(tasks), f"Expected all acked tasks, got: {found}"
+
+    def test_commit_metrics_exported(self, server_url):
+        """/metrics should expose batch size and commit latency"""
+        resp = requests.get(f"{server_url}/metrics", timeout=5.0)
+        assert resp.status_code == 200
+        assert "dobrika_index_commit_batch_size_count" in resp.text
+        assert "dobrika_index_commit_latency_seconds_sum" in resp.text
+
+
+class TestOverlongTerms:
+    """Terms past Xapian's 245-byte limit are refused before the ingest log"""
+
+    def _tag_search(self, server_url, tag):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks",
+            "user_tags": [tag]
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        return resp.json().get("task_id", [])
+
+    def test_long_tag_rejected_shard_keeps_indexing(self, server_url):
+        """A 300-byte tag gets 400; later tasks on every shard still commit"""
+        resp = requests.post(f"{server_url}/index", json={
+            "task_id": "overlong_tag",
+            "task_name": "Overlong tag",
+            "task_tags": ["x" * 300],
+        }, timeout=5.0)
+        assert resp.status_code == 400
+        assert resp.json()["error"] == "SearchIndexFall"
+
+        # Enough ids to land on every shard; each must commit within wait=1.
+        for i in range(8):
+            resp = requests.post(f"{server_url}/index?wait=1", json={
+                "task_id": f"after_overlong_{i}",
+                "task_name": "After overlong",
+                "task_tags": ["after_overlong"],
+            }, timeout=10.0)
+            assert resp.status_code == 200
+        found = [t for t in self._tag_search(server_url, "after_overlong")
+                 if t.startswith("after_overlong_")]
+        assert len(found) == 8
+
+    def test_long_task_id_rejected_by_delete(self, server_url):
+        resp = requests.post(f"{server_url}/delete",
+                             json={"task_id": "d" * 300}, timeout=5.0)
+        assert resp.status_code == 400
+
+    def test_long_tag_rejected_in_bulk(self, server_url):
+        lines = [
+            json.dumps({"task_id": "bulk_overlong_0", "task_tags": ["bulk_overlong"]}),
+            json.dumps({"task_id": "bulk_overlong_1", "task_tags": ["y" * 300]}),
+            json.dumps({"task_id": "bulk_overlong_2", "task_tags": ["bulk_overlong"]}),
+        ]
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+        body = resp.json()
+        assert body["accepted"] == 2
+        assert body["failed"] == 1
+        assert body["errors"][0]["record"] == 2
+        found = [t for t in self._tag_search(server_url, "bulk_overlong")
+                 if t.startswith("bulk_overlong_")]
+        assert sorted(found) == ["bulk_overlong_0", "bulk_overlong_2"]
+
+
+def _pb_varint(value: int) -> bytes:
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def _pb_index_task(task: dict) -> bytes:
+    """Hand-rolled DSIndexTask encoding (all fields are strings)"""
+    fields = {"task_name": 1, "task_desc": 2, "geo_data": 3, "task_id": 4, "task_type": 5}
+    out = bytearray()
+    for name, number in fields.items():
+        if name in task:
+            raw = task[name].encode("utf-8")
+            out += _pb_varint((number << 3) | 2) + _pb_varint(len(raw)) + raw
+    for tag in task.get("task_tags", []):
+        raw = tag.encode("utf-8")
+        out += _pb_varint((6 << 3) | 2) + _pb_varint(len(raw)) + raw
+    return bytes(out)
+
+
+class TestBulkIndex:
+    """Tests for the /index/bulk streaming endpoint"""
+
+    def _tag_search(self, server_url, tag):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks",
+            "user_tags": [tag]
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        return resp.json().get("task_id", [])
+
+    def test_ndjson_with_bad_record(self, server_url):
+        """Valid lines are committed, the broken one is reported by number"""
+        lines = [
+            json.dumps({"task_id": f"bulk_nd_{i}", "task_name": "Bulk", "task_tags": ["bulk_nd"]})
+            for i in range(3)
+        ]
+        lines.insert(1, "{not json")
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+        body = resp.json()
+        assert body["accepted"] == 3
+        assert body["failed"] == 1
+        assert body["errors"][0]["record"] == 2
+
+        found = [t for t in self._tag_search(server_url, "bulk_nd") if t.startswith("bulk_nd_")]
+        assert sorted(found) == ["bulk_nd_0", "bulk_nd_1", "bulk_nd_2"]
+
+    def test_delimited_protobuf(self, server_url):
+        """Length-prefixed DSIndexTask records are accepted"""
+        payload = bytearray()
+        for i in range(5):
+            record = _pb_index_task({"task_id": f"bulk_pb_{i}", "task_name": "Bulk", "task_tags": ["bulk_pb"]})
+            payload += _pb_varint(len(record)) + record
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data=bytes(payload),
+            headers={"Content-Type": "application/x-protobuf"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+        assert resp.json()["accepted"] == 5
+
+        found = [t for t in self._tag_search(server_url, "bulk_pb") if t.startswith("bulk_pb_")]
+        assert len(found) == 5
+
+    def test_delimited_protobuf_skips_malformed_record(self, server_url):
+        """A broken record inside an intact frame does not stop the stream"""
+        good = [_pb_index_task({"task_id": f"bulk_pbm_{i}", "task_name": "Bulk", "task_tags": ["bulk_pbm"]})
+                for i in range(2)]
+        broken = b"\x0f\x00"  # wire type 7 does not exist
+        payload = b"".join(_pb_varint(len(r)) + r for r in (good[0], broken, good[1]))
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data=payload,
+            headers={"Content-Type": "application/x-protobuf"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+        body = resp.json()
+        assert body["accepted"] == 2
+        assert body["failed"] == 1
+        assert body["errors"][0]["record"] == 2
+        found = [t for t in self._tag_search(server_url, "bulk_pbm") if t.startswith("bulk_pbm_")]
+        assert sorted(found) == ["bulk_pbm_0", "bulk_pbm_1"]
+
+    def test_unsupported_content_type(self, server_url):
+        resp = requests.post(f"{server_url}/index/bulk", data="x",
+                             headers={"Content-Type": "text/csv"}, timeout=5.0)
+        assert resp.status_code == 415
+
+    def test_concurrent_streams_bounded(self, server_url):
+        """Streams beyond the bulk pool and its queue get 503, the rest commit"""
+        def post(i):
+            lines = [
+                json.dumps({"task_id": f"bulk_cc_{i}_{j}", "task_name": "Bulk", "task_tags": ["bulk_cc"]})
+                for j in range(200)
+            ]
+            return requests.post(
+                f"{server_url}/index/bulk",
+                data="\n".join(lines).encode("utf-8"),
+                headers={"Content-Type": "application/x-ndjson"},
+                timeout=60.0,
+            )
+
+        with concurrent.futures.ThreadPoolExecutor(max_workers=12) as pool:
+            responses = list(pool.map(post, range(12)))
+        assert {r.status_code for r in responses} <= {200, 503}
+        for resp in responses:
+            if resp.status_code == 200:
+                assert resp.json()["accepted"] == 200
+            else:
+                assert resp.headers.get("Retry-After") == "1"
+        assert any(r.status_code == 200 for r in responses)
+
+
+def _metric(server_url, name):
+    resp = requests.get(f"{server_url}/metrics", timeout=5.0)
+    assert resp.status_code == 200
+    for line in resp.text.splitlines():
+        if line.startswith(name + " "):
+            return float(line.split()[1])
+    raise AssertionError(f"metric {name} not exported")
+
+
+class TestResultCache:
+    """Repeated /search requests are served from the write-generation cache"""
+
+    def _search(self, server_url, tags):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks",
+            "user_tags": tags
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        return resp.json().get("task_id", [])
+
+    def test_equivalent_requests_hit(self, server_url):
+        """Tag order does not matter for the cache key"""
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "cache_hit_1", "task_name": "Cache",
+            "task_tags": ["cache_a", "cache_b"]
+        }, timeout=5.0)
+        first = self._search(server_url, ["cache_a", "cache_b"])
+        hits = _metric(server_url, "dobrika_result_cache_hits_total")
+        second = self._search(server_url, ["cache_b", "cache_a"])
+        assert second == first
+        assert _metric(server_url, "dobrika_result_cache_hits_total") >= hits + 1
+
+    def test_index_invalidates(self, server_url):
+        """A committed task is visible even if the search was cached before"""
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "cache_inv_1", "task_name": "Cache", "task_tags": ["cache_inv"]
+        }, timeout=5.0)
+        assert self._search(server_url, ["cache_inv"]) == ["cache_inv_1"]
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "cache_inv_2", "task_name": "Cache", "task_tags": ["cache_inv"]
+        }, timeout=5.0)
+        assert sorted(self._search(server_url, ["cache_inv"])) == ["cache_inv_1", "cache_inv_2"]
+
+
+class TestQueryCache:
+    """Readers keep parsed query texts; pages of one text parse it once per reader"""
+
+    def test_repeated_text_hits(self, server_url):
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "qcache_1", "task_name": "Парсер запросов",
+            "task_desc": "кеш разобранных запросов"
+        }, timeout=5.0)
+        before = _metric(server_url, "dobrika_query_cache_hits_total")
+        # Different offsets keep the result cache out of the way.
+        for offset in range(5):
+            resp = requests.post(f"{server_url}/search", json={
+                "user_query": "  разобранных   запросов ",
+                "offset": offset
+            }, timeout=5.0)
+            assert resp.status_code == 200
+        assert _metric(server_url, "dobrika_query_cache_hits_total") > before
+
+    def test_results_match_uncached_text(self, server_url):
+        """Whitespace differences share an entry without changing results"""
+        ids = []
+        for text in ("кеш разобранных", "  кеш\tразобранных  "):
+            resp = requests.post(f"{server_url}/search", json={
+                "user_query": text
+            }, timeout=5.0)
+            assert resp.status_code == 200
+            ids.append(resp.json().get("task_id", []))
+        assert "qcache_1" in ids[0]
+        assert ids[0] == ids[1]
+
+
+class TestPagination:
+    """Per-request offset/limit and next_cursor paging"""
+
+    TAG = "paging_tag"
+    COUNT = 25
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        lines = [
+            json.dumps({
+                "task_id": f"paging_{i}",
+                "task_name": "Paging",
+                "geo_data": f"{60 + i * 0.001},{30 + i * 0.001}",
+                "task_tags": [self.TAG],
+            })
+            for i in range(self.COUNT)
+        ]
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+
+    def _walk(self, server_url, query):
+        seen, cursor = [], None
+        for _ in range(20):
+            body = dict(query, limit=7)
+            if cursor:
+                body["cursor"] = cursor
+            resp = requests.post(f"{server_url}/search", json=body, timeout=5.0)
+            assert resp.status_code == 200
+            page = resp.json()
+            assert page["status"] == "SearchOk"
+            seen.extend(page["task_id"])
+            cursor = page.get("next_cursor")
+            if not cursor:
+                break
+        return seen
+
+    def test_tag_cursor_walks_all(self, server_url):
+        seen = self._walk(server_url, {"query_type": "QT_TagTasks", "user_tags": [self.TAG]})
+        assert len(seen) == len(set(seen))
+        assert sorted(seen) == sorted(f"paging_{i}" for i in range(self.COUNT))
+
+    def test_geo_cursor_continues_by_distance(self, server_url):
+        seen = self._walk(server_url, {
+            "query_type": "QT_GeoTasks", "geo_data": "60,30", "radius_km": 5,
+        })
+        paging = [t for t in seen if t.startswith("paging_")]
+        assert paging == [f"paging_{i}" for i in range(self.COUNT)]
+
+    def test_offset_and_limit(self, server_url):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": [self.TAG], "offset": 20, "limit": 10,
+        }, timeout=5.0)
+        body = resp.json()
+        assert len(body["task_id"]) == self.COUNT - 20
+        assert body["estimated_total"] >= self.COUNT
+        assert "next_cursor" not in body
+
+    def test_limit_is_capped(self, server_url):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": [self.TAG], "limit": 10**9,
+        }, timeout=5.0)
+        assert resp.json()["status"] == "SearchOk"
+
+    def test_foreign_cursor_rejected(self, server_url):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": [self.TAG], "limit": 5,
+        }, timeout=5.0)
+        cursor = resp.json()["next_cursor"]
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["other_tag"], "cursor": cursor,
+        }, timeout=5.0)
+        assert resp.json()["status"] == "SearchInvalidPaging"
+
+
+class TestComposedFilters:
+    """task_type, all_tags and radius filters applied inside the match"""
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        tasks = [
+            {"task_id": "filt_online_1", "task_name": "Ремонт велосипеда", "task_type": "TT_OnlineTask",
+             "geo_data": "61.0,31.0", "task_tags": ["filt_a", "filt_b"]},
+            {"task_id": "filt_online_2", "task_name": "Ремонт ноутбука", "task_type": "TT_OnlineTask",
+             "geo_data": "61.5,31.0", "task_tags": ["filt_a"]},
+            {"task_id": "filt_offline_1", "task_name": "Ремонт велосипеда", "task_type": "TT_OfflineTask",
+             "geo_data": "61.0,31.0", "task_tags": ["filt_a", "filt_b"]},
+        ]
+        for task in tasks:
+            assert requests.post(f"{server_url}/index?wait=1", json=task, timeout=5.0).status_code == 200
+
+    def _search(self, server_url, body):
+        resp = requests.post(f"{server_url}/search", json=body, timeout=5.0)
+        assert resp.status_code == 200
+        data = resp.json()
+        assert data["status"] == "SearchOk"
+        return [t for t in data["task_id"] if t.startswith("filt_")]
+
+    def test_online_tasks(self, server_url):
+        found = self._search(server_url, {"query_type": "QT_OnlineTasks", "user_tags": ["filt_a"], "limit": 1000})
+        assert sorted(found) == ["filt_online_1", "filt_online_2"]
+
+    def test_all_tags(self, server_url):
+        found = self._search(server_url, {"query_type": "QT_TagTasks", "user_tags": ["filt_a", "filt_b"],
+                                          "all_tags": True, "limit": 1000})
+        assert sorted(found) == ["filt_offline_1", "filt_online_1"]
+
+    def test_text_with_type_and_radius(self, server_url):
+        found = self._search(server_url, {"user_query": "ремонт", "task_type": "TT_OnlineTask",
+                                          "geo_data": "61.0,31.0", "radius_km": 10, "limit": 1000})
+        assert found == ["filt_online_1"]
+
+    def test_geo_with_tag_filter(self, server_url):
+        found = self._search(server_url, {"query_type": "QT_GeoTasks", "geo_data": "61.0,31.0",
+                                          "user_tags": ["filt_b"], "limit": 10})
+        assert sorted(found) == ["filt_offline_1", "filt_online_1"]
+
+
+class TestRandomTasks:
+    """QT_RandomTasks sampling sessions"""
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        lines = [
+            json.dumps({
+                "task_id": f"random_{i}",
+                "task_name": "Random",
+                "task_type": "TT_OnlineTask" if i % 2 else "TT_OfflineTask",
+                "task_tags": ["random_tag"] + (["random_rare"] if i < 3 else []),
+            })
+            for i in range(40)
+        ]
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+
+    def _session(self, server_url, body, pages):
+        seen, cursor = [], None
+        for _ in range(pages):
+            req = dict(body)
+            if cursor:
+                req["cursor"] = cursor
+            data = requests.post(f"{server_url}/search", json=req, timeout=5.0).json()
+            assert data["status"] == "SearchOk"
+            seen.extend(data["task_id"])
+            cursor = data.get("next_cursor")
+            if not cursor:
+                break
+        return seen
+
+    def test_no_repeats_within_seed(self, server_url):
+        body = {"query_type": "QT_RandomTasks", "user_tags": ["random_tag"], "seed": 42, "limit": 7}
+        seen = self._session(server_url, body, 20)
+        assert len(seen) == len(set(seen))
+        assert sorted(seen) == sorted(f"random_{i}" for i in range(40))
+
+    def test_same_seed_same_sample(self, server_url):
+        body = {"query_type": "QT_RandomTasks", "seed": 7, "limit": 5}
+        first = requests.post(f"{server_url}/search", json=body, timeout=5.0).json()["task_id"]
+        second = requests.post(f"{server_url}/search", json=body, timeout=5.0).json()["task_id"]
+        assert len(first) == 5
+        assert first == second
+
+    def test_selective_filter(self, server_url):
+        body = {"query_type": "QT_RandomTasks", "user_tags": ["random_rare"], "limit": 10}
+        seen = self._session(server_url, body, 5)
+        assert sorted(seen) == ["random_0", "random_1", "random_2"]
+
+    def test_task_type_filter(self, server_url):
+        body = {"query_type": "QT_RandomTasks", "user_tags": ["random_tag"],
+                "task_type": "TT_OnlineTask", "seed": 3, "limit": 50}
+        seen = self._session(server_url, body, 5)
+        assert sorted(seen) == sorted(f"random_{i}" for i in range(1, 40, 2))
+
+
+class TestTagBitmaps:
+    """QT_TagTasks served from the in-memory tag bitmaps"""
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        tasks = [
+            {"task_id": "bm_1", "task_name": "Bitmap", "task_tags": ["bm_x", "bm_y", "bm_z"]},
+            {"task_id": "bm_2", "task_name": "Bitmap", "task_tags": ["bm_x", "bm_y"]},
+            {"task_id": "bm_3", "task_name": "Bitmap", "task_tags": ["bm_x", "bm_skip"]},
+        ]
+        for task in tasks:
+            assert requests.post(f"{server_url}/index?wait=1", json=task, timeout=5.0).status_code == 200
+
+    def _search(self, server_url, body):
+        data = requests.post(f"{server_url}/search", json=dict(body, query_type="QT_TagTasks"), timeout=5.0).json()
+        assert data["status"] == "SearchOk"
+        return data["task_id"]
+
+    def test_ranked_by_matched_tags(self, server_url):
+        found = self._search(server_url, {"user_tags": ["bm_x", "bm_y", "bm_z"]})
+        assert found[:3] == ["bm_1", "bm_2", "bm_3"]
+
+    def test_exclude(self, server_url):
+        found = self._search(server_url, {"user_tags": ["bm_x"], "exclude_tags": ["bm_skip"]})
+        assert sorted(found) == ["bm_1", "bm_2"]
+
+    def test_exclude_not_cached_as_include(self, server_url):
+        """Moving a tag from user_tags to exclude_tags changes the cache key"""
+        both = self._search(server_url, {"user_tags": ["bm_x", "bm_skip"]})
+        assert "bm_3" in both
+        found = self._search(server_url, {"user_tags": ["bm_x"], "exclude_tags": ["bm_skip"]})
+        assert sorted(found) == ["bm_1", "bm_2"]
+
+    def test_retag_replaces_bitmaps(self, server_url):
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "bm_2", "task_name": "Bitmap", "task_tags": ["bm_moved"]
+        }, timeout=5.0)
+        assert "bm_2" not in self._search(server_url, {"user_tags": ["bm_y"]})
+        assert self._search(server_url, {"user_tags": ["bm_moved"]}) == ["bm_2"]
+
+    def test_memory_gauges(self, server_url):
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        assert "dobrika_tag_bitmap_bytes" in text
+
+
+class TestLatencyHistograms:
+    """Request and stage latency histograms on /metrics"""
+
+    def test_search_histograms(self, server_url):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["histogram_tag"]
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        assert "# TYPE dobrika_request_duration_seconds histogram" in text
+        assert ('dobrika_request_duration_seconds_bucket{endpoint="/search",'
+                'query_type="QT_TagTasks",status="SearchOk",le="+Inf"}') in text
+        for stage in ("parse", "query_build", "match", "materialise", "serialise"):
+            assert f'dobrika_search_stage_seconds_count{{stage="{stage}"}}' in text
+
+    def test_buckets_are_cumulative(self, server_url):
+        requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["histogram_tag"]
+        }, timeout=5.0)
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        buckets = [
+            float(line.split()[-1]) for line in text.splitlines()
+            if line.startswith('dobrika_search_stage_seconds_bucket{stage="match"')
+        ]
+        assert buckets and buckets == sorted(buckets)
+        assert buckets[-1] == _metric_labeled(
+            text, 'dobrika_search_stage_seconds_count{stage="match"}')
+
+    def test_write_histograms(self, server_url):
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "histogram_1", "task_name": "Histogram"
+        }, timeout=5.0)
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        assert "dobrika_index_commit_seconds_count" in text
+        assert "dobrika_reader_reopen_seconds_count" in text
+
+
+def _metric_labeled(text, series):
+    for line in text.splitlines():
+        if line.startswith(series + " "):
+            return float(line.split()[-1])
+    raise AssertionError(f"series {series} not exported")
+
+
+class TestAccessLog:
+    """Asynchronous access log counters"""
+
+    def test_counters_exported(self, server_url):
+        requests.get(f"{server_url}/healthz", timeout=5.0)
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        for name in ("dobrika_access_log_written_total",
+                     "dobrika_access_log_dropped_total",
+                     "dobrika_access_log_sampled_out_total"):
+            assert f"# TYPE {name} counter" in text
+
+    def test_failed_requests_always_logged(self, server_url):
+        before = _metric(server_url, "dobrika_access_log_sampled_out_total")
+        for _ in range(5):
+            resp = requests.post(f"{server_url}/search", data="not json",
+                                 headers={"Content-Type": "application/json"},
+                                 timeout=5.0)
+            assert resp.status_code == 400
+        # Failures bypass sampling, so none of them can be sampled out.
+        after = _metric(server_url, "dobrika_access_log_sampled_out_total")
+        assert after - before <= 1  # the /metrics scrape itself
+
+
+def _pb_search_request(req: dict) -> bytes:
+    """Hand-rolled DSearchRequest encoding for the fields used in tests"""
+    out = bytearray()
+    for name, number in {"user_query": 1, "geo_data": 2, "query_type": 4}.items():
+        if name in req:
+            raw = req[name].encode("utf-8")
+            out += _pb_varint((number << 3) | 2) + _pb_varint(len(raw)) + raw
+    for tag in req.get("user_tags", []):
+        raw = tag.encode("utf-8")
+        out += _pb_varint((3 << 3) | 2) + _pb_varint(len(raw)) + raw
+    if "limit" in req:
+        out += _pb_varint(7 << 3) + _pb_varint(req["limit"])
+    return bytes(out)
+
+
+def _pb_decode(data: bytes) -> dict:
+    """Field number -> list of values (varints as int, the rest as bytes)"""
+    fields, pos = {}, 0
+
+    def varint():
+        nonlocal pos
+        shift = value = 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    while pos < len(data):
+        key = varint()
+        if key & 7 == 0:
+            value = varint()
+        else:
+            length = varint()
+            value = data[pos:pos + length]
+            pos += length
+        fields.setdefault(key >> 3, []).append(value)
+    return fields
+
+
+class TestBackupMetrics:
+    """Backup subsystem counters and gauges"""
+
+    def test_exported_per_kind(self, server_url):
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        assert "# TYPE dobrika_backup_runs_total counter" in text
+        for name in ("dobrika_backup_runs_total",
+                     "dobrika_backup_failures_total",
+                     "dobrika_backup_last_lock_seconds",
+                     "dobrika_backup_last_size_bytes",
+                     "dobrika_backup_last_success_timestamp_seconds"):
+            for kind in ("cold", "hot"):
+                assert _metric_labeled(text, f'{name}{{kind="{kind}"}}') >= 0
+
+    def test_failures_within_runs(self, server_url):
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        for kind in ("cold", "hot"):
+            runs = _metric_labeled(text, f'dobrika_backup_runs_total{{kind="{kind}"}}')
+            failures = _metric_labeled(
+                text, f'dobrika_backup_failures_total{{kind="{kind}"}}')
+            assert failures <= runs
+
+
+class TestIngestLog:
+    """/index acks from the ingest log; wait=1 gives read-your-writes"""
+
+    def _tag_search(self, server_url, tag):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": [tag]
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        return resp.json().get("task_id", [])
+
+    def test_fast_ack_becomes_visible(self, server_url):
+        resp = requests.post(f"{server_url}/index", json={
+            "task_id": "ingest_log_1", "task_name": "Log", "task_tags": ["ingest_log_tag"]
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        assert resp.json()["status"] == "SearchIndexOk"
+        deadline = time.time() + 5.0
+        while "ingest_log_1" not in self._tag_search(server_url, "ingest_log_tag"):
+            assert time.time() < deadline, "logged task never became searchable"
+            time.sleep(0.05)
+
+    def test_wait_is_read_your_writes(self, server_url):
+        for i in range(5):
+            task_id = f"ingest_wait_{i}"
+            resp = requests.post(f"{server_url}/index", params={"wait": "1"}, json={
+                "task_id": task_id, "task_name": "Log", "task_tags": ["ingest_wait_tag"]
+            }, timeout=5.0)
+            assert resp.status_code == 200
+            assert task_id in self._tag_search(server_url, "ingest_wait_tag")
+
+    def test_metrics(self, server_url):
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "ingest_log_metrics", "task_name": "Log"
+        }, timeout=5.0)
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        assert _metric_labeled(text, "dobrika_ingest_log_records_total") >= 1
+        assert _metric_labeled(text, "dobrika_ingest_log_syncs_total") >= 1
+        assert _metric_labeled(text, "dobrika_ingest_log_lag_records") >= 0
+        assert _metric_labeled(text, "dobrika_ingest_log_write_errors_total") == 0
+
+    def test_idle_log_frees_segments(self, server_url):
+        """Once everything is applied and ingest is idle, no segment is kept"""
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "ingest_log_idle", "task_name": "Log"
+        }, timeout=5.0)
+        deadline = time.time() + 5.0
+        while True:
+            text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+            if _metric_labeled(text, "dobrika_ingest_log_segments") == 0:
+                break
+            assert time.time() < deadline, "applied segments were never removed"
+            time.sleep(0.2)
+
+
+class TestShards:
+    """Hash-partitioned shards; answers must not depend on the read mode"""
+
+    TAG = "shard_tag"
+    COUNT = 30
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        lines = [
+            json.dumps({
+                "task_id": f"shard_{i}",
+                "task_name": "Shard",
+                "task_type": "TT_OnlineTask",
+                "geo_data": f"{61 + i * 0.002},{31 + i * 0.002}",
+                "task_tags": [self.TAG],
+            })
+            for i in range(self.COUNT)
+        ]
+        resp = requests.post(
+            f"{server_url}/index/bulk",
+            data="\n".join(lines).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=30.0,
+        )
+        assert resp.status_code == 200
+
+    def test_metrics(self, server_url):
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        shards = _metric_labeled(text, "dobrika_index_shards")
+        assert shards >= 1
+        assert _metric_labeled(text, 'dobrika_index_shard_commits_total{shard="0"}') >= 1
+
+    def test_repeated_geo_search_is_stable(self, server_url):
+        """Enough repeats for the read mode chooser to try both modes; the
+        centre moves a little each time to miss the result cache"""
+        first = None
+        for k in range(40):
+            body = {
+                "query_type": "QT_GeoTasks",
+                "geo_data": f"{60.96 + k * 0.001:.3f},31",
+                "user_tags": [self.TAG],
+                "limit": 10,
+                "offset": 5,
+            }
+            resp = requests.post(f"{server_url}/search", json=body, timeout=5.0)
+            assert resp.status_code == 200
+            ids = resp.json()["task_id"]
+            if first is None:
+                first = ids
+            assert ids == first
+        assert first == [f"shard_{i}" for i in range(5, 15)]
+
+
+class TestProtobufTransport:
+    """Binary protobuf bodies on /search and /index"""
+
+    PB = "application/x-protobuf"
+
+    def test_index_and_search_protobuf(self, server_url):
+        resp = requests.post(f"{server_url}/index?wait=1", data=_pb_index_task({
+            "task_id": "pb_transport_1", "task_name": "Protobuf", "task_tags": ["pb_transport"]
+        }), headers={"Content-Type": self.PB}, timeout=5.0)
+        assert resp.status_code == 200
+        assert resp.headers["Content-Type"].startswith(self.PB)
+        indexed = _pb_decode(resp.content)
+        assert indexed[1] == [1] and indexed[2] == [b"SearchIndexOk"]
+
+        resp = requests.post(f"{server_url}/search", data=_pb_search_request({
+            "query_type": "QT_TagTasks", "user_tags": ["pb_transport"]
+        }), headers={"Content-Type": self.PB}, timeout=5.0)
+        assert resp.status_code == 200
+        found = _pb_decode(resp.content)
+        assert found[2] == [b"SearchOk"]
+        assert b"pb_transport_1" in found[1]
+
+    def test_accept_overrides_request_format(self, server_url):
+        resp = requests.post(f"{server_url}/search", data=_pb_search_request({
+            "query_type": "QT_TagTasks", "user_tags": ["pb_transport"]
+        }), headers={"Content-Type": self.PB, "Accept": "application/json"}, timeout=5.0)
+        assert resp.json()["status"] == "SearchOk"
+
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["pb_transport"]
+        }, headers={"Accept": self.PB}, timeout=5.0)
+        assert _pb_decode(resp.content)[2] == [b"SearchOk"]
+
+    def test_malformed_protobuf(self, server_url):
+        resp = requests.post(f"{server_url}/search", data=b"\xff\xff\xff",
+                             headers={"Content-Type": self.PB}, timeout=5.0)
+        assert resp.status_code == 400
+        assert _pb_decode(resp.content)[2] == [b"SearchInvalidProtobuf"]
+
+
+class TestJsonFastPath:
+    """Streaming JSON parser edge cases on /search and /index"""
+
+    def _post(self, server_url, path, raw):
+        return requests.post(f"{server_url}{path}", data=raw,
+                             headers={"Content-Type": "application/json"}, timeout=5.0)
+
+    def test_malformed_rejected(self, server_url):
+        for raw in ('{"user_query": "x",}', '[]', '{"user_query": {}}', '{"a": 1} trailing'):
+            resp = self._post(server_url, "/search", raw)
+            assert resp.status_code == 400, raw
+            assert resp.json()["error"] == "SearchInvalidJson"
+
+    def test_escapes_round_trip(self, server_url):
+        task_id = 'json_fast_"quoted"\\слэш'
+        resp = self._post(server_url, "/index?wait=1", json.dumps({
+            "task_id": task_id, "task_name": "Json", "task_tags": ["json_fast_tag"]
+        }))
+        assert resp.status_code == 200
+        assert resp.json() == {"ok": True, "status": "SearchIndexOk"}
+        resp = self._post(server_url, "/search", json.dumps({
+            "query_type": "QT_TagTasks", "user_tags": ["json_fast_tag"], "unknown": [1, {"x": None}]
+        }))
+        assert resp.json()["task_id"] == [task_id]
+
+    def test_lenient_scalar_types(self, server_url):
+        """Typed fields of the wrong type are ignored, as before"""
+        resp = self._post(server_url, "/search", json.dumps({
+            "query_type": "QT_TagTasks", "user_tags": ["json_fast_tag"],
+            "limit": "5", "radius_km": None, "all_tags": 1
+        }))
+        assert resp.status_code == 200
+        assert resp.json()["status"] == "SearchOk"
+
+
+class TestSuggest:
+    """GET /suggest completes words and task names"""
+
+    @pytest.fixture(autouse=True)
+    def setup(self, server_url):
+        tasks = [
+            {"task_id": f"sg_{i}", "task_name": "Выгул зябликов",
+             "task_desc": "Нужно выгулять зябликов", "task_tags": ["sg_tag"]}
+            for i in range(3)
+        ] + [
+            {"task_id": "sg_3", "task_name": "Корм",
+             "task_desc": "Покормить зябликам", "task_tags": ["sg_tag"]},
+        ]
+        for task in tasks:
+            assert requests.post(f"{server_url}/index?wait=1", json=task, timeout=5.0).status_code == 200
+
+    def _suggest(self, server_url, q, **params):
+        resp = requests.get(f"{server_url}/suggest", params=dict(params, q=q), timeout=5.0)
+        assert resp.status_code == 200
+        return resp.json()
+
+    def test_inflections_fold_into_one_word(self, server_url):
+        words = [w for w in self._suggest(server_url, "зябл")["words"] if w["text"].startswith("зяблик")]
+        assert len(words) == 1
+        assert words[0]["text"] == "зябликов"
+        assert words[0]["weight"] >= 4
+
+    def test_last_word_is_completed(self, server_url):
+        words = self._suggest(server_url, "выгул зябл")["words"]
+        assert words[0]["text"] == "выгул зябликов"
+
+    def test_task_names(self, server_url):
+        names = self._suggest(server_url, "ВЫГУЛ ЗЯБ")["names"]
+        assert {"text": "Выгул зябликов", "weight": 3} in names
+
+    def test_limit(self, server_url):
+        data = self._suggest(server_url, "з", limit=1)
+        assert len(data["words"]) <= 1 and len(data["names"]) <= 1
+
+    def test_deleted_task_disappears(self, server_url):
+        task = {"task_id": "sg_gone", "task_name": "Сушка квоккозавров", "task_tags": ["sg_tag"]}
+        assert requests.post(f"{server_url}/index?wait=1", json=task, timeout=5.0).status_code == 200
+        assert self._suggest(server_url, "квоккоз")["words"][0]["text"] == "квоккозавров"
+        assert requests.post(f"{server_url}/delete", json={"task_id": "sg_gone"}, timeout=5.0).status_code == 200
+        data = self._suggest(server_url, "квоккоз")
+        assert data["words"] == [] and data["names"] == []
+
+    def test_memory_gauges(self, server_url):
+        assert _metric(server_url, "dobrika_suggest_bytes") > 0
+        assert _metric(server_url, "dobrika_suggest_budget_bytes") >= _metric(server_url, "dobrika_suggest_bytes")
+
+
+class TestSearchDeadline:
+    """timeout_ms, partial results and admission control metrics"""
+
+    def test_timeout_ms_accepted(self, server_url):
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "deadline_1", "task_name": "Deadline", "task_tags": ["deadline_tag"]
+        }, timeout=5.0)
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["deadline_tag"], "timeout_ms": 5000
+        }, timeout=5.0)
+        assert resp.status_code == 200
+        data = resp.json()
+        assert data["status"] == "SearchOk"
+        assert data["task_id"] == ["deadline_1"]
+        assert "partial" not in data
+
+    def test_tiny_timeout_is_partial_or_complete(self, server_url):
+        """A 1 ms budget may or may not cut a broad match short; either way
+        the answer is a 200 (or a 503 when it ran out before matching)"""
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_GeoTasks", "geo_data": "55.75,37.61", "limit": 50, "timeout_ms": 1
+        }, timeout=5.0)
+        if resp.status_code == 503:
+            assert resp.headers["Retry-After"] == "1"
+            assert resp.json()["error"] == "SearchDeadlineExceeded"
+            return
+        assert resp.status_code == 200
+        data = resp.json()
+        assert data["status"] == "SearchOk"
+        if data.get("partial"):
+            assert "next_cursor" not in data
+
+    def test_expired_deadline_is_shed(self, server_url):
+        """Proxy-stamped 10 s ago with a 1 s budget: 503 without searching"""
+        def rejected():
+            text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+            return _metric_labeled(text, 'dobrika_search_rejected_total{reason="deadline"}')
+
+        before = rejected()
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["deadline_expired_tag"], "timeout_ms": 1000
+        }, headers={"X-Request-Start": f"t={time.time() - 10:.3f}"}, timeout=5.0)
+        assert resp.status_code == 503
+        assert resp.headers["Retry-After"] == "1"
+        assert resp.json()["error"] == "SearchDeadlineExceeded"
+        assert rejected() == before + 1
+
+    def test_fresh_request_start_is_searched(self, server_url):
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["deadline_fresh_tag"], "timeout_ms": 5000
+        }, headers={"X-Request-Start": f"t={time.time():.3f}"}, timeout=5.0)
+        assert resp.status_code == 200
+        assert resp.json()["status"] == "SearchOk"
+
+    def test_metrics(self, server_url):
+        requests.post(f"{server_url}/search", json={"user_query": "deadline"}, timeout=5.0)
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        assert _metric_labeled(text, "dobrika_search_in_flight") >= 0
+        assert _metric_labeled(text, "dobrika_search_queued") >= 0
+        for reason in ("queue_full", "queue_timeout", "deadline"):
+            assert _metric_labeled(text, f'dobrika_search_rejected_total{{reason="{reason}"}}') >= 0
+        assert _metric_labeled(text, "dobrika_search_partial_total") >= 0
+
+
+class TestWorkerPools:
+    """Searches and writes run on their own worker pools"""
+
+    def test_pool_metrics(self, server_url):
+        requests.post(f"{server_url}/index?wait=1", json={
+            "task_id": "pool_1", "task_name": "Pool", "task_tags": ["pool_tag"]
+        }, timeout=5.0)
+        resp = requests.post(f"{server_url}/search", json={
+            "query_type": "QT_TagTasks", "user_tags": ["pool_tag"]
+        }, timeout=5.0)
+        assert resp.json()["task_id"] == ["pool_1"]
+        text = requests.get(f"{server_url}/metrics", timeout=5.0).text
+        for pool in ("search", "index"):
+            assert _metric_labeled(text, f'dobrika_worker_threads{{pool="{pool}"}}') >= 1
+            assert _metric_labeled(text, f'dobrika_worker_busy{{pool="{pool}"}}') >= 0
+            assert _metric_labeled(text, f'dobrika_worker_queued{{pool="{pool}"}}') >= 0
+
+    def test_concurrent_index_and_search(self, server_url):
+        """Slow writes must not hold up searches on the same event loop"""
+        def index(i):
+            return requests.post(f"{server_url}/index?wait=1", json={
+                "task_id": f"pool_c_{i}", "task_name": "Pool", "task_tags": ["pool_c"]
+            }, timeout=10.0).status_code
+
+        def search(_):
+            return requests.post(f"{server_url}/search", json={"user_query": "pool"}, timeout=10.0).status_code
+
+        with concurrent.futures.ThreadPoolExecutor(max_workers=16) as pool:
+            # Submit everything before collecting, so writes and searches overlap.
+            futures = [pool.submit(index, i) for i in range(20)]
+            futures += [pool.submit(search, i) for i in range(40)]
+            codes = [f.result() for f in futures]
+        assert all(code == 200 for code in codes)
+
+    def test_search_latency_during_slow_write(self, server_url):
+        """Searches stay fast while a large write waits for its commit"""
+        lines = [
+            json.dumps({"task_id": f"pool_slow_{i}", "task_name": "Pool slow write",
+                        "task_desc": "Bulk commit in flight " * 8, "task_tags": ["pool_slow"]})
+            for i in range(5000)
+        ]
+
+        def slow_write():
+            return requests.post(
+                f"{server_url}/index/bulk",
+                data="\n".join(lines).encode("utf-8"),
+                headers={"Content-Type": "application/x-ndjson"},
+                timeout=120.0,
+            ).status_code
+
+        def wait_write():
+            return requests.post(f"{server_url}/index?wait=1", json={
+                "task_id": "pool_slow_waited", "task_name": "Pool", "task_tags": ["pool_slow"]
+            }, timeout=60.0).status_code
+
+        latencies = []
+        with concurrent.futures.ThreadPoolExecutor(max_workers=2) as pool:
+            writes = [pool.submit(slow_write), pool.submit(wait_write)]
+            with requests.Session() as session:
+                while not all(w.done() for w in writes) or len(latencies) < 5:
+                    t0 = time.perf_counter()
+                    resp = session.post(f"{server_url}/search", json={
+                        "query_type": "QT_TagTasks", "user_tags": ["pool_tag"]
+                    }, timeout=10.0)
+                    latencies.append(time.perf_counter() - t0)
+                    assert resp.status_code == 200
+            assert [w.result() for w in writes] == [200, 200]
+        assert max(latencies) < 1.0, f"slowest search {max(latencies):.3f}s during the write"
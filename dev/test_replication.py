@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""Leader/follower replication: two server processes on localhost.
+
+Needs RUN_SERVER=1 and DOBRIKA_BINARY; the test starts both nodes itself.
+"""
+import json
+import os
+import time
+from pathlib import Path
+
+import pytest
+import requests
+
+from conftest import _get_env_bool, _pick_free_port, _spawn_server, _stop_server
+
+pytestmark = pytest.mark.skipif(
+    not (_get_env_bool("RUN_SERVER") and os.environ.get("DOBRIKA_BINARY")),
+    reason="starts its own leader and follower; set RUN_SERVER=1 and DOBRIKA_BINARY",
+)
+
+TAG = "replica_tag"
+BEFORE = 40  # indexed before the follower starts: arrives with the snapshot
+
+
+def _task(i):
+    return {
+        "task_id": f"replica_{i}",
+        "task_name": "Replica",
+        "task_type": "TT_OnlineTask",
+        "geo_data": f"{62 + i * 0.001},{32 + i * 0.001}",
+        "task_tags": [TAG],
+    }
+
+
+def _node_env(port, db_path, **extra):
+    env = os.environ.copy()
+    for key in ("DOBRIKA_REPLICA_OF", "DOBRIKA_REPLICATION_LOG_MB", "DOBRIKA_INGEST_LOG_DIR"):
+        env.pop(key, None)
+    env.update({
+        "DOBRIKA_ADDR": "127.0.0.1",
+        "DOBRIKA_PORT": str(port),
+        "DOBRIKA_DB_PATH": str(db_path),
+        "DOBRIKA_BACKUP_DIR": "",
+        "DOBRIKA_GEO_INDEX": "9",
+        "DOBRIKA_LOG_REQUESTS": "0",
+    })
+    env.update(extra)
+    return env
+
+
+def _tag_ids(url, limit=1000):
+    resp = requests.post(f"{url}/search", json={
+        "query_type": "QT_TagTasks", "user_tags": [TAG], "limit": limit,
+    }, timeout=5.0)
+    assert resp.status_code == 200
+    return sorted(resp.json()["task_id"])
+
+
+def _wait_until(predicate, timeout_s=15.0):
+    deadline = time.time() + timeout_s
+    while time.time() < deadline:
+        if predicate():
+            return True
+        time.sleep(0.1)
+    return predicate()
+
+
+def _metrics(url):
+    values = {}
+    for line in requests.get(f"{url}/metrics", timeout=5.0).text.splitlines():
+        if line and not line.startswith("#"):
+            name, value = line.rsplit(" ", 1)
+            values[name] = float(value)
+    return values
+
+
+@pytest.fixture(scope="module")
+def cluster(tmp_path_factory):
+    binary = Path(os.environ["DOBRIKA_BINARY"]).resolve()
+    root = tmp_path_factory.mktemp("replication")
+    leader_port = _pick_free_port()
+    follower_port = _pick_free_port()
+    leader_url = f"http://127.0.0.1:{leader_port}"
+    follower_url = f"http://127.0.0.1:{follower_port}"
+    leader_env = _node_env(leader_port, root / "leader", DOBRIKA_REPLICATION_LOG_MB="16")
+    procs = {"leader": _spawn_server(binary, leader_env, leader_url)}
+
+    lines = [json.dumps(_task(i)) for i in range(BEFORE)]
+    resp = requests.post(
+        f"{leader_url}/index/bulk",
+        data="\n".join(lines).encode("utf-8"),
+        headers={"Content-Type": "application/x-ndjson"},
+        timeout=30.0,
+    )
+    assert resp.status_code == 200
+
+    follower_env = _node_env(
+        follower_port, root / "follower",
+        DOBRIKA_REPLICA_OF=leader_url, DOBRIKA_REPLICATION_POLL_MS="50",
+    )
+    procs["follower"] = _spawn_server(binary, follower_env, follower_url)
+
+    def restart_leader():
+        _stop_server(procs["leader"])
+        procs["leader"] = _spawn_server(binary, leader_env, leader_url)
+
+    yield {"leader": leader_url, "follower": follower_url, "restart_leader": restart_leader}
+
+    for proc in procs.values():
+        _stop_server(proc)
+
+
+class TestReplication:
+    """Follower copies the leader, follows its commits and refuses writes"""
+
+    def test_snapshot_copies_existing_tasks(self, cluster):
+        expected = sorted(f"replica_{i}" for i in range(BEFORE))
+        assert _wait_until(lambda: _tag_ids(cluster["follower"]) == expected)
+
+    def test_commits_reach_follower(self, cluster):
+        for i in range(BEFORE, BEFORE + 10):
+            resp = requests.post(f"{cluster['leader']}/index?wait=1", json=_task(i), timeout=5.0)
+            assert resp.status_code == 200
+        expected = _tag_ids(cluster["leader"])
+        assert len(expected) == BEFORE + 10
+        assert _wait_until(lambda: _tag_ids(cluster["follower"]) == expected)
+
+    def test_reindexed_task_is_replaced(self, cluster):
+        task = dict(_task(0), task_tags=[TAG, "replica_moved"])
+        resp = requests.post(f"{cluster['leader']}/index?wait=1", json=task, timeout=5.0)
+        assert resp.status_code == 200
+
+        def moved():
+            resp = requests.post(f"{cluster['follower']}/search", json={
+                "query_type": "QT_TagTasks", "user_tags": ["replica_moved"],
+            }, timeout=5.0)
+            return resp.json()["task_id"] == ["replica_0"]
+
+        assert _wait_until(moved)
+        assert _tag_ids(cluster["follower"]) == _tag_ids(cluster["leader"])
+
+    def test_cursor_from_leader_works_on_follower(self, cluster):
+        """Docids are replicated as is, so a page cursor is portable"""
+        assert _wait_until(lambda: _tag_ids(cluster["follower"]) == _tag_ids(cluster["leader"]))
+        query = {"query_type": "QT_GeoTasks", "geo_data": "62,32", "radius_km": 20, "limit": 7}
+        first = requests.post(f"{cluster['leader']}/search", json=query, timeout=5.0).json()
+        cursor = first["next_cursor"]
+        pages = [
+            requests.post(f"{url}/search", json=dict(query, cursor=cursor), timeout=5.0).json()
+            for url in (cluster["leader"], cluster["follower"])
+        ]
+        assert pages[0]["status"] == pages[1]["status"] == "SearchOk"
+        assert pages[0]["task_id"] == pages[1]["task_id"]
+
+    def test_follower_refuses_writes(self, cluster):
+        resp = requests.post(f"{cluster['follower']}/index", json=_task(999), timeout=5.0)
+        assert resp.status_code == 403
+        assert resp.json()["error"] == "SearchIndexReadOnly"
+        resp = requests.post(
+            f"{cluster['follower']}/index/bulk",
+            data=json.dumps(_task(999)).encode("utf-8"),
+            headers={"Content-Type": "application/x-ndjson"},
+            timeout=5.0,
+        )
+        assert resp.status_code == 403
+        assert "replica_999" not in _tag_ids(cluster["follower"])
+
+    def test_lag_metrics(self, cluster):
+        leader = _metrics(cluster["leader"])
+        assert leader["dobrika_replication_log_last_seq"] >= 1
+        assert "dobrika_replication_lag_seconds" not in leader
+
+        def caught_up():
+            m = _metrics(cluster["follower"])
+            return (m["dobrika_replication_lag_changesets"] == 0
+                    and m["dobrika_replication_applied_seq"] == leader["dobrika_replication_log_last_seq"])
+
+        assert _wait_until(caught_up)
+        follower = _metrics(cluster["follower"])
+        assert follower["dobrika_replication_lag_seconds"] == 0
+        assert follower["dobrika_replication_resyncs_total"] >= 1
+        assert follower["dobrika_replication_changesets_total"] >= 1
+        assert follower["dobrika_replication_last_contact_timestamp_seconds"] > 0
+
+    def test_follower_resyncs_after_leader_restart(self, cluster):
+        before = _metrics(cluster["follower"])["dobrika_replication_resyncs_total"]
+        cluster["restart_leader"]()
+        resp = requests.post(f"{cluster['leader']}/index?wait=1", json=_task(500), timeout=5.0)
+        assert resp.status_code == 200
+        expected = _tag_ids(cluster["leader"])
+        assert "replica_500" in expected
+        assert _wait_until(lambda: _tag_ids(cluster["follower"]) == expected, timeout_s=30.0)
+        assert _metrics(cluster["follower"])["dobrika_replication_resyncs_total"] > before
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Stress test: concurrent /index and /search traffic against one server"""
+import concurrent.futures
+import threading
+import time
+
+import pytest
+import requests
+
+
+@pytest.mark.slow
+class TestConcurrentIndexSearch:
+    """Searches must keep succeeding while writers commit and readers reopen"""
+
+    WRITERS = 4
+    SEARCHERS = 8
+    TASKS_PER_WRITER = 100
+
+    def _writer(self, server_url, writer_id):
+        errors = []
+        with requests.Session() as session:
+            for i in range(self.TASKS_PER_WRITER):
+                task = {
+                    "task_id": f"stress_{writer_id}_{i}",
+                    "task_name": f"Stress task {writer_id} {i}",
+                    "task_desc": "Concurrent index and search",
+                    "task_type": "TT_OnlineTask",
+                    "geo_data": f"55.{7000 + i},37.{6000 + writer_id}",
+                    "task_tags": ["stress", f"stress_w{writer_id}"],
+                }
+                resp = session.post(f"{server_url}/index", json=task, timeout=10.0)
+                if resp.status_code != 200:
+                    errors.append((task["task_id"], resp.status_code, resp.text))
+        return errors
+
+    def _searcher(self, server_url, stop):
+        queries = [
+            {"query_type": "QT_TagTasks", "user_tags": ["stress"]},
+            {"query_type": "QT_GeoTasks", "geo_data": "55.7558,37.6173"},
+            {"user_query": "stress task"},
+        ]
+        errors = []
+        count = 0
+        with requests.Session() as session:
+            while not stop.is_set():
+                query = queries[count % len(queries)]
+                resp = session.post(f"{server_url}/search", json=query, timeout=10.0)
+                count += 1
+                if resp.status_code != 200 or resp.json().get("status") != "SearchOk":
+                    errors.append((query, resp.status_code, resp.text))
+        return count, errors
+
+    def test_index_and_search_concurrently(self, server_url):
+        stop = threading.Event()
+        with concurrent.futures.ThreadPoolExecutor(
+            max_workers=self.WRITERS + self.SEARCHERS
+        ) as pool:
+            searchers = [
+                pool.submit(self._searcher, server_url, stop) for _ in range(self.SEARCHERS)
+            ]
+            writers = [
+                pool.submit(self._writer, server_url, w) for w in range(self.WRITERS)
+            ]
+            write_errors = [e for fut in writers for e in fut.result()]
+            time.sleep(0.5)
+            stop.set()
+            search_results = [fut.result() for fut in searchers]
+
+        assert not write_errors, f"Index failures: {write_errors[:5]}"
+        search_errors = [e for _, errs in search_results for e in errs]
+        assert not search_errors, f"Search failures: {search_errors[:5]}"
+        assert sum(count for count, _ in search_results) > 0
+
+        # Every acknowledged write is visible once the writers are done.
+        for w in range(self.WRITERS):
+            resp = requests.post(f"{server_url}/search", json={
+                "query_type": "QT_TagTasks",
+                "user_tags": [f"stress_w{w}"],
+            }, timeout=5.0)
+            assert resp.status_code == 200
+            assert len(resp.json().get("task_id", [])) > 0
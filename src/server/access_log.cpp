@@ -0,0 +1,190 @@
+#include "server/access_log.hpp"
+
+#include <functional>
+#include <iostream>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr size_t kWriteBatch = 256;
+// How long the writer sleeps on an empty ring; lines show up at most this
+// late.
+constexpr std::chrono::milliseconds kIdleWait{20};
+
+size_t RoundUpPow2(size_t n) {
+  size_t p = 2;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+// Per-thread xorshift, so sampling needs no shared state.
+double NextUniform() {
+  thread_local uint64_t state =
+      std::hash<std::thread::id>{}(std::this_thread::get_id()) |
+      uint64_t{1};
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return static_cast<double>(state >> 11) * 0x1.0p-53;
+}
+
+void AppendQuoted(std::string &line, const char *key, std::string_view value) {
+  line += ' ';
+  line += key;
+  line += "=\"";
+  line.append(value.data(), value.size());
+  line += '"';
+}
+
+void AppendNumber(std::string &line, const char *key, int64_t value) {
+  if (value < 0)
+    return;
+  line += ' ';
+  line += key;
+  line += '=';
+  line += std::to_string(value);
+}
+
+// Same shape as the old synchronous lines:
+//   peer "POST /search" 200 1.234ms req_bytes=.. results=.. ua=".."
+std::string FormatLine(const AccessLogRecord &r) {
+  std::string line = r.peer.toIpPort();
+  line += " \"";
+  line += r.method;
+  line += ' ';
+  line += r.path;
+  line += "\" ";
+  line += std::to_string(r.status);
+  if (r.latency_us >= 0) {
+    const std::string us = std::to_string(r.latency_us % 1000 + 1000);
+    line += ' ';
+    line += std::to_string(r.latency_us / 1000);
+    line += '.';
+    line += us.substr(1);
+    line += "ms";
+  }
+  AppendNumber(line, "req_bytes", static_cast<int64_t>(r.req_bytes));
+  AppendNumber(line, "results", r.results);
+  AppendNumber(line, "accepted", r.accepted);
+  AppendNumber(line, "failed", r.failed_records);
+  if (!r.task_id.empty())
+    AppendQuoted(line, "task_id", r.task_id);
+  if (!r.user_agent.empty())
+    AppendQuoted(line, "ua", r.user_agent);
+  return line;
+}
+} // namespace
+
+AccessLog::AccessLog(const AccessLogOptions &options)
+    : options(options), mask(RoundUpPow2(options.capacity) - 1),
+      cells(new Cell[mask + 1]) {
+  for (size_t i = 0; i <= mask; ++i)
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+  writer = std::thread([this]() { WriterLoop(); });
+}
+
+AccessLog::~AccessLog() { Stop(); }
+
+bool AccessLog::ShouldLog(bool failed, int64_t latency_us) {
+  if (failed)
+    return true;
+  if (options.slow.count() >= 0 && latency_us >= 0 &&
+      latency_us >= options.slow.count() * 1000)
+    return true;
+  if (options.sample_rate >= 1.0 || NextUniform() < options.sample_rate)
+    return true;
+  sampled_out.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void AccessLog::Submit(AccessLogRecord record) {
+  if (stopping.load(std::memory_order_relaxed)) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Bounded MPMC ring (Vyukov): a cell is free for position pos when its
+  // sequence equals pos, and holds a record when it equals pos + 1.
+  size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+  Cell *cell;
+  while (true) {
+    cell = &cells[pos & mask];
+    const size_t seq = cell->sequence.load(std::memory_order_acquire);
+    const auto diff =
+        static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->record = std::move(record);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool AccessLog::TryPop(AccessLogRecord &out) {
+  Cell &cell = cells[dequeue_pos & mask];
+  if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+    return false;
+  out = std::move(cell.record);
+  cell.record = AccessLogRecord{};
+  cell.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+  ++dequeue_pos;
+  return true;
+}
+
+void AccessLog::WriterLoop() {
+  std::vector<AccessLogRecord> batch;
+  batch.reserve(kWriteBatch);
+  std::string bodies;
+  while (true) {
+    // Read the flag first so the final pass sees everything queued before
+    // Stop().
+    const bool stop = stopping.load(std::memory_order_acquire);
+    batch.clear();
+    AccessLogRecord record;
+    while (batch.size() < kWriteBatch && TryPop(record))
+      batch.push_back(std::move(record));
+    if (batch.empty()) {
+      if (stop)
+        break;
+      std::this_thread::sleep_for(kIdleWait);
+      continue;
+    }
+    bodies.clear();
+    for (const auto &r : batch) {
+      const std::string line = FormatLine(r);
+      LOG_INFO << line;
+      if (options.log_bodies) {
+        bodies += "[REQ] ";
+        bodies += line;
+        AppendQuoted(bodies, "body", r.body);
+        bodies += '\n';
+      }
+    }
+    if (!bodies.empty()) {
+      std::cout << bodies << std::flush;
+    }
+    written.fetch_add(batch.size(), std::memory_order_relaxed);
+  }
+}
+
+void AccessLog::Stop() {
+  stopping.store(true, std::memory_order_release);
+  if (writer.joinable())
+    writer.join();
+}
+
+AccessLogStats AccessLog::GetStats() const {
+  AccessLogStats stats;
+  stats.written = written.load(std::memory_order_relaxed);
+  stats.dropped = dropped.load(std::memory_order_relaxed);
+  stats.sampled_out = sampled_out.load(std::memory_order_relaxed);
+  return stats;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <drogon/drogon.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+// One access-log line, captured on the request thread without any
+// formatting; the writer thread turns it into text.
+struct AccessLogRecord {
+  const char *method = "";
+  std::string path;
+  trantor::InetAddress peer;
+  int status = 0;
+  bool failed = false;
+  // Negative when unknown (e.g. endpoints logged from the post-handling
+  // advice).
+  int64_t latency_us = -1;
+  size_t req_bytes = 0;
+  std::string user_agent;
+  // Optional fields; negative / empty ones are left out of the line.
+  int64_t results = -1;
+  int64_t accepted = -1;
+  int64_t failed_records = -1;
+  std::string task_id;
+  // Truncated request body, only with DOBRIKA_LOG_REQUESTS.
+  std::string body;
+};
+
+struct AccessLogOptions {
+  // Fraction of ordinary requests logged, 0..1.
+  double sample_rate = 1.0;
+  // Requests at least this slow are always logged; negative disables.
+  std::chrono::milliseconds slow{500};
+  // Ring capacity, rounded up to a power of two.
+  size_t capacity = 8192;
+  bool log_bodies = false;
+};
+
+struct AccessLogStats {
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  uint64_t sampled_out = 0;
+};
+
+// Access log with a bounded lock-free ring between request threads and one
+// writer thread. Submit() never blocks: when the writer falls behind,
+// records are dropped and counted. Failed and slow requests bypass
+// sampling.
+class AccessLog {
+public:
+  explicit AccessLog(const AccessLogOptions &options);
+  ~AccessLog();
+
+  AccessLog(const AccessLog &) = delete;
+  AccessLog &operator=(const AccessLog &) = delete;
+
+  // Sampling decision; call before building a record.
+  bool ShouldLog(bool failed, int64_t latency_us);
+  bool LogBodies() const { return options.log_bodies; }
+  void Submit(AccessLogRecord record);
+
+  // Drains what is queued and joins the writer. Later records are counted
+  // as dropped.
+  void Stop();
+
+  AccessLogStats GetStats() const;
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    AccessLogRecord record;
+  };
+
+  bool TryPop(AccessLogRecord &out);
+  void WriterLoop();
+
+  const AccessLogOptions options;
+  const size_t mask;
+  std::unique_ptr<Cell[]> cells;
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) size_t dequeue_pos = 0;
+
+  std::atomic<bool> stopping{false};
+  std::thread writer;
+
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> sampled_out{0};
+};
@@ -0,0 +1,192 @@
+#include "server/bulk_ingest.hpp"
+
+#include "server/request_codec.hpp"
+#include "xapian_processor/xapian_processor.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+
+#include <google/protobuf/io/coded_stream.h>
+
+namespace {
+constexpr size_t kChunkRecords = 1024;
+constexpr size_t kMaxInFlightChunks = 8;
+// Longest encoding of a record's length prefix.
+constexpr size_t kMaxVarint32Bytes = 5;
+
+void AddError(BulkIngestSummary &summary, size_t record, std::string reason) {
+  if (summary.errors.size() < kMaxBulkErrors)
+    summary.errors.emplace_back(record, std::move(reason));
+}
+
+// Accumulates parsed tasks and keeps a bounded number of chunks queued at
+// the writer so that memory stays flat for arbitrarily large bodies.
+class ChunkFeeder {
+public:
+  ChunkFeeder(XapianLayer &layer, BulkIngestSummary &summary)
+      : layer(layer), summary(summary) {
+    chunk.reserve(kChunkRecords);
+  }
+
+  void Add(DSIndexTask &&task, size_t record) {
+    if (chunk.empty())
+      chunk_first_record = record;
+    chunk.push_back(std::move(task));
+    if (chunk.size() >= kChunkRecords)
+      Flush();
+  }
+
+  void Finish() {
+    Flush();
+    while (!in_flight.empty())
+      WaitOldest();
+  }
+
+private:
+  struct InFlight {
+    std::future<void> done;
+    size_t first_record;
+    size_t size;
+  };
+
+  void Flush() {
+    if (chunk.empty())
+      return;
+    if (in_flight.size() >= kMaxInFlightChunks)
+      WaitOldest();
+    InFlight f;
+    f.first_record = chunk_first_record;
+    f.size = chunk.size();
+    f.done = layer.AddTasksToDBAsync(chunk);
+    in_flight.push_back(std::move(f));
+    chunk.clear();
+  }
+
+  void WaitOldest() {
+    InFlight f = std::move(in_flight.front());
+    in_flight.pop_front();
+    try {
+      f.done.get();
+      summary.accepted += f.size;
+    } catch (const std::exception &e) {
+      summary.failed += f.size;
+      AddError(summary, f.first_record,
+               std::string("commit failed for chunk of ") +
+                   std::to_string(f.size) + " records: " + e.what());
+    } catch (...) {
+      summary.failed += f.size;
+      AddError(summary, f.first_record,
+               "commit failed for chunk of " + std::to_string(f.size) +
+                   " records");
+    }
+  }
+
+  XapianLayer &layer;
+  BulkIngestSummary &summary;
+  std::vector<DSIndexTask> chunk;
+  size_t chunk_first_record = 0;
+  std::deque<InFlight> in_flight;
+};
+
+void RejectRecord(BulkIngestSummary &summary, size_t record,
+                  std::string reason) {
+  ++summary.failed;
+  AddError(summary, record, std::move(reason));
+}
+
+void IngestNdJson(std::string_view body, ChunkFeeder &feeder,
+                  BulkIngestSummary &summary) {
+  size_t record = 0;
+  size_t pos = 0;
+  while (pos < body.size()) {
+    size_t end = body.find('\n', pos);
+    if (end == std::string_view::npos)
+      end = body.size();
+    std::string_view line = body.substr(pos, end - pos);
+    pos = end + 1;
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (line.find_first_not_of(" \t") == std::string_view::npos)
+      continue;
+
+    ++record;
+    DSIndexTask task;
+    if (!ParseTaskJson(line, task)) {
+      RejectRecord(summary, record, "invalid json");
+      continue;
+    }
+    if (task.task_id().empty()) {
+      RejectRecord(summary, record, "missing task_id");
+      continue;
+    }
+    if (auto reason = UnindexableTask(task)) {
+      RejectRecord(summary, record, std::move(*reason));
+      continue;
+    }
+    feeder.Add(std::move(task), record);
+  }
+}
+
+void IngestDelimitedProtobuf(std::string_view body, ChunkFeeder &feeder,
+                             BulkIngestSummary &summary) {
+  // Protobuf streams count in int, so each record gets its own parser over
+  // just its bytes and the body itself may exceed 2 GiB.
+  const auto *data = reinterpret_cast<const uint8_t *>(body.data());
+  size_t record = 0;
+  size_t pos = 0;
+  while (pos < body.size()) {
+    ++record;
+    google::protobuf::io::CodedInputStream prefix(
+        data + pos,
+        static_cast<int>(std::min(body.size() - pos, kMaxVarint32Bytes)));
+    uint32_t len = 0;
+    if (!prefix.ReadVarint32(&len)) {
+      RejectRecord(summary, record, "truncated length prefix");
+      return;
+    }
+    pos += static_cast<size_t>(prefix.CurrentPosition());
+    if (len > body.size() - pos ||
+        len > static_cast<uint32_t>(std::numeric_limits<int>::max())) {
+      RejectRecord(summary, record, "truncated protobuf record");
+      return;
+    }
+    DSIndexTask task;
+    const bool ok = task.ParseFromArray(data + pos, static_cast<int>(len));
+    // The frame is intact, so a broken record is skipped, not fatal.
+    pos += len;
+    if (!ok) {
+      RejectRecord(summary, record, "malformed protobuf record");
+      continue;
+    }
+    if (task.task_id().empty()) {
+      RejectRecord(summary, record, "missing task_id");
+      continue;
+    }
+    if (auto reason = UnindexableTask(task)) {
+      RejectRecord(summary, record, std::move(*reason));
+      continue;
+    }
+    feeder.Add(std::move(task), record);
+  }
+}
+} // namespace
+
+BulkIngestSummary RunBulkIngest(XapianLayer &layer, std::string_view body,
+                                BulkFormat format) {
+  BulkIngestSummary summary;
+  ChunkFeeder feeder(layer, summary);
+  switch (format) {
+  case BulkFormat::NdJson:
+    IngestNdJson(body, feeder, summary);
+    break;
+  case BulkFormat::DelimitedProtobuf:
+    IngestDelimitedProtobuf(body, feeder, summary);
+    break;
+  }
+  feeder.Finish();
+  return summary;
+}
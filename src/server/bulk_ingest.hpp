@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class XapianLayer;
+
+enum class BulkFormat {
+  // One JSON object per line (application/x-ndjson).
+  NdJson,
+  // Varint length prefix followed by a serialised DSIndexTask, repeated
+  // (application/x-protobuf).
+  DelimitedProtobuf,
+};
+
+struct BulkIngestSummary {
+  size_t accepted = 0;
+  size_t failed = 0;
+  // (record number, reason); capped at kMaxBulkErrors entries, the counters
+  // above stay exact.
+  std::vector<std::pair<size_t, std::string>> errors;
+};
+
+inline constexpr size_t kMaxBulkErrors = 100;
+
+// Parses records one at a time from body and hands them to the writer in
+// chunks, so neither a JSON tree of the whole body nor a vector of all tasks
+// is ever materialised. Chunks are queued without waiting on each other and
+// merge into large group commits; the call returns once every queued chunk
+// is durable.
+BulkIngestSummary RunBulkIngest(XapianLayer &layer, std::string_view body,
+                                BulkFormat format);
@@ -0,0 +1,293 @@
+#include "server/json_reader.hpp"
+
+namespace {
+void AppendUtf8(std::string &out, unsigned cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+} // namespace
+
+void JsonReader::SkipSpace() {
+  while (pos < text.size()) {
+    const char c = text[pos];
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+      return;
+    ++pos;
+  }
+}
+
+JsonReader::Type JsonReader::Peek() {
+  SkipSpace();
+  if (failed || pos >= text.size())
+    return Type::Invalid;
+  switch (text[pos]) {
+  case '{':
+    return Type::Object;
+  case '[':
+    return Type::Array;
+  case '"':
+    return Type::String;
+  case 't':
+    return Type::True;
+  case 'f':
+    return Type::False;
+  case 'n':
+    return Type::Null;
+  default:
+    return text[pos] == '-' || IsDigit(text[pos]) ? Type::Number
+                                                  : Type::Invalid;
+  }
+}
+
+bool JsonReader::BeginContainer(char open) {
+  SkipSpace();
+  if (failed || pos >= text.size() || text[pos] != open ||
+      first.size() >= kMaxDepth)
+    return Fail();
+  ++pos;
+  first.push_back(true);
+  return true;
+}
+
+bool JsonReader::NextInContainer(char close) {
+  SkipSpace();
+  if (failed || first.empty() || pos >= text.size())
+    return Fail();
+  if (text[pos] == close) {
+    ++pos;
+    first.pop_back();
+    return false;
+  }
+  if (!first.back()) {
+    if (text[pos] != ',')
+      return Fail();
+    ++pos;
+  }
+  first.back() = false;
+  return true;
+}
+
+bool JsonReader::BeginObject() { return BeginContainer('{'); }
+bool JsonReader::BeginArray() { return BeginContainer('['); }
+bool JsonReader::NextElement() { return NextInContainer(']'); }
+
+bool JsonReader::NextKey(std::string &key) {
+  if (!NextInContainer('}'))
+    return false;
+  if (!ReadString(key))
+    return false;
+  SkipSpace();
+  if (pos >= text.size() || text[pos] != ':')
+    return Fail();
+  ++pos;
+  return true;
+}
+
+bool JsonReader::ReadHex4(unsigned &out) {
+  if (pos + 4 > text.size())
+    return Fail();
+  out = 0;
+  for (int i = 0; i < 4; ++i) {
+    const char c = text[pos++];
+    out <<= 4;
+    if (IsDigit(c))
+      out |= static_cast<unsigned>(c - '0');
+    else if (c >= 'a' && c <= 'f')
+      out |= static_cast<unsigned>(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      out |= static_cast<unsigned>(c - 'A' + 10);
+    else
+      return Fail();
+  }
+  return true;
+}
+
+bool JsonReader::ReadString(std::string &out) {
+  SkipSpace();
+  if (failed || pos >= text.size() || text[pos] != '"')
+    return Fail();
+  ++pos;
+  out.clear();
+  while (true) {
+    // Copy the run up to the next quote, escape or control character.
+    size_t run = pos;
+    while (run < text.size() && text[run] != '"' && text[run] != '\\' &&
+           static_cast<unsigned char>(text[run]) >= 0x20)
+      ++run;
+    out.append(text.data() + pos, run - pos);
+    pos = run;
+    if (pos >= text.size() || static_cast<unsigned char>(text[pos]) < 0x20)
+      return Fail();
+    if (text[pos++] == '"')
+      return true;
+    if (pos >= text.size())
+      return Fail();
+    switch (text[pos++]) {
+    case '"':
+      out += '"';
+      break;
+    case '\\':
+      out += '\\';
+      break;
+    case '/':
+      out += '/';
+      break;
+    case 'b':
+      out += '\b';
+      break;
+    case 'f':
+      out += '\f';
+      break;
+    case 'n':
+      out += '\n';
+      break;
+    case 'r':
+      out += '\r';
+      break;
+    case 't':
+      out += '\t';
+      break;
+    case 'u': {
+      unsigned cp;
+      if (!ReadHex4(cp))
+        return false;
+      if (cp >= 0xDC00 && cp <= 0xDFFF)
+        return Fail();
+      if (cp >= 0xD800 && cp <= 0xDBFF) {
+        unsigned low;
+        if (pos + 2 > text.size() || text[pos] != '\\' || text[pos + 1] != 'u')
+          return Fail();
+        pos += 2;
+        if (!ReadHex4(low))
+          return false;
+        if (low < 0xDC00 || low > 0xDFFF)
+          return Fail();
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+      }
+      AppendUtf8(out, cp);
+      break;
+    }
+    default:
+      return Fail();
+    }
+  }
+}
+
+bool JsonReader::ReadNumber(std::string_view &token, bool &integer) {
+  SkipSpace();
+  if (failed)
+    return false;
+  const size_t start = pos;
+  integer = true;
+  if (pos < text.size() && text[pos] == '-')
+    ++pos;
+  if (pos < text.size() && text[pos] == '0') {
+    ++pos;
+  } else if (pos < text.size() && IsDigit(text[pos])) {
+    while (pos < text.size() && IsDigit(text[pos]))
+      ++pos;
+  } else {
+    return Fail();
+  }
+  if (pos < text.size() && text[pos] == '.') {
+    integer = false;
+    ++pos;
+    if (pos >= text.size() || !IsDigit(text[pos]))
+      return Fail();
+    while (pos < text.size() && IsDigit(text[pos]))
+      ++pos;
+  }
+  if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+    integer = false;
+    ++pos;
+    if (pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+      ++pos;
+    if (pos >= text.size() || !IsDigit(text[pos]))
+      return Fail();
+    while (pos < text.size() && IsDigit(text[pos]))
+      ++pos;
+  }
+  token = text.substr(start, pos - start);
+  return true;
+}
+
+bool JsonReader::Literal(std::string_view word) {
+  SkipSpace();
+  if (failed || text.substr(pos, word.size()) != word)
+    return Fail();
+  pos += word.size();
+  return true;
+}
+
+bool JsonReader::ReadBool(bool &out) {
+  switch (Peek()) {
+  case Type::True:
+    out = true;
+    return Literal("true");
+  case Type::False:
+    out = false;
+    return Literal("false");
+  default:
+    return Fail();
+  }
+}
+
+bool JsonReader::ReadNull() { return Literal("null"); }
+
+bool JsonReader::Skip() {
+  switch (Peek()) {
+  case Type::Object:
+    if (!BeginObject())
+      return false;
+    while (NextKey(scratch)) {
+      if (!Skip())
+        return false;
+    }
+    return !failed;
+  case Type::Array:
+    if (!BeginArray())
+      return false;
+    while (NextElement()) {
+      if (!Skip())
+        return false;
+    }
+    return !failed;
+  case Type::String:
+    return ReadString(scratch);
+  case Type::Number: {
+    std::string_view token;
+    bool integer;
+    return ReadNumber(token, integer);
+  }
+  case Type::True:
+  case Type::False: {
+    bool value;
+    return ReadBool(value);
+  }
+  case Type::Null:
+    return ReadNull();
+  case Type::Invalid:
+    break;
+  }
+  return Fail();
+}
+
+bool JsonReader::AtEnd() {
+  SkipSpace();
+  return !failed && pos == text.size();
+}
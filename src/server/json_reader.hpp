@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Strict pull parser over a JSON text, used to fill protobuf messages
+// straight from the request body without building a Json::Value tree.
+// Every call returns false on malformed input and latches Failed(); the
+// "end of object/array" false of NextKey()/NextElement() is told apart by
+// checking Failed().
+class JsonReader {
+public:
+  enum class Type { Object, Array, String, Number, True, False, Null, Invalid };
+
+  explicit JsonReader(std::string_view text) : text(text) {}
+
+  // Type of the next value, without consuming it.
+  Type Peek();
+
+  bool BeginObject();
+  // Reads the next key and the ':' after it; false at the closing '}'.
+  bool NextKey(std::string &key);
+  bool BeginArray();
+  // Positions on the next element; false at the closing ']'.
+  bool NextElement();
+
+  bool ReadString(std::string &out);
+  // Validated number token; integer is false if it has a fraction or
+  // exponent.
+  bool ReadNumber(std::string_view &token, bool &integer);
+  bool ReadBool(bool &out);
+  bool ReadNull();
+  // Skips one value of any type (validating it).
+  bool Skip();
+
+  // True once only whitespace is left.
+  bool AtEnd();
+  bool Failed() const { return failed; }
+
+private:
+  static constexpr size_t kMaxDepth = 64;
+
+  void SkipSpace();
+  bool Fail() {
+    failed = true;
+    return false;
+  }
+  bool Literal(std::string_view word);
+  bool ReadHex4(unsigned &out);
+  bool BeginContainer(char open);
+  bool NextInContainer(char close);
+
+  std::string_view text;
+  size_t pos = 0;
+  bool failed = false;
+  // One entry per open container: true until its first member was read.
+  std::vector<bool> first;
+  std::string scratch;
+};
@@ -11,9 +11,54 @@
 //  - DOBRIKA_DB_PATH (default "db")
 //  - DOBRIKA_COLD_MIN (default 30)
 //  - DOBRIKA_HOT_MIN (default 15)
+//  - DOBRIKA_BACKUP_SEC (default 0; > 0 overrides both periods, in seconds)
+//  - DOBRIKA_BACKUP_DIR (default "<DOBRIKA_DB_PATH>_backup", empty disables)
+//  - DOBRIKA_BACKUP_KEEP (default 3)
+//  - DOBRIKA_BACKUP_MAX_MB_PER_SEC (default 0 = unlimited)
 //  - DOBRIKA_SEARCH_OFFSET (default 0)
 //  - DOBRIKA_SEARCH_LIMIT (default 20)
-//  - DOBRIKA_GEO_INDEX (default 2)
+//  - DOBRIKA_SEARCH_MAX_LIMIT (default 1000)
+//  - DOBRIKA_SEARCH_MAX_OFFSET (default 10000)
+//  - DOBRIKA_GEO_INDEX (default 2; value slots 10 and 11 are reserved for
+//    task_id and expires_at)
+//  - DOBRIKA_INGEST_LOG (default 1, negative disables)
+//  - DOBRIKA_INGEST_LOG_DIR (default "<DOBRIKA_DB_PATH>_wal")
+//  - DOBRIKA_SHARDS (default 1; see dobrika_reshard)
+//  - DOBRIKA_REPLICATION_LOG_MB (default 0; > 0 serves read replicas)
+//  - DOBRIKA_REPLICA_OF (leader URL; makes this node a read replica)
+//  - DOBRIKA_REPLICATION_POLL_MS (default 100)
+//  - DOBRIKA_COMMIT_BATCH_DOCS (default 256)
+//  - DOBRIKA_COMMIT_BATCH_MS (default 5)
+//  - DOBRIKA_MAX_BODY_MB (default 256)
+//  - DOBRIKA_ACCESS_LOG_SAMPLE (default 1.0, negative: failed/slow only)
+//  - DOBRIKA_ACCESS_LOG_SLOW_MS (default 500, negative disables)
+//  - DOBRIKA_ACCESS_LOG_QUEUE (default 8192)
+//  - DOBRIKA_LOG_REQUESTS (log request bodies to stdout)
+//  - DOBRIKA_TAG_BITMAPS (default 1, negative disables)
+//  - DOBRIKA_RESULT_CACHE_MB (default 64, negative disables)
+//  - DOBRIKA_RESULT_CACHE_SHARDS (default 16)
+//  - DOBRIKA_RESULT_CACHE_GEO_PRECISION (default 3)
+//  - DOBRIKA_RESULT_CACHE_MAX_STALE_MS (default 0)
+//  - DOBRIKA_QUERY_CACHE_ENTRIES (default 256 per reader, negative disables)
+//  - DOBRIKA_EXPIRY_SWEEP_SEC (default 60, negative disables)
+//  - DOBRIKA_EXPIRY_SWEEP_BATCH (default 1000)
+//  - DOBRIKA_COMPACTION_CHECK_SEC (default 600, negative disables)
+//  - DOBRIKA_COMPACTION_DELETED_PCT (default 25, negative disables)
+//  - DOBRIKA_COMPACTION_FRAGMENTATION_PCT (default 100, negative disables)
+//  - DOBRIKA_SUGGEST_MB (default 64, negative disables /suggest)
+//  - DOBRIKA_SEARCH_DEADLINE_MS (default 2000, negative disables)
+//  - DOBRIKA_SEARCH_MAX_IN_FLIGHT (search worker threads; default 0 =
+//    2 x hardware threads, negative disables admission control)
+//  - DOBRIKA_SEARCH_QUEUE (default 0 = 4 x max in flight, negative: none)
+//  - DOBRIKA_SEARCH_QUEUE_WAIT_MS (default 100)
+//  - DOBRIKA_INDEX_WORKERS (/index and /delete threads; default 0 =
+//    4 x hardware threads)
+//  - DOBRIKA_BULK_WORKERS (concurrent /index/bulk streams; default 0 = 2)
+//  - DOBRIKA_IO_THREADS (HTTP event loops; default 0 = one per core)
+//  - DOBRIKA_REUSEPORT (default 0; 1 gives every event loop its own
+//    SO_REUSEPORT listening socket)
+//  - DOBRIKA_PIN_CORES (CPU list such as "0-7"; pins event loops, then
+//    search workers, one per CPU in turn; empty disables)
 static std::string envOr(const char *name, const std::string &def) {
   const char *v = std::getenv(name);
   return v ? std::string(v) : def;
@@ -30,6 +75,17 @@ static int envOrInt(const char *name, int def) {
   }
 }
 
+static double envOrDouble(const char *name, double def) {
+  const char *v = std::getenv(name);
+  if (!v)
+    return def;
+  try {
+    return std::stod(v);
+  } catch (...) {
+    return def;
+  }
+}
+
 int main() {
   const std::string addr = envOr("DOBRIKA_ADDR", "127.0.0.1");
   const uint16_t port = static_cast<uint16_t>(envOrInt("DOBRIKA_PORT", 8088));
@@ -41,6 +97,68 @@ int main() {
   const int gidx = envOrInt("DOBRIKA_GEO_INDEX", 9);
 
   DobrikaServerConfig cfg = MakeServerConfig(db, cold, hot, off, lim, gidx);
+  cfg.mutable_sc()->set_backup_root(
+      envOr("DOBRIKA_BACKUP_DIR", db + "_backup"));
+  cfg.mutable_sc()->set_backup_keep(envOrInt("DOBRIKA_BACKUP_KEEP", 3));
+  cfg.mutable_sc()->set_backup_timer_sec(envOrInt("DOBRIKA_BACKUP_SEC", 0));
+  cfg.mutable_sc()->set_backup_max_mb_per_sec(
+      envOrInt("DOBRIKA_BACKUP_MAX_MB_PER_SEC", 0));
+  cfg.mutable_sc()->set_ingest_log(envOrInt("DOBRIKA_INGEST_LOG", 1));
+  cfg.mutable_sc()->set_ingest_log_dir(envOr("DOBRIKA_INGEST_LOG_DIR", ""));
+  cfg.mutable_sc()->set_shards(envOrInt("DOBRIKA_SHARDS", 1));
+  cfg.mutable_sc()->set_replication_log_mb(
+      envOrInt("DOBRIKA_REPLICATION_LOG_MB", 0));
+  cfg.mutable_sc()->set_replicate_from(envOr("DOBRIKA_REPLICA_OF", ""));
+  cfg.mutable_sc()->set_replication_poll_ms(
+      envOrInt("DOBRIKA_REPLICATION_POLL_MS", 100));
+  cfg.mutable_sc()->set_commit_batch_docs(
+      envOrInt("DOBRIKA_COMMIT_BATCH_DOCS", 256));
+  cfg.mutable_sc()->set_commit_batch_ms(envOrInt("DOBRIKA_COMMIT_BATCH_MS", 5));
+  cfg.mutable_sc()->set_search_max_limit(
+      envOrInt("DOBRIKA_SEARCH_MAX_LIMIT", 1000));
+  cfg.mutable_sc()->set_search_max_offset(
+      envOrInt("DOBRIKA_SEARCH_MAX_OFFSET", 10000));
+  cfg.mutable_sc()->set_tag_bitmap_index(envOrInt("DOBRIKA_TAG_BITMAPS", 1));
+  cfg.mutable_sc()->set_result_cache_max_mb(
+      envOrInt("DOBRIKA_RESULT_CACHE_MB", 64));
+  cfg.mutable_sc()->set_result_cache_shards(
+      envOrInt("DOBRIKA_RESULT_CACHE_SHARDS", 16));
+  cfg.mutable_sc()->set_result_cache_geo_precision(
+      envOrInt("DOBRIKA_RESULT_CACHE_GEO_PRECISION", 3));
+  cfg.mutable_sc()->set_result_cache_max_stale_ms(
+      envOrInt("DOBRIKA_RESULT_CACHE_MAX_STALE_MS", 0));
+  cfg.mutable_sc()->set_query_cache_entries(
+      envOrInt("DOBRIKA_QUERY_CACHE_ENTRIES", 256));
+  cfg.mutable_sc()->set_expiry_sweep_sec(
+      envOrInt("DOBRIKA_EXPIRY_SWEEP_SEC", 60));
+  cfg.mutable_sc()->set_expiry_sweep_batch(
+      envOrInt("DOBRIKA_EXPIRY_SWEEP_BATCH", 1000));
+  cfg.mutable_sc()->set_compaction_check_sec(
+      envOrInt("DOBRIKA_COMPACTION_CHECK_SEC", 600));
+  cfg.mutable_sc()->set_compaction_deleted_pct(
+      envOrInt("DOBRIKA_COMPACTION_DELETED_PCT", 25));
+  cfg.mutable_sc()->set_compaction_fragmentation_pct(
+      envOrInt("DOBRIKA_COMPACTION_FRAGMENTATION_PCT", 100));
+  cfg.mutable_sc()->set_suggest_max_mb(envOrInt("DOBRIKA_SUGGEST_MB", 64));
+  cfg.mutable_sc()->set_search_deadline_ms(
+      envOrInt("DOBRIKA_SEARCH_DEADLINE_MS", 2000));
+  cfg.mutable_sc()->set_search_max_in_flight(
+      envOrInt("DOBRIKA_SEARCH_MAX_IN_FLIGHT", 0));
+  cfg.mutable_sc()->set_search_queue(envOrInt("DOBRIKA_SEARCH_QUEUE", 0));
+  cfg.mutable_sc()->set_search_queue_wait_ms(
+      envOrInt("DOBRIKA_SEARCH_QUEUE_WAIT_MS", 100));
+  cfg.mutable_http()->set_max_body_mb(envOrInt("DOBRIKA_MAX_BODY_MB", 256));
+  cfg.mutable_http()->set_index_workers(envOrInt("DOBRIKA_INDEX_WORKERS", 0));
+  cfg.mutable_http()->set_bulk_workers(envOrInt("DOBRIKA_BULK_WORKERS", 0));
+  cfg.mutable_http()->set_io_threads(envOrInt("DOBRIKA_IO_THREADS", 0));
+  cfg.mutable_http()->set_reuse_port(envOrInt("DOBRIKA_REUSEPORT", 0) > 0);
+  cfg.mutable_http()->set_pin_cores(envOr("DOBRIKA_PIN_CORES", ""));
+  cfg.mutable_http()->set_access_log_sample_rate(
+      envOrDouble("DOBRIKA_ACCESS_LOG_SAMPLE", 1.0));
+  cfg.mutable_http()->set_access_log_slow_ms(
+      envOrInt("DOBRIKA_ACCESS_LOG_SLOW_MS", 500));
+  cfg.mutable_http()->set_access_log_queue(
+      envOrInt("DOBRIKA_ACCESS_LOG_QUEUE", 8192));
 
   std::cerr << "Dobrika web server configuration:\n";
   std::cerr << cfg.DebugString() << std::endl;
@@ -0,0 +1,240 @@
+#include "server/replication_follower.hpp"
+
+#include "xapian_processor/xapian_processor.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+constexpr double kRequestTimeoutSec = 30;
+constexpr auto kRetryDelay = std::chrono::seconds(1);
+constexpr size_t kSnapshotPageDocs = 2000;
+constexpr size_t kChangesMaxKb = 4096;
+
+uint64_t ParseU64(const std::string &text, const char *what) {
+  try {
+    size_t used = 0;
+    const uint64_t v = std::stoull(text, &used);
+    if (used == text.size())
+      return v;
+  } catch (...) {
+  }
+  throw std::runtime_error(std::string("leader sent a bad ") + what + ": \"" +
+                           text + "\"");
+}
+
+int64_t UnixNow() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+} // namespace
+
+ReplicationFollower::ReplicationFollower(XapianLayer &layer,
+                                         const std::string &leader_url,
+                                         std::chrono::milliseconds poll)
+    : layer(layer), leader_url(leader_url), poll(poll),
+      client_loop("replication"),
+      caught_up_at(std::chrono::steady_clock::now()) {
+  client_loop.run();
+  client = drogon::HttpClient::newHttpClient(leader_url,
+                                             client_loop.getLoop());
+  thread = std::thread([this]() { Run(); });
+}
+
+ReplicationFollower::~ReplicationFollower() { Stop(); }
+
+void ReplicationFollower::Stop() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopping = true;
+  }
+  stop_cv.notify_all();
+  if (thread.joinable())
+    thread.join();
+}
+
+ReplicationStats ReplicationFollower::GetStats() const {
+  std::lock_guard<std::mutex> lk(mutex);
+  ReplicationStats out = stats;
+  if (epoch == 0 || stats.applied_seq < stats.leader_seq)
+    out.lag_seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - caught_up_at)
+                          .count();
+  return out;
+}
+
+bool ReplicationFollower::Sleep(std::chrono::milliseconds period) {
+  std::unique_lock<std::mutex> lk(mutex);
+  return !stop_cv.wait_for(lk, period, [this] { return stopping; });
+}
+
+void ReplicationFollower::Run() {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lk(mutex);
+      if (stopping)
+        return;
+    }
+    std::chrono::milliseconds wait{0};
+    try {
+      bool synced;
+      {
+        std::lock_guard<std::mutex> lk(mutex);
+        synced = epoch != 0;
+      }
+      if (!synced) {
+        Resync();
+      } else {
+        switch (Pull()) {
+        case PullResult::CaughtUp:
+          wait = poll;
+          break;
+        case PullResult::More:
+          break;
+        case PullResult::Gone: {
+          LOG_WARN << "replication: changesets from " << leader_url
+                   << " are gone (leader restarted or replica too far "
+                      "behind); resyncing";
+          std::lock_guard<std::mutex> lk(mutex);
+          epoch = 0;
+          break;
+        }
+        }
+      }
+      last_error.clear();
+    } catch (const std::exception &e) {
+      std::lock_guard<std::mutex> lk(mutex);
+      ++stats.errors_total;
+      // Log once per distinct failure rather than once per retry.
+      if (last_error != e.what()) {
+        last_error = e.what();
+        LOG_WARN << "replication from " << leader_url << ": " << e.what();
+      }
+      wait = kRetryDelay;
+    }
+    if (wait.count() > 0 && !Sleep(wait))
+      return;
+  }
+}
+
+drogon::HttpResponsePtr
+ReplicationFollower::Fetch(const std::string &path,
+                           const std::map<std::string, std::string> &params,
+                           drogon::HttpStatusCode accepted) {
+  auto req = drogon::HttpRequest::newHttpRequest();
+  req->setMethod(drogon::Get);
+  req->setPath(path);
+  for (const auto &[key, value] : params)
+    req->setParameter(key, value);
+  const auto [result, resp] = client->sendRequest(req, kRequestTimeoutSec);
+  if (result != drogon::ReqResult::Ok || !resp)
+    throw std::runtime_error(path + ": request failed (" +
+                             std::to_string(static_cast<int>(result)) + ")");
+  const drogon::HttpStatusCode code = resp->getStatusCode();
+  if (code != drogon::k200OK && code != accepted)
+    throw std::runtime_error(path + ": HTTP " +
+                             std::to_string(static_cast<int>(code)));
+  std::lock_guard<std::mutex> lk(mutex);
+  stats.last_contact_unix = UnixNow();
+  return resp;
+}
+
+void ReplicationFollower::Resync() {
+  const auto status = Fetch("/replication/status", {});
+  const auto json = status->getJsonObject();
+  if (!json || !json->isObject())
+    throw std::runtime_error("/replication/status: not a JSON object");
+  const uint64_t leader_epoch =
+      ParseU64((*json)["epoch"].asString(), "epoch");
+  const uint64_t leader_seq = (*json)["last_seq"].asUInt64();
+  const size_t shards = (*json)["shards"].asUInt();
+  if (shards != layer.ShardCount())
+    throw std::runtime_error("leader has " + std::to_string(shards) +
+                             " shards, this replica " +
+                             std::to_string(layer.ShardCount()) +
+                             "; set DOBRIKA_SHARDS to match");
+
+  // Changesets after leader_seq are applied once the copy is done; pages
+  // read later may already hold some of them, which replaying fixes up.
+  uint64_t documents = 0;
+  for (size_t shard = 0; shard < shards; ++shard) {
+    Xapian::docid after = 0;
+    while (true) {
+      const auto resp = Fetch("/replication/snapshot",
+                              {{"shard", std::to_string(shard)},
+                               {"after", std::to_string(after)},
+                               {"limit", std::to_string(kSnapshotPageDocs)}});
+      std::vector<Changeset> pages;
+      if (!ParseChangesets(resp->getBody(), pages) || pages.size() != 1 ||
+          pages.front().shard != shard)
+        throw std::runtime_error("/replication/snapshot: malformed page");
+      const Changeset &page = pages.front();
+      const bool done =
+          resp->getHeader("x-dobrika-snapshot-done") == "1" ||
+          page.entries.empty();
+      const Xapian::docid upto = done ? 0 : page.entries.back().docid;
+      layer.ApplySnapshotPage(page, after, upto);
+      documents += page.entries.size();
+      if (done)
+        break;
+      after = upto;
+      std::lock_guard<std::mutex> lk(mutex);
+      if (stopping)
+        return;
+    }
+  }
+
+  std::lock_guard<std::mutex> lk(mutex);
+  epoch = leader_epoch;
+  stats.applied_seq = leader_seq;
+  stats.leader_seq = leader_seq;
+  stats.documents_total += documents;
+  ++stats.resyncs_total;
+  LOG_INFO << "replication: copied " << documents << " documents from "
+           << leader_url << " at changeset " << leader_seq;
+}
+
+ReplicationFollower::PullResult ReplicationFollower::Pull() {
+  uint64_t expected_epoch;
+  uint64_t after;
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    expected_epoch = epoch;
+    after = stats.applied_seq;
+  }
+  const auto resp = Fetch("/replication/changes",
+                          {{"epoch", std::to_string(expected_epoch)},
+                           {"after", std::to_string(after)},
+                           {"max_kb", std::to_string(kChangesMaxKb)}},
+                          drogon::k410Gone);
+  if (resp->getStatusCode() == drogon::k410Gone)
+    return PullResult::Gone;
+  const uint64_t leader_seq =
+      ParseU64(resp->getHeader("x-dobrika-last-seq"), "last seq");
+  std::vector<Changeset> changesets;
+  if (!ParseChangesets(resp->getBody(), changesets))
+    throw std::runtime_error("/replication/changes: malformed body");
+  uint64_t next = after;
+  uint64_t documents = 0;
+  for (const auto &changeset : changesets) {
+    if (changeset.seq != ++next)
+      throw std::runtime_error("/replication/changes: expected changeset " +
+                               std::to_string(next) + ", got " +
+                               std::to_string(changeset.seq));
+    documents += changeset.entries.size();
+  }
+  layer.ApplyChangesets(changesets);
+
+  std::lock_guard<std::mutex> lk(mutex);
+  stats.applied_seq = next;
+  stats.leader_seq = std::max(next, leader_seq);
+  stats.changesets_total += changesets.size();
+  stats.documents_total += documents;
+  if (next >= stats.leader_seq) {
+    caught_up_at = std::chrono::steady_clock::now();
+    return PullResult::CaughtUp;
+  }
+  return PullResult::More;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <drogon/drogon.h>
+#include <trantor/net/EventLoopThread.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class XapianLayer;
+
+struct ReplicationStats {
+  uint64_t applied_seq = 0;
+  uint64_t leader_seq = 0;
+  // 0 while caught up, otherwise the time since the replica last was.
+  double lag_seconds = 0;
+  uint64_t changesets_total = 0;
+  uint64_t documents_total = 0;
+  uint64_t resyncs_total = 0;
+  uint64_t errors_total = 0;
+  // Unix time of the last answer from the leader (0 = none yet).
+  int64_t last_contact_unix = 0;
+};
+
+// Keeps a read replica in step with the leader's /replication endpoints.
+// On start, and whenever the leader restarted or no longer holds the
+// changesets the replica needs, every shard is copied page by page from
+// /replication/snapshot; then /replication/changes is polled and applied
+// in order. Reads keep being served from the replica's own copy
+// throughout, so during a resync they may briefly see a mix of old and new
+// documents.
+class ReplicationFollower {
+public:
+  ReplicationFollower(XapianLayer &layer, const std::string &leader_url,
+                      std::chrono::milliseconds poll);
+  ~ReplicationFollower();
+
+  ReplicationFollower(const ReplicationFollower &) = delete;
+  ReplicationFollower &operator=(const ReplicationFollower &) = delete;
+
+  void Stop();
+
+  ReplicationStats GetStats() const;
+
+private:
+  enum class PullResult { CaughtUp, More, Gone };
+
+  void Run();
+  void Resync();
+  PullResult Pull();
+  // Throws std::runtime_error unless the leader answers 200 or one of
+  // `accepted`.
+  drogon::HttpResponsePtr
+  Fetch(const std::string &path,
+        const std::map<std::string, std::string> &params,
+        drogon::HttpStatusCode accepted = drogon::k200OK);
+  // False once Stop() was called.
+  bool Sleep(std::chrono::milliseconds period);
+
+  XapianLayer &layer;
+  const std::string leader_url;
+  const std::chrono::milliseconds poll;
+  trantor::EventLoopThread client_loop;
+  drogon::HttpClientPtr client;
+
+  mutable std::mutex mutex;
+  std::condition_variable stop_cv;
+  bool stopping = false;
+  // 0 until the first resync completed.
+  uint64_t epoch = 0;
+  std::chrono::steady_clock::time_point caught_up_at;
+  ReplicationStats stats;
+  std::string last_error;
+  std::thread thread;
+};
@@ -0,0 +1,313 @@
+#include "server/request_codec.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+
+#include "server/json_reader.hpp"
+
+namespace {
+using Type = JsonReader::Type;
+
+bool ReadScalarString(JsonReader &r, std::string &out) {
+  switch (r.Peek()) {
+  case Type::String:
+    return r.ReadString(out);
+  case Type::Null:
+    out.clear();
+    return r.ReadNull();
+  case Type::True:
+  case Type::False: {
+    bool value;
+    if (!r.ReadBool(value))
+      return false;
+    out = value ? "true" : "false";
+    return true;
+  }
+  case Type::Number: {
+    std::string_view token;
+    bool integer;
+    if (!r.ReadNumber(token, integer))
+      return false;
+    out.assign(token.data(), token.size());
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// Replaces out with the array's strings; a non-array value is ignored.
+bool ReadStringArray(JsonReader &r,
+                     google::protobuf::RepeatedPtrField<std::string> &out) {
+  if (r.Peek() != Type::Array)
+    return r.Skip();
+  out.Clear();
+  if (!r.BeginArray())
+    return false;
+  while (r.NextElement()) {
+    if (!ReadScalarString(r, *out.Add()))
+      return false;
+  }
+  return !r.Failed();
+}
+
+double ToDouble(std::string_view token) {
+  char buf[64];
+  if (token.size() >= sizeof(buf))
+    return std::strtod(std::string(token).c_str(), nullptr);
+  token.copy(buf, token.size());
+  buf[token.size()] = '\0';
+  return std::strtod(buf, nullptr);
+}
+
+// Integral values in [lo, hi], also when written as 20.0 or 2e1 (what
+// jsoncpp's isInt()/isUInt64() accept).
+template <typename Int>
+std::optional<Int> ToInteger(std::string_view token, bool integer) {
+  Int value;
+  if (integer) {
+    const auto [end, ec] =
+        std::from_chars(token.data(), token.data() + token.size(), value);
+    if (ec != std::errc() || end != token.data() + token.size())
+      return std::nullopt;
+    return value;
+  }
+  const double d = ToDouble(token);
+  if (d != std::floor(d) ||
+      d < static_cast<double>(std::numeric_limits<Int>::min()) ||
+      d >= static_cast<double>(std::numeric_limits<Int>::max()) + 1.0)
+    return std::nullopt;
+  return static_cast<Int>(d);
+}
+
+// Calls set(token, integer) for a number; other types are skipped.
+template <typename Set> bool ReadIfNumber(JsonReader &r, Set &&set) {
+  if (r.Peek() != Type::Number)
+    return r.Skip();
+  std::string_view token;
+  bool integer;
+  if (!r.ReadNumber(token, integer))
+    return false;
+  set(token, integer);
+  return true;
+}
+
+void AppendJsonString(std::string &out, const std::string &value) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  out += '"';
+  for (const char c : value) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += "\\u00";
+        out += kHex[(c >> 4) & 0xF];
+        out += kHex[c & 0xF];
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+void AppendSuggestions(
+    std::string &out,
+    const google::protobuf::RepeatedPtrField<DSSuggestion> &list) {
+  out += '[';
+  for (int i = 0; i < list.size(); ++i) {
+    if (i > 0)
+      out += ',';
+    out += "{\"text\":";
+    AppendJsonString(out, list[i].text());
+    out += ",\"weight\":";
+    out += std::to_string(list[i].weight());
+    out += '}';
+  }
+  out += ']';
+}
+} // namespace
+
+bool ParseTaskJson(std::string_view body, DSIndexTask &task) {
+  task.Clear();
+  JsonReader r(body);
+  if (!r.BeginObject())
+    return false;
+  std::string key;
+  while (r.NextKey(key)) {
+    bool ok;
+    if (key == "task_name")
+      ok = ReadScalarString(r, *task.mutable_task_name());
+    else if (key == "task_desc")
+      ok = ReadScalarString(r, *task.mutable_task_desc());
+    else if (key == "geo_data")
+      ok = ReadScalarString(r, *task.mutable_geo_data());
+    else if (key == "task_id")
+      ok = ReadScalarString(r, *task.mutable_task_id());
+    else if (key == "task_type")
+      ok = ReadScalarString(r, *task.mutable_task_type());
+    else if (key == "task_tags")
+      ok = ReadStringArray(r, *task.mutable_task_tags());
+    else if (key == "expires_at")
+      ok = ReadIfNumber(r, [&](std::string_view token, bool integer) {
+        if (auto v = ToInteger<int64_t>(token, integer))
+          task.set_expires_at(*v);
+      });
+    else
+      ok = r.Skip();
+    if (!ok)
+      return false;
+  }
+  return !r.Failed() && r.AtEnd();
+}
+
+bool ParseDeleteJson(std::string_view body, DSDeleteTask &task) {
+  task.Clear();
+  JsonReader r(body);
+  if (!r.BeginObject())
+    return false;
+  std::string key;
+  while (r.NextKey(key)) {
+    const bool ok = key == "task_id"
+                        ? ReadScalarString(r, *task.mutable_task_id())
+                        : r.Skip();
+    if (!ok)
+      return false;
+  }
+  return !r.Failed() && r.AtEnd();
+}
+
+bool ParseSearchJson(std::string_view body, DSearchRequest &req) {
+  req.Clear();
+  JsonReader r(body);
+  if (!r.BeginObject())
+    return false;
+  std::string key;
+  while (r.NextKey(key)) {
+    bool ok;
+    if (key == "user_query") {
+      ok = ReadScalarString(r, *req.mutable_user_query());
+    } else if (key == "geo_data") {
+      ok = ReadScalarString(r, *req.mutable_geo_data());
+    } else if (key == "query_type") {
+      ok = ReadScalarString(r, *req.mutable_query_type());
+    } else if (key == "task_type") {
+      ok = ReadScalarString(r, *req.mutable_task_type());
+    } else if (key == "user_tags") {
+      ok = ReadStringArray(r, *req.mutable_user_tags());
+    } else if (key == "exclude_tags") {
+      ok = ReadStringArray(r, *req.mutable_exclude_tags());
+    } else if (key == "radius_km") {
+      ok = ReadIfNumber(r, [&](std::string_view token, bool) {
+        req.set_radius_km(ToDouble(token));
+      });
+    } else if (key == "seed") {
+      ok = ReadIfNumber(r, [&](std::string_view token, bool integer) {
+        if (auto v = ToInteger<uint64_t>(token, integer))
+          req.set_seed(*v);
+      });
+    } else if (key == "offset") {
+      ok = ReadIfNumber(r, [&](std::string_view token, bool integer) {
+        if (auto v = ToInteger<int32_t>(token, integer))
+          req.set_offset(*v);
+      });
+    } else if (key == "limit") {
+      ok = ReadIfNumber(r, [&](std::string_view token, bool integer) {
+        if (auto v = ToInteger<int32_t>(token, integer))
+          req.set_limit(*v);
+      });
+    } else if (key == "timeout_ms") {
+      ok = ReadIfNumber(r, [&](std::string_view token, bool integer) {
+        if (auto v = ToInteger<uint32_t>(token, integer))
+          req.set_timeout_ms(*v);
+      });
+    } else if (key == "all_tags") {
+      const Type type = r.Peek();
+      if (type == Type::True || type == Type::False) {
+        bool value;
+        ok = r.ReadBool(value);
+        req.set_all_tags(value);
+      } else {
+        ok = r.Skip();
+      }
+    } else if (key == "cursor") {
+      ok = r.Peek() == Type::String ? r.ReadString(*req.mutable_cursor())
+                                    : r.Skip();
+    } else {
+      ok = r.Skip();
+    }
+    if (!ok)
+      return false;
+  }
+  return !r.Failed() && r.AtEnd();
+}
+
+std::string ToJson(const DSearchResult &res) {
+  // Sized for the common case of ids without escapes.
+  size_t size = 64 + res.status().size() + res.next_cursor().size();
+  for (const auto &id : res.task_id())
+    size += id.size() + 3;
+  std::string out;
+  out.reserve(size);
+  out += "{\"status\":";
+  AppendJsonString(out, res.status());
+  out += ",\"task_id\":[";
+  for (int i = 0; i < res.task_id_size(); ++i) {
+    if (i > 0)
+      out += ',';
+    AppendJsonString(out, res.task_id(i));
+  }
+  out += "],\"estimated_total\":";
+  out += std::to_string(res.estimated_total());
+  if (!res.next_cursor().empty()) {
+    out += ",\"next_cursor\":";
+    AppendJsonString(out, res.next_cursor());
+  }
+  if (res.partial())
+    out += ",\"partial\":true";
+  out += '}';
+  return out;
+}
+
+std::string ToJson(const DSIndexResult &res) {
+  std::string out;
+  out.reserve(32 + res.status().size());
+  out += res.ok() ? "{\"ok\":true,\"status\":" : "{\"ok\":false,\"status\":";
+  AppendJsonString(out, res.status());
+  out += '}';
+  return out;
+}
+
+std::string ToJson(const DSSuggestResult &res) {
+  size_t size = 32;
+  for (const auto &s : res.words())
+    size += s.text().size() + 32;
+  for (const auto &s : res.names())
+    size += s.text().size() + 32;
+  std::string out;
+  out.reserve(size);
+  out += "{\"words\":";
+  AppendSuggestions(out, res.words());
+  out += ",\"names\":";
+  AppendSuggestions(out, res.names());
+  out += '}';
+  return out;
+}
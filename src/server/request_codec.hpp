@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+#include "DSRequest.pb.h"
+#include "DSResponse.pb.h"
+
+// Conversions between the HTTP JSON bodies and the protobuf request/response
+// types used by XapianLayer. Requests are parsed straight from the body
+// buffer and responses written into one pre-sized string; no Json::Value
+// tree is built either way.
+//
+// Scalar string fields follow jsoncpp's asString(): null is empty, numbers
+// and booleans keep their text. Typed fields (radius_km, offset, ...) of
+// the wrong type are ignored. Malformed JSON, a non-object body or an
+// object/array where a string is expected make the parse fail.
+bool ParseTaskJson(std::string_view body, DSIndexTask &task);
+bool ParseDeleteJson(std::string_view body, DSDeleteTask &task);
+bool ParseSearchJson(std::string_view body, DSearchRequest &req);
+std::string ToJson(const DSearchResult &res);
+std::string ToJson(const DSIndexResult &res);
+std::string ToJson(const DSSuggestResult &res);
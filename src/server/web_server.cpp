@@ -1,6 +1,12 @@
 #include "server/web_server.hpp"
 #include "DServer.pb.h"
+#include "server/access_log.hpp"
+#include "server/bulk_ingest.hpp"
+#include "server/replication_follower.hpp"
+#include "server/request_codec.hpp"
+#include "server/worker_pool.hpp"
 #include "static.hpp"
+#include "tools/latency_histogram.hpp"
 #include "xapian_processor/xapian_processor.hpp"
 #include <algorithm>
 #include <atomic>
@@ -8,10 +14,12 @@
 #include <cctype>
 #include <cstdlib>
 #include <drogon/drogon.h>
-#include <iostream>
+#include <limits>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <utility>
 
 using namespace drogon;
@@ -22,12 +30,26 @@ std::atomic<bool> g_running{false};
 // Prometheus-style counters (cumulative; Prometheus will compute RPS via rate())
 std::atomic<uint64_t> g_search_requests_total{0};
 std::atomic<uint64_t> g_index_requests_total{0};
-std::atomic<bool> g_log_requests{false};
+std::atomic<uint64_t> g_bulk_records_accepted_total{0};
+std::atomic<uint64_t> g_bulk_records_failed_total{0};
+std::shared_ptr<AccessLog> g_access_log;
+// Set on read replicas (SearchConfig.replicate_from).
+std::unique_ptr<ReplicationFollower> g_follower;
+// Xapian work runs here, off the event loops. The search pool's threads
+// and bounded queue are its admission control.
+std::unique_ptr<WorkerPool> g_search_pool;
+std::unique_ptr<WorkerPool> g_index_pool;
+std::unique_ptr<WorkerPool> g_bulk_pool;
+// Longest wait in the search queue; nullopt without admission control.
+std::optional<std::chrono::milliseconds> g_search_queue_wait;
+std::atomic<uint64_t> g_search_queue_timeout_total{0};
+std::atomic<uint64_t> g_search_deadline_rejected_total{0};
+std::atomic<uint64_t> g_search_partial_total{0};
+// dobrika_request_duration_seconds; query_type is only set for /search.
+LatencyHistogramFamily g_request_latency(
+    std::vector<std::string>{"endpoint", "query_type", "status"});
 
-bool EnvFlagEnabled(const char *name) {
-  const char *val = std::getenv(name);
-  if (!val)
-    return false;
+bool FlagEnabled(const std::string &val) {
   std::string lower(val);
   std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) {
     return static_cast<char>(std::tolower(c));
@@ -35,6 +57,11 @@ bool EnvFlagEnabled(const char *name) {
   return lower == "1" || lower == "true" || lower == "yes" || lower == "on";
 }
 
+bool EnvFlagEnabled(const char *name) {
+  const char *val = std::getenv(name);
+  return val && FlagEnabled(val);
+}
+
 std::string TruncateForLog(std::string_view body) {
   constexpr std::size_t kMaxBodyLog = 512;
   if (body.size() <= kMaxBodyLog) {
@@ -45,59 +72,487 @@ std::string TruncateForLog(std::string_view body) {
   return truncated;
 }
 
-DSIndexTask MakeTaskFromJson(const Json::Value &json) {
-  DSIndexTask task;
-  if (json.isMember("task_name"))
-    task.set_task_name(json["task_name"].asString());
-  if (json.isMember("task_desc"))
-    task.set_task_desc(json["task_desc"].asString());
-  if (json.isMember("geo_data"))
-    task.set_geo_data(json["geo_data"].asString());
-  if (json.isMember("task_id"))
-    task.set_task_id(json["task_id"].asString());
-  if (json.isMember("task_type"))
-    task.set_task_type(json["task_type"].asString());
-  if (json.isMember("task_tags") && json["task_tags"].isArray()) {
-    for (const auto &t : json["task_tags"]) {
-      task.add_task_tags(t.asString());
+// Captures the raw fields of an access-log line on the request thread, or
+// returns nullopt if the request is sampled out. start is nullopt when the
+// latency is unknown.
+std::optional<AccessLogRecord>
+BeginAccessLog(AccessLog &log, const HttpRequestPtr &req, int status,
+               bool failed,
+               std::optional<std::chrono::steady_clock::time_point> start) {
+  const int64_t latency_us =
+      start ? std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - *start)
+                  .count()
+            : -1;
+  if (!log.ShouldLog(failed, latency_us))
+    return std::nullopt;
+  AccessLogRecord rec;
+  rec.method = req->methodString();
+  rec.path = req->path();
+  rec.peer = req->peerAddr();
+  rec.status = status;
+  rec.failed = failed;
+  rec.latency_us = latency_us;
+  rec.req_bytes = req->getBody().size();
+  rec.user_agent = req->getHeader("user-agent");
+  if (log.LogBodies())
+    rec.body = TruncateForLog(req->getBody());
+  return rec;
+}
+
+// Media type without parameters, lower-cased.
+std::string MediaType(std::string ctype) {
+  ctype = ctype.substr(0, ctype.find(';'));
+  std::transform(ctype.begin(), ctype.end(), ctype.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  while (!ctype.empty() && ctype.back() == ' ')
+    ctype.pop_back();
+  while (!ctype.empty() && ctype.front() == ' ')
+    ctype.erase(ctype.begin());
+  return ctype;
+}
+
+bool IsProtobufMediaType(const std::string &type) {
+  return type == "application/x-protobuf" || type == "application/protobuf";
+}
+
+// /search and /index speak JSON or the binary protobuf of their request and
+// response messages.
+enum class WireFormat { Json, Protobuf };
+
+WireFormat RequestWireFormat(const HttpRequest &req) {
+  return IsProtobufMediaType(MediaType(req.getHeader("content-type")))
+             ? WireFormat::Protobuf
+             : WireFormat::Json;
+}
+
+// An explicit Accept wins; otherwise answer in the request's format.
+WireFormat ResponseWireFormat(const HttpRequest &req, WireFormat request) {
+  const std::string &accept = req.getHeader("accept");
+  bool wildcard = accept.empty();
+  size_t start = 0;
+  while (start <= accept.size()) {
+    size_t end = accept.find(',', start);
+    if (end == std::string::npos)
+      end = accept.size();
+    const std::string type = MediaType(accept.substr(start, end - start));
+    if (IsProtobufMediaType(type))
+      return WireFormat::Protobuf;
+    if (type == "application/json")
+      return WireFormat::Json;
+    wildcard = wildcard || type == "*/*" || type == "application/*";
+    start = end + 1;
+  }
+  return wildcard ? request : WireFormat::Json;
+}
+
+// Both formats are parsed straight from the request buffer.
+template <typename Message>
+bool ParseBody(const HttpRequest &req, WireFormat format, Message &msg,
+               bool (*from_json)(std::string_view, Message &)) {
+  const std::string_view body = req.getBody();
+  if (format == WireFormat::Protobuf)
+    return msg.ParseFromArray(body.data(), static_cast<int>(body.size()));
+  return from_json(body, msg);
+}
+
+HttpResponsePtr JsonResponse(std::string body) {
+  auto resp = HttpResponse::newHttpResponse();
+  resp->setContentTypeCode(CT_APPLICATION_JSON);
+  resp->setBody(std::move(body));
+  return resp;
+}
+
+HttpResponsePtr
+ProtobufResponse(const google::protobuf::MessageLite &message) {
+  auto resp = HttpResponse::newHttpResponse();
+  resp->setContentTypeString("application/x-protobuf");
+  resp->setBody(message.SerializeAsString());
+  return resp;
+}
+
+// Read replicas only take writes from their leader.
+HttpResponsePtr ReadOnlyResponse(WireFormat out) {
+  const std::string status = GetSearchStatus(DSearchStatus::DSIndexReadOnly);
+  HttpResponsePtr resp;
+  if (out == WireFormat::Protobuf) {
+    DSIndexResult res;
+    res.set_status(status);
+    resp = ProtobufResponse(res);
+  } else {
+    Json::Value v;
+    v["error"] = status;
+    resp = HttpResponse::newHttpJsonResponse(v);
+  }
+  resp->setStatusCode(k403Forbidden);
+  return resp;
+}
+
+// /search turned away by the admission gate or out of time before matching.
+HttpResponsePtr OverloadedResponse(WireFormat out, const std::string &status) {
+  HttpResponsePtr resp;
+  if (out == WireFormat::Protobuf) {
+    DSearchResult res;
+    res.set_status(status);
+    resp = ProtobufResponse(res);
+  } else {
+    Json::Value v;
+    v["error"] = status;
+    resp = HttpResponse::newHttpJsonResponse(v);
+  }
+  resp->setStatusCode(k503ServiceUnavailable);
+  resp->addHeader("Retry-After", "1");
+  return resp;
+}
+
+// When the request reached the front proxy, if it stamped one (nginx:
+// `proxy_set_header X-Request-Start "t=${msec}";`, Unix seconds), so the
+// time spent queued there counts against the search deadline. Stamps
+// from the future (clock skew) are ignored; older than an hour, capped.
+std::chrono::steady_clock::time_point
+RequestStart(const HttpRequest &req, std::chrono::steady_clock::time_point t0) {
+  std::string stamp = req.getHeader("x-request-start");
+  if (stamp.rfind("t=", 0) == 0)
+    stamp.erase(0, 2);
+  if (stamp.empty())
+    return t0;
+  char *end = nullptr;
+  const double sent = std::strtod(stamp.c_str(), &end);
+  if (*end != '\0' || !(sent > 0))
+    return t0;
+  const std::chrono::duration<double> now =
+      std::chrono::system_clock::now().time_since_epoch();
+  const double age = now.count() - sent;
+  if (!(age > 0))
+    return t0;
+  return t0 - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                  std::chrono::duration<double>(std::min(age, 3600.0)));
+}
+
+// Search workers and admission control. The defaults allow twice the
+// hardware threads in flight and four times that waiting, each for at
+// most 100 ms.
+void StartSearchPool(const SearchConfig &sc, const std::vector<int> &cpus) {
+  const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  const size_t threads = sc.search_max_in_flight() > 0
+                             ? static_cast<size_t>(sc.search_max_in_flight())
+                             : 2 * hardware;
+  size_t max_queue = WorkerPool::kUnboundedQueue;
+  g_search_queue_wait.reset();
+  if (sc.search_max_in_flight() >= 0) {
+    if (sc.search_queue() > 0)
+      max_queue = static_cast<size_t>(sc.search_queue());
+    else
+      max_queue = sc.search_queue() == 0 ? 4 * threads : 0;
+    g_search_queue_wait = std::chrono::milliseconds(
+        sc.search_queue_wait_ms() > 0 ? sc.search_queue_wait_ms() : 100);
+  }
+  g_search_pool = std::make_unique<WorkerPool>(threads, max_queue, cpus);
+}
+
+HttpResponsePtr TextResponse(HttpStatusCode code, std::string body) {
+  auto resp = HttpResponse::newHttpResponse();
+  resp->setStatusCode(code);
+  resp->setContentTypeCode(CT_TEXT_PLAIN);
+  resp->setBody(std::move(body));
+  return resp;
+}
+
+// nullopt if the query parameter is missing or not a number.
+std::optional<uint64_t> ParamU64(const HttpRequest &req,
+                                 const std::string &key) {
+  const std::string &text = req.getParameter(key);
+  if (text.empty() ||
+      !std::all_of(text.begin(), text.end(),
+                   [](unsigned char c) { return std::isdigit(c); }))
+    return std::nullopt;
+  try {
+    return std::stoull(text);
+  } catch (...) {
+    return std::nullopt;
+  }
+}
+
+std::optional<BulkFormat> BulkFormatFromContentType(std::string ctype) {
+  ctype = MediaType(std::move(ctype));
+  if (ctype == "application/x-ndjson" || ctype == "application/jsonl")
+    return BulkFormat::NdJson;
+  if (ctype == "application/x-protobuf" || ctype == "application/protobuf" ||
+      ctype == "application/octet-stream")
+    return BulkFormat::DelimitedProtobuf;
+  return std::nullopt;
+}
+
+Json::Value ToJson(const BulkIngestSummary &summary) {
+  Json::Value v;
+  v["ok"] = summary.failed == 0;
+  v["status"] = GetSearchStatus(summary.failed == 0 ? DSearchStatus::DSIndexOk
+                                                    : DSearchStatus::DSIndexFall);
+  v["accepted"] = static_cast<Json::UInt64>(summary.accepted);
+  v["failed"] = static_cast<Json::UInt64>(summary.failed);
+  Json::Value errors(Json::arrayValue);
+  for (const auto &[record, reason] : summary.errors) {
+    Json::Value e;
+    e["record"] = static_cast<Json::UInt64>(record);
+    e["error"] = reason;
+    errors.append(std::move(e));
+  }
+  v["errors"] = std::move(errors);
+  return v;
+}
+
+void AppendMetric(std::string &body, const char *name, const char *type,
+                  const char *help, const std::string &value) {
+  body += "# HELP ";
+  body += name;
+  body += ' ';
+  body += help;
+  body += "\n# TYPE ";
+  body += name;
+  body += ' ';
+  body += type;
+  body += '\n';
+  body += name;
+  body += ' ';
+  body += value;
+  body += '\n';
+}
+
+// Summaries are exported as _sum/_count pairs without quantiles.
+void AppendSummary(std::string &body, const char *name, const char *help,
+                   const std::string &sum, uint64_t count) {
+  body += "# HELP ";
+  body += name;
+  body += ' ';
+  body += help;
+  body += "\n# TYPE ";
+  body += name;
+  body += " summary\n";
+  body += name;
+  body += "_sum ";
+  body += sum;
+  body += '\n';
+  body += name;
+  body += "_count ";
+  body += std::to_string(count);
+  body += '\n';
+}
+
+std::string EscapeLabelValue(const std::string &value) {
+  std::string out;
+  out.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else {
+      out += c;
     }
   }
-  return task;
+  return out;
 }
 
-DSearchRequest MakeSearchFromJson(const Json::Value &json) {
-  DSearchRequest req;
-  if (json.isMember("user_query"))
-    req.set_user_query(json["user_query"].asString());
-  if (json.isMember("geo_data"))
-    req.set_geo_data(json["geo_data"].asString());
-  if (json.isMember("query_type"))
-    req.set_query_type(json["query_type"].asString());
-  if (json.isMember("user_tags") && json["user_tags"].isArray()) {
-    for (const auto &t : json["user_tags"]) {
-      req.add_user_tags(t.asString());
+// One series per value of a single label.
+void AppendLabeledMetric(
+    std::string &body, const char *name, const char *type, const char *help,
+    const char *label,
+    const std::vector<std::pair<std::string, std::string>> &series) {
+  body += "# HELP ";
+  body += name;
+  body += ' ';
+  body += help;
+  body += "\n# TYPE ";
+  body += name;
+  body += ' ';
+  body += type;
+  body += '\n';
+  for (const auto &[label_value, value] : series) {
+    body += name;
+    body += '{';
+    body += label;
+    body += "=\"";
+    body += EscapeLabelValue(label_value);
+    body += "\"} ";
+    body += value;
+    body += '\n';
+  }
+}
+
+// Histograms are exported with cumulative _bucket series plus _sum/_count.
+void AppendHistogram(
+    std::string &body, const char *name, const char *help,
+    const std::vector<std::string> &label_names,
+    const std::vector<std::pair<std::vector<std::string>, HistogramSnapshot>>
+        &series) {
+  body += "# HELP ";
+  body += name;
+  body += ' ';
+  body += help;
+  body += "\n# TYPE ";
+  body += name;
+  body += " histogram\n";
+  for (const auto &[values, snap] : series) {
+    std::string labels;
+    for (size_t i = 0; i < label_names.size() && i < values.size(); ++i) {
+      labels += label_names[i];
+      labels += "=\"";
+      labels += EscapeLabelValue(values[i]);
+      labels += "\",";
+    }
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b < kLatencyBucketCount; ++b) {
+      cumulative += snap.counts[b];
+      std::ostringstream le;
+      if (b + 1 < kLatencyBucketCount)
+        le << kLatencyBucketsSec[b];
+      else
+        le << "+Inf";
+      body += name;
+      body += "_bucket{";
+      body += labels;
+      body += "le=\"";
+      body += le.str();
+      body += "\"} ";
+      body += std::to_string(cumulative);
+      body += '\n';
     }
+    if (!labels.empty())
+      labels = "{" + labels.substr(0, labels.size() - 1) + "}";
+    body += name;
+    body += "_sum";
+    body += labels;
+    body += ' ';
+    body += std::to_string(snap.sum_sec);
+    body += '\n';
+    body += name;
+    body += "_count";
+    body += labels;
+    body += ' ';
+    body += std::to_string(snap.count);
+    body += '\n';
+  }
+}
+
+// Unknown query types share one label value so clients can't blow up the
+// series count.
+std::string_view QueryTypeLabel(const DSearchRequest &request) {
+  return kQueryTypeByString.count(request.query_type())
+             ? std::string_view(request.query_type())
+             : std::string_view("unknown");
+}
+
+// A /search between the event loop and a search worker.
+struct SearchCall {
+  HttpRequestPtr req;
+  std::function<void(const HttpResponsePtr &)> callback;
+  DSearchRequest sreq;
+  WireFormat out = WireFormat::Json;
+  std::chrono::steady_clock::time_point t0;
+  SearchDeadline deadline;
+  std::chrono::steady_clock::time_point queued_at;
+};
+
+void AnswerSearch(const SearchCall &call, const DSearchResult &sres) {
+  const bool shed =
+      sres.status() == GetSearchStatus(DSearchStatus::DSOverloaded) ||
+      sres.status() == GetSearchStatus(DSearchStatus::DSDeadlineExceeded);
+  if (sres.partial())
+    g_search_partial_total.fetch_add(1, std::memory_order_relaxed);
+  LatencyHistogramFamily &stages = g_layer->SearchStageLatency();
+  const auto serialise_start = std::chrono::steady_clock::now();
+  HttpResponsePtr resp;
+  if (shed) {
+    resp = OverloadedResponse(call.out, sres.status());
+  } else {
+    resp = call.out == WireFormat::Protobuf ? ProtobufResponse(sres)
+                                            : JsonResponse(ToJson(sres));
+    resp->setStatusCode(k200OK);
+  }
+  stages.WithLabels({"serialise"}).ObserveSince(serialise_start);
+  call.callback(resp);
+  g_request_latency
+      .WithLabels({"/search", QueryTypeLabel(call.sreq), sres.status()})
+      .ObserveSince(call.t0);
+  const bool failed = sres.status() != GetSearchStatus(DSearchStatus::DSOk);
+  if (auto rec = BeginAccessLog(*g_access_log, call.req, shed ? 503 : 200,
+                                failed, call.t0)) {
+    rec->results = sres.task_id_size();
+    g_access_log->Submit(std::move(*rec));
   }
-  return req;
 }
 
-Json::Value ToJson(const DSearchResult &res) {
-  Json::Value j;
-  j["status"] = res.status();
-  Json::Value ids(Json::arrayValue);
-  for (int i = 0; i < res.task_id_size(); ++i) {
-    ids.append(res.task_id(i));
+// On a search worker. A search that waited longer than queue_wait is
+// turned away without running; one whose deadline passed gets
+// DSDeadlineExceeded from DoSearch().
+void RunSearch(const SearchCall &call) {
+  DSearchResult sres;
+  if (g_search_queue_wait &&
+      std::chrono::steady_clock::now() - call.queued_at >
+          *g_search_queue_wait) {
+    g_search_queue_timeout_total.fetch_add(1, std::memory_order_relaxed);
+    sres.set_status(GetSearchStatus(DSearchStatus::DSOverloaded));
+  } else {
+    sres = g_layer->DoSearch(call.sreq, call.deadline);
+    if (sres.status() ==
+        GetSearchStatus(DSearchStatus::DSDeadlineExceeded))
+      g_search_deadline_rejected_total.fetch_add(1,
+                                                 std::memory_order_relaxed);
   }
-  j["task_id"] = std::move(ids);
-  return j;
+  AnswerSearch(call, sres);
 }
+
 } // namespace
 
 void start_server_blocking(const DobrikaServerConfig &cfg,
                            const std::string &address, uint16_t port) {
   g_layer = std::make_shared<XapianLayer>(cfg);
-  g_log_requests.store(EnvFlagEnabled("DOBRIKA_LOG_REQUESTS"),
-                       std::memory_order_relaxed);
+  if (g_layer->IsFollower()) {
+    g_follower = std::make_unique<ReplicationFollower>(
+        *g_layer, cfg.sc().replicate_from(),
+        std::chrono::milliseconds(cfg.sc().replication_poll_ms() > 0
+                                      ? cfg.sc().replication_poll_ms()
+                                      : 100));
+  }
+  if (!cfg.sc().backup_root().empty())
+    g_layer->StartBackupScheduler(cfg.sc().backup_root());
+  g_layer->StartMaintenance();
+  const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  const size_t io_threads = cfg.http().io_threads() > 0
+                                ? static_cast<size_t>(cfg.http().io_threads())
+                                : hardware;
+  // Event loop i runs on cpus[i], search workers on the CPUs after them.
+  const std::vector<int> cpus = ParseCpuList(cfg.http().pin_cores());
+  std::vector<int> worker_cpus = cpus;
+  if (!cpus.empty()) {
+    std::rotate(worker_cpus.begin(),
+                worker_cpus.begin() +
+                    static_cast<std::ptrdiff_t>(io_threads % cpus.size()),
+                worker_cpus.end());
+  }
+  StartSearchPool(cfg.sc(), worker_cpus);
+  g_index_pool = std::make_unique<WorkerPool>(
+      cfg.http().index_workers() > 0
+          ? static_cast<size_t>(cfg.http().index_workers())
+          : 4 * hardware,
+      WorkerPool::kUnboundedQueue);
+  // Each queued stream holds its whole body, so the queue stays short.
+  const size_t bulk_workers =
+      cfg.http().bulk_workers() > 0
+          ? static_cast<size_t>(cfg.http().bulk_workers())
+          : 2;
+  g_bulk_pool = std::make_unique<WorkerPool>(bulk_workers, bulk_workers);
+  AccessLogOptions log_options;
+  if (cfg.http().access_log_sample_rate() != 0)
+    log_options.sample_rate =
+        std::clamp(cfg.http().access_log_sample_rate(), 0.0, 1.0);
+  if (cfg.http().access_log_slow_ms() != 0)
+    log_options.slow = std::chrono::milliseconds(cfg.http().access_log_slow_ms());
+  if (cfg.http().access_log_queue() > 0)
+    log_options.capacity = static_cast<size_t>(cfg.http().access_log_queue());
+  log_options.log_bodies = EnvFlagEnabled("DOBRIKA_LOG_REQUESTS");
+  g_access_log = std::make_shared<AccessLog>(log_options);
 
   // Basic HTTP metrics endpoint (Prometheus exposition format)
   app().registerHandler(
@@ -105,7 +560,7 @@ void start_server_blocking(const DobrikaServerConfig &cfg,
       [](const HttpRequestPtr &,
          std::function<void(const HttpResponsePtr &)> &&callback) {
         std::string body;
-        body.reserve(256);
+        body.reserve(2048);
         body += "# HELP dobrika_search_requests_total Total search requests\n";
         body += "# TYPE dobrika_search_requests_total counter\n";
         body += "dobrika_search_requests_total ";
@@ -116,6 +571,358 @@ void start_server_blocking(const DobrikaServerConfig &cfg,
         body += "dobrika_index_requests_total ";
         body += std::to_string(g_index_requests_total.load());
         body += "\n";
+        AppendMetric(body, "dobrika_bulk_records_accepted_total", "counter",
+                     "Records committed through /index/bulk",
+                     std::to_string(g_bulk_records_accepted_total.load()));
+        AppendMetric(body, "dobrika_bulk_records_failed_total", "counter",
+                     "Records rejected by /index/bulk",
+                     std::to_string(g_bulk_records_failed_total.load()));
+        AppendMetric(body, "dobrika_bulk_rejected_total", "counter",
+                     "/index/bulk streams refused with 503 while others ran",
+                     std::to_string(g_bulk_pool->GetStats().rejected_total));
+        const WriterStats ws = g_layer->GetWriterStats();
+        AppendSummary(body, "dobrika_index_commit_batch_size",
+                      "Documents per group commit",
+                      std::to_string(ws.committed_docs_total),
+                      ws.commits_total);
+        AppendSummary(body, "dobrika_index_commit_latency_seconds",
+                      "Group commit latency",
+                      std::to_string(ws.commit_latency_us_total / 1e6),
+                      ws.commits_total);
+        AppendHistogram(body, "dobrika_index_commit_seconds",
+                        "Transaction commit time per group commit", {},
+                        {{{}, g_layer->GetCommitLatency()}});
+        AppendHistogram(body, "dobrika_reader_reopen_seconds",
+                        "Time to reopen a reader handle after a commit", {},
+                        {{{}, g_layer->GetReopenLatency()}});
+        AppendHistogram(body, "dobrika_request_duration_seconds",
+                        "HTTP request latency",
+                        g_request_latency.LabelNames(),
+                        g_request_latency.Collect());
+        AppendHistogram(body, "dobrika_search_stage_seconds",
+                        "Time spent per /search stage",
+                        g_layer->SearchStageLatency().LabelNames(),
+                        g_layer->SearchStageLatency().Collect());
+        AppendMetric(body, "dobrika_index_commit_failures_total", "counter",
+                     "Failed group commits",
+                     std::to_string(ws.commit_failures_total));
+        AppendMetric(body, "dobrika_index_rejected_docs_total", "counter",
+                     "Documents the index refused and the writer dropped",
+                     std::to_string(ws.rejected_docs_total));
+        AppendMetric(body, "dobrika_index_last_commit_batch_size", "gauge",
+                     "Documents in the most recent group commit",
+                     std::to_string(ws.last_batch_size));
+        AppendMetric(body, "dobrika_index_pending_docs", "gauge",
+                     "Documents waiting for the next group commit",
+                     std::to_string(ws.pending_docs));
+        std::vector<std::pair<std::string, std::string>> shard_commits;
+        std::vector<std::pair<std::string, std::string>> shard_pending;
+        const std::vector<WriterStats> per_shard =
+            g_layer->GetShardWriterStats();
+        for (size_t i = 0; i < per_shard.size(); ++i) {
+          const std::string shard = std::to_string(i);
+          shard_commits.emplace_back(
+              shard, std::to_string(per_shard[i].commits_total));
+          shard_pending.emplace_back(
+              shard, std::to_string(per_shard[i].pending_docs));
+        }
+        AppendMetric(body, "dobrika_index_shards", "gauge",
+                     "Hash-partitioned index shards",
+                     std::to_string(g_layer->ShardCount()));
+        AppendLabeledMetric(body, "dobrika_index_shard_commits_total",
+                            "counter", "Group commits per shard", "shard",
+                            shard_commits);
+        AppendLabeledMetric(body, "dobrika_index_shard_pending_docs", "gauge",
+                            "Documents waiting for their shard's next commit",
+                            "shard", shard_pending);
+        body += "# HELP dobrika_search_read_mode_total Searches run over the "
+                "combined shards or fanned out per shard\n";
+        body += "# TYPE dobrika_search_read_mode_total counter\n";
+        for (const auto &c : g_layer->GetReadModeCounts()) {
+          body += "dobrika_search_read_mode_total{plan=\"" + c.plan +
+                  "\",mode=\"" + c.mode + "\"} " +
+                  std::to_string(c.queries) + "\n";
+        }
+        const WorkerPoolStats sp = g_search_pool->GetStats();
+        const WorkerPoolStats ip = g_index_pool->GetStats();
+        const WorkerPoolStats bp = g_bulk_pool->GetStats();
+        AppendMetric(body, "dobrika_search_in_flight", "gauge",
+                     "Searches admitted and running",
+                     std::to_string(sp.busy));
+        AppendMetric(body, "dobrika_search_queued", "gauge",
+                     "Searches waiting for a search worker",
+                     std::to_string(sp.queued));
+        AppendLabeledMetric(body, "dobrika_worker_threads", "gauge",
+                            "Threads of the search, index and bulk worker "
+                            "pools",
+                            "pool",
+                            {{"search", std::to_string(sp.threads)},
+                             {"index", std::to_string(ip.threads)},
+                             {"bulk", std::to_string(bp.threads)}});
+        AppendLabeledMetric(body, "dobrika_worker_busy", "gauge",
+                            "Worker threads running a request", "pool",
+                            {{"search", std::to_string(sp.busy)},
+                             {"index", std::to_string(ip.busy)},
+                             {"bulk", std::to_string(bp.busy)}});
+        AppendLabeledMetric(body, "dobrika_worker_queued", "gauge",
+                            "Requests waiting for a worker thread", "pool",
+                            {{"search", std::to_string(sp.queued)},
+                             {"index", std::to_string(ip.queued)},
+                             {"bulk", std::to_string(bp.queued)}});
+        AppendLabeledMetric(
+            body, "dobrika_search_rejected_total", "counter",
+            "Searches answered 503 without a result", "reason",
+            {{"queue_full", std::to_string(sp.rejected_total)},
+             {"queue_timeout",
+              std::to_string(g_search_queue_timeout_total.load())},
+             {"deadline",
+              std::to_string(g_search_deadline_rejected_total.load())}});
+        AppendMetric(body, "dobrika_search_partial_total", "counter",
+                     "Searches whose match the deadline cut short",
+                     std::to_string(g_search_partial_total.load()));
+        AppendMetric(body, "dobrika_index_write_generation", "gauge",
+                     "Commits visible to readers since start",
+                     std::to_string(g_layer->GetWriteGeneration()));
+        AppendMetric(body, "dobrika_reader_handles", "gauge",
+                     "Open read-only database handles",
+                     std::to_string(g_layer->GetReaderHandleCount()));
+        AppendMetric(body, "dobrika_task_id_table_entries", "gauge",
+                     "Documents in the docid to task_id side table",
+                     std::to_string(g_layer->GetTaskIdTableSize()));
+        AppendMetric(body, "dobrika_task_id_table_bytes", "gauge",
+                     "Memory held by the docid to task_id side table",
+                     std::to_string(g_layer->GetTaskIdTableBytes()));
+        const TermBitmapStats bs = g_layer->GetTagBitmapStats();
+        AppendMetric(body, "dobrika_tag_bitmap_terms", "gauge",
+                     "Tag and task type terms held as bitmaps",
+                     std::to_string(bs.terms));
+        AppendMetric(body, "dobrika_tag_bitmap_chunks", "gauge",
+                     "Roaring containers across all tag bitmaps",
+                     std::to_string(bs.chunks));
+        AppendMetric(body, "dobrika_tag_bitmap_bytes", "gauge",
+                     "Memory held by tag bitmaps",
+                     std::to_string(bs.bitmap_bytes));
+        AppendMetric(body, "dobrika_tag_bitmap_doc_terms_bytes", "gauge",
+                     "Memory held by per-document term lists of the tag index",
+                     std::to_string(bs.doc_terms_bytes));
+        const SuggestStats ss = g_layer->GetSuggestStats();
+        AppendLabeledMetric(body, "dobrika_suggest_keys", "gauge",
+                            "Words and task names in the /suggest trie",
+                            "kind",
+                            {{"word", std::to_string(ss.words)},
+                             {"name", std::to_string(ss.names)}});
+        AppendMetric(body, "dobrika_suggest_bytes", "gauge",
+                     "Memory held by the /suggest trie",
+                     std::to_string(ss.bytes));
+        AppendMetric(body, "dobrika_suggest_budget_bytes", "gauge",
+                     "Memory budget of the /suggest trie",
+                     std::to_string(ss.max_bytes));
+        AppendMetric(body, "dobrika_suggest_dropped_keys_total", "counter",
+                     "Keys left out of the /suggest trie by its budget",
+                     std::to_string(ss.dropped_total));
+        const AccessLogStats ls = g_access_log->GetStats();
+        AppendMetric(body, "dobrika_access_log_written_total", "counter",
+                     "Access log lines written",
+                     std::to_string(ls.written));
+        AppendMetric(body, "dobrika_access_log_dropped_total", "counter",
+                     "Access log records dropped because the queue was full",
+                     std::to_string(ls.dropped));
+        AppendMetric(body, "dobrika_access_log_sampled_out_total", "counter",
+                     "Requests left out of the access log by sampling",
+                     std::to_string(ls.sampled_out));
+        const IngestLogStats is = g_layer->GetIngestLogStats();
+        AppendMetric(body, "dobrika_ingest_log_records_total", "counter",
+                     "Records appended to the ingest log",
+                     std::to_string(is.records_total));
+        AppendMetric(body, "dobrika_ingest_log_bytes_total", "counter",
+                     "Bytes written to the ingest log",
+                     std::to_string(is.bytes_total));
+        AppendMetric(body, "dobrika_ingest_log_syncs_total", "counter",
+                     "Ingest log fsyncs (one per group of appends)",
+                     std::to_string(is.syncs_total));
+        AppendMetric(body, "dobrika_ingest_log_lag_records", "gauge",
+                     "Records acknowledged from the ingest log but not yet "
+                     "searchable",
+                     std::to_string(is.lag_records));
+        AppendMetric(body, "dobrika_ingest_log_replayed_records", "gauge",
+                     "Records replayed from the ingest log at startup",
+                     std::to_string(is.replayed_records));
+        AppendMetric(body, "dobrika_ingest_log_segments", "gauge",
+                     "Ingest log segment files on disk",
+                     std::to_string(is.segments));
+        AppendMetric(body, "dobrika_ingest_log_write_errors_total", "counter",
+                     "Ingest log batches whose write or sync failed and "
+                     "was retried",
+                     std::to_string(is.write_errors_total));
+        if (const ReplicationLog *rlog = g_layer->GetReplicationLog()) {
+          const ReplicationLogStats rs = rlog->GetStats();
+          AppendMetric(body, "dobrika_replication_log_last_seq", "gauge",
+                       "Newest changeset published for read replicas",
+                       std::to_string(rs.last_seq));
+          AppendMetric(body, "dobrika_replication_log_changesets", "gauge",
+                       "Changesets held in memory for read replicas",
+                       std::to_string(rs.changesets));
+          AppendMetric(body, "dobrika_replication_log_bytes", "gauge",
+                       "Memory held by changesets for read replicas",
+                       std::to_string(rs.bytes));
+        }
+        if (g_follower) {
+          const ReplicationStats rs = g_follower->GetStats();
+          AppendMetric(body, "dobrika_replication_lag_changesets", "gauge",
+                       "Leader changesets this replica has not applied yet",
+                       std::to_string(rs.leader_seq - rs.applied_seq));
+          AppendMetric(body, "dobrika_replication_lag_seconds", "gauge",
+                       "Time since this replica was last caught up with "
+                       "the leader (0 while it is)",
+                       std::to_string(rs.lag_seconds));
+          AppendMetric(body, "dobrika_replication_applied_seq", "gauge",
+                       "Last leader changeset applied",
+                       std::to_string(rs.applied_seq));
+          AppendMetric(body, "dobrika_replication_changesets_total",
+                       "counter", "Leader changesets applied",
+                       std::to_string(rs.changesets_total));
+          AppendMetric(body, "dobrika_replication_documents_total", "counter",
+                       "Documents written from changesets and snapshots",
+                       std::to_string(rs.documents_total));
+          AppendMetric(body, "dobrika_replication_resyncs_total", "counter",
+                       "Full copies from the leader's snapshot",
+                       std::to_string(rs.resyncs_total));
+          AppendMetric(body, "dobrika_replication_errors_total", "counter",
+                       "Failed replication requests or applies",
+                       std::to_string(rs.errors_total));
+          AppendMetric(body,
+                       "dobrika_replication_last_contact_timestamp_seconds",
+                       "gauge",
+                       "Unix time of the last answer from the leader "
+                       "(0 = none yet)",
+                       std::to_string(rs.last_contact_unix));
+        }
+        const BackupStats backup_stats[] = {
+            g_layer->GetBackupStats(BackupKind::Cold),
+            g_layer->GetBackupStats(BackupKind::Hot)};
+        auto per_kind = [&backup_stats](auto field) {
+          return std::vector<std::pair<std::string, std::string>>{
+              {"cold", field(backup_stats[0])},
+              {"hot", field(backup_stats[1])}};
+        };
+        AppendLabeledMetric(
+            body, "dobrika_backup_runs_total", "counter",
+            "Backup runs started", "kind", per_kind([](const BackupStats &b) {
+              return std::to_string(b.runs_total);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_failures_total", "counter",
+            "Backup runs that failed or were cancelled", "kind",
+            per_kind([](const BackupStats &b) {
+              return std::to_string(b.failures_total);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_last_duration_seconds", "gauge",
+            "Wall time of the last successful backup", "kind",
+            per_kind([](const BackupStats &b) {
+              return std::to_string(b.last_duration_sec);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_last_lock_seconds", "gauge",
+            "Time the last successful backup blocked commits", "kind",
+            per_kind([](const BackupStats &b) {
+              return std::to_string(b.last_lock_sec);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_last_size_bytes", "gauge",
+            "Size of the newest backup generation", "kind",
+            per_kind([](const BackupStats &b) {
+              return std::to_string(b.last_size_bytes);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_last_copied_bytes", "gauge",
+            "Bytes written by the last successful backup", "kind",
+            per_kind([](const BackupStats &b) {
+              return std::to_string(b.last_bytes_copied);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_last_linked_bytes", "gauge",
+            "Bytes the last backup shared through hardlinks or reflinks",
+            "kind", per_kind([](const BackupStats &b) {
+              return std::to_string(b.last_bytes_linked);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_last_revision", "gauge",
+            "Database revision held by the newest backup generation", "kind",
+            per_kind([](const BackupStats &b) {
+              return std::to_string(b.last_revision);
+            }));
+        AppendLabeledMetric(
+            body, "dobrika_backup_last_success_timestamp_seconds", "gauge",
+            "Unix time of the last successful backup (0 = none yet)", "kind",
+            per_kind([](const BackupStats &b) {
+              return std::to_string(b.last_success_unix);
+            }));
+        const XapianLayer::DeletionStats ds = g_layer->GetDeletionStats();
+        AppendLabeledMetric(body, "dobrika_documents_deleted_total",
+                            "counter", "Tasks removed from the index",
+                            "reason",
+                            {{"api", std::to_string(ds.api_total)},
+                             {"expired", std::to_string(ds.expired_total)}});
+        AppendMetric(body, "dobrika_expiry_sweeps_total", "counter",
+                     "Passes of the expiry sweeper over all shards",
+                     std::to_string(ds.expiry_sweeps_total));
+        const DatabaseFootprint footprint = g_layer->GetIndexFootprint();
+        AppendMetric(body, "dobrika_index_documents", "gauge",
+                     "Documents in the index",
+                     std::to_string(footprint.documents));
+        AppendMetric(body, "dobrika_index_size_bytes", "gauge",
+                     "Size of the index files on disk",
+                     std::to_string(footprint.bytes));
+        const CompactionStats cps = g_layer->GetCompactionStats();
+        AppendMetric(body, "dobrika_compaction_runs_total", "counter",
+                     "Shard compactions completed",
+                     std::to_string(cps.runs_total));
+        AppendMetric(body, "dobrika_compaction_failures_total", "counter",
+                     "Shard compactions that failed or were cancelled",
+                     std::to_string(cps.failures_total));
+        AppendMetric(body, "dobrika_compaction_last_duration_seconds",
+                     "gauge", "Wall time of the last shard compaction",
+                     std::to_string(cps.last_duration_sec));
+        AppendMetric(body, "dobrika_compaction_last_lock_seconds", "gauge",
+                     "Time the last shard compaction blocked commits",
+                     std::to_string(cps.last_lock_sec));
+        AppendMetric(body, "dobrika_compaction_last_size_before_bytes",
+                     "gauge", "Shard size before the last compaction",
+                     std::to_string(cps.last_size_before_bytes));
+        AppendMetric(body, "dobrika_compaction_last_size_after_bytes",
+                     "gauge", "Shard size after the last compaction",
+                     std::to_string(cps.last_size_after_bytes));
+        AppendMetric(body, "dobrika_compaction_last_documents", "gauge",
+                     "Documents in the last compacted shard",
+                     std::to_string(cps.last_documents));
+        AppendMetric(body, "dobrika_compaction_last_success_timestamp_seconds",
+                     "gauge",
+                     "Unix time of the last shard compaction (0 = none yet)",
+                     std::to_string(cps.last_success_unix));
+        const ResultCacheStats cs = g_layer->GetResultCacheStats();
+        AppendMetric(body, "dobrika_result_cache_hits_total", "counter",
+                     "Searches answered from the result cache",
+                     std::to_string(cs.hits));
+        AppendMetric(body, "dobrika_result_cache_misses_total", "counter",
+                     "Searches that missed or found a stale cache entry",
+                     std::to_string(cs.misses));
+        AppendMetric(body, "dobrika_result_cache_evictions_total", "counter",
+                     "Cache entries evicted to stay within the memory limit",
+                     std::to_string(cs.evictions));
+        AppendMetric(body, "dobrika_result_cache_entries", "gauge",
+                     "Entries currently held by the result cache",
+                     std::to_string(cs.entries));
+        AppendMetric(body, "dobrika_result_cache_bytes", "gauge",
+                     "Estimated memory used by the result cache",
+                     std::to_string(cs.bytes));
+        const QueryCacheStats qs = g_layer->GetQueryCacheStats();
+        AppendMetric(body, "dobrika_query_cache_hits_total", "counter",
+                     "Query texts served from a reader's parsed-query cache",
+                     std::to_string(qs.hits));
+        AppendMetric(body, "dobrika_query_cache_misses_total", "counter",
+                     "Query texts parsed by the QueryParser",
+                     std::to_string(qs.misses));
         auto resp = HttpResponse::newHttpResponse();
         resp->setStatusCode(k200OK);
         resp->setContentTypeCode(CT_TEXT_PLAIN);
@@ -141,58 +948,217 @@ void start_server_blocking(const DobrikaServerConfig &cfg,
       [](const HttpRequestPtr &req,
          std::function<void(const HttpResponsePtr &)> &&callback) {
         auto t0 = std::chrono::steady_clock::now();
-        auto json = req->getJsonObject();
-        if (!json) {
-          Json::Value v;
-          v["error"] = GetSearchStatus(DSearchStatus::DSInvalidJson);
-          auto resp = HttpResponse::newHttpJsonResponse(v);
+        const WireFormat in = RequestWireFormat(*req);
+        const WireFormat out = ResponseWireFormat(*req, in);
+        if (g_layer->IsFollower()) {
+          callback(ReadOnlyResponse(out));
+          g_request_latency
+              .WithLabels({"/index", "",
+                           GetSearchStatus(DSearchStatus::DSIndexReadOnly)})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, 403, true, t0))
+            g_access_log->Submit(std::move(*rec));
+          return;
+        }
+        DSIndexTask task;
+        const bool parsed = ParseBody(*req, in, task, ParseTaskJson);
+        // Refused before it reaches the log: acknowledged, it would fail
+        // every commit it joined.
+        const std::optional<std::string> unindexable =
+            parsed ? UnindexableTask(task) : std::nullopt;
+        if (!parsed || unindexable) {
+          const std::string status = GetSearchStatus(
+              unindexable                    ? DSearchStatus::DSIndexFall
+              : in == WireFormat::Protobuf ? DSearchStatus::DSInvalidProtobuf
+                                           : DSearchStatus::DSInvalidJson);
+          HttpResponsePtr resp;
+          if (out == WireFormat::Protobuf) {
+            DSIndexResult res;
+            res.set_status(status);
+            resp = ProtobufResponse(res);
+          } else {
+            Json::Value v;
+            v["error"] = status;
+            if (unindexable)
+              v["reason"] = *unindexable;
+            resp = HttpResponse::newHttpJsonResponse(v);
+          }
           resp->setStatusCode(k400BadRequest);
           callback(resp);
-          auto t1 = std::chrono::steady_clock::now();
-          auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-          std::string peer = req->peerAddr().toIpPort();
-          std::string ua = req->getHeader("user-agent");
-          size_t req_size = req->getBody().size();
-          LOG_INFO << peer << " \"POST /index\" 400 "
-                   << ms << "ms req_bytes=" << req_size
-                   << " ua=\"" << ua << "\"";
+          g_request_latency.WithLabels({"/index", "", status}).ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, 400, true, t0))
+            g_access_log->Submit(std::move(*rec));
           return;
         }
-        DSIndexTask task = MakeTaskFromJson(*json);
-        try {
-          g_layer->AddTaskToDB(task);
-          Json::Value v;
-          v["ok"] = true;
-          v["status"] = GetSearchStatus(DSearchStatus::DSIndexOk);
-          auto resp = HttpResponse::newHttpJsonResponse(v);
-          resp->setStatusCode(k200OK);
+        // Waits for the ingest log fsync (or a commit); off the loop.
+        g_index_pool->Post([req, callback = std::move(callback),
+                            task = std::move(task), out, t0]() {
+          DSIndexResult res;
+          HttpStatusCode code = k200OK;
+          try {
+            // ?wait=1: answer only once the task is searchable.
+            g_layer->IngestTask(task, FlagEnabled(req->getParameter("wait")));
+            res.set_ok(true);
+            res.set_status(GetSearchStatus(DSearchStatus::DSIndexOk));
+          } catch (...) {
+            // ok stays true in JSON for compatibility with existing clients.
+            res.set_ok(out == WireFormat::Json);
+            res.set_status(GetSearchStatus(DSearchStatus::DSIndexFall));
+            code = k500InternalServerError;
+          }
+          HttpResponsePtr resp = out == WireFormat::Protobuf
+                                     ? ProtobufResponse(res)
+                                     : JsonResponse(ToJson(res));
+          resp->setStatusCode(code);
           callback(resp);
-          auto t1 = std::chrono::steady_clock::now();
-          auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-          std::string peer = req->peerAddr().toIpPort();
-          std::string ua = req->getHeader("user-agent");
-          size_t req_size = req->getBody().size();
-          LOG_INFO << peer << " \"POST /index\" 200 "
-                   << ms << "ms req_bytes=" << req_size
-                   << " task_id=\"" << task.task_id() << "\""
-                   << " ua=\"" << ua << "\"";
-        } catch (...) {
+          g_request_latency.WithLabels({"/index", "", res.status()})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, code,
+                                        code != k200OK, t0)) {
+            rec->task_id = task.task_id();
+            g_access_log->Submit(std::move(*rec));
+          }
+        });
+      },
+      {Post});
+
+  // Streaming bulk ingest: NDJSON or varint-delimited DSIndexTask records.
+  app().registerHandler(
+      "/index/bulk",
+      [](const HttpRequestPtr &req,
+         std::function<void(const HttpResponsePtr &)> &&callback) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (g_layer->IsFollower()) {
+          callback(ReadOnlyResponse(WireFormat::Json));
+          g_request_latency
+              .WithLabels({"/index/bulk", "",
+                           GetSearchStatus(DSearchStatus::DSIndexReadOnly)})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, 403, true, t0))
+            g_access_log->Submit(std::move(*rec));
+          return;
+        }
+        const auto format = BulkFormatFromContentType(req->getHeader("content-type"));
+        if (!format) {
           Json::Value v;
-          v["ok"] = true;
-          v["status"] = GetSearchStatus(DSearchStatus::DSIndexFall);
+          v["error"] = "unsupported content type; use application/x-ndjson "
+                       "or application/x-protobuf";
           auto resp = HttpResponse::newHttpJsonResponse(v);
-          resp->setStatusCode(k500InternalServerError);
+          resp->setStatusCode(k415UnsupportedMediaType);
+          callback(resp);
+          g_request_latency
+              .WithLabels({"/index/bulk", "",
+                           GetSearchStatus(DSearchStatus::DSIndexFall)})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, 415, true, t0))
+            g_access_log->Submit(std::move(*rec));
+          return;
+        }
+        // A reindex can take minutes; run it off the event loop and answer
+        // from the worker once every chunk is committed. The callback is
+        // shared so it is still ours if the pool refuses the task.
+        auto respond =
+            std::make_shared<std::function<void(const HttpResponsePtr &)>>(
+                std::move(callback));
+        const bool posted = g_bulk_pool->Post([layer = g_layer,
+                                               log = g_access_log, req,
+                                               respond, format = *format,
+                                               t0]() {
+          const auto &callback = *respond;
+          const BulkIngestSummary summary =
+              RunBulkIngest(*layer, req->getBody(), format);
+          g_bulk_records_accepted_total.fetch_add(summary.accepted,
+                                                  std::memory_order_relaxed);
+          g_bulk_records_failed_total.fetch_add(summary.failed,
+                                                std::memory_order_relaxed);
+          auto resp = HttpResponse::newHttpJsonResponse(ToJson(summary));
+          const bool rejected = summary.accepted == 0 && summary.failed > 0;
+          resp->setStatusCode(rejected ? k400BadRequest : k200OK);
           callback(resp);
-          auto t1 = std::chrono::steady_clock::now();
-          auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-          std::string peer = req->peerAddr().toIpPort();
-          std::string ua = req->getHeader("user-agent");
-          size_t req_size = req->getBody().size();
-          LOG_INFO << peer << " \"POST /index\" 500 "
-                   << ms << "ms req_bytes=" << req_size
-                   << " task_id=\"" << task.task_id() << "\""
-                   << " ua=\"" << ua << "\"";
+          g_request_latency
+              .WithLabels({"/index/bulk", "",
+                           GetSearchStatus(summary.failed == 0
+                                               ? DSearchStatus::DSIndexOk
+                                               : DSearchStatus::DSIndexFall)})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*log, req, rejected ? 400 : 200,
+                                        summary.failed > 0, t0)) {
+            rec->accepted = static_cast<int64_t>(summary.accepted);
+            rec->failed_records = static_cast<int64_t>(summary.failed);
+            log->Submit(std::move(*rec));
+          }
+        });
+        if (!posted) {
+          const std::string status =
+              GetSearchStatus(DSearchStatus::DSOverloaded);
+          (*respond)(OverloadedResponse(WireFormat::Json, status));
+          g_request_latency.WithLabels({"/index/bulk", "", status})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, 503, true, t0))
+            g_access_log->Submit(std::move(*rec));
+        }
+      },
+      {Post});
+
+  // Removes one task by id; 200 also when it was not indexed.
+  app().registerHandler(
+      "/delete",
+      [](const HttpRequestPtr &req,
+         std::function<void(const HttpResponsePtr &)> &&callback) {
+        auto t0 = std::chrono::steady_clock::now();
+        const WireFormat in = RequestWireFormat(*req);
+        const WireFormat out = ResponseWireFormat(*req, in);
+        if (g_layer->IsFollower()) {
+          callback(ReadOnlyResponse(out));
+          g_request_latency
+              .WithLabels({"/delete", "",
+                           GetSearchStatus(DSearchStatus::DSIndexReadOnly)})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, 403, true, t0))
+            g_access_log->Submit(std::move(*rec));
+          return;
         }
+        DSDeleteTask task;
+        const bool parsed = ParseBody(*req, in, task, ParseDeleteJson) &&
+                            !task.task_id().empty();
+        const bool indexable = parsed && !UnindexableTaskId(task.task_id());
+        // Waits for the shard's commit; off the loop.
+        g_index_pool->Post([req, callback = std::move(callback),
+                            task = std::move(task), parsed, indexable, in, out,
+                            t0]() {
+          DSIndexResult res;
+          HttpStatusCode code = k200OK;
+          if (parsed && !indexable) {
+            res.set_status(GetSearchStatus(DSearchStatus::DSIndexFall));
+            code = k400BadRequest;
+          } else if (!parsed) {
+            res.set_status(GetSearchStatus(
+                in == WireFormat::Protobuf ? DSearchStatus::DSInvalidProtobuf
+                                           : DSearchStatus::DSInvalidJson));
+            code = k400BadRequest;
+          } else {
+            try {
+              g_layer->DeleteTask(task.task_id());
+              res.set_ok(true);
+              res.set_status(GetSearchStatus(DSearchStatus::DSDeleteOk));
+            } catch (...) {
+              res.set_status(GetSearchStatus(DSearchStatus::DSIndexFall));
+              code = k500InternalServerError;
+            }
+          }
+          HttpResponsePtr resp = out == WireFormat::Protobuf
+                                     ? ProtobufResponse(res)
+                                     : JsonResponse(ToJson(res));
+          resp->setStatusCode(code);
+          callback(resp);
+          g_request_latency.WithLabels({"/delete", "", res.status()})
+              .ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, code,
+                                        code != k200OK, t0)) {
+            rec->task_id = task.task_id();
+            g_access_log->Submit(std::move(*rec));
+          }
+        });
       },
       {Post});
 
@@ -202,75 +1168,214 @@ void start_server_blocking(const DobrikaServerConfig &cfg,
       [](const HttpRequestPtr &req,
          std::function<void(const HttpResponsePtr &)> &&callback) {
         auto t0 = std::chrono::steady_clock::now();
-        auto json = req->getJsonObject();
-        if (!json) {
-          Json::Value v;
-          v["error"] = GetSearchStatus(DSearchStatus::DSInvalidJson);
-          auto resp = HttpResponse::newHttpJsonResponse(v);
+        const WireFormat in = RequestWireFormat(*req);
+        const WireFormat out = ResponseWireFormat(*req, in);
+        DSearchRequest sreq;
+        if (!ParseBody(*req, in, sreq, ParseSearchJson)) {
+          const std::string status = GetSearchStatus(
+              in == WireFormat::Protobuf ? DSearchStatus::DSInvalidProtobuf
+                                         : DSearchStatus::DSInvalidJson);
+          HttpResponsePtr resp;
+          if (out == WireFormat::Protobuf) {
+            DSearchResult res;
+            res.set_status(status);
+            resp = ProtobufResponse(res);
+          } else {
+            Json::Value v;
+            v["error"] = status;
+            resp = HttpResponse::newHttpJsonResponse(v);
+          }
           resp->setStatusCode(k400BadRequest);
           callback(resp);
-          auto t1 = std::chrono::steady_clock::now();
-          auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-          std::string peer = req->peerAddr().toIpPort();
-          std::string ua = req->getHeader("user-agent");
-          size_t req_size = req->getBody().size();
-          LOG_INFO << peer << " \"POST /search\" 400 "
-                   << ms << "ms req_bytes=" << req_size
-                   << " ua=\"" << ua << "\"";
+          g_request_latency.WithLabels({"/search", "", status}).ObserveSince(t0);
+          if (auto rec = BeginAccessLog(*g_access_log, req, 400, true, t0))
+            g_access_log->Submit(std::move(*rec));
           return;
         }
-        DSearchRequest sreq = MakeSearchFromJson(*json);
-        DSearchResult sres = g_layer->DoSearch(sreq);
-        auto resp = HttpResponse::newHttpJsonResponse(ToJson(sres));
-        resp->setStatusCode(k200OK);
-        callback(resp);
-        auto t1 = std::chrono::steady_clock::now();
-        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-        std::string peer = req->peerAddr().toIpPort();
-        std::string ua = req->getHeader("user-agent");
-        size_t req_size = req->getBody().size();
-        LOG_INFO << peer << " \"POST /search\" 200 "
-                 << ms << "ms req_bytes=" << req_size
-                 << " results=" << sres.task_id_size()
-                 << " ua=\"" << ua << "\"";
+        LatencyHistogramFamily &stages = g_layer->SearchStageLatency();
+        stages.WithLabels({"parse"}).ObserveSince(t0);
+        auto call = std::make_shared<SearchCall>();
+        call->req = req;
+        call->callback = std::move(callback);
+        call->sreq = std::move(sreq);
+        call->out = out;
+        call->t0 = t0;
+        call->deadline =
+            g_layer->DeadlineFor(call->sreq, RequestStart(*req, t0));
+        call->queued_at = std::chrono::steady_clock::now();
+        // A full queue is answered right here with a fast 503.
+        if (!g_search_pool->Post([call] { RunSearch(*call); })) {
+          DSearchResult sres;
+          sres.set_status(GetSearchStatus(DSearchStatus::DSOverloaded));
+          AnswerSearch(*call, sres);
+        }
       },
       {Post});
 
-  // Request logging + metrics increment after handlers produce a response
+  // ?q=[&limit=]: completions for a search box; see SuggestIndex.
+  if (g_layer->HasSuggest()) {
+    app().registerHandler(
+        "/suggest",
+        [](const HttpRequestPtr &req,
+           std::function<void(const HttpResponsePtr &)> &&callback) {
+          auto t0 = std::chrono::steady_clock::now();
+          const size_t limit = static_cast<size_t>(std::clamp<uint64_t>(
+              ParamU64(*req, "limit").value_or(10), 1, 50));
+          const Suggestions found =
+              g_layer->Suggest(req->getParameter("q"), limit);
+          DSSuggestResult res;
+          for (const Suggestion &s : found.words) {
+            DSSuggestion *out = res.add_words();
+            out->set_text(s.text);
+            out->set_weight(s.weight);
+          }
+          for (const Suggestion &s : found.names) {
+            DSSuggestion *out = res.add_names();
+            out->set_text(s.text);
+            out->set_weight(s.weight);
+          }
+          callback(ResponseWireFormat(*req, WireFormat::Json) ==
+                           WireFormat::Protobuf
+                       ? ProtobufResponse(res)
+                       : JsonResponse(ToJson(res)));
+          static const std::string ok = GetSearchStatus(DSearchStatus::DSOk);
+          g_request_latency.WithLabels({"/suggest", "", ok}).ObserveSince(t0);
+        },
+        {Get});
+  }
+
+  // Leader side of read replication; see ReplicationFollower.
+  if (g_layer->GetReplicationLog()) {
+    app().registerHandler(
+        "/replication/status",
+        [](const HttpRequestPtr &,
+           std::function<void(const HttpResponsePtr &)> &&callback) {
+          const ReplicationLog &log = *g_layer->GetReplicationLog();
+          Json::Value v;
+          // A string: JSON numbers lose precision above 2^53.
+          v["epoch"] = std::to_string(log.Epoch());
+          v["last_seq"] = static_cast<Json::UInt64>(log.LastSeq());
+          v["shards"] = static_cast<Json::UInt>(g_layer->ShardCount());
+          callback(HttpResponse::newHttpJsonResponse(v));
+        },
+        {Get});
+
+    // ?epoch=&after=[&max_kb=]: changesets after `after`, or 410 if the
+    // follower has to resync.
+    app().registerHandler(
+        "/replication/changes",
+        [](const HttpRequestPtr &req,
+           std::function<void(const HttpResponsePtr &)> &&callback) {
+          const ReplicationLog &log = *g_layer->GetReplicationLog();
+          const auto epoch = ParamU64(*req, "epoch");
+          const auto after = ParamU64(*req, "after");
+          if (!epoch || !after) {
+            callback(TextResponse(k400BadRequest, "epoch and after required"));
+            return;
+          }
+          const uint64_t max_kb =
+              std::clamp<uint64_t>(ParamU64(*req, "max_kb").value_or(1024),
+                                   1, 64 * 1024);
+          // Read first; the body may run ahead of it, never behind.
+          const uint64_t last_seq = log.LastSeq();
+          std::string body;
+          if (*epoch != log.Epoch() || !log.Read(*after, max_kb << 10, body)) {
+            callback(
+                TextResponse(k410Gone, "resync from /replication/snapshot"));
+            return;
+          }
+          auto resp = HttpResponse::newHttpResponse();
+          resp->setContentTypeCode(CT_APPLICATION_OCTET_STREAM);
+          resp->addHeader("X-Dobrika-Epoch", std::to_string(log.Epoch()));
+          resp->addHeader("X-Dobrika-Last-Seq", std::to_string(last_seq));
+          resp->setBody(std::move(body));
+          callback(resp);
+        },
+        {Get});
+
+    // ?shard=&after=[&limit=]: one page of the shard's documents by docid.
+    app().registerHandler(
+        "/replication/snapshot",
+        [](const HttpRequestPtr &req,
+           std::function<void(const HttpResponsePtr &)> &&callback) {
+          const auto shard = ParamU64(*req, "shard");
+          const auto after = ParamU64(*req, "after");
+          if (!shard || !after || *shard >= g_layer->ShardCount() ||
+              *after >= std::numeric_limits<Xapian::docid>::max()) {
+            callback(TextResponse(k400BadRequest,
+                                  "shard and after required"));
+            return;
+          }
+          const size_t limit = static_cast<size_t>(std::clamp<uint64_t>(
+              ParamU64(*req, "limit").value_or(1000), 1, 10000));
+          Changeset page;
+          bool done = false;
+          try {
+            done = g_layer->ReadSnapshotPage(
+                *shard, static_cast<Xapian::docid>(*after), limit, page);
+          } catch (const Xapian::Error &e) {
+            callback(TextResponse(k500InternalServerError,
+                                  e.get_description()));
+            return;
+          }
+          std::string body;
+          AppendChangeset(body, page);
+          auto resp = HttpResponse::newHttpResponse();
+          resp->setContentTypeCode(CT_APPLICATION_OCTET_STREAM);
+          resp->addHeader("X-Dobrika-Snapshot-Done", done ? "1" : "0");
+          resp->setBody(std::move(body));
+          callback(resp);
+        },
+        {Get});
+  }
+
+  // Metrics increment and the access log for endpoints that don't log
+  // themselves.
   app().registerPostHandlingAdvice([](const HttpRequestPtr &req,
                                       const HttpResponsePtr &resp) {
-    const std::string path = req->path();
+    const std::string &path = req->path();
     if (path == "/search") {
       g_search_requests_total.fetch_add(1, std::memory_order_relaxed);
     } else if (path == "/index") {
       g_index_requests_total.fetch_add(1, std::memory_order_relaxed);
     }
-    // Basic access log for other endpoints only (avoid duplicate logs for /search and /index)
-    if (path != "/search" && path != "/index") {
-      int code = static_cast<int>(resp->statusCode());
-      std::string peer = req->peerAddr().toIpPort();
-      LOG_INFO << peer << " \"" << req->methodString() << " " << path << "\" " << code;
-    }
-    if (g_log_requests.load(std::memory_order_relaxed)) {
-      const auto peer = req->peerAddr().toIpPort();
-      const auto method = req->methodString();
-      const auto status = static_cast<int>(resp->statusCode());
-      const auto &body = req->getBody();
-      const std::string ua = req->getHeader("user-agent");
-      std::ostringstream oss;
-      oss << "[REQ] " << peer << " \"" << method << " " << path << "\" "
-          << status << " req_bytes=" << body.size()
-          << " ua=\"" << ua << "\" body=\"" << TruncateForLog(body) << "\"";
-      const auto line = oss.str();
-      LOG_INFO << line;
-      std::cout << line << std::endl;
+    if (path != "/search" && path != "/index" && path != "/index/bulk" &&
+        path != "/delete") {
+      const int code = static_cast<int>(resp->statusCode());
+      // Replicas poll this several times a second; log only failures.
+      if (path == "/replication/changes" && code < 400)
+        return;
+      if (auto rec = BeginAccessLog(*g_access_log, req, code, code >= 400,
+                                    std::nullopt))
+        g_access_log->Submit(std::move(*rec));
     }
   });
 
+  const int max_body_mb =
+      cfg.http().max_body_mb() > 0 ? cfg.http().max_body_mb() : 256;
+  app().setClientMaxBodySize(static_cast<size_t>(max_body_mb) * 1024 * 1024);
+  app().setThreadNum(io_threads);
+  app().enableReusePort(cfg.http().reuse_port());
+  if (!cpus.empty()) {
+    app().registerBeginningAdvice([io_threads, cpus]() {
+      for (size_t i = 0; i < io_threads; ++i) {
+        if (trantor::EventLoop *loop = app().getIOLoop(i)) {
+          const int cpu = cpus[i % cpus.size()];
+          loop->queueInLoop([cpu]() { PinCurrentThread(cpu); });
+        }
+      }
+    });
+  }
   app().addListener(address, port);
   g_running.store(true);
   app().run();
   g_running.store(false);
+  // Finish what the workers hold; their answers go nowhere now.
+  g_search_pool.reset();
+  g_index_pool.reset();
+  g_bulk_pool.reset();
+  g_follower.reset();
+  g_access_log->Stop();
 }
 
 std::thread start_server_background(const DobrikaServerConfig &cfg,
@@ -8,10 +8,23 @@ class DobrikaServerConfig;
 // Endpoints:
 //  - GET  /healthz
 //  - POST /index  {task_name, task_desc, geo_data, task_id, task_type}
-//  - POST /search {user_query, geo_data, user_tags[], query_type}
+//  - POST /index/bulk  NDJSON or varint-delimited DSIndexTask stream
+//  - POST /search {user_query, geo_data, user_tags[], all_tags, exclude_tags[],
+//                  task_type, query_type, radius_km, seed, offset, limit,
+//                  cursor, timeout_ms}
+//                 -> {status, task_id[], estimated_total, next_cursor,
+//                     partial}
+//                 503 + Retry-After when overloaded or out of time
+//
+// /index and /search also take a binary DSIndexTask / DSearchRequest body
+// with Content-Type: application/x-protobuf and answer with DSIndexResult /
+// DSearchResult bytes. The response format follows Accept, or the request
+// format when Accept is absent or a wildcard.
 //
 // The server binds to the provided address and port and serves requests that
-// are handled by XapianLayer with the supplied configuration.
+// are handled by XapianLayer with the supplied configuration. Event loops
+// only parse and answer; searches run on a search worker pool and /index
+// and /delete on an index worker pool, each sized by the configuration.
 void start_server_blocking(const DobrikaServerConfig &cfg,
                            const std::string &address, uint16_t port);
 
@@ -0,0 +1,111 @@
+#include "server/worker_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cctype>
+#include <stdexcept>
+
+WorkerPool::WorkerPool(size_t threads, size_t max_queue,
+                       std::vector<int> cpus)
+    : max_queue(max_queue) {
+  stats.threads = threads;
+  for (size_t i = 0; i < threads; ++i) {
+    const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    this->threads.emplace_back([this, cpu]() { WorkerLoop(cpu); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+bool WorkerPool::Post(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    const size_t idle = stats.threads - stats.busy;
+    // The first `idle` queued tasks are about to be taken.
+    if (queue.size() >= idle && queue.size() - idle >= max_queue) {
+      ++stats.rejected_total;
+      return false;
+    }
+    queue.push_back(std::move(task));
+    stats.queued = queue.size();
+  }
+  cv.notify_one();
+  return true;
+}
+
+WorkerPoolStats WorkerPool::GetStats() const {
+  std::lock_guard<std::mutex> lk(mutex);
+  return stats;
+}
+
+void WorkerPool::WorkerLoop(int cpu) {
+  if (cpu >= 0)
+    PinCurrentThread(cpu);
+  std::unique_lock<std::mutex> lk(mutex);
+  while (true) {
+    cv.wait(lk, [this] { return stopping || !queue.empty(); });
+    if (queue.empty())
+      return;
+    std::function<void()> task = std::move(queue.front());
+    queue.pop_front();
+    stats.queued = queue.size();
+    ++stats.busy;
+    lk.unlock();
+    try {
+      task();
+    } catch (...) {
+    }
+    // Destroy captures (e.g. a response callback) outside the lock.
+    task = nullptr;
+    lk.lock();
+    --stats.busy;
+    ++stats.completed_total;
+  }
+}
+
+std::vector<int> ParseCpuList(const std::string &text) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  auto number = [&]() {
+    const size_t start = pos;
+    while (pos < text.size() && pos - start < 5 &&
+           std::isdigit(static_cast<unsigned char>(text[pos])))
+      ++pos;
+    if (pos == start)
+      throw std::invalid_argument("bad CPU list: " + text);
+    return std::stoi(text.substr(start, pos - start));
+  };
+  while (pos < text.size()) {
+    const int first = number();
+    int last = first;
+    if (pos < text.size() && text[pos] == '-') {
+      ++pos;
+      last = number();
+    }
+    if (last < first)
+      throw std::invalid_argument("bad CPU list: " + text);
+    for (int cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(cpu);
+    if (pos < text.size() && text[pos++] != ',')
+      throw std::invalid_argument("bad CPU list: " + text);
+  }
+  return cpus;
+}
+
+bool PinCurrentThread(int cpu) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct WorkerPoolStats {
+  size_t threads = 0;
+  // Threads running a task.
+  size_t busy = 0;
+  // Tasks waiting for a thread.
+  size_t queued = 0;
+  uint64_t completed_total = 0;
+  // Refused by Post() because the queue was full.
+  uint64_t rejected_total = 0;
+};
+
+// Fixed threads running posted tasks in arrival order, so Xapian work (a
+// group commit, a geo sort over the whole index) never runs on an HTTP
+// event loop and stalls the other connections of that loop.
+class WorkerPool {
+public:
+  static constexpr size_t kUnboundedQueue = std::numeric_limits<size_t>::max();
+
+  // At most max_queue tasks wait beyond the idle threads (0: a task is
+  // only taken if a thread is idle). Thread i is pinned to
+  // cpus[i % cpus.size()] unless cpus is empty.
+  WorkerPool(size_t threads, size_t max_queue, std::vector<int> cpus = {});
+  // Runs the tasks already queued, then joins.
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // False, without running the task, when the queue is full. Tasks
+  // report their own errors; an exception escaping one is dropped.
+  bool Post(std::function<void()> task);
+
+  WorkerPoolStats GetStats() const;
+
+private:
+  void WorkerLoop(int cpu);
+
+  const size_t max_queue;
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> queue;
+  bool stopping = false;
+  WorkerPoolStats stats;
+  std::vector<std::thread> threads;
+};
+
+// CPUs named by a list such as "0-3,8,10-11"; throws std::invalid_argument
+// on anything else. Empty for an empty string.
+std::vector<int> ParseCpuList(const std::string &text);
+
+// Binds the calling thread to one CPU; false if the OS refused.
+bool PinCurrentThread(int cpu);
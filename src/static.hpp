@@ -48,7 +48,13 @@ enum DSearchStatus {
   DSHealthOk,
   DSIndexOk,
   DSIndexFall,
-  DSInvalidJson
+  DSInvalidJson,
+  DSInvalidPaging,
+  DSInvalidProtobuf,
+  DSIndexReadOnly,
+  DSDeleteOk,
+  DSOverloaded,
+  DSDeadlineExceeded
 };
 inline const std::map<DSearchStatus, std::string> kStatusToString = {
     {DSearchStatus::DSOk, "SearchOk"},
@@ -58,6 +64,12 @@ inline const std::map<DSearchStatus, std::string> kStatusToString = {
     {DSearchStatus::DSIndexOk, "SearchIndexOk"},
     {DSearchStatus::DSIndexFall, "SearchIndexFall"},
     {DSearchStatus::DSInvalidJson, "SearchInvalidJson"},
+    {DSearchStatus::DSInvalidPaging, "SearchInvalidPaging"},
+    {DSearchStatus::DSInvalidProtobuf, "SearchInvalidProtobuf"},
+    {DSearchStatus::DSIndexReadOnly, "SearchIndexReadOnly"},
+    {DSearchStatus::DSDeleteOk, "SearchDeleteOk"},
+    {DSearchStatus::DSOverloaded, "SearchOverloaded"},
+    {DSearchStatus::DSDeadlineExceeded, "SearchDeadlineExceeded"},
 };
 
 inline std::string GetSearchStatus(DSearchStatus status) {
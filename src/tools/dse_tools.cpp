@@ -18,23 +18,6 @@ std::string GetTimeNow() {
   return ss.str();
 }
 
-bool CopyDirRecursive(const fs::path &src, const fs::path &dst) {
-  std::error_code ec;
-  if (!fs::exists(src, ec))
-    return false;
-  // Ensure parent for destination exists
-  fs::create_directories(dst.parent_path(), ec);
-  // Replace the destination entirely to avoid stale files
-  ec.clear();
-  fs::remove_all(dst, ec);
-  ec.clear();
-  fs::copy(src, dst,
-           fs::copy_options::recursive | fs::copy_options::copy_symlinks |
-               fs::copy_options::overwrite_existing,
-           ec);
-  return !ec;
-}
-
 std::optional<std::pair<double, double>> ParseGeo(const std::string &geo) {
   if (geo.empty())
     return std::nullopt;
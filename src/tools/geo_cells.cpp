@@ -0,0 +1,154 @@
+#include "tools/geo_cells.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+constexpr double kPi = 3.14159265358979323846;
+constexpr double kDegToRad = kPi / 180.0;
+// Rings tried on every level but the coarsest before switching levels. At
+// ring 4 the cover is 9 cells wide, still inside ring 1 of the next level
+// (10x larger cells).
+constexpr int kRingsPerLevel = 4;
+
+long Columns(size_t level) {
+  return std::lround(360.0 / kGeoCellSizesDeg[level]);
+}
+long Rows(size_t level) { return std::lround(180.0 / kGeoCellSizesDeg[level]); }
+
+long CellX(size_t level, double lon) {
+  const long x =
+      static_cast<long>(std::floor((lon + 180.0) / kGeoCellSizesDeg[level]));
+  return std::clamp(x, 0L, Columns(level) - 1);
+}
+
+long CellY(size_t level, double lat) {
+  const long y =
+      static_cast<long>(std::floor((lat + 90.0) / kGeoCellSizesDeg[level]));
+  return std::clamp(y, 0L, Rows(level) - 1);
+}
+
+std::string CellTerm(size_t level, long x, long y) {
+  std::string term = kGeoCellPrefix;
+  term += std::to_string(level);
+  term += ':';
+  term += std::to_string(x);
+  term += ':';
+  term += std::to_string(y);
+  return term;
+}
+} // namespace
+
+std::vector<std::string> GeoCellTermsForPoint(double lat, double lon) {
+  std::vector<std::string> out;
+  out.reserve(kGeoCellLevels);
+  for (size_t level = 0; level < kGeoCellLevels; ++level) {
+    out.push_back(CellTerm(level, CellX(level, lon), CellY(level, lat)));
+  }
+  return out;
+}
+
+double GreatCircleKm(double lat1, double lon1, double lat2, double lon2) {
+  const double dlat = (lat2 - lat1) * kDegToRad;
+  const double dlon = (lon2 - lon1) * kDegToRad;
+  const double a = std::sin(dlat / 2) * std::sin(dlat / 2) +
+                   std::cos(lat1 * kDegToRad) * std::cos(lat2 * kDegToRad) *
+                       std::sin(dlon / 2) * std::sin(dlon / 2);
+  return 2 * kEarthRadiusKm * std::asin(std::min(1.0, std::sqrt(a)));
+}
+
+GeoCellCover::GeoCellCover(double lat, double lon)
+    : lat(std::clamp(lat, -90.0, 90.0)), lon(std::clamp(lon, -180.0, 180.0)) {
+  cx = CellX(level, this->lon);
+  cy = CellY(level, this->lat);
+  ring = 0;
+  AddRing(0);
+}
+
+int GeoCellCover::MaxRing() const {
+  if (level + 1 < kGeoCellLevels)
+    return kRingsPerLevel;
+  // The coarsest level keeps growing until it spans the globe.
+  return static_cast<int>(std::max(Columns(level), Rows(level)) / 2 + 1);
+}
+
+bool GeoCellCover::Exhausted() const {
+  return level + 1 == kGeoCellLevels && ring >= MaxRing();
+}
+
+bool GeoCellCover::Grow() {
+  if (Exhausted())
+    return false;
+  if (ring < MaxRing()) {
+    AddRing(++ring);
+    return true;
+  }
+  ++level;
+  terms.clear();
+  seen.clear();
+  cx = CellX(level, lon);
+  cy = CellY(level, lat);
+  AddRing(0);
+  AddRing(1);
+  ring = 1;
+  return true;
+}
+
+void GeoCellCover::AddRing(int r) {
+  const long cols = Columns(level);
+  const long rows = Rows(level);
+  for (long dy = -r; dy <= r; ++dy) {
+    const long y = cy + dy;
+    if (y < 0 || y >= rows)
+      continue;
+    const bool edge_row = dy == -r || dy == r;
+    for (long dx = -r; dx <= r; dx += (edge_row || r == 0) ? 1 : 2L * r) {
+      const long x = ((cx + dx) % cols + cols) % cols;
+      // Wide rings wrap around in longitude; skip cells already covered.
+      if (seen.insert(static_cast<long long>(x) * rows + y).second)
+        terms.push_back(CellTerm(level, x, y));
+    }
+  }
+}
+
+double GeoCellCover::BoundKm() const {
+  if (Exhausted())
+    return std::numeric_limits<double>::infinity();
+  const double c = kGeoCellSizesDeg[level];
+  const double south = (cy - ring) * c - 90.0;
+  const double north = (cy + ring + 1) * c - 90.0;
+  const double west = (cx - ring) * c - 180.0;
+  const double east = (cx + ring + 1) * c - 180.0;
+  const double inf = std::numeric_limits<double>::infinity();
+
+  // Leaving the box across a parallel: d >= R * dlat.
+  const double d_south = south <= -90.0 ? inf : (lat - south) * kDegToRad;
+  const double d_north = north >= 90.0 ? inf : (north - lat) * kDegToRad;
+  double bound = std::min(d_south, d_north) * kEarthRadiusKm;
+
+  // Leaving across a meridian while staying inside the latitude band:
+  // hav(d) = hav(lat2 - lat) + cos(lat) cos(lat2) hav(dlon), minimised over
+  // lat2 in the band (sampled; the band is at most a few cells high).
+  if (2L * ring + 1 < Columns(level)) {
+    const double dlon = std::min(lon - west, east - lon) * kDegToRad;
+    const double hav_dlon = std::sin(dlon / 2) * std::sin(dlon / 2);
+    const double lo = std::max(-90.0, south);
+    const double hi = std::min(90.0, north);
+    constexpr int kSteps = 32;
+    double min_hav = 1.0;
+    for (int i = 0; i <= kSteps; ++i) {
+      const double lat2 = lo + (hi - lo) * i / kSteps;
+      const double dlat = (lat2 - lat) * kDegToRad;
+      const double hav = std::sin(dlat / 2) * std::sin(dlat / 2) +
+                         std::cos(lat * kDegToRad) * std::cos(lat2 * kDegToRad) *
+                             hav_dlon;
+      min_hav = std::min(min_hav, hav);
+    }
+    // Shave a little off to stay a lower bound between the samples.
+    const double d_lon =
+        0.98 * 2 * kEarthRadiusKm * std::asin(std::sqrt(std::max(0.0, min_hav)));
+    bound = std::min(bound, d_lon);
+  }
+  return bound;
+}
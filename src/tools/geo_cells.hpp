@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Spatial cell terms for the geo index. The globe is cut into uniform
+// lat/lon grids at several resolutions; every document gets one boolean
+// term per level ("GEO<level>:<x>:<y>"), so a geo query can match only the
+// cells around the user instead of every document.
+inline constexpr double kGeoCellSizesDeg[] = {0.01, 0.1, 1.0, 10.0};
+inline constexpr size_t kGeoCellLevels =
+    sizeof(kGeoCellSizesDeg) / sizeof(kGeoCellSizesDeg[0]);
+inline const std::string kGeoCellPrefix = "GEO";
+
+// Same radius as Xapian::GreatCircleMetric's default, in km.
+inline constexpr double kEarthRadiusKm = 6372.7976;
+
+std::vector<std::string> GeoCellTermsForPoint(double lat, double lon);
+
+// Great-circle distance in km.
+double GreatCircleKm(double lat1, double lon1, double lat2, double lon2);
+
+// Square rings of cells grown outward from a centre point, switching to the
+// next coarser level once a level's ring budget is used up.
+class GeoCellCover {
+public:
+  GeoCellCover(double lat, double lon);
+
+  // Adds the next ring (or moves to a coarser level). Returns false once the
+  // cover already spans the whole globe.
+  bool Grow();
+  bool Exhausted() const;
+
+  // Terms of all cells in the cover at the current level.
+  const std::vector<std::string> &Terms() const { return terms; }
+
+  // Lower bound on the distance from the centre to any point outside the
+  // cover, in km; infinity once exhausted.
+  double BoundKm() const;
+
+private:
+  void AddRing(int r);
+  int MaxRing() const;
+
+  double lat;
+  double lon;
+  size_t level = 0;
+  int ring = -1;
+  long cx = 0;
+  long cy = 0;
+  std::vector<std::string> terms;
+  std::unordered_set<long long> seen;
+};
@@ -0,0 +1,123 @@
+#include "tools/hdr_histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+// Position of the highest set bit plus one; value > 0.
+int BitLength(uint64_t value) { return 64 - __builtin_clzll(value); }
+} // namespace
+
+HdrHistogram::HdrHistogram(int64_t highest, int digits) : highest(highest) {
+  if (highest < 2 || digits < 1 || digits > 5)
+    throw std::invalid_argument("HdrHistogram: bad range or precision");
+  // Enough sub-buckets that one unit is resolved up to 2 * 10^digits.
+  const auto largest_single_unit =
+      static_cast<int64_t>(2 * std::pow(10.0, digits));
+  const int sub_bucket_count_magnitude =
+      static_cast<int>(std::ceil(std::log2(largest_single_unit)));
+  sub_bucket_half_count_magnitude = sub_bucket_count_magnitude - 1;
+  const int64_t sub_bucket_count = int64_t{1} << sub_bucket_count_magnitude;
+  sub_bucket_half_count = sub_bucket_count / 2;
+  sub_bucket_mask = sub_bucket_count - 1;
+
+  // Each bucket doubles the range covered by the previous one.
+  int bucket_count = 1;
+  for (int64_t untrackable = sub_bucket_count; untrackable <= highest;
+       ++bucket_count) {
+    if (untrackable > std::numeric_limits<int64_t>::max() / 2) {
+      ++bucket_count;
+      break;
+    }
+    untrackable <<= 1;
+  }
+  counts.assign(static_cast<size_t>(bucket_count + 1) *
+                    static_cast<size_t>(sub_bucket_half_count),
+                0);
+}
+
+size_t HdrHistogram::IndexOf(int64_t value) const {
+  const int bucket =
+      BitLength(static_cast<uint64_t>(value | sub_bucket_mask)) -
+      (sub_bucket_half_count_magnitude + 1);
+  const int64_t sub_bucket = value >> bucket;
+  return static_cast<size_t>(
+      ((static_cast<int64_t>(bucket) + 1) << sub_bucket_half_count_magnitude) +
+      (sub_bucket - sub_bucket_half_count));
+}
+
+void HdrHistogram::BucketOf(size_t index, int &bucket,
+                            int64_t &sub_bucket) const {
+  const auto i = static_cast<int64_t>(index);
+  bucket = static_cast<int>(i >> sub_bucket_half_count_magnitude) - 1;
+  sub_bucket = (i & (sub_bucket_half_count - 1)) + sub_bucket_half_count;
+  if (bucket < 0) {
+    sub_bucket -= sub_bucket_half_count;
+    bucket = 0;
+  }
+}
+
+int64_t HdrHistogram::HighestEquivalent(size_t index) const {
+  int bucket = 0;
+  int64_t sub_bucket = 0;
+  BucketOf(index, bucket, sub_bucket);
+  return ((sub_bucket + 1) << bucket) - 1;
+}
+
+int64_t HdrHistogram::MedianEquivalent(size_t index) const {
+  int bucket = 0;
+  int64_t sub_bucket = 0;
+  BucketOf(index, bucket, sub_bucket);
+  return (sub_bucket << bucket) + ((int64_t{1} << bucket) >> 1);
+}
+
+void HdrHistogram::Record(int64_t value, uint64_t count) {
+  counts[IndexOf(std::clamp<int64_t>(value, 1, highest))] += count;
+  total += count;
+}
+
+void HdrHistogram::Add(const HdrHistogram &other) {
+  if (other.counts.size() != counts.size() ||
+      other.sub_bucket_mask != sub_bucket_mask)
+    throw std::invalid_argument("HdrHistogram: layouts differ");
+  for (size_t i = 0; i < counts.size(); ++i)
+    counts[i] += other.counts[i];
+  total += other.total;
+}
+
+int64_t HdrHistogram::ValueAtPercentile(double percentile) const {
+  if (total == 0)
+    return 0;
+  const double share = std::clamp(percentile, 0.0, 100.0) / 100;
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(share * static_cast<double>(total))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen >= rank)
+      return std::min(HighestEquivalent(i), highest);
+  }
+  return highest;
+}
+
+int64_t HdrHistogram::Max() const {
+  for (size_t i = counts.size(); i-- > 0;) {
+    if (counts[i] > 0)
+      return std::min(HighestEquivalent(i), highest);
+  }
+  return 0;
+}
+
+double HdrHistogram::Mean() const {
+  if (total == 0)
+    return 0;
+  double sum = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] > 0)
+      sum += static_cast<double>(counts[i]) *
+             static_cast<double>(MedianEquivalent(i));
+  }
+  return sum / static_cast<double>(total);
+}
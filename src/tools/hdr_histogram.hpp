@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// High Dynamic Range histogram (the HdrHistogram layout): values from 1 to
+// `highest` are kept with `digits` significant decimal digits, so
+// percentiles are exact to that precision at any magnitude. Recording is
+// an index computation and an increment; memory is fixed at construction
+// (~200 KB for 3 digits up to an hour in microseconds).
+//
+// Not thread-safe; merge per-thread histograms with Add().
+class HdrHistogram {
+public:
+  explicit HdrHistogram(int64_t highest, int digits = 3);
+
+  // Values below 1 count as 1, above highest as highest.
+  void Record(int64_t value, uint64_t count = 1);
+  // Both must have the same highest and digits.
+  void Add(const HdrHistogram &other);
+
+  uint64_t Count() const { return total; }
+  // Smallest value v such that percentile% of the recorded values are <= v
+  // (to the histogram's precision); 0 when empty.
+  int64_t ValueAtPercentile(double percentile) const;
+  int64_t Max() const;
+  double Mean() const;
+
+private:
+  size_t IndexOf(int64_t value) const;
+  // Largest value that shares the bucket of counts[index].
+  int64_t HighestEquivalent(size_t index) const;
+  // Midpoint of that bucket.
+  int64_t MedianEquivalent(size_t index) const;
+  void BucketOf(size_t index, int &bucket, int64_t &sub_bucket) const;
+
+  const int64_t highest;
+  int sub_bucket_half_count_magnitude = 0;
+  int64_t sub_bucket_half_count = 0;
+  int64_t sub_bucket_mask = 0;
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+};
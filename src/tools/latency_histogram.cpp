@@ -0,0 +1,97 @@
+#include "tools/latency_histogram.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+constexpr std::array<uint64_t, kLatencyBucketCount - 1> BucketBoundsNs() {
+  std::array<uint64_t, kLatencyBucketCount - 1> out{};
+  for (size_t i = 0; i < out.size(); ++i)
+    out[i] = static_cast<uint64_t>(kLatencyBucketsSec[i] * 1e9 + 0.5);
+  return out;
+}
+constexpr auto kBoundsNs = BucketBoundsNs();
+
+std::atomic<size_t> g_next_thread_slot{0};
+std::atomic<uint64_t> g_next_family_id{1};
+
+size_t ThreadSlot() {
+  thread_local const size_t slot =
+      g_next_thread_slot.fetch_add(1, std::memory_order_relaxed);
+  return slot;
+}
+
+std::string JoinLabels(std::initializer_list<std::string_view> values) {
+  std::string key;
+  for (std::string_view v : values) {
+    key.append(v.data(), v.size());
+    key += '\x1f';
+  }
+  return key;
+}
+} // namespace
+
+LatencyHistogram::LatencyHistogram() : shards(new Shard[kShards]) {}
+
+void LatencyHistogram::Observe(std::chrono::nanoseconds elapsed) {
+  const uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(0, elapsed.count()));
+  const size_t bucket = static_cast<size_t>(
+      std::lower_bound(kBoundsNs.begin(), kBoundsNs.end(), ns) -
+      kBoundsNs.begin());
+  Shard &shard = shards[ThreadSlot() % kShards];
+  shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+HistogramSnapshot LatencyHistogram::Snapshot() const {
+  HistogramSnapshot snap;
+  uint64_t sum_ns = 0;
+  for (size_t s = 0; s < kShards; ++s) {
+    for (size_t b = 0; b < kLatencyBucketCount; ++b)
+      snap.counts[b] += shards[s].counts[b].load(std::memory_order_relaxed);
+    sum_ns += shards[s].sum_ns.load(std::memory_order_relaxed);
+  }
+  // Derive the count from the buckets so _count always matches +Inf.
+  for (uint64_t c : snap.counts)
+    snap.count += c;
+  snap.sum_sec = static_cast<double>(sum_ns) / 1e9;
+  return snap;
+}
+
+LatencyHistogramFamily::LatencyHistogramFamily(
+    std::vector<std::string> label_names)
+    : id(g_next_family_id.fetch_add(1, std::memory_order_relaxed)),
+      label_names(std::move(label_names)) {}
+
+LatencyHistogram &
+LatencyHistogramFamily::WithLabels(std::initializer_list<std::string_view> values) {
+  // Family ids are never reused, so a stale entry of a destroyed family is
+  // never looked up again.
+  thread_local std::unordered_map<
+      uint64_t, std::unordered_map<std::string, LatencyHistogram *>>
+      cache;
+  std::string key = JoinLabels(values);
+  auto &local = cache[id];
+  if (auto it = local.find(key); it != local.end())
+    return *it->second;
+
+  std::lock_guard<std::mutex> lk(mutex);
+  auto &entry = series[key];
+  if (!entry.second) {
+    entry.first.assign(values.begin(), values.end());
+    entry.first.resize(label_names.size());
+    entry.second = std::make_unique<LatencyHistogram>();
+  }
+  local.emplace(std::move(key), entry.second.get());
+  return *entry.second;
+}
+
+std::vector<std::pair<std::vector<std::string>, HistogramSnapshot>>
+LatencyHistogramFamily::Collect() const {
+  std::vector<std::pair<std::vector<std::string>, HistogramSnapshot>> out;
+  std::lock_guard<std::mutex> lk(mutex);
+  out.reserve(series.size());
+  for (const auto &[key, entry] : series)
+    out.emplace_back(entry.first, entry.second->Snapshot());
+  return out;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Upper bucket bounds in seconds (+Inf is implicit), 50us to 10s.
+inline constexpr double kLatencyBucketsSec[] = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05,    0.1,    0.25,    0.5,    1.0,   2.5,    5.0,   10.0};
+inline constexpr size_t kLatencyBucketCount =
+    sizeof(kLatencyBucketsSec) / sizeof(kLatencyBucketsSec[0]) + 1;
+
+// Merged view of a histogram. counts[i] is the number of observations in
+// bucket i (not cumulative); the last bucket is +Inf.
+struct HistogramSnapshot {
+  std::array<uint64_t, kLatencyBucketCount> counts{};
+  uint64_t count = 0;
+  double sum_sec = 0;
+
+  void Merge(const HistogramSnapshot &other) {
+    for (size_t i = 0; i < kLatencyBucketCount; ++i)
+      counts[i] += other.counts[i];
+    count += other.count;
+    sum_sec += other.sum_sec;
+  }
+};
+
+// Latency histogram for hot paths. Every thread records into its own shard
+// (picked once per thread), so Observe() is a couple of uncontended relaxed
+// increments; shards are only merged by Snapshot() at scrape time.
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  void Observe(std::chrono::nanoseconds elapsed);
+  void ObserveSince(std::chrono::steady_clock::time_point start) {
+    Observe(std::chrono::steady_clock::now() - start);
+  }
+
+  HistogramSnapshot Snapshot() const;
+
+private:
+  // More threads than shards just share them; increments stay atomic.
+  static constexpr size_t kShards = 16;
+
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, kLatencyBucketCount> counts{};
+    std::atomic<uint64_t> sum_ns{0};
+  };
+
+  std::unique_ptr<Shard[]> shards;
+};
+
+// Histograms of one metric split by label values, e.g.
+// {endpoint, query_type, status}. Label sets are created on first use and
+// live as long as the family; lookups hit a per-thread cache and only take
+// the family lock the first time a thread sees a label set.
+class LatencyHistogramFamily {
+public:
+  explicit LatencyHistogramFamily(std::vector<std::string> label_names);
+
+  LatencyHistogramFamily(const LatencyHistogramFamily &) = delete;
+  LatencyHistogramFamily &operator=(const LatencyHistogramFamily &) = delete;
+
+  // Values in label_names order. The reference stays valid for the
+  // family's lifetime.
+  LatencyHistogram &WithLabels(std::initializer_list<std::string_view> values);
+
+  const std::vector<std::string> &LabelNames() const { return label_names; }
+  // (label values, snapshot) for every label set seen so far.
+  std::vector<std::pair<std::vector<std::string>, HistogramSnapshot>>
+  Collect() const;
+
+private:
+  const uint64_t id;
+  const std::vector<std::string> label_names;
+  mutable std::mutex mutex;
+  // Keyed by the joined label values.
+  std::map<std::string, std::pair<std::vector<std::string>,
+                                  std::unique_ptr<LatencyHistogram>>>
+      series;
+};
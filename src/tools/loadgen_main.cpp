@@ -0,0 +1,483 @@
+#include "tools/hdr_histogram.hpp"
+
+#include <drogon/drogon.h>
+#include <json/json.h>
+#include <trantor/net/EventLoopThreadPool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Open-loop replay of captured requests against a running server:
+//
+//   dobrika_loadgen [options] <capture.jsonl>
+//
+// Requests are started on a fixed schedule at --rps, whether or not
+// earlier ones have finished, over --connections keep-alive connections.
+// A request waits in a backlog until a connection is free, and its
+// latency is measured from the time it was scheduled, so a stalled server
+// shows up in the percentiles instead of silently lowering the offered
+// load (coordinated omission). "service" latency is measured from the
+// moment the request was written, as closed-loop tools report it.
+//
+// Each capture line is a JSON object, either a request body (a task_id
+// with task fields goes to /index, anything else to /search) or
+//   {"path": "/...", "body": {...} or "...", "method": "GET", "params": {}}
+// for any endpoint. /index, /index/bulk and /delete are
+// writes, everything else reads; --index-ratio replaces the capture's own
+// mix with that share of writes (each kind replayed in capture order).
+//
+// Results are reported per endpoint and /search query_type: HDR
+// percentiles (3 significant digits), status counts and error rate; with
+// --json=<file> also as JSON.
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Latencies are recorded in microseconds, up to an hour.
+constexpr int64_t kHighestUs = 3600LL * 1000 * 1000;
+// Status key for requests that got no HTTP response.
+constexpr int kTransportError = 0;
+// Status key for requests still queued when the run ended.
+constexpr int kUnsent = -1;
+
+struct Options {
+  std::string url = "http://127.0.0.1:8088";
+  double rps = 100;
+  double duration_sec = 30;
+  size_t connections = 16;
+  size_t threads = 2;
+  double index_ratio = -1; // negative: keep the capture's mix
+  double timeout_sec = 10;
+  bool poisson = false;
+  uint64_t seed = 1;
+  std::string json_out;
+  std::string capture;
+};
+
+struct CapturedRequest {
+  drogon::HttpMethod method = drogon::Post;
+  std::string path;
+  std::string body;
+  std::vector<std::pair<std::string, std::string>> params;
+  std::string query_type; // /search only
+  bool write = false;
+};
+
+struct Series {
+  HdrHistogram latency{kHighestUs};
+  HdrHistogram service{kHighestUs};
+  std::map<int, uint64_t> statuses;
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+};
+
+int Usage() {
+  std::cerr
+      << "usage: dobrika_loadgen [--url=http://127.0.0.1:8088] [--rps=100]\n"
+         "           [--duration=30] [--connections=16] [--threads=2]\n"
+         "           [--index-ratio=<0..1>] [--timeout=10] [--poisson]\n"
+         "           [--seed=1] [--json=<file>] <capture.jsonl>\n";
+  return 2;
+}
+
+bool ParseOptions(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      if (!opt.capture.empty())
+        return false;
+      opt.capture = arg;
+      continue;
+    }
+    const size_t eq = arg.find('=');
+    const std::string key = arg.substr(2, eq - 2);
+    const std::string value =
+        eq == std::string::npos ? "" : arg.substr(eq + 1);
+    try {
+      if (key == "url")
+        opt.url = value;
+      else if (key == "rps")
+        opt.rps = std::stod(value);
+      else if (key == "duration")
+        opt.duration_sec = std::stod(value);
+      else if (key == "connections")
+        opt.connections = std::stoul(value);
+      else if (key == "threads")
+        opt.threads = std::stoul(value);
+      else if (key == "index-ratio")
+        opt.index_ratio = std::stod(value);
+      else if (key == "timeout")
+        opt.timeout_sec = std::stod(value);
+      else if (key == "poisson")
+        opt.poisson = true;
+      else if (key == "seed")
+        opt.seed = std::stoull(value);
+      else if (key == "json")
+        opt.json_out = value;
+      else
+        return false;
+    } catch (...) {
+      return false;
+    }
+  }
+  return !opt.capture.empty() && opt.rps > 0 && opt.duration_sec > 0 &&
+         opt.connections > 0 && opt.threads > 0 && opt.index_ratio <= 1;
+}
+
+std::string Compact(const Json::Value &value) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+bool ParseLine(const std::string &line, CapturedRequest &out) {
+  Json::Value v;
+  Json::CharReaderBuilder builder;
+  std::string errors;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  if (!reader->parse(line.data(), line.data() + line.size(), &v, &errors) ||
+      !v.isObject())
+    return false;
+  const Json::Value *body = &v;
+  if (v.isMember("path")) {
+    out.path = v["path"].asString();
+    if (v.get("method", "POST").asString() == "GET")
+      out.method = drogon::Get;
+    body = &v["body"];
+    for (const auto &key : v["params"].getMemberNames())
+      out.params.emplace_back(key, v["params"][key].asString());
+  } else if (v.isMember("task_id") &&
+             (v.isMember("task_name") || v.isMember("task_desc") ||
+              v.isMember("geo_data"))) {
+    out.path = "/index";
+  } else {
+    out.path = "/search";
+  }
+  if (body->isString())
+    out.body = body->asString();
+  else if (!body->isNull())
+    out.body = Compact(*body);
+  if (out.path == "/search")
+    out.query_type = body->isObject() && (*body)["query_type"].isString()
+                         ? (*body)["query_type"].asString()
+                         : "unknown";
+  out.write = out.path == "/index" || out.path == "/index/bulk" ||
+              out.path == "/delete";
+  return !out.path.empty();
+}
+
+// Picks the request for each slot of the schedule.
+class Mix {
+public:
+  Mix(std::vector<CapturedRequest> requests, double index_ratio,
+      uint64_t seed)
+      : all(std::move(requests)), index_ratio(index_ratio), rng(seed) {
+    for (const auto &r : all)
+      (r.write ? writes : reads).push_back(&r);
+  }
+
+  const CapturedRequest &Next() {
+    if (index_ratio < 0)
+      return all[next_any++ % all.size()];
+    const bool write = writes.empty()  ? false
+                       : reads.empty() ? true
+                                       : coin(rng) < index_ratio;
+    return write ? *writes[next_write++ % writes.size()]
+                 : *reads[next_read++ % reads.size()];
+  }
+
+private:
+  const std::vector<CapturedRequest> all;
+  const double index_ratio;
+  std::vector<const CapturedRequest *> reads;
+  std::vector<const CapturedRequest *> writes;
+  std::mt19937_64 rng;
+  std::uniform_real_distribution<double> coin{0, 1};
+  size_t next_any = 0;
+  size_t next_read = 0;
+  size_t next_write = 0;
+};
+
+class Dispatcher {
+public:
+  Dispatcher(const Options &opt, trantor::EventLoopThreadPool &loops)
+      : timeout_sec(opt.timeout_sec) {
+    for (size_t i = 0; i < opt.connections; ++i) {
+      clients.push_back(
+          drogon::HttpClient::newHttpClient(opt.url, loops.getNextLoop()));
+      idle.push_back(i);
+    }
+  }
+
+  // Sends now on an idle connection or queues until one is free.
+  void Submit(const CapturedRequest &request, Clock::time_point scheduled) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ++in_flight;
+    if (idle.empty()) {
+      backlog.push_back({&request, scheduled});
+      max_backlog = std::max(max_backlog, backlog.size());
+      return;
+    }
+    const size_t conn = idle.back();
+    idle.pop_back();
+    lock.unlock();
+    Send(conn, {&request, scheduled});
+  }
+
+  // Waits for the backlog to drain until deadline, then records what is
+  // left as unsent and waits for requests on the wire (bounded by the
+  // request timeout).
+  void Finish(Clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait_until(lock, deadline, [&] { return backlog.empty(); });
+    const auto now = Clock::now();
+    for (const Pending &p : backlog) {
+      Series &s = SeriesOf(*p.request);
+      ++s.requests;
+      ++s.errors;
+      ++s.statuses[kUnsent];
+      // A lower bound: it had not even been sent.
+      s.latency.Record(Micros(now - p.scheduled));
+    }
+    in_flight -= backlog.size();
+    backlog.clear();
+    changed.wait(lock, [&] { return in_flight == 0; });
+  }
+
+  std::map<std::pair<std::string, std::string>, Series> TakeSeries() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::move(series);
+  }
+  size_t MaxBacklog() const { return max_backlog; }
+
+private:
+  struct Pending {
+    const CapturedRequest *request;
+    Clock::time_point scheduled;
+  };
+
+  static int64_t Micros(Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  }
+
+  Series &SeriesOf(const CapturedRequest &r) {
+    return series[{r.path, r.query_type}];
+  }
+
+  void Send(size_t conn, Pending p) {
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setMethod(p.request->method);
+    req->setPath(p.request->path);
+    for (const auto &[key, value] : p.request->params)
+      req->setParameter(key, value);
+    if (!p.request->body.empty()) {
+      req->setBody(p.request->body);
+      if (p.request->path == "/index/bulk")
+        req->addHeader("Content-Type", "application/x-ndjson");
+      else
+        req->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+    }
+    const auto sent = Clock::now();
+    clients[conn]->sendRequest(
+        req,
+        [this, conn, p, sent](drogon::ReqResult result,
+                              const drogon::HttpResponsePtr &resp) {
+          OnDone(conn, p, sent, result, resp);
+        },
+        timeout_sec);
+  }
+
+  void OnDone(size_t conn, const Pending &p, Clock::time_point sent,
+              drogon::ReqResult result, const drogon::HttpResponsePtr &resp) {
+    const auto now = Clock::now();
+    const int status = result == drogon::ReqResult::Ok && resp
+                           ? static_cast<int>(resp->statusCode())
+                           : kTransportError;
+    std::unique_lock<std::mutex> lock(mutex);
+    Series &s = SeriesOf(*p.request);
+    ++s.requests;
+    ++s.statuses[status];
+    if (status == kTransportError || status >= 400)
+      ++s.errors;
+    s.latency.Record(Micros(now - p.scheduled));
+    s.service.Record(Micros(now - sent));
+    --in_flight;
+    // Under the lock: Finish() may return, and the dispatcher go away, as
+    // soon as it is released.
+    changed.notify_all();
+    if (backlog.empty()) {
+      idle.push_back(conn);
+      return;
+    }
+    const Pending next = backlog.front();
+    backlog.pop_front();
+    lock.unlock();
+    Send(conn, next);
+  }
+
+  const double timeout_sec;
+  std::vector<drogon::HttpClientPtr> clients;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<size_t> idle;
+  std::deque<Pending> backlog;
+  size_t in_flight = 0;
+  size_t max_backlog = 0;
+  std::map<std::pair<std::string, std::string>, Series> series;
+};
+
+double Ms(int64_t us) { return static_cast<double>(us) / 1000; }
+
+Json::Value Percentiles(const HdrHistogram &h) {
+  Json::Value v;
+  v["p50_ms"] = Ms(h.ValueAtPercentile(50));
+  v["p99_ms"] = Ms(h.ValueAtPercentile(99));
+  v["p999_ms"] = Ms(h.ValueAtPercentile(99.9));
+  v["max_ms"] = Ms(h.Max());
+  v["mean_ms"] = h.Mean() / 1000;
+  return v;
+}
+
+void PrintRow(const std::string &name, const Series &s, double elapsed) {
+  std::printf("%-28s %9llu %8.1f %7.3f%% %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+              name.c_str(), static_cast<unsigned long long>(s.requests),
+              static_cast<double>(s.requests) / elapsed,
+              s.requests ? 100.0 * static_cast<double>(s.errors) /
+                               static_cast<double>(s.requests)
+                         : 0.0,
+              Ms(s.latency.ValueAtPercentile(50)),
+              Ms(s.latency.ValueAtPercentile(99)),
+              Ms(s.latency.ValueAtPercentile(99.9)),
+              Ms(s.latency.Max()), Ms(s.service.ValueAtPercentile(99)));
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!ParseOptions(argc, argv, opt))
+    return Usage();
+
+  std::vector<CapturedRequest> requests;
+  {
+    std::ifstream in(opt.capture);
+    if (!in) {
+      std::cerr << "cannot open " << opt.capture << "\n";
+      return 1;
+    }
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(in, line)) {
+      ++line_no;
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+      CapturedRequest r;
+      if (!ParseLine(line, r)) {
+        std::cerr << opt.capture << ":" << line_no << ": not a JSON object\n";
+        return 1;
+      }
+      requests.push_back(std::move(r));
+    }
+  }
+  if (requests.empty()) {
+    std::cerr << "no requests in " << opt.capture << "\n";
+    return 1;
+  }
+
+  trantor::EventLoopThreadPool loops(opt.threads, "loadgen");
+  loops.start();
+  Mix mix(std::move(requests), opt.index_ratio, opt.seed);
+  Dispatcher dispatcher(opt, loops);
+
+  // The schedule; a late wake-up still uses the slot's own time.
+  std::mt19937_64 rng(opt.seed);
+  std::exponential_distribution<double> gap(opt.rps);
+  const auto start = Clock::now();
+  const auto end = start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double>(opt.duration_sec));
+  double offset_sec = 0;
+  uint64_t scheduled = 0;
+  for (auto at = start; at < end;) {
+    std::this_thread::sleep_until(at);
+    dispatcher.Submit(mix.Next(), at);
+    ++scheduled;
+    offset_sec += opt.poisson ? gap(rng) : 1 / opt.rps;
+    at = start + std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>(offset_sec));
+  }
+  dispatcher.Finish(end + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>(opt.timeout_sec)));
+  const double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  const auto series = dispatcher.TakeSeries();
+  Series total;
+  Json::Value report;
+  report["target_rps"] = opt.rps;
+  report["scheduled"] = static_cast<Json::UInt64>(scheduled);
+  report["elapsed_sec"] = elapsed;
+  report["connections"] = static_cast<Json::UInt64>(opt.connections);
+  report["max_backlog"] = static_cast<Json::UInt64>(dispatcher.MaxBacklog());
+  std::printf("%-28s %9s %8s %8s %9s %9s %9s %9s %9s\n", "endpoint",
+              "requests", "rps", "errors", "p50 ms", "p99 ms", "p99.9 ms",
+              "max ms", "svc p99");
+  for (const auto &[key, s] : series) {
+    const std::string name =
+        key.second.empty() ? key.first : key.first + " " + key.second;
+    PrintRow(name, s, elapsed);
+    total.latency.Add(s.latency);
+    total.service.Add(s.service);
+    total.requests += s.requests;
+    total.errors += s.errors;
+    for (const auto &[status, n] : s.statuses)
+      total.statuses[status] += n;
+
+    Json::Value v;
+    v["endpoint"] = key.first;
+    if (!key.second.empty())
+      v["query_type"] = key.second;
+    v["requests"] = static_cast<Json::UInt64>(s.requests);
+    v["errors"] = static_cast<Json::UInt64>(s.errors);
+    v["latency"] = Percentiles(s.latency);
+    v["service"] = Percentiles(s.service);
+    for (const auto &[status, n] : s.statuses) {
+      std::string label = std::to_string(status);
+      if (status == kUnsent)
+        label = "unsent";
+      else if (status == kTransportError)
+        label = "transport";
+      v["statuses"][label] = static_cast<Json::UInt64>(n);
+    }
+    report["series"].append(v);
+  }
+  PrintRow("total", total, elapsed);
+  std::printf("achieved %.1f rps of %.1f target, max backlog %zu\n",
+              static_cast<double>(total.requests) / elapsed, opt.rps,
+              dispatcher.MaxBacklog());
+  report["latency"] = Percentiles(total.latency);
+  report["service"] = Percentiles(total.service);
+  report["requests"] = static_cast<Json::UInt64>(total.requests);
+  report["errors"] = static_cast<Json::UInt64>(total.errors);
+
+  if (!opt.json_out.empty()) {
+    std::ofstream out(opt.json_out);
+    out << report.toStyledString();
+    if (!out) {
+      std::cerr << "cannot write " << opt.json_out << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include "xapian_processor/index_writer.hpp"
+#include "xapian_processor/shards.hpp"
+
+#include <xapian.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Copies a database into a new directory laid out for another shard count
+// (see SearchConfig.shards):
+//
+//   dobrika_reshard <source db> <target db> <shards>
+//
+// The source may be a single database or a sharded one and is only read.
+// Run it with the server stopped, then point DOBRIKA_DB_PATH at the target
+// and set DOBRIKA_SHARDS to match. Every target shard starts from the
+// oldest ingest log position of the source, so records the log still
+// holds are replayed once more (re-indexing is idempotent).
+namespace fs = std::filesystem;
+
+namespace {
+constexpr size_t kCommitEvery = 10000;
+const std::string kIdTermPrefix = "ID";
+
+// Documents are keyed by their unique "ID" + task_id term.
+std::string IdTerm(const Xapian::Document &doc) {
+  Xapian::TermIterator it = doc.termlist_begin();
+  it.skip_to(kIdTermPrefix);
+  if (it == doc.termlist_end() || (*it).rfind(kIdTermPrefix, 0) != 0)
+    return {};
+  return *it;
+}
+
+int Usage() {
+  std::cerr << "usage: dobrika_reshard <source db> <target db> <shards>\n";
+  return 2;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 4)
+    return Usage();
+  const std::string source = argv[1];
+  const std::string target = argv[2];
+  size_t shard_count = 0;
+  try {
+    shard_count = static_cast<size_t>(std::stoul(argv[3]));
+  } catch (...) {
+    return Usage();
+  }
+  if (shard_count == 0)
+    return Usage();
+
+  const size_t source_shards = DetectShardCount(source);
+  if (source_shards == 0) {
+    std::cerr << source << ": no database\n";
+    return 1;
+  }
+  std::error_code ec;
+  if (fs::exists(target, ec) && !fs::is_empty(target, ec)) {
+    std::cerr << target << ": exists and is not empty\n";
+    return 1;
+  }
+
+  try {
+    const std::vector<std::string> source_paths =
+        ShardPaths(source, source_shards);
+    const Xapian::Database in = OpenCombined(source_paths);
+
+    if (shard_count > 1)
+      fs::create_directories(target);
+    std::vector<std::unique_ptr<Xapian::WritableDatabase>> out;
+    for (const auto &path : ShardPaths(target, shard_count))
+      out.push_back(std::make_unique<Xapian::WritableDatabase>(
+          path, Xapian::DB_CREATE));
+
+    // Metadata (index format and the like) is the same in every source
+    // shard except the ingest log position.
+    const Xapian::Database first(source_paths.front());
+    uint64_t log_position = ~uint64_t{0};
+    for (const auto &path : source_paths) {
+      const std::string stored =
+          Xapian::Database(path).get_metadata(IndexWriter::kLogPositionKey);
+      log_position = std::min<uint64_t>(
+          log_position, stored.empty() ? 0 : std::stoull(stored));
+    }
+    for (auto it = first.metadata_keys_begin(); it != first.metadata_keys_end();
+         ++it) {
+      for (auto &db : out)
+        db->set_metadata(*it, first.get_metadata(*it));
+    }
+    for (auto &db : out) {
+      db->set_metadata(IndexWriter::kLogPositionKey,
+                       log_position == 0 ? std::string()
+                                         : std::to_string(log_position));
+    }
+
+    std::vector<size_t> copied(shard_count);
+    size_t skipped = 0;
+    size_t total = 0;
+    for (auto it = in.postlist_begin(""); it != in.postlist_end(""); ++it) {
+      const Xapian::Document doc = in.get_document(*it);
+      const std::string id = IdTerm(doc);
+      if (id.empty()) {
+        ++skipped;
+        continue;
+      }
+      const size_t shard =
+          ShardForTask(id.substr(kIdTermPrefix.size()), shard_count);
+      out[shard]->replace_document(id, doc);
+      if (++copied[shard] % kCommitEvery == 0)
+        out[shard]->commit();
+      if (++total % (kCommitEvery * 10) == 0)
+        std::cerr << total << " documents\n";
+    }
+    for (auto &db : out)
+      db->commit();
+
+    std::cout << "copied " << total << " documents from " << source_shards
+              << " to " << shard_count << " shards";
+    for (size_t s = 0; s < shard_count; ++s)
+      std::cout << (s == 0 ? ": " : ", ") << copied[s];
+    std::cout << '\n';
+    if (skipped > 0)
+      std::cout << "skipped " << skipped << " documents without an ID term\n";
+  } catch (const Xapian::Error &e) {
+    std::cerr << "xapian error: " << e.get_description() << '\n';
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,568 @@
+#include "xapian_processor/db_backup.hpp"
+
+#include <xapian.h>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr size_t kCopyChunk = 1 << 20;
+// mtime only moves once per kernel clock tick, so a file written within
+// this long of a scan may change again without its stamp changing. Such
+// files are never treated as unchanged.
+constexpr int64_t kMtimeSlackNs = 1'000'000'000;
+const std::string kManifestName = "DOBRIKA_BACKUP";
+const std::string kStagingPrefix = ".tmp-";
+
+struct FileStamp {
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+
+  bool operator==(const FileStamp &o) const {
+    return size == o.size && mtime_ns == o.mtime_ns;
+  }
+};
+
+// Relative path -> stamp of every regular file in a tree.
+using TreeStamps = std::map<std::string, FileStamp>;
+
+// Stored in each generation: the revision of each part it holds and the
+// live files' stamps at the time, which the next hot run compares against.
+struct Manifest {
+  std::vector<uint64_t> revisions;
+  int64_t locked_at_ns = 0;
+  TreeStamps files;
+};
+
+class FdGuard {
+public:
+  explicit FdGuard(int fd) : fd(fd) {}
+  ~FdGuard() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+  FdGuard(const FdGuard &) = delete;
+  FdGuard &operator=(const FdGuard &) = delete;
+
+  const int fd;
+};
+
+// Paces the unlocked copy to a byte rate.
+class Throttle {
+public:
+  explicit Throttle(uint64_t bytes_per_sec)
+      : rate(bytes_per_sec), start(std::chrono::steady_clock::now()) {}
+
+  void Consume(uint64_t bytes) {
+    if (rate == 0)
+      return;
+    consumed += bytes;
+    std::this_thread::sleep_until(
+        start + std::chrono::nanoseconds(static_cast<int64_t>(
+                    static_cast<double>(consumed) * 1e9 /
+                    static_cast<double>(rate))));
+  }
+
+private:
+  const uint64_t rate;
+  const std::chrono::steady_clock::time_point start;
+  uint64_t consumed = 0;
+};
+
+int64_t WallNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// UTC, so generation names sort by age across DST changes.
+std::string UtcStamp() {
+  const std::time_t t = std::time(nullptr);
+  std::tm tm{};
+  gmtime_r(&t, &tm);
+  char buf[32];
+  std::strftime(buf, sizeof(buf), "%Y%m%dT%H%M%SZ", &tm);
+  return buf;
+}
+
+bool StatFile(const fs::path &path, FileStamp &stamp,
+              nlink_t *links = nullptr) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0)
+    return false;
+  stamp.size = static_cast<uint64_t>(st.st_size);
+  stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 +
+                   st.st_mtim.tv_nsec;
+  if (links)
+    *links = st.st_nlink;
+  return true;
+}
+
+bool ScanTree(const fs::path &root, TreeStamps &out) {
+  out.clear();
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (!it->is_regular_file(ec))
+      continue;
+    FileStamp stamp;
+    if (!StatFile(it->path(), stamp))
+      return false;
+    out.emplace(it->path().lexically_relative(root).generic_string(), stamp);
+  }
+  return !ec;
+}
+
+bool WriteAll(int fd, const char *data, size_t n) {
+  while (n > 0) {
+    const ssize_t w = ::write(fd, data, n);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += w;
+    n -= static_cast<size_t>(w);
+  }
+  return true;
+}
+
+bool PWriteAll(int fd, const char *data, size_t n, off_t off) {
+  while (n > 0) {
+    const ssize_t w = ::pwrite(fd, data, n, off);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += w;
+    n -= static_cast<size_t>(w);
+    off += w;
+  }
+  return true;
+}
+
+// Reads up to buf.size() bytes at off; short only at end of file.
+ssize_t PReadFull(int fd, std::vector<char> &buf, off_t off) {
+  size_t got = 0;
+  while (got < buf.size()) {
+    const ssize_t r = ::pread(fd, buf.data() + got, buf.size() - got,
+                              off + static_cast<off_t>(got));
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (r == 0)
+      break;
+    got += static_cast<size_t>(r);
+  }
+  return static_cast<ssize_t>(got);
+}
+
+// Makes dst a clone of src's data; false if the filesystem cannot.
+bool Reflink(int src_fd, int dst_fd) {
+#ifdef FICLONE
+  return ::ioctl(dst_fd, FICLONE, src_fd) == 0;
+#else
+  (void)src_fd;
+  (void)dst_fd;
+  return false;
+#endif
+}
+
+// Creates dst as a copy of src: a reflink when possible, otherwise a plain
+// copy paced by throttle (null when unpaced).
+bool CopyFile(const fs::path &src, const fs::path &dst, Throttle *throttle,
+              const std::atomic<bool> &cancel, uint64_t &copied,
+              uint64_t &linked) {
+  FdGuard in(::open(src.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in.fd < 0)
+    return false;
+  FdGuard out(
+      ::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (out.fd < 0)
+    return false;
+  struct stat st;
+  if (::fstat(in.fd, &st) != 0)
+    return false;
+  if (Reflink(in.fd, out.fd)) {
+    linked += static_cast<uint64_t>(st.st_size);
+    return true;
+  }
+  std::vector<char> buf(kCopyChunk);
+  while (true) {
+    if (cancel.load(std::memory_order_relaxed))
+      return false;
+    const ssize_t n = ::read(in.fd, buf.data(), buf.size());
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (n == 0)
+      return true;
+    if (!WriteAll(out.fd, buf.data(), static_cast<size_t>(n)))
+      return false;
+    copied += static_cast<uint64_t>(n);
+    if (throttle)
+      throttle->Consume(static_cast<uint64_t>(n));
+  }
+}
+
+// Brings the staged dst up to date with src, rewriting only the chunks
+// that differ. Runs under the commit locks, so it is not paced.
+bool Resync(const fs::path &src, const fs::path &dst,
+            const std::atomic<bool> &cancel, uint64_t &copied,
+            uint64_t &linked) {
+  FileStamp unused;
+  nlink_t links = 0;
+  // Missing, or a hardlink into the previous generation which must not be
+  // written through: start from a fresh copy.
+  if (!StatFile(dst, unused, &links) || links > 1) {
+    std::error_code ec;
+    fs::remove(dst, ec);
+    fs::create_directories(dst.parent_path(), ec);
+    return CopyFile(src, dst, nullptr, cancel, copied, linked);
+  }
+  FdGuard in(::open(src.c_str(), O_RDONLY | O_CLOEXEC));
+  FdGuard out(::open(dst.c_str(), O_RDWR | O_CLOEXEC));
+  if (in.fd < 0 || out.fd < 0)
+    return false;
+  std::vector<char> live(kCopyChunk);
+  std::vector<char> staged(kCopyChunk);
+  off_t off = 0;
+  while (true) {
+    const ssize_t n = PReadFull(in.fd, live, off);
+    if (n < 0)
+      return false;
+    if (n == 0)
+      break;
+    const ssize_t m = PReadFull(out.fd, staged, off);
+    if (m < 0)
+      return false;
+    if (m != n || std::memcmp(live.data(), staged.data(),
+                              static_cast<size_t>(n)) != 0) {
+      if (!PWriteAll(out.fd, live.data(), static_cast<size_t>(n), off))
+        return false;
+      copied += static_cast<uint64_t>(n);
+    }
+    off += n;
+  }
+  return ::ftruncate(out.fd, off) == 0;
+}
+
+bool Fsync(const fs::path &path, bool directory) {
+  FdGuard fd(::open(path.c_str(),
+                    O_RDONLY | O_CLOEXEC | (directory ? O_DIRECTORY : 0)));
+  return fd.fd >= 0 && ::fsync(fd.fd) == 0;
+}
+
+bool FsyncTree(const fs::path &root) {
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    const bool dir = it->is_directory(ec);
+    if (!Fsync(it->path(), dir))
+      return false;
+  }
+  return !ec && Fsync(root, true);
+}
+
+bool WriteManifest(const fs::path &dir, const Manifest &manifest) {
+  {
+    std::ofstream out(dir / kManifestName, std::ios::trunc);
+    for (uint64_t revision : manifest.revisions)
+      out << "revision " << revision << '\n';
+    out << "locked_at_ns " << manifest.locked_at_ns << '\n';
+    for (const auto &[path, stamp] : manifest.files)
+      out << "file " << stamp.size << ' ' << stamp.mtime_ns << ' ' << path
+          << '\n';
+    out.flush();
+    if (!out)
+      return false;
+  }
+  return Fsync(dir / kManifestName, false);
+}
+
+std::optional<Manifest> ReadManifest(const fs::path &dir) {
+  std::ifstream in(dir / kManifestName);
+  if (!in)
+    return std::nullopt;
+  Manifest manifest;
+  std::string key;
+  while (in >> key) {
+    if (key == "revision") {
+      uint64_t revision = 0;
+      in >> revision;
+      manifest.revisions.push_back(revision);
+    } else if (key == "locked_at_ns") {
+      in >> manifest.locked_at_ns;
+    } else if (key == "file") {
+      FileStamp stamp;
+      std::string path;
+      in >> stamp.size >> stamp.mtime_ns;
+      in.get();
+      std::getline(in, path);
+      manifest.files[path] = stamp;
+    } else {
+      return std::nullopt;
+    }
+    if (in.fail())
+      return std::nullopt;
+  }
+  return manifest;
+}
+
+// Complete generations, oldest first.
+std::vector<fs::path> ListGenerations(const fs::path &kind_dir) {
+  std::vector<fs::path> out;
+  std::error_code ec;
+  for (fs::directory_iterator it(kind_dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    const std::string name = it->path().filename().string();
+    if (it->is_directory(ec) && name.rfind(kStagingPrefix, 0) != 0)
+      out.push_back(it->path());
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+// True if the previous generation's copy of a file with this stamp can be
+// hardlinked instead of copied.
+bool Unchanged(const Manifest &prev, const std::string &path,
+               const FileStamp &stamp) {
+  auto it = prev.files.find(path);
+  return it != prev.files.end() && it->second == stamp &&
+         stamp.mtime_ns < prev.locked_at_ns - kMtimeSlackNs;
+}
+
+double SecondsSince(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+// Removes the staging directory unless the run got to rename it.
+struct StagingGuard {
+  fs::path path;
+  ~StagingGuard() {
+    if (!path.empty()) {
+      std::error_code ec;
+      fs::remove_all(path, ec);
+    }
+  }
+};
+} // namespace
+
+struct DatabaseBackup::RunTotals {
+  uint64_t copied = 0;
+  uint64_t linked = 0;
+  uint64_t size = 0;
+  uint64_t revision = 0;
+  double lock_sec = 0;
+};
+
+// Holds every part's mutex shared, always taken in part order.
+class DatabaseBackup::SharedLocks {
+public:
+  explicit SharedLocks(const std::vector<BackupPart> &parts) {
+    locks.reserve(parts.size());
+    for (const auto &part : parts)
+      locks.emplace_back(*part.mutex);
+  }
+
+private:
+  std::vector<std::shared_lock<std::shared_mutex>> locks;
+};
+
+DatabaseBackup::DatabaseBackup(fs::path db_path, std::vector<BackupPart> parts,
+                               const BackupOptions &options)
+    : db_path(std::move(db_path)), parts(std::move(parts)), options(options) {}
+
+std::vector<uint64_t>
+DatabaseBackup::ReadRevisions(const fs::path &root) const {
+  std::vector<uint64_t> revisions;
+  for (const auto &part : parts) {
+    const fs::path dir = part.dir.empty() ? root : root / part.dir;
+    revisions.push_back(Xapian::Database(dir.string()).get_revision());
+  }
+  return revisions;
+}
+
+bool DatabaseBackup::Run(BackupKind kind, const fs::path &root,
+                         const std::atomic<bool> &cancel) {
+  std::lock_guard<std::mutex> run(run_mutex);
+  const auto t0 = std::chrono::steady_clock::now();
+  RunTotals totals;
+  bool ok = false;
+  try {
+    ok = RunLocked(kind, root, cancel, totals);
+  } catch (const Xapian::Error &) {
+    ok = false;
+  } catch (const std::exception &) {
+    ok = false;
+  }
+
+  std::lock_guard<std::mutex> lk(stats_mutex);
+  BackupStats &s = stats[static_cast<size_t>(kind)];
+  ++s.runs_total;
+  if (!ok) {
+    ++s.failures_total;
+    return false;
+  }
+  s.last_duration_sec = SecondsSince(t0);
+  s.last_lock_sec = totals.lock_sec;
+  s.last_bytes_copied = totals.copied;
+  s.last_bytes_linked = totals.linked;
+  s.last_size_bytes = totals.size;
+  s.last_revision = totals.revision;
+  s.last_success_unix = static_cast<int64_t>(std::time(nullptr));
+  return true;
+}
+
+bool DatabaseBackup::RunLocked(BackupKind kind, const fs::path &root,
+                               const std::atomic<bool> &cancel,
+                               RunTotals &totals) {
+  const fs::path kind_dir =
+      root / (kind == BackupKind::Cold ? "cold" : "hot");
+  std::error_code ec;
+  fs::create_directories(kind_dir, ec);
+  if (ec)
+    return false;
+  // Leftovers of a run that crashed or was cancelled.
+  for (fs::directory_iterator it(kind_dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->path().filename().string().rfind(kStagingPrefix, 0) == 0) {
+      std::error_code rm;
+      fs::remove_all(it->path(), rm);
+    }
+  }
+
+  std::optional<Manifest> prev;
+  fs::path prev_dir;
+  if (kind == BackupKind::Hot) {
+    const auto generations = ListGenerations(kind_dir);
+    if (!generations.empty()) {
+      prev_dir = generations.back();
+      prev = ReadManifest(prev_dir);
+    }
+  }
+
+  StagingGuard staging{kind_dir / (kStagingPrefix + UtcStamp())};
+  if (!fs::create_directories(staging.path, ec))
+    return false;
+
+  // Stamps and revisions read together: no commit can run in between.
+  TreeStamps before;
+  std::vector<uint64_t> start_revisions;
+  int64_t scanned_at_ns;
+  {
+    const auto t = std::chrono::steady_clock::now();
+    SharedLocks lock(parts);
+    scanned_at_ns = WallNowNs();
+    if (!ScanTree(db_path, before))
+      return false;
+    start_revisions = ReadRevisions(db_path);
+    totals.lock_sec += SecondsSince(t);
+  }
+
+  // Bulk of the copy, with commits running. Whatever they change is fixed
+  // up below.
+  Throttle throttle(options.max_bytes_per_sec);
+  for (const auto &[path, stamp] : before) {
+    const fs::path dst = staging.path / path;
+    fs::create_directories(dst.parent_path(), ec);
+    if (prev && Unchanged(*prev, path, stamp)) {
+      fs::create_hard_link(prev_dir / path, dst, ec);
+      if (!ec) {
+        totals.linked += stamp.size;
+        continue;
+      }
+    }
+    if (!CopyFile(db_path / path, dst, &throttle, cancel, totals.copied,
+                  totals.linked))
+      return false;
+  }
+
+  Manifest manifest;
+  {
+    const auto t = std::chrono::steady_clock::now();
+    SharedLocks lock(parts);
+    manifest.locked_at_ns = WallNowNs();
+    manifest.revisions = ReadRevisions(db_path);
+    if (!ScanTree(db_path, manifest.files))
+      return false;
+    // Files are only written by commits, so unchanged revisions mean the
+    // unlocked copy already holds them.
+    if (manifest.revisions != start_revisions) {
+      for (const auto &[path, stamp] : manifest.files) {
+        auto it = before.find(path);
+        if (it != before.end() && it->second == stamp &&
+            stamp.mtime_ns < scanned_at_ns - kMtimeSlackNs)
+          continue;
+        if (!Resync(db_path / path, staging.path / path, cancel,
+                    totals.copied, totals.linked))
+          return false;
+      }
+      for (const auto &[path, stamp] : before) {
+        if (!manifest.files.count(path))
+          fs::remove(staging.path / path, ec);
+      }
+    }
+    totals.lock_sec += SecondsSince(t);
+  }
+
+  if (!FsyncTree(staging.path))
+    return false;
+  if (ReadRevisions(staging.path) != manifest.revisions)
+    return false;
+  if (!WriteManifest(staging.path, manifest) || !Fsync(staging.path, true))
+    return false;
+
+  const uint64_t revision = std::accumulate(
+      manifest.revisions.begin(), manifest.revisions.end(), uint64_t{0});
+  std::string name = UtcStamp() + "-r" + std::to_string(revision);
+  fs::path target = kind_dir / name;
+  for (int i = 2; fs::exists(target, ec); ++i)
+    target = kind_dir / (name + "-" + std::to_string(i));
+  fs::rename(staging.path, target, ec);
+  if (ec)
+    return false;
+  staging.path.clear();
+  Fsync(kind_dir, true);
+
+  const auto generations = ListGenerations(kind_dir);
+  const size_t keep = std::max<size_t>(1, options.keep);
+  for (size_t i = 0; i + keep < generations.size(); ++i)
+    fs::remove_all(generations[i], ec);
+
+  totals.revision = revision;
+  for (const auto &[path, stamp] : manifest.files)
+    totals.size += stamp.size;
+  return true;
+}
+
+BackupStats DatabaseBackup::GetStats(BackupKind kind) const {
+  std::lock_guard<std::mutex> lk(stats_mutex);
+  return stats[static_cast<size_t>(kind)];
+}
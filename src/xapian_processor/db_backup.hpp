@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+enum class BackupKind { Cold, Hot };
+
+struct BackupOptions {
+  // Generations kept per kind; older ones go after each successful run.
+  size_t keep = 3;
+  // Copy rate outside the lock in bytes per second; 0 = unlimited.
+  uint64_t max_bytes_per_sec = 0;
+};
+
+// Per kind, exported on /metrics. The last_* fields describe the last
+// successful run.
+struct BackupStats {
+  uint64_t runs_total = 0;
+  uint64_t failures_total = 0;
+  double last_duration_sec = 0;
+  // Time the commit locks were held, i.e. how long commits were blocked.
+  double last_lock_sec = 0;
+  // Bytes written, and bytes shared with the previous generation through
+  // hardlinks or reflinks instead.
+  uint64_t last_bytes_copied = 0;
+  uint64_t last_bytes_linked = 0;
+  uint64_t last_size_bytes = 0;
+  // Sum over shards.
+  uint64_t last_revision = 0;
+  int64_t last_success_unix = 0;
+};
+
+// One Xapian database inside the backed-up directory ("" for the directory
+// itself) and the mutex its commits hold exclusively.
+struct BackupPart {
+  std::filesystem::path dir;
+  std::shared_mutex *mutex;
+};
+
+// Point-in-time copies of the database directory as generations
+// <root>/<cold|hot>/<timestamp>-r<revision>.
+//
+// Files only change under the parts' mutexes (commits), so a run copies
+// the live files without them first, throttled, then holds all of them
+// shared just long enough to re-sync whatever a commit touched meanwhile.
+// The result is exactly the committed revisions read under the locks; it
+// is verified by opening every part, fsynced and renamed into place, so a
+// crash never leaves a half-written generation behind the newest complete
+// one.
+//
+// Hot generations hardlink files unchanged since the previous hot
+// generation; cold ones never share inodes with older generations. Both
+// reflink (FICLONE) where the filesystem supports it.
+class DatabaseBackup {
+public:
+  DatabaseBackup(std::filesystem::path db_path, std::vector<BackupPart> parts,
+                 const BackupOptions &options);
+
+  // Writes one generation under root; false on failure or when cancel was
+  // raised (the partial copy is removed). Runs are serialised.
+  bool Run(BackupKind kind, const std::filesystem::path &root,
+           const std::atomic<bool> &cancel);
+
+  BackupStats GetStats(BackupKind kind) const;
+
+private:
+  struct RunTotals;
+  class SharedLocks;
+  std::vector<uint64_t> ReadRevisions(const std::filesystem::path &root) const;
+  bool RunLocked(BackupKind kind, const std::filesystem::path &root,
+                 const std::atomic<bool> &cancel, RunTotals &totals);
+
+  const std::filesystem::path db_path;
+  const std::vector<BackupPart> parts;
+  const BackupOptions options;
+
+  std::mutex run_mutex;
+  mutable std::mutex stats_mutex;
+  BackupStats stats[2];
+};
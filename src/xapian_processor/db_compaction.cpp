@@ -0,0 +1,128 @@
+#include "xapian_processor/db_compaction.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace {
+// "<bytes> <documents> <last_docid>" of the last compaction's output.
+const std::string kBaselineKey = "dobrika_compaction_baseline";
+// Below this, fixed per-table overhead swamps the per-document estimate.
+constexpr uint64_t kMinFragmentedBytes = 4ull << 20;
+
+class CancellableCompactor : public Xapian::Compactor {
+public:
+  explicit CancellableCompactor(const std::atomic<bool> &cancel)
+      : cancel(cancel) {}
+
+  void set_status(const std::string &, const std::string &) override {
+    if (cancel.load())
+      throw Xapian::DatabaseError("compaction cancelled");
+  }
+
+private:
+  const std::atomic<bool> &cancel;
+};
+
+fs::path Sibling(const std::string &db_path, const char *suffix) {
+  fs::path path = fs::path(db_path).lexically_normal();
+  if (!path.has_filename()) // trailing separator
+    path = path.parent_path();
+  return path.parent_path() / ("." + path.filename().string() + suffix);
+}
+} // namespace
+
+uint64_t DatabaseBytes(const std::string &path) {
+  uint64_t bytes = 0;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(path, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->is_regular_file(ec))
+      bytes += it->file_size(ec);
+  }
+  return bytes;
+}
+
+DatabaseFootprint MeasureDatabase(const std::string &path,
+                                  const Xapian::Database &db) {
+  DatabaseFootprint out;
+  out.bytes = DatabaseBytes(path);
+  out.documents = db.get_doccount();
+  out.last_docid = db.get_lastdocid();
+  return out;
+}
+
+std::string CompactionReason(const Xapian::Database &db,
+                             const DatabaseFootprint &now,
+                             const CompactionPolicy &policy) {
+  DatabaseFootprint base;
+  std::istringstream(db.get_metadata(kBaselineKey)) >> base.bytes >>
+      base.documents >> base.last_docid;
+
+  // Docids are never reused, so new docids minus net growth is what was
+  // deleted since (replacements keep their docid).
+  const double issued = static_cast<double>(now.last_docid) - base.last_docid;
+  const double grown = static_cast<double>(now.documents) - base.documents;
+  const double deleted = issued - grown;
+  if (policy.deleted_ratio > 0 && deleted > 0 &&
+      deleted / (now.documents + deleted) >= policy.deleted_ratio)
+    return "deleted";
+
+  if (policy.fragmentation > 0 && base.documents > 0 && base.bytes > 0 &&
+      now.bytes >= kMinFragmentedBytes) {
+    const double expected = static_cast<double>(base.bytes) /
+                            base.documents * std::max(now.documents, 1u);
+    if (now.bytes / expected - 1 >= policy.fragmentation)
+      return "fragmented";
+  }
+  return {};
+}
+
+void StoreCompactionBaseline(Xapian::WritableDatabase &wdb,
+                             const DatabaseFootprint &compacted) {
+  wdb.set_metadata(kBaselineKey, std::to_string(compacted.bytes) + " " +
+                                     std::to_string(compacted.documents) +
+                                     " " +
+                                     std::to_string(compacted.last_docid));
+}
+
+void CompactCopy(Xapian::Database db, const std::string &out,
+                 const std::atomic<bool> &cancel) {
+  CancellableCompactor compactor(cancel);
+  // Docids are shared with the side tables, cursors and replicas.
+  db.compact(out, Xapian::DBCOMPACT_NO_RENUMBER, 0, compactor);
+}
+
+std::string CompactionStagingPath(const std::string &db_path) {
+  return Sibling(db_path, ".compact").string();
+}
+
+std::string CompactionRetiredPath(const std::string &db_path) {
+  return Sibling(db_path, ".old").string();
+}
+
+void SwapInCompacted(const std::string &db_path) {
+  const fs::path retired = CompactionRetiredPath(db_path);
+  fs::remove_all(retired);
+  fs::rename(db_path, retired);
+  try {
+    fs::rename(CompactionStagingPath(db_path), db_path);
+  } catch (...) {
+    fs::rename(retired, db_path);
+    throw;
+  }
+  std::error_code ec;
+  fs::remove_all(retired, ec);
+}
+
+void RecoverCompaction(const std::string &db_path) {
+  const fs::path retired = CompactionRetiredPath(db_path);
+  std::error_code ec;
+  if (!fs::exists(db_path, ec) && fs::exists(retired, ec))
+    fs::rename(retired, db_path);
+  fs::remove_all(retired, ec);
+  fs::remove_all(CompactionStagingPath(db_path), ec);
+}
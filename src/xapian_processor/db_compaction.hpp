@@ -0,0 +1,76 @@
+#pragma once
+#include <xapian.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Exported on /metrics. The last_* fields describe the last successful
+// run (one shard).
+struct CompactionStats {
+  uint64_t runs_total = 0;
+  uint64_t failures_total = 0;
+  double last_duration_sec = 0;
+  // Time the shard's commits were blocked for the catch-up and the swap.
+  double last_lock_sec = 0;
+  uint64_t last_size_before_bytes = 0;
+  uint64_t last_size_after_bytes = 0;
+  uint64_t last_documents = 0;
+  int64_t last_success_unix = 0;
+};
+
+// Size on disk of one database and the documents it holds and has
+// numbered.
+struct DatabaseFootprint {
+  uint64_t bytes = 0;
+  Xapian::doccount documents = 0;
+  Xapian::docid last_docid = 0;
+};
+
+DatabaseFootprint MeasureDatabase(const std::string &path,
+                                  const Xapian::Database &db);
+// Just the size of the files under path (a directory walk).
+uint64_t DatabaseBytes(const std::string &path);
+
+// Ratios that trigger a compaction; <= 0 disables that trigger.
+struct CompactionPolicy {
+  // Documents deleted since the last compaction over those held plus
+  // deleted.
+  double deleted_ratio = 0.25;
+  // How far the size exceeds the compacted size per document times the
+  // current document count.
+  double fragmentation = 1.0;
+};
+
+// Why db (measured as `now`) should be compacted ("deleted" or
+// "fragmented"), or empty. Both are measured against the footprint the
+// last compaction stored in the database; before the first one, every
+// docid handed out but no longer held counts as deleted.
+std::string CompactionReason(const Xapian::Database &db,
+                             const DatabaseFootprint &now,
+                             const CompactionPolicy &policy);
+
+// Records a fresh compaction's footprint for CompactionReason().
+void StoreCompactionBaseline(Xapian::WritableDatabase &wdb,
+                             const DatabaseFootprint &compacted);
+
+// Writes a compacted copy of the revision db is open at into out, keeping
+// docids. Throws on failure, or Xapian::DatabaseError once cancel is
+// raised (checked between tables).
+void CompactCopy(Xapian::Database db, const std::string &out,
+                 const std::atomic<bool> &cancel);
+
+// Scratch directories next to the database: <parent>/.<name>.compact for
+// the copy and <parent>/.<name>.old for the database it replaces. The dot
+// keeps them out of shard discovery.
+std::string CompactionStagingPath(const std::string &db_path);
+std::string CompactionRetiredPath(const std::string &db_path);
+
+// Moves the staged copy to db_path and removes the old database. The two
+// renames are the only window where db_path is missing; if the second one
+// fails, the old database is moved back.
+void SwapInCompacted(const std::string &db_path);
+
+// Cleans up after a crash during compaction: puts back an old database
+// whose swap did not finish and drops staged copies.
+void RecoverCompaction(const std::string &db_path);
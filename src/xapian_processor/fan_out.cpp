@@ -0,0 +1,125 @@
+#include "xapian_processor/fan_out.hpp"
+
+#include <algorithm>
+#include <exception>
+
+struct FanOutPool::Job {
+  size_t n = 0;
+  const std::function<void(size_t)> *fn = nullptr;
+  std::atomic<size_t> next{0};
+
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  size_t done = 0;
+  std::exception_ptr error;
+
+  // Takes parts until none are left. A thread that picks the job up after
+  // the last part was taken returns without touching fn.
+  void Work() {
+    for (size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+      std::exception_ptr failed;
+      try {
+        (*fn)(i);
+      } catch (...) {
+        failed = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lk(mutex);
+      if (failed && !error)
+        error = failed;
+      if (++done == n)
+        done_cv.notify_all();
+    }
+  }
+};
+
+FanOutPool::FanOutPool(size_t threads) {
+  for (size_t i = 0; i < threads; ++i)
+    this->threads.emplace_back([this]() { WorkerLoop(); });
+}
+
+FanOutPool::~FanOutPool() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+void FanOutPool::ParallelFor(size_t n,
+                             const std::function<void(size_t)> &fn) {
+  if (n == 0)
+    return;
+  auto job = std::make_shared<Job>();
+  job->n = n;
+  job->fn = &fn;
+  const size_t helpers = std::min(n - 1, threads.size());
+  if (helpers > 0) {
+    {
+      std::lock_guard<std::mutex> lk(mutex);
+      for (size_t i = 0; i < helpers; ++i)
+        queue.push_back(job);
+    }
+    if (helpers == 1)
+      cv.notify_one();
+    else
+      cv.notify_all();
+  }
+  job->Work();
+  std::unique_lock<std::mutex> lk(job->mutex);
+  job->done_cv.wait(lk, [&] { return job->done == n; });
+  if (job->error)
+    std::rethrow_exception(job->error);
+}
+
+void FanOutPool::WorkerLoop() {
+  std::unique_lock<std::mutex> lk(mutex);
+  while (true) {
+    cv.wait(lk, [this] { return stopping || !queue.empty(); });
+    if (queue.empty())
+      return;
+    std::shared_ptr<Job> job = std::move(queue.front());
+    queue.pop_front();
+    lk.unlock();
+    job->Work();
+    lk.lock();
+  }
+}
+
+ReadModeChooser::ReadModeChooser(size_t kinds)
+    : kinds(std::make_unique<Kind[]>(kinds)) {}
+
+ReadModeChooser::Mode ReadModeChooser::Choose(size_t kind) {
+  Kind &k = kinds[kind];
+  const uint64_t n = k.queries.fetch_add(1, std::memory_order_relaxed);
+  const int64_t combined = k.avg_ns[0].load(std::memory_order_relaxed);
+  const int64_t fan_out = k.avg_ns[1].load(std::memory_order_relaxed);
+  Mode mode;
+  if (combined == 0) {
+    mode = Mode::Combined;
+  } else if (fan_out == 0) {
+    mode = Mode::FanOut;
+  } else {
+    mode = fan_out < combined ? Mode::FanOut : Mode::Combined;
+    if (n % kExploreEvery == kExploreEvery - 1)
+      mode = mode == Mode::FanOut ? Mode::Combined : Mode::FanOut;
+  }
+  k.chosen[static_cast<size_t>(mode)].fetch_add(1, std::memory_order_relaxed);
+  return mode;
+}
+
+void ReadModeChooser::Record(size_t kind, Mode mode,
+                             std::chrono::nanoseconds took) {
+  std::atomic<int64_t> &avg = kinds[kind].avg_ns[static_cast<size_t>(mode)];
+  // Racing updates may drop a sample; the average only steers the choice.
+  const int64_t sample = std::max<int64_t>(1, took.count());
+  const int64_t old = avg.load(std::memory_order_relaxed);
+  avg.store(old == 0 ? sample : old + (sample - old) / 8,
+            std::memory_order_relaxed);
+}
+
+uint64_t ReadModeChooser::Count(size_t kind, Mode mode) const {
+  return kinds[kind].chosen[static_cast<size_t>(mode)].load(
+      std::memory_order_relaxed);
+}
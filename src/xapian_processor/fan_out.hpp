@@ -0,0 +1,68 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed threads for per-shard query parts. The calling thread works
+// through the parts as well, so a fan-out makes progress even when every
+// pool thread is busy with other queries.
+class FanOutPool {
+public:
+  explicit FanOutPool(size_t threads);
+  ~FanOutPool();
+
+  FanOutPool(const FanOutPool &) = delete;
+  FanOutPool &operator=(const FanOutPool &) = delete;
+
+  // Runs fn(0) .. fn(n - 1) in parallel and returns once all are done,
+  // rethrowing the first exception any of them threw.
+  void ParallelFor(size_t n, const std::function<void(size_t)> &fn);
+
+private:
+  struct Job;
+
+  void WorkerLoop();
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::shared_ptr<Job>> queue;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
+
+// Picks, per kind of query, between one match over the combined database
+// and a fan-out over the shards, whichever has the lower moving average
+// latency. Each mode is tried once first, and every kExploreEvery-th query
+// runs the other mode so the choice follows changes in data and load.
+class ReadModeChooser {
+public:
+  enum class Mode { Combined = 0, FanOut = 1 };
+
+  explicit ReadModeChooser(size_t kinds);
+
+  Mode Choose(size_t kind);
+  void Record(size_t kind, Mode mode, std::chrono::nanoseconds took);
+  // Queries of the kind run in the mode so far.
+  uint64_t Count(size_t kind, Mode mode) const;
+
+private:
+  static constexpr uint64_t kExploreEvery = 32;
+
+  struct alignas(64) Kind {
+    std::atomic<uint64_t> queries{0};
+    // 0 until the mode's first sample.
+    std::array<std::atomic<int64_t>, 2> avg_ns{};
+    std::array<std::atomic<uint64_t>, 2> chosen{};
+  };
+
+  std::unique_ptr<Kind[]> kinds;
+};
@@ -0,0 +1,347 @@
+#include "xapian_processor/index_writer.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+namespace {
+// Pause before retrying a failed commit of logged batches, doubling up to
+// the maximum.
+constexpr std::chrono::milliseconds kRetryDelayMin{50};
+constexpr std::chrono::milliseconds kRetryDelayMax{5000};
+
+// Errors a later attempt can get past: the database or the disk under it
+// (Xapian::DatabaseError and its subclasses), the OS, memory. Anything else,
+// such as InvalidArgumentError for an over-long term, comes from a document
+// and fails the same way every time.
+bool IsTransient(const std::exception_ptr &error) {
+  try {
+    std::rethrow_exception(error);
+  } catch (const Xapian::DatabaseError &) {
+    return true;
+  } catch (const std::system_error &) {
+    return true;
+  } catch (const std::bad_alloc &) {
+    return true;
+  } catch (...) {
+    return false;
+  }
+}
+} // namespace
+
+IndexWriter::IndexWriter(const std::string &db_path,
+                         std::shared_mutex &db_mutex, size_t batch_docs,
+                         std::chrono::milliseconds batch_delay,
+                         CommitHook on_commit)
+    : db_path(db_path), wdb(db_path, Xapian::DB_CREATE_OR_OPEN),
+      db_mutex(db_mutex),
+      batch_docs(batch_docs == 0 ? 1 : batch_docs), batch_delay(batch_delay),
+      on_commit(std::move(on_commit)) {
+  commit_thread = std::thread([this]() { CommitLoop(); });
+}
+
+IndexWriter::~IndexWriter() { Stop(); }
+
+std::future<void> IndexWriter::Submit(PendingDocument doc) {
+  std::vector<PendingDocument> docs;
+  docs.push_back(std::move(doc));
+  return Submit(std::move(docs));
+}
+
+std::future<void> IndexWriter::Submit(std::vector<PendingDocument> docs,
+                                      uint64_t log_position) {
+  PendingBatch batch;
+  batch.docs = std::move(docs);
+  batch.log_position = log_position;
+  std::future<void> done = batch.done.get_future();
+  if (batch.docs.empty()) {
+    batch.done.set_value();
+    return done;
+  }
+  {
+    std::lock_guard<std::mutex> lk(queue_mutex);
+    if (stopping) {
+      batch.done.set_exception(std::make_exception_ptr(
+          std::runtime_error("index writer is stopped")));
+      return done;
+    }
+    if (queue.empty()) {
+      oldest_enqueued = std::chrono::steady_clock::now();
+    }
+    queued_docs += batch.docs.size();
+    queue.push_back(std::move(batch));
+  }
+  queue_cv.notify_one();
+  return done;
+}
+
+void IndexWriter::RunExclusive(
+    const std::function<void(Xapian::WritableDatabase &)> &fn,
+    bool atomic) {
+  {
+    // The commit thread only touches wdb under db_mutex.
+    std::unique_lock<std::shared_mutex> lock(db_mutex);
+    if (atomic) {
+      wdb.begin_transaction();
+      try {
+        fn(wdb);
+        wdb.commit_transaction();
+      } catch (...) {
+        // Otherwise the next group commit would write fn's partial
+        // changes without the caller's side-table updates.
+        wdb.cancel_transaction();
+        throw;
+      }
+    } else {
+      fn(wdb);
+      wdb.commit();
+    }
+  }
+  if (on_commit)
+    on_commit({}, 0);
+}
+
+void IndexWriter::SwapDatabase(
+    const std::function<void(Xapian::WritableDatabase &)> &prepare,
+    const std::function<void()> &swap) {
+  std::unique_lock<std::shared_mutex> lock(db_mutex);
+  prepare(wdb);
+  wdb.close();
+  try {
+    swap();
+  } catch (...) {
+    // swap() leaves either the old or the new files in place.
+    wdb = Xapian::WritableDatabase(db_path, Xapian::DB_OPEN);
+    throw;
+  }
+  wdb = Xapian::WritableDatabase(db_path, Xapian::DB_OPEN);
+}
+
+void IndexWriter::Stop() {
+  {
+    std::lock_guard<std::mutex> lk(queue_mutex);
+    stopping = true;
+  }
+  queue_cv.notify_all();
+  if (commit_thread.joinable())
+    commit_thread.join();
+}
+
+uint64_t IndexWriter::CommittedLogPosition() {
+  std::unique_lock<std::shared_mutex> lock(db_mutex);
+  const std::string stored = wdb.get_metadata(kLogPositionKey);
+  return stored.empty() ? 0 : std::stoull(stored);
+}
+
+WriterStats IndexWriter::GetStats() const {
+  WriterStats stats;
+  stats.commits_total = commits_total.load(std::memory_order_relaxed);
+  stats.commit_failures_total =
+      commit_failures_total.load(std::memory_order_relaxed);
+  stats.rejected_docs_total =
+      rejected_docs_total.load(std::memory_order_relaxed);
+  stats.committed_docs_total =
+      committed_docs_total.load(std::memory_order_relaxed);
+  stats.commit_latency_us_total =
+      commit_latency_us_total.load(std::memory_order_relaxed);
+  stats.last_batch_size = last_batch_size.load(std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lk(queue_mutex);
+    stats.pending_docs = queued_docs;
+  }
+  return stats;
+}
+
+void IndexWriter::CommitLoop() {
+  std::unique_lock<std::mutex> lk(queue_mutex);
+  std::chrono::milliseconds retry_delay{0};
+  while (true) {
+    queue_cv.wait(lk, [this] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      break; // stopping and fully drained
+    }
+    // Give concurrent writers a chance to join this transaction.
+    queue_cv.wait_until(lk, oldest_enqueued + batch_delay, [this] {
+      return stopping || queued_docs >= batch_docs;
+    });
+    std::vector<PendingBatch> batches;
+    batches.swap(queue);
+    const size_t doc_count = queued_docs;
+    queued_docs = 0;
+    const bool last_try = stopping;
+    lk.unlock();
+    std::vector<PendingBatch> retry =
+        ApplyAndCommit(batches, doc_count, last_try);
+    lk.lock();
+    if (retry.empty()) {
+      retry_delay = std::chrono::milliseconds{0};
+      continue;
+    }
+    // Put them back in front of anything submitted meanwhile, keeping log
+    // positions in order.
+    for (const auto &batch : retry)
+      queued_docs += batch.docs.size();
+    queue.insert(queue.begin(), std::make_move_iterator(retry.begin()),
+                 std::make_move_iterator(retry.end()));
+    oldest_enqueued = std::chrono::steady_clock::now();
+    retry_delay = std::clamp(retry_delay * 2, kRetryDelayMin, kRetryDelayMax);
+    queue_cv.wait_for(lk, retry_delay, [this] { return stopping; });
+  }
+}
+
+std::vector<IndexWriter::PendingBatch>
+IndexWriter::ApplyAndCommit(std::vector<PendingBatch> &batches,
+                            size_t doc_count, bool last_try) {
+  const auto t0 = std::chrono::steady_clock::now();
+  std::exception_ptr error;
+  std::vector<CommittedDocument> committed;
+  committed.reserve(doc_count);
+  uint64_t log_position = 0;
+  for (const auto &batch : batches)
+    log_position = std::max(log_position, batch.log_position);
+  {
+    std::unique_lock<std::shared_mutex> lock(db_mutex);
+    try {
+      wdb.begin_transaction();
+      try {
+        for (const auto &batch : batches) {
+          for (const auto &pending : batch.docs) {
+            if (pending.second) {
+              committed.push_back(
+                  {wdb.replace_document(pending.first, *pending.second),
+                   &pending});
+              continue;
+            }
+            // The id term is unique, so this finds at most one document.
+            Xapian::PostingIterator it = wdb.postlist_begin(pending.first);
+            if (it == wdb.postlist_end(pending.first))
+              continue;
+            const Xapian::docid docid = *it;
+            wdb.delete_document(docid);
+            committed.push_back({docid, &pending});
+          }
+        }
+        if (log_position != 0)
+          wdb.set_metadata(kLogPositionKey, std::to_string(log_position));
+        const auto commit_start = std::chrono::steady_clock::now();
+        wdb.commit_transaction();
+        commit_latency.ObserveSince(commit_start);
+      } catch (...) {
+        wdb.cancel_transaction();
+        throw;
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // The batch is durable at this point; a failing hook (e.g. a reader
+    // reopen) must not be reported as a failed write.
+    if (!error && on_commit) {
+      try {
+        on_commit(committed, log_position);
+      } catch (...) {
+      }
+    }
+  }
+  const auto t1 = std::chrono::steady_clock::now();
+
+  if (error) {
+    commit_failures_total.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    commits_total.fetch_add(1, std::memory_order_relaxed);
+    committed_docs_total.fetch_add(doc_count, std::memory_order_relaxed);
+    commit_latency_us_total.fetch_add(
+        std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count(),
+        std::memory_order_relaxed);
+    last_batch_size.store(doc_count, std::memory_order_relaxed);
+  }
+
+  const bool transient = error && IsTransient(error);
+  if (error && !transient && doc_count > 1)
+    return CommitEachDocument(batches, last_try);
+  std::vector<PendingBatch> retry;
+  for (auto &batch : batches) {
+    if (!error) {
+      batch.done.set_value();
+      continue;
+    }
+    if (!transient) {
+      rejected_docs_total.fetch_add(batch.docs.size(),
+                                    std::memory_order_relaxed);
+      // Replaying the record would fail again and stall the shard.
+      if (batch.log_position != 0 && !SkipLogged(batch.log_position) &&
+          !last_try) {
+        retry.push_back(std::move(batch));
+        continue;
+      }
+    } else if (batch.log_position != 0 && !last_try) {
+      retry.push_back(std::move(batch));
+      continue;
+    }
+    // Logged records left here are replayed on the next start.
+    batch.done.set_exception(error);
+  }
+  return retry;
+}
+
+std::vector<IndexWriter::PendingBatch>
+IndexWriter::CommitEachDocument(std::vector<PendingBatch> &batches,
+                                bool last_try) {
+  std::vector<PendingBatch> retry;
+  for (auto &batch : batches) {
+    // Later positions must not be stored before an earlier retried one.
+    if (!retry.empty()) {
+      retry.push_back(std::move(batch));
+      continue;
+    }
+    std::exception_ptr refused;
+    size_t i = 0;
+    for (; i < batch.docs.size(); ++i) {
+      std::vector<PendingBatch> one(1);
+      one[0].docs.push_back(batch.docs[i]);
+      // Only the last document completes the batch's log records.
+      if (i + 1 == batch.docs.size())
+        one[0].log_position = batch.log_position;
+      std::future<void> done = one[0].done.get_future();
+      // last_try: report every failure here instead of queueing a retry.
+      ApplyAndCommit(one, 1, true);
+      try {
+        done.get();
+      } catch (...) {
+        const std::exception_ptr error = std::current_exception();
+        if (IsTransient(error) && batch.log_position != 0 && !last_try)
+          break;
+        if (!refused)
+          refused = error;
+      }
+    }
+    if (i < batch.docs.size()) {
+      batch.docs.erase(batch.docs.begin(),
+                       batch.docs.begin() + static_cast<std::ptrdiff_t>(i));
+      retry.push_back(std::move(batch));
+    } else if (refused) {
+      batch.done.set_exception(refused);
+    } else {
+      batch.done.set_value();
+    }
+  }
+  return retry;
+}
+
+bool IndexWriter::SkipLogged(uint64_t log_position) {
+  std::unique_lock<std::shared_mutex> lock(db_mutex);
+  try {
+    wdb.set_metadata(kLogPositionKey, std::to_string(log_position));
+    wdb.commit();
+  } catch (...) {
+    return false;
+  }
+  if (on_commit) {
+    try {
+      on_commit({}, log_position);
+    } catch (...) {
+    }
+  }
+  return true;
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <xapian.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tools/latency_histogram.hpp"
+
+// Snapshot of the group-commit pipeline counters, exported on /metrics.
+struct WriterStats {
+  uint64_t commits_total = 0;
+  uint64_t commit_failures_total = 0;
+  // Documents Xapian refused (e.g. an over-long term); never retried.
+  uint64_t rejected_docs_total = 0;
+  uint64_t committed_docs_total = 0;
+  uint64_t commit_latency_us_total = 0;
+  uint64_t last_batch_size = 0;
+  uint64_t pending_docs = 0;
+};
+
+// Document keyed by its unique id term ("ID" + task_id); without a
+// document, the one holding the term is deleted.
+using PendingDocument =
+    std::pair<std::string, std::optional<Xapian::Document>>;
+// Docid assigned to a committed document, or that a deletion removed
+// (deletions of absent ids are not reported). `doc` points into the batch
+// and is only valid while the commit hook runs.
+struct CommittedDocument {
+  Xapian::docid docid;
+  const PendingDocument *doc;
+};
+
+// Long-lived writer with a background commit thread. Concurrent Submit()
+// calls are merged into one transaction which is committed once
+// batch_docs documents are pending or batch_delay has passed since the
+// oldest pending one. Each returned future completes after the commit that
+// made its documents durable (or carries the commit error).
+//
+// Batches carrying an ingest log position are already durable in the log:
+// the highest position is stored in the same commit (kLogPositionKey), and
+// a commit that failed on a transient error (Xapian::DatabaseError, I/O,
+// memory) is retried instead of failing them, so the stored position never
+// skips an unapplied record. Any other error is the fault of a document:
+// the batches are then committed one document at a time, the refused ones
+// fail their batch's future, and the log position moves past them.
+class IndexWriter {
+public:
+  // Runs after each successful commit with the documents it made durable
+  // (empty for RunExclusive) and the ingest log position now stored in the
+  // database (0 if the commit carried none).
+  using CommitHook = std::function<void(
+      const std::vector<CommittedDocument> &, uint64_t log_position)>;
+
+  static constexpr const char *kLogPositionKey = "dobrika_ingest_log_position";
+
+  IndexWriter(const std::string &db_path, std::shared_mutex &db_mutex,
+              size_t batch_docs, std::chrono::milliseconds batch_delay,
+              CommitHook on_commit);
+  ~IndexWriter();
+
+  IndexWriter(const IndexWriter &) = delete;
+  IndexWriter &operator=(const IndexWriter &) = delete;
+
+  std::future<void> Submit(PendingDocument doc);
+  // log_position: sequence number of the last ingest log record in docs,
+  // or 0 for documents not written to the log. Positions must be submitted
+  // in increasing order.
+  std::future<void> Submit(std::vector<PendingDocument> docs,
+                           uint64_t log_position = 0);
+
+  // Runs fn with exclusive access to the writable database (outside the
+  // batching queue), commits and fires the commit hook. Used for one-off
+  // maintenance such as index format migrations. If atomic, fn runs in a
+  // transaction that is cancelled if it throws. Otherwise fn may commit
+  // in steps itself, as a migration too large for one transaction does.
+  void RunExclusive(const std::function<void(Xapian::WritableDatabase &)> &fn,
+                    bool atomic = true);
+
+  // Runs prepare with exclusive access, closes the database, calls swap
+  // (which may replace the files at db_path) and reopens it. Commits wait
+  // meanwhile; nothing is committed and the hook does not fire.
+  void SwapDatabase(
+      const std::function<void(Xapian::WritableDatabase &)> &prepare,
+      const std::function<void()> &swap);
+
+  // Flushes everything already submitted and joins the commit thread.
+  void Stop();
+
+  // Ingest log position stored by the last commit that carried one.
+  uint64_t CommittedLogPosition();
+
+  WriterStats GetStats() const;
+  // Transaction commit time per group commit, excluding the commit hook.
+  HistogramSnapshot GetCommitLatency() const {
+    return commit_latency.Snapshot();
+  }
+
+private:
+  struct PendingBatch {
+    std::vector<PendingDocument> docs;
+    uint64_t log_position = 0;
+    std::promise<void> done;
+  };
+
+  void CommitLoop();
+  // Returns the logged batches of a failed commit, to be retried.
+  std::vector<PendingBatch> ApplyAndCommit(std::vector<PendingBatch> &batches,
+                                           size_t doc_count, bool last_try);
+  // After a document was refused: commits every document on its own, in
+  // order. Returns the batches to retry (from the first transient failure
+  // on), with the documents already committed removed.
+  std::vector<PendingBatch> CommitEachDocument(
+      std::vector<PendingBatch> &batches, bool last_try);
+  // Stores log_position without a document, so replay skips a refused
+  // record. False if that commit failed.
+  bool SkipLogged(uint64_t log_position);
+
+  const std::string db_path;
+  Xapian::WritableDatabase wdb;
+  std::shared_mutex &db_mutex;
+  const size_t batch_docs;
+  const std::chrono::milliseconds batch_delay;
+  CommitHook on_commit;
+
+  mutable std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  std::vector<PendingBatch> queue;
+  size_t queued_docs = 0;
+  std::chrono::steady_clock::time_point oldest_enqueued;
+  bool stopping = false;
+  std::thread commit_thread;
+
+  std::atomic<uint64_t> commits_total{0};
+  std::atomic<uint64_t> commit_failures_total{0};
+  std::atomic<uint64_t> rejected_docs_total{0};
+  std::atomic<uint64_t> committed_docs_total{0};
+  std::atomic<uint64_t> commit_latency_us_total{0};
+  std::atomic<uint64_t> last_batch_size{0};
+  LatencyHistogram commit_latency;
+};
@@ -0,0 +1,405 @@
+#include "xapian_processor/ingest_log.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+// A new segment is started once the current one is this large.
+constexpr uint64_t kSegmentBytes = 64ull << 20;
+// With nothing appended for this long, a fully applied current segment is
+// removed as well.
+constexpr std::chrono::seconds kIdleReclaim{1};
+// Backoff between retries of a batch that failed to write.
+constexpr std::chrono::milliseconds kRetryMin{50};
+constexpr std::chrono::milliseconds kRetryMax{5000};
+constexpr size_t kHeaderBytes = 16;
+// Anything larger is treated as a corrupt size field.
+constexpr uint32_t kMaxPayloadBytes = 64u << 20;
+constexpr size_t kSeqDigits = 20;
+const std::string kSegmentSuffix = ".log";
+
+constexpr std::array<uint32_t, 256> Crc32cTable() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+    table[i] = c;
+  }
+  return table;
+}
+constexpr auto kCrc32c = Crc32cTable();
+
+uint32_t Crc32c(uint32_t crc, const char *data, size_t n) {
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i)
+    crc = kCrc32c[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^
+          (crc >> 8);
+  return ~crc;
+}
+
+void PutLE(std::string &out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+uint64_t GetLE(const char *p, int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i)
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  return v;
+}
+
+void AppendRecord(std::string &out, uint64_t seq, const std::string &payload) {
+  std::string seq_bytes;
+  PutLE(seq_bytes, seq, 8);
+  uint32_t crc = Crc32c(0, seq_bytes.data(), seq_bytes.size());
+  crc = Crc32c(crc, payload.data(), payload.size());
+  PutLE(out, payload.size(), 4);
+  PutLE(out, crc, 4);
+  out += seq_bytes;
+  out += payload;
+}
+
+std::string SegmentName(uint64_t first_seq) {
+  std::string digits = std::to_string(first_seq);
+  return std::string(kSeqDigits - digits.size(), '0') + digits +
+         kSegmentSuffix;
+}
+
+// Walks the intact records of a segment, stopping at the first torn or
+// corrupt one. Records not above after_seq are copies a retried batch
+// wrote again after a failed write; they are skipped. Returns the length
+// of the intact prefix.
+uint64_t
+ScanSegment(const fs::path &path, uint64_t &after_seq,
+            const std::function<void(uint64_t, std::string_view)> &fn) {
+  std::ifstream in(path, std::ios::binary);
+  const std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  size_t pos = 0;
+  while (data.size() - pos >= kHeaderBytes) {
+    const char *h = data.data() + pos;
+    const uint64_t size = GetLE(h, 4);
+    const uint32_t crc = static_cast<uint32_t>(GetLE(h + 4, 4));
+    const uint64_t seq = GetLE(h + 8, 8);
+    if (size > kMaxPayloadBytes || data.size() - pos - kHeaderBytes < size)
+      break;
+    const char *payload = h + kHeaderBytes;
+    if (Crc32c(Crc32c(0, h + 8, 8), payload, size) != crc)
+      break;
+    if (seq > after_seq) {
+      if (fn)
+        fn(seq, std::string_view(payload, size));
+      after_seq = seq;
+    }
+    pos += kHeaderBytes + size;
+  }
+  return pos;
+}
+
+bool WriteAll(int fd, const char *data, size_t n) {
+  while (n > 0) {
+    const ssize_t w = ::write(fd, data, n);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += w;
+    n -= static_cast<size_t>(w);
+  }
+  return true;
+}
+
+bool FsyncDir(const fs::path &dir) {
+  const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  const bool ok = ::fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
+} // namespace
+
+IngestLog::IngestLog(fs::path dir, uint64_t applied, uint64_t highest)
+    : dir(std::move(dir)) {
+  fs::create_directories(this->dir);
+  for (const auto &entry : fs::directory_iterator(this->dir)) {
+    const std::string name = entry.path().filename().string();
+    if (name.size() != kSeqDigits + kSegmentSuffix.size() ||
+        name.compare(kSeqDigits, std::string::npos, kSegmentSuffix) != 0 ||
+        !std::all_of(name.begin(), name.begin() + kSeqDigits,
+                     [](char c) { return c >= '0' && c <= '9'; }))
+      continue;
+    segments.push_back({std::stoull(name.substr(0, kSeqDigits)), entry.path()});
+  }
+  std::sort(segments.begin(), segments.end(),
+            [](const Segment &a, const Segment &b) {
+              return a.first_seq < b.first_seq;
+            });
+
+  // A bad record is a torn tail: cut it off. Records are only appended to
+  // the newest segment, except that a batch which failed to write is
+  // retried in a new one, so a later segment is kept if it continues from
+  // the intact records; otherwise it goes too.
+  uint64_t seq = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const uint64_t intact = ScanSegment(segments[i].path, seq, nullptr);
+    if (intact == fs::file_size(segments[i].path))
+      continue;
+    fs::resize_file(segments[i].path, intact);
+    if (i + 1 < segments.size() && segments[i + 1].first_seq <= seq + 1)
+      continue;
+    while (segments.size() > i + 1) {
+      fs::remove(segments.back().path);
+      segments.pop_back();
+    }
+    break;
+  }
+
+  last_seq = durable_seq = std::max({seq, applied, highest});
+  applied_seq.store(applied, std::memory_order_relaxed);
+  if (!segments.empty()) {
+    fd = ::open(segments.back().path.c_str(),
+                O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("cannot open ingest log segment " +
+                               segments.back().path.string());
+    segment_bytes = fs::file_size(segments.back().path);
+  }
+  segment_count.store(segments.size(), std::memory_order_relaxed);
+  flusher = std::thread([this]() { FlushLoop(); });
+}
+
+IngestLog::~IngestLog() { Stop(); }
+
+void IngestLog::Replay(
+    const std::function<void(uint64_t, std::string_view)> &fn) {
+  const uint64_t applied = applied_seq.load(std::memory_order_relaxed);
+  uint64_t seq = 0;
+  for (const auto &segment : segments) {
+    ScanSegment(segment.path, seq,
+                [&](uint64_t record_seq, std::string_view payload) {
+                  if (record_seq <= applied)
+                    return;
+                  fn(record_seq, payload);
+                  replayed_records.fetch_add(1, std::memory_order_relaxed);
+                });
+  }
+  std::lock_guard<std::mutex> lk(mutex);
+  replayed = true;
+}
+
+uint64_t IngestLog::Append(const std::vector<std::string> &payloads,
+                           const std::function<void(uint64_t)> &sequenced) {
+  std::unique_lock<std::mutex> lk(mutex);
+  if (write_error || stopping)
+    throw std::runtime_error("ingest log is not writable");
+  replayed = true;
+  if (payloads.empty())
+    return last_seq;
+  if (buffer.empty())
+    buffer_first_seq = last_seq + 1;
+  for (const auto &payload : payloads)
+    AppendRecord(buffer, ++last_seq, payload);
+  records_total.fetch_add(payloads.size(), std::memory_order_relaxed);
+  const uint64_t seq = last_seq;
+  if (sequenced)
+    sequenced(seq);
+  lk.unlock();
+  flush_cv.notify_one();
+  return seq;
+}
+
+void IngestLog::WaitDurable(uint64_t seq) {
+  std::unique_lock<std::mutex> lk(mutex);
+  durable_cv.wait(lk, [&] { return durable_seq >= seq || failed; });
+  if (durable_seq < seq)
+    throw std::runtime_error("ingest log write failed");
+}
+
+void IngestLog::MarkApplied(uint64_t seq) {
+  uint64_t current = applied_seq.load(std::memory_order_relaxed);
+  while (current < seq) {
+    if (applied_seq.compare_exchange_weak(current, seq,
+                                          std::memory_order_relaxed)) {
+      // Let the flusher delete the segments this completed.
+      {
+        std::lock_guard<std::mutex> lk(mutex);
+        reclaim = true;
+      }
+      flush_cv.notify_one();
+      return;
+    }
+  }
+}
+
+void IngestLog::FlushLoop() {
+  std::unique_lock<std::mutex> lk(mutex);
+  auto backoff = kRetryMin;
+  while (true) {
+    if (write_error) {
+      flush_cv.wait_for(lk, backoff, [this] { return stopping; });
+      if (stopping) {
+        failed = true;
+        durable_cv.notify_all();
+        break;
+      }
+      backoff = std::min(backoff * 2, kRetryMax);
+    } else {
+      const bool woken = flush_cv.wait_for(lk, kIdleReclaim, [this] {
+        return stopping || reclaim || !buffer.empty();
+      });
+      reclaim = false;
+      if (buffer.empty()) {
+        if (stopping)
+          break; // fully flushed
+        // Replay() may still be reading the segments.
+        if (!replayed)
+          continue;
+        lk.unlock();
+        DropAppliedSegments(!woken);
+        lk.lock();
+        continue;
+      }
+    }
+    // Appends during the write and sync below go to the next batch.
+    std::string batch;
+    batch.swap(buffer);
+    const uint64_t first = buffer_first_seq;
+    const uint64_t last = last_seq;
+    lk.unlock();
+    const bool ok = WriteBatch(batch, first);
+    if (ok) {
+      DropAppliedSegments(false);
+    } else {
+      write_errors_total.fetch_add(1, std::memory_order_relaxed);
+      AbandonSegment();
+    }
+    lk.lock();
+    if (ok) {
+      durable_seq = last;
+      write_error = false;
+      backoff = kRetryMin;
+      durable_cv.notify_all();
+    } else {
+      // Retried ahead of anything appended meanwhile.
+      write_error = true;
+      batch += buffer;
+      buffer.swap(batch);
+      buffer_first_seq = first;
+    }
+  }
+}
+
+bool IngestLog::WriteBatch(const std::string &data, uint64_t first_seq) {
+  if (fd < 0 || segment_bytes >= kSegmentBytes) {
+    const fs::path path = dir / SegmentName(first_seq);
+    const int next =
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+               0644);
+    if (next < 0)
+      return false;
+    if (fd >= 0)
+      ::close(fd);
+    fd = next;
+    segment_bytes = 0;
+    segments.push_back({first_seq, path});
+    segment_count.store(segments.size(), std::memory_order_relaxed);
+    if (!FsyncDir(dir))
+      return false;
+  }
+  if (!WriteAll(fd, data.data(), data.size()) || ::fdatasync(fd) != 0)
+    return false;
+  segment_bytes += data.size();
+  bytes_total.fetch_add(data.size(), std::memory_order_relaxed);
+  syncs_total.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+// Cuts whatever part of the failed batch reached the current segment, so
+// the segment ends at an intact record, and makes the retry start a new
+// one. A segment holding nothing else is removed instead.
+void IngestLog::AbandonSegment() {
+  if (fd < 0)
+    return;
+  if (segment_bytes == 0) {
+    std::error_code ec;
+    fs::remove(segments.back().path, ec);
+    segments.pop_back();
+  } else {
+    // Best effort: if this fails, opening the log cuts the torn tail and
+    // skips the records the retry writes again.
+    [[maybe_unused]] const int rc =
+        ::ftruncate(fd, static_cast<off_t>(segment_bytes));
+  }
+  ::close(fd);
+  fd = -1;
+  segment_bytes = 0;
+  segment_count.store(segments.size(), std::memory_order_relaxed);
+}
+
+// Runs on the flusher, the only thread that changes segments, fd and
+// durable_seq.
+void IngestLog::DropAppliedSegments(bool idle) {
+  const uint64_t applied = applied_seq.load(std::memory_order_relaxed);
+  // The oldest segment ends right before the next one starts.
+  while (segments.size() > 1 && segments[1].first_seq <= applied + 1) {
+    std::error_code ec;
+    fs::remove(segments.front().path, ec);
+    segments.pop_front();
+  }
+  // The current segment ends at durable_seq. Once that is applied and no
+  // append is coming, it can go too; the next write starts a new one.
+  if (idle && segments.size() == 1 && applied >= durable_seq) {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+    segment_bytes = 0;
+    std::error_code ec;
+    fs::remove(segments.front().path, ec);
+    segments.pop_front();
+  }
+  segment_count.store(segments.size(), std::memory_order_relaxed);
+}
+
+void IngestLog::Stop() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopping = true;
+  }
+  flush_cv.notify_all();
+  if (flusher.joinable())
+    flusher.join();
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+IngestLogStats IngestLog::GetStats() const {
+  IngestLogStats stats;
+  stats.records_total = records_total.load(std::memory_order_relaxed);
+  stats.bytes_total = bytes_total.load(std::memory_order_relaxed);
+  stats.syncs_total = syncs_total.load(std::memory_order_relaxed);
+  stats.write_errors_total =
+      write_errors_total.load(std::memory_order_relaxed);
+  stats.replayed_records = replayed_records.load(std::memory_order_relaxed);
+  stats.segments = segment_count.load(std::memory_order_relaxed);
+  const uint64_t applied = applied_seq.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lk(mutex);
+  stats.lag_records = last_seq > applied ? last_seq - applied : 0;
+  return stats;
+}
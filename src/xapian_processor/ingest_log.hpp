@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct IngestLogStats {
+  uint64_t records_total = 0;
+  uint64_t bytes_total = 0;
+  uint64_t syncs_total = 0;
+  // Failed writes or syncs of a batch (each one retried).
+  uint64_t write_errors_total = 0;
+  // Records made durable by the log but not yet committed to Xapian.
+  uint64_t lag_records = 0;
+  uint64_t replayed_records = 0;
+  uint64_t segments = 0;
+};
+
+// Append-only, checksummed log of index records in front of the Xapian
+// writer. Records get consecutive sequence numbers and are written by one
+// flusher thread that fsyncs once per batch, so concurrent appenders share
+// a sync. Segment files are named after their first sequence number and
+// removed once every record in them is applied (committed to Xapian); the
+// segment being written is removed too once the log has been idle and
+// fully applied for a second. A batch whose write or sync fails is cut
+// from its segment and retried in a fresh one, with backoff.
+//
+// Record layout: u32 payload size, u32 CRC-32C of (seq, payload), u64 seq,
+// payload; little endian. A torn or corrupt record ends the log: it is cut
+// off when the log is opened.
+class IngestLog {
+public:
+  // Opens or creates the log in dir. applied is the position every shard
+  // has checkpointed, highest the newest any shard has (the same without
+  // shards). Sequence numbers continue after the last intact record and
+  // never go back to or below highest.
+  IngestLog(std::filesystem::path dir, uint64_t applied, uint64_t highest);
+  ~IngestLog();
+
+  IngestLog(const IngestLog &) = delete;
+  IngestLog &operator=(const IngestLog &) = delete;
+
+  // Calls fn for every intact record with a sequence number above
+  // `applied`, in order. Only meaningful before the first Append().
+  void Replay(const std::function<void(uint64_t, std::string_view)> &fn);
+
+  // Assigns sequence numbers to payloads and queues them for the flusher.
+  // sequenced(last) runs under the log's lock, so whatever it hands the
+  // records to sees them in log order. Returns the last sequence number;
+  // the records are durable once WaitDurable() for it returns. Throws
+  // while a failed batch is waiting for its retry.
+  uint64_t Append(const std::vector<std::string> &payloads,
+                  const std::function<void(uint64_t)> &sequenced);
+  // Throws if the log stopped before the records could be written.
+  void WaitDurable(uint64_t seq);
+
+  // Everything up to seq is committed to Xapian.
+  void MarkApplied(uint64_t seq);
+
+  // Flushes what was appended and joins the flusher.
+  void Stop();
+
+  IngestLogStats GetStats() const;
+
+private:
+  struct Segment {
+    uint64_t first_seq;
+    std::filesystem::path path;
+  };
+
+  void FlushLoop();
+  bool WriteBatch(const std::string &data, uint64_t first_seq);
+  void AbandonSegment();
+  void DropAppliedSegments(bool idle);
+
+  const std::filesystem::path dir;
+  std::deque<Segment> segments;
+  int fd = -1;
+  uint64_t segment_bytes = 0;
+
+  mutable std::mutex mutex;
+  std::condition_variable flush_cv;
+  std::condition_variable durable_cv;
+  std::string buffer;
+  uint64_t buffer_first_seq = 0;
+  uint64_t last_seq = 0;
+  uint64_t durable_seq = 0;
+  // The last batch failed and is back in buffer for a retry.
+  bool write_error = false;
+  // Stopped with records that never became durable.
+  bool failed = false;
+  // MarkApplied() moved the applied position.
+  bool reclaim = false;
+  // Replay() or Append() ran; segments may be deleted from now on.
+  bool replayed = false;
+  bool stopping = false;
+  std::thread flusher;
+
+  std::atomic<uint64_t> applied_seq{0};
+  std::atomic<uint64_t> records_total{0};
+  std::atomic<uint64_t> bytes_total{0};
+  std::atomic<uint64_t> syncs_total{0};
+  std::atomic<uint64_t> write_errors_total{0};
+  std::atomic<uint64_t> replayed_records{0};
+  std::atomic<uint64_t> segment_count{0};
+};
@@ -0,0 +1,47 @@
+#include "xapian_processor/query_context.hpp"
+
+QueryContext::QueryContext(size_t max_entries, QueryCacheCounters &counters)
+    : max_entries(max_entries), counters(counters) {
+  parser.set_stemmer(Xapian::Stem("russian"));
+  parser.set_stemming_strategy(Xapian::QueryParser::STEM_SOME);
+}
+
+Xapian::Query QueryContext::Parse(const std::string &text) {
+  if (max_entries == 0) {
+    counters.misses.fetch_add(1, std::memory_order_relaxed);
+    return parser.parse_query(text, Xapian::QueryParser::FLAG_DEFAULT);
+  }
+  std::string key = NormaliseQueryText(text);
+  if (auto it = index.find(key); it != index.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    counters.hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second->second;
+  }
+  counters.misses.fetch_add(1, std::memory_order_relaxed);
+  Xapian::Query query =
+      parser.parse_query(key, Xapian::QueryParser::FLAG_DEFAULT);
+  lru.emplace_front(std::move(key), query);
+  index.emplace(lru.front().first, lru.begin());
+  if (lru.size() > max_entries) {
+    index.erase(lru.back().first);
+    lru.pop_back();
+  }
+  return query;
+}
+
+std::string NormaliseQueryText(std::string_view text) {
+  std::string out;
+  out.reserve(text.size());
+  bool space = false;
+  for (char c : text) {
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      space = true;
+      continue;
+    }
+    if (space && !out.empty())
+      out += ' ';
+    space = false;
+    out += c;
+  }
+  return out;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <xapian.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct QueryCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+// Shared by every QueryContext of a ReaderPool.
+struct QueryCacheCounters {
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+};
+
+// QueryParser (Russian stemmer, STEM_SOME) kept alive across searches, plus
+// an LRU of parsed queries keyed by NormaliseQueryText(). Like the database
+// handle it lives next to, a context is used by one thread at a time:
+// Xapian::Query copies share a non-atomic refcount, so cached queries must
+// never reach another thread.
+//
+// FLAG_DEFAULT parses without looking at the database (no wildcards or
+// spelling), so cached queries stay valid across commits; Bind() only
+// keeps the parser pointed at the current generation.
+class QueryContext {
+public:
+  // max_entries 0 disables the cache; the parser is still reused.
+  QueryContext(size_t max_entries, QueryCacheCounters &counters);
+
+  QueryContext(const QueryContext &) = delete;
+  QueryContext &operator=(const QueryContext &) = delete;
+
+  void Bind(const Xapian::Database &db) { parser.set_database(db); }
+  Xapian::Query Parse(const std::string &text);
+
+  size_t Size() const { return lru.size(); }
+
+private:
+  Xapian::QueryParser parser;
+  const size_t max_entries;
+  QueryCacheCounters &counters;
+  // Most recently used first.
+  std::list<std::pair<std::string, Xapian::Query>> lru;
+  std::unordered_map<std::string_view,
+                     std::list<std::pair<std::string, Xapian::Query>>::iterator>
+      index;
+};
+
+// Query text with surrounding whitespace trimmed and inner runs collapsed
+// to one space. Case is kept: the parser treats AND/OR/NOT as operators
+// only in upper case.
+std::string NormaliseQueryText(std::string_view text);
@@ -0,0 +1,64 @@
+#include "xapian_processor/random_sampler.hpp"
+
+#include <algorithm>
+
+namespace {
+uint64_t SplitMix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+constexpr int kFeistelRounds = 4;
+} // namespace
+
+DocidPermutation::DocidPermutation(uint64_t domain, uint64_t seed)
+    : domain(domain), seed(seed) {
+  while (half_bits < 32 && Span() < domain) {
+    ++half_bits;
+  }
+}
+
+std::optional<uint64_t> DocidPermutation::At(uint64_t index) const {
+  const uint64_t mask = (uint64_t{1} << half_bits) - 1;
+  uint64_t left = index >> half_bits;
+  uint64_t right = index & mask;
+  for (int round = 0; round < kFeistelRounds; ++round) {
+    const uint64_t f = SplitMix64(seed ^ (right * 0x100000001b3ULL) ^
+                                  static_cast<uint64_t>(round)) &
+                       mask;
+    const uint64_t next = left ^ f;
+    left = right;
+    right = next;
+  }
+  const uint64_t value = (left << half_bits) | right;
+  if (value >= domain)
+    return std::nullopt;
+  return value;
+}
+
+uint64_t SampleHash(uint64_t seed, Xapian::docid docid) {
+  return SplitMix64(seed ^ SplitMix64(docid));
+}
+
+bool BottomKSampler::operator()(const Xapian::Document &doc) const {
+  const Xapian::docid docid = doc.get_docid();
+  const uint64_t h = SampleHash(seed, docid);
+  if (h <= after || k == 0)
+    return false;
+  if (heap.size() < k) {
+    heap.emplace_back(h, docid);
+    std::push_heap(heap.begin(), heap.end());
+  } else if (h < heap.front().first) {
+    std::pop_heap(heap.begin(), heap.end());
+    heap.back() = {h, docid};
+    std::push_heap(heap.begin(), heap.end());
+  }
+  return false;
+}
+
+std::vector<std::pair<uint64_t, Xapian::docid>> BottomKSampler::Take() {
+  std::sort_heap(heap.begin(), heap.end());
+  return std::move(heap);
+}
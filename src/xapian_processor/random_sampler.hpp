@@ -0,0 +1,51 @@
+#pragma once
+#include <xapian.h>
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Seeded pseudo-random bijection over [0, 4^k) (a balanced Feistel network
+// with k-bit halves), restricted to [0, domain) by skipping indexes that
+// map outside it. Walking indexes 0, 1, 2, ... visits every value below
+// domain exactly once in a seed-dependent order, at O(1) per step and
+// without materialising anything.
+class DocidPermutation {
+public:
+  DocidPermutation(uint64_t domain, uint64_t seed);
+
+  // Number of indexes to walk; at most 4 * domain.
+  uint64_t Span() const { return uint64_t{1} << (2 * half_bits); }
+  std::optional<uint64_t> At(uint64_t index) const;
+
+private:
+  uint64_t domain;
+  uint64_t seed;
+  unsigned half_bits = 1;
+};
+
+// Per-session pseudo-random rank of a document.
+uint64_t SampleHash(uint64_t seed, Xapian::docid docid);
+
+// Bottom-k sampling over whatever the match yields: keeps the k documents
+// with the smallest SampleHash above `after` and rejects everything, so
+// the matcher just streams the filter's posting lists through it. Later
+// pages resume after the last hash returned, so a session never repeats.
+class BottomKSampler : public Xapian::MatchDecider {
+public:
+  BottomKSampler(uint64_t seed, size_t k, uint64_t after)
+      : seed(seed), k(k), after(after) {}
+
+  bool operator()(const Xapian::Document &doc) const override;
+
+  // (hash, docid) in ascending hash order.
+  std::vector<std::pair<uint64_t, Xapian::docid>> Take();
+
+private:
+  uint64_t seed;
+  size_t k;
+  uint64_t after;
+  // Max-heap on hash.
+  mutable std::vector<std::pair<uint64_t, Xapian::docid>> heap;
+};
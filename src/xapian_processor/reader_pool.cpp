@@ -0,0 +1,95 @@
+#include "xapian_processor/reader_pool.hpp"
+
+#include "xapian_processor/shards.hpp"
+
+ReaderPool::Handle::Handle(ReaderPool &pool)
+    : db(OpenCombined(pool.shard_paths)),
+      context(pool.query_cache_entries, pool.query_cache) {
+  context.Bind(db);
+}
+
+ReaderPool::ReaderPool(std::vector<std::string> shard_paths,
+                       size_t query_cache_entries)
+    : shard_paths(std::move(shard_paths)),
+      query_cache_entries(query_cache_entries) {}
+
+ReaderPool::Lease ReaderPool::Acquire() {
+  std::unique_ptr<Handle> handle;
+  {
+    std::lock_guard<std::mutex> lk(idle_mutex);
+    if (!idle.empty()) {
+      handle = std::move(idle.back());
+      idle.pop_back();
+    }
+  }
+  // Read the generation before reopening: a commit that lands during the
+  // reopen bumps it again and the next lease catches up.
+  const uint64_t current = Generation();
+  if (!handle) {
+    // Likewise the epoch: files swapped in during the open get the handle
+    // dropped on release.
+    const uint64_t opened_epoch = epoch.load(std::memory_order_acquire);
+    handle = std::make_unique<Handle>(*this);
+    handle->generation = current;
+    handle->epoch = opened_epoch;
+    std::lock_guard<std::mutex> lk(idle_mutex);
+    ++total_handles;
+  } else if (handle->generation != current) {
+    const auto start = std::chrono::steady_clock::now();
+    handle->db.reopen();
+    handle->context.Bind(handle->db);
+    reopen_latency.ObserveSince(start);
+    handle->generation = current;
+  }
+  return Lease(*this, std::move(handle));
+}
+
+std::vector<Xapian::Database> &ReaderPool::Shards(Handle &handle) {
+  if (handle.shards.empty()) {
+    for (const auto &path : shard_paths) {
+      handle.shards.emplace_back(path);
+      handle.shard_contexts.push_back(
+          std::make_unique<QueryContext>(query_cache_entries, query_cache));
+      handle.shard_contexts.back()->Bind(handle.shards.back());
+    }
+    handle.shards_generation = handle.generation;
+  } else if (handle.shards_generation != handle.generation) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < handle.shards.size(); ++s) {
+      handle.shards[s].reopen();
+      handle.shard_contexts[s]->Bind(handle.shards[s]);
+    }
+    reopen_latency.ObserveSince(start);
+    handle.shards_generation = handle.generation;
+  }
+  return handle.shards;
+}
+
+void ReaderPool::Release(std::unique_ptr<Handle> handle) {
+  {
+    std::lock_guard<std::mutex> lk(idle_mutex);
+    if (handle->epoch == epoch.load(std::memory_order_relaxed)) {
+      idle.push_back(std::move(handle));
+      return;
+    }
+    --total_handles;
+  }
+  // Closed outside the lock.
+  handle.reset();
+}
+
+void ReaderPool::DropHandles() {
+  std::vector<std::unique_ptr<Handle>> dropped;
+  {
+    std::lock_guard<std::mutex> lk(idle_mutex);
+    epoch.fetch_add(1, std::memory_order_release);
+    total_handles -= idle.size();
+    dropped.swap(idle);
+  }
+  BumpGeneration();
+}
+
+size_t ReaderPool::HandleCount() const {
+  std::lock_guard<std::mutex> lk(idle_mutex);
+  return total_handles;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <xapian.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tools/latency_histogram.hpp"
+#include "xapian_processor/query_context.hpp"
+
+// Pool of read-only database handles tagged with the write generation they
+// were last reopened at. A handle is owned by exactly one thread while
+// leased, so Xapian::Database is never shared between threads, and it is
+// reopened lazily by that thread only when the generation has moved since.
+// Writers just bump the generation counter and never touch the handles.
+//
+// With several shards a handle's db() is all of them combined; the
+// per-shard databases for fan-out queries are opened on first use.
+//
+// Every database comes with a QueryContext that is rebound whenever the
+// database is reopened, so parsers and parsed queries are per handle too.
+class ReaderPool {
+private:
+  struct Handle {
+    explicit Handle(ReaderPool &pool);
+    Xapian::Database db;
+    QueryContext context;
+    uint64_t generation = 0;
+    std::vector<Xapian::Database> shards;
+    std::vector<std::unique_ptr<QueryContext>> shard_contexts;
+    uint64_t shards_generation = 0;
+    // DropHandles() calls made before the handle was opened.
+    uint64_t epoch = 0;
+  };
+
+public:
+  class Lease {
+  public:
+    Lease(ReaderPool &pool, std::unique_ptr<Handle> handle)
+        : pool(&pool), handle(std::move(handle)) {}
+    Lease(Lease &&) = default;
+    Lease &operator=(Lease &&) = delete;
+    ~Lease() {
+      if (handle)
+        pool->Release(std::move(handle));
+    }
+
+    Xapian::Database &db() { return handle->db; }
+    // One database per shard, at least as new as db(). Each may be used by
+    // a different thread while the lease is held.
+    std::vector<Xapian::Database> &shards() { return pool->Shards(*handle); }
+    // Parser and query cache for db().
+    QueryContext &context() { return handle->context; }
+    // Same for shards()[shard]; valid once shards() was called.
+    QueryContext &shard_context(size_t shard) {
+      return *handle->shard_contexts[shard];
+    }
+    uint64_t generation() const { return handle->generation; }
+    // Forces a reopen on the next acquire (e.g. after DatabaseModifiedError).
+    void Invalidate() { handle->generation = kStale; }
+
+  private:
+    ReaderPool *pool;
+    std::unique_ptr<Handle> handle;
+  };
+
+  // query_cache_entries: parsed queries kept per database handle.
+  ReaderPool(std::vector<std::string> shard_paths, size_t query_cache_entries);
+
+  Lease Acquire();
+
+  // Called by the writer after every commit.
+  void BumpGeneration() { generation.fetch_add(1, std::memory_order_release); }
+  uint64_t Generation() const {
+    return generation.load(std::memory_order_acquire);
+  }
+  // Called after database files were replaced rather than committed to
+  // (compaction): handles can't reopen onto those, so idle ones are closed
+  // and leased ones are closed on release. Searches still running keep
+  // reading the old files.
+  void DropHandles();
+
+  size_t HandleCount() const;
+  // Time spent catching handles up with the writer in Acquire().
+  HistogramSnapshot GetReopenLatency() const { return reopen_latency.Snapshot(); }
+  QueryCacheStats GetQueryCacheStats() const {
+    return {query_cache.hits.load(std::memory_order_relaxed),
+            query_cache.misses.load(std::memory_order_relaxed)};
+  }
+
+private:
+  static constexpr uint64_t kStale = ~uint64_t{0};
+
+  void Release(std::unique_ptr<Handle> handle);
+  std::vector<Xapian::Database> &Shards(Handle &handle);
+
+  const std::vector<std::string> shard_paths;
+  const size_t query_cache_entries;
+  QueryCacheCounters query_cache;
+  std::atomic<uint64_t> generation{1};
+  // Changed under idle_mutex, so idle never holds a dropped handle.
+  std::atomic<uint64_t> epoch{0};
+  mutable std::mutex idle_mutex;
+  std::vector<std::unique_ptr<Handle>> idle;
+  size_t total_handles = 0;
+  LatencyHistogram reopen_latency;
+};
@@ -0,0 +1,117 @@
+#include "xapian_processor/replication_log.hpp"
+
+#include <chrono>
+#include <random>
+
+namespace {
+constexpr size_t kChangesetHeaderBytes = 24;
+constexpr size_t kEntryHeaderBytes = 8;
+
+void PutLE(std::string &out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+uint64_t GetLE(const char *p, int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i)
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  return v;
+}
+
+uint64_t NewEpoch() {
+  std::random_device rd;
+  const uint64_t random = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+  const uint64_t now = static_cast<uint64_t>(
+      std::chrono::system_clock::now().time_since_epoch().count());
+  // Never 0, which followers use for "not synced".
+  return (random ^ now) | 1;
+}
+} // namespace
+
+void AppendChangeset(std::string &out, const Changeset &changeset) {
+  PutLE(out, changeset.seq, 8);
+  PutLE(out, changeset.shard, 4);
+  PutLE(out, static_cast<uint64_t>(changeset.commit_unix_ms), 8);
+  PutLE(out, changeset.entries.size(), 4);
+  for (const auto &entry : changeset.entries) {
+    PutLE(out, entry.docid, 4);
+    PutLE(out, entry.document.size(), 4);
+    out += entry.document;
+  }
+}
+
+bool ParseChangesets(std::string_view body, std::vector<Changeset> &out) {
+  size_t pos = 0;
+  while (pos < body.size()) {
+    if (body.size() - pos < kChangesetHeaderBytes)
+      return false;
+    const char *p = body.data() + pos;
+    Changeset changeset;
+    changeset.seq = GetLE(p, 8);
+    changeset.shard = static_cast<uint32_t>(GetLE(p + 8, 4));
+    changeset.commit_unix_ms = static_cast<int64_t>(GetLE(p + 12, 8));
+    const uint64_t count = GetLE(p + 20, 4);
+    pos += kChangesetHeaderBytes;
+    for (uint64_t i = 0; i < count; ++i) {
+      if (body.size() - pos < kEntryHeaderBytes)
+        return false;
+      p = body.data() + pos;
+      Changeset::Entry entry;
+      entry.docid = static_cast<Xapian::docid>(GetLE(p, 4));
+      const uint64_t size = GetLE(p + 4, 4);
+      pos += kEntryHeaderBytes;
+      if (body.size() - pos < size)
+        return false;
+      entry.document.assign(body.data() + pos, size);
+      pos += size;
+      changeset.entries.push_back(std::move(entry));
+    }
+    out.push_back(std::move(changeset));
+  }
+  return true;
+}
+
+ReplicationLog::ReplicationLog(size_t max_bytes)
+    : max_bytes(max_bytes), epoch(NewEpoch()) {}
+
+uint64_t ReplicationLog::LastSeq() const {
+  std::lock_guard<std::mutex> lk(mutex);
+  return last_seq;
+}
+
+void ReplicationLog::Publish(Changeset changeset) {
+  std::lock_guard<std::mutex> lk(mutex);
+  changeset.seq = ++last_seq;
+  std::string encoded;
+  AppendChangeset(encoded, changeset);
+  bytes += encoded.size();
+  held.push_back({changeset.seq, std::move(encoded)});
+  while (bytes > max_bytes && held.size() > 1) {
+    bytes -= held.front().encoded.size();
+    held.pop_front();
+  }
+}
+
+bool ReplicationLog::Read(uint64_t after, size_t max_bytes,
+                          std::string &out) const {
+  std::lock_guard<std::mutex> lk(mutex);
+  if (after > last_seq)
+    return false;
+  if (after == last_seq)
+    return true;
+  // Sequence numbers in `held` are consecutive.
+  if (held.empty() || after + 1 < held.front().seq)
+    return false;
+  for (size_t i = after + 1 - held.front().seq; i < held.size(); ++i) {
+    out += held[i].encoded;
+    if (out.size() >= max_bytes)
+      break;
+  }
+  return true;
+}
+
+ReplicationLogStats ReplicationLog::GetStats() const {
+  std::lock_guard<std::mutex> lk(mutex);
+  return {last_seq, held.size(), bytes};
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <xapian.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What one shard commit changed, as shipped from the leader to read
+// replicas. Docids are the shard's own, so a follower that applies every
+// changeset in order holds the same docids as the leader and cursors work
+// against either.
+struct Changeset {
+  struct Entry {
+    Xapian::docid docid = 0;
+    // Xapian::Document::serialise(); empty if the document was deleted.
+    std::string document;
+  };
+  // 0 for a snapshot page.
+  uint64_t seq = 0;
+  uint32_t shard = 0;
+  int64_t commit_unix_ms = 0;
+  std::vector<Entry> entries;
+};
+
+// Wire layout: u64 seq, u32 shard, i64 commit_unix_ms, u32 entry count,
+// then per entry u32 docid, u32 size, document bytes; little endian.
+// Bodies are changesets back to back.
+void AppendChangeset(std::string &out, const Changeset &changeset);
+// False if body is truncated or malformed.
+bool ParseChangesets(std::string_view body, std::vector<Changeset> &out);
+
+struct ReplicationLogStats {
+  uint64_t last_seq = 0;
+  uint64_t changesets = 0;
+  uint64_t bytes = 0;
+};
+
+// Recent changesets of the leader, kept encoded in memory up to max_bytes
+// (the newest one is always kept). Sequence numbers count up from 1 across
+// all shards. The log starts empty on every start under a new random
+// epoch; a follower that sees another epoch, or asks for changesets that
+// were already evicted, has to resync from a snapshot.
+class ReplicationLog {
+public:
+  explicit ReplicationLog(size_t max_bytes);
+
+  ReplicationLog(const ReplicationLog &) = delete;
+  ReplicationLog &operator=(const ReplicationLog &) = delete;
+
+  uint64_t Epoch() const { return epoch; }
+  uint64_t LastSeq() const;
+
+  // Assigns the next sequence number. Changesets of one shard must be
+  // published in commit order.
+  void Publish(Changeset changeset);
+
+  // Appends the changesets after `after` to out, stopping once out holds
+  // max_bytes (at least one changeset is returned if any is newer). False
+  // if some of them are no longer held.
+  bool Read(uint64_t after, size_t max_bytes, std::string &out) const;
+
+  ReplicationLogStats GetStats() const;
+
+private:
+  struct Held {
+    uint64_t seq;
+    std::string encoded;
+  };
+
+  const size_t max_bytes;
+  const uint64_t epoch;
+  mutable std::mutex mutex;
+  std::deque<Held> held;
+  uint64_t last_seq = 0;
+  uint64_t bytes = 0;
+};
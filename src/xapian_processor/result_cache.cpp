@@ -0,0 +1,183 @@
+#include "xapian_processor/result_cache.hpp"
+
+#include "static.hpp"
+#include "tools/dse_tools.hpp"
+
+#include <xapian.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+
+ResultCache::ResultCache(size_t max_bytes, size_t shard_count,
+                         std::chrono::milliseconds max_stale)
+    : shard_budget(max_bytes / std::max<size_t>(shard_count, 1)),
+      max_stale(max_stale) {
+  shards.reserve(std::max<size_t>(shard_count, 1));
+  for (size_t i = 0; i < std::max<size_t>(shard_count, 1); ++i) {
+    shards.push_back(std::make_unique<Shard>());
+  }
+}
+
+ResultCache::Shard &ResultCache::ShardFor(const std::string &key) {
+  return *shards[std::hash<std::string>{}(key) % shards.size()];
+}
+
+bool ResultCache::Fresh(const Entry &e, uint64_t generation) const {
+  if (e.generation == generation)
+    return true;
+  return max_stale.count() > 0 &&
+         std::chrono::steady_clock::now() - e.stored_at <= max_stale;
+}
+
+std::optional<DSearchResult> ResultCache::Get(const std::string &key,
+                                              uint64_t generation) {
+  Shard &shard = ShardFor(key);
+  std::lock_guard<std::mutex> lk(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+  if (!Fresh(*it->second, generation)) {
+    shard.bytes -= it->second->bytes;
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  hits.fetch_add(1, std::memory_order_relaxed);
+  return it->second->result;
+}
+
+void ResultCache::Put(const std::string &key, uint64_t generation,
+                      const DSearchResult &result) {
+  // Key is stored twice (list entry and index).
+  const size_t bytes = 2 * key.size() + result.SpaceUsedLong() + 128;
+  if (bytes > shard_budget)
+    return;
+  Shard &shard = ShardFor(key);
+  std::lock_guard<std::mutex> lk(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    shard.bytes -= it->second->bytes;
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+  }
+  while (!shard.lru.empty() && shard.bytes + bytes > shard_budget) {
+    shard.bytes -= shard.lru.back().bytes;
+    shard.index.erase(shard.lru.back().key);
+    shard.lru.pop_back();
+    evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+  shard.lru.push_front(
+      Entry{key, generation, std::chrono::steady_clock::now(), result, bytes});
+  shard.index.emplace(key, shard.lru.begin());
+  shard.bytes += bytes;
+}
+
+ResultCacheStats ResultCache::GetStats() const {
+  ResultCacheStats stats;
+  stats.hits = hits.load(std::memory_order_relaxed);
+  stats.misses = misses.load(std::memory_order_relaxed);
+  stats.evictions = evictions.load(std::memory_order_relaxed);
+  for (const auto &shard : shards) {
+    std::lock_guard<std::mutex> lk(shard->mutex);
+    stats.entries += shard->index.size();
+    stats.bytes += shard->bytes;
+  }
+  return stats;
+}
+
+namespace {
+std::string FormatRounded(double v, int precision) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%.*f", precision, v);
+  return buf;
+}
+} // namespace
+
+void RoundRequestGeo(DSearchRequest &request, int geo_precision) {
+  const auto geo = ParseGeo(request.geo_data());
+  if (!geo)
+    return;
+  request.set_geo_data(FormatRounded(geo->first, geo_precision) + "," +
+                       FormatRounded(geo->second, geo_precision));
+}
+
+std::string MakeQueryKey(const DSearchRequest &request, int geo_precision) {
+  std::string key = request.query_type();
+  key += '\x1f';
+
+  // Xapian lower-cases full Unicode (the queries are mostly Cyrillic).
+  bool space = true;
+  for (char c : Xapian::Unicode::tolower(request.user_query())) {
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      space = true;
+      continue;
+    }
+    if (space && key.back() != '\x1f')
+      key += ' ';
+    space = false;
+    key += c;
+  }
+  key += '\x1f';
+
+  std::vector<std::string> tags(request.user_tags().begin(),
+                                request.user_tags().end());
+  std::sort(tags.begin(), tags.end());
+  tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+  for (const auto &tag : tags) {
+    key += tag;
+    key += '\x1e';
+  }
+  key += '\x1f';
+  std::vector<std::string> excluded(request.exclude_tags().begin(),
+                                    request.exclude_tags().end());
+  std::sort(excluded.begin(), excluded.end());
+  excluded.erase(std::unique(excluded.begin(), excluded.end()),
+                 excluded.end());
+  for (const auto &tag : excluded) {
+    key += tag;
+    key += '\x1e';
+  }
+  key += '\x1f';
+  key += request.all_tags() ? "all" : "any";
+  key += '\x1f';
+  key += request.task_type();
+  key += '\x1f';
+  if (request.seed() != 0)
+    key += std::to_string(request.seed());
+  key += '\x1f';
+
+  // Only geo and radius searches look at the position; leaving it out
+  // elsewhere lets searches from different places share an entry.
+  if (GetTaskType(request) != DSQueryTypeEnum::SGeoTasks &&
+      request.radius_km() <= 0)
+    return key;
+  if (const auto geo = ParseGeo(request.geo_data())) {
+    key += FormatRounded(geo->first, geo_precision);
+    key += ',';
+    key += FormatRounded(geo->second, geo_precision);
+  }
+  key += '\x1f';
+  if (request.radius_km() > 0)
+    key += FormatRounded(request.radius_km(), 3);
+  return key;
+}
+
+std::string MakeResultCacheKey(const DSearchRequest &request,
+                               int geo_precision) {
+  std::string key = MakeQueryKey(request, geo_precision);
+  key += '\x1d';
+  if (request.has_offset())
+    key += std::to_string(request.offset());
+  key += '\x1f';
+  if (request.has_limit())
+    key += std::to_string(request.limit());
+  key += '\x1f';
+  key += request.cursor();
+  return key;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DSRequest.pb.h"
+#include "DSResponse.pb.h"
+
+struct ResultCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+};
+
+// Search result cache sharded by key hash, with an LRU per shard. Entries
+// are tagged with the write generation they were computed at and are
+// treated as misses once the generation moves on (optionally tolerating a
+// bounded staleness window under constant ingest).
+class ResultCache {
+public:
+  ResultCache(size_t max_bytes, size_t shard_count,
+              std::chrono::milliseconds max_stale);
+
+  std::optional<DSearchResult> Get(const std::string &key, uint64_t generation);
+  // generation must be read before the search ran, so a commit racing with
+  // the search leaves the entry already stale.
+  void Put(const std::string &key, uint64_t generation,
+           const DSearchResult &result);
+
+  ResultCacheStats GetStats() const;
+
+private:
+  struct Entry {
+    std::string key;
+    uint64_t generation;
+    std::chrono::steady_clock::time_point stored_at;
+    DSearchResult result;
+    size_t bytes;
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+  };
+
+  Shard &ShardFor(const std::string &key);
+  bool Fresh(const Entry &e, uint64_t generation) const;
+
+  const size_t shard_budget;
+  const std::chrono::milliseconds max_stale;
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+  std::atomic<uint64_t> evictions{0};
+};
+
+// Normalised query: query type, lower-cased and whitespace-collapsed query
+// text, sorted tags and geo rounded to geo_precision decimals. Paging is
+// not part of it.
+std::string MakeQueryKey(const DSearchRequest &request, int geo_precision);
+
+// MakeQueryKey plus the requested page.
+std::string MakeResultCacheKey(const DSearchRequest &request, int geo_precision);
+
+// Rounds geo_data in place to geo_precision decimals so every request that
+// shares a cache key also runs the same search.
+void RoundRequestGeo(DSearchRequest &request, int geo_precision);
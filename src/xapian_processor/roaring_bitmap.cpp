@@ -0,0 +1,150 @@
+#include "xapian_processor/roaring_bitmap.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void RoaringBitmap::Container::Add(uint16_t low) {
+  if (IsBitset()) {
+    uint64_t &word = bits[low >> 6];
+    const uint64_t bit = uint64_t{1} << (low & 63);
+    if (!(word & bit)) {
+      word |= bit;
+      ++cardinality;
+    }
+    return;
+  }
+  // Ids mostly arrive in increasing order (docids), so try the end first.
+  if (array.empty() || array.back() < low) {
+    array.push_back(low);
+  } else {
+    const auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (*it == low)
+      return;
+    array.insert(it, low);
+  }
+  ++cardinality;
+  if (array.size() > kArrayMax) {
+    bits.assign(kChunkWords, 0);
+    for (uint16_t v : array) {
+      bits[v >> 6] |= uint64_t{1} << (v & 63);
+    }
+    std::vector<uint16_t>().swap(array);
+  }
+}
+
+bool RoaringBitmap::Container::Remove(uint16_t low) {
+  if (IsBitset()) {
+    uint64_t &word = bits[low >> 6];
+    const uint64_t bit = uint64_t{1} << (low & 63);
+    if (!(word & bit))
+      return false;
+    word &= ~bit;
+    --cardinality;
+    if (cardinality <= kArrayMax / 2) {
+      array.reserve(cardinality);
+      for (size_t w = 0; w < kChunkWords; ++w) {
+        for (uint64_t b = bits[w]; b; b &= b - 1) {
+          array.push_back(static_cast<uint16_t>(w * 64 + __builtin_ctzll(b)));
+        }
+      }
+      std::vector<uint64_t>().swap(bits);
+    }
+    return true;
+  }
+  const auto it = std::lower_bound(array.begin(), array.end(), low);
+  if (it == array.end() || *it != low)
+    return false;
+  array.erase(it);
+  --cardinality;
+  return true;
+}
+
+bool RoaringBitmap::Container::Contains(uint16_t low) const {
+  if (IsBitset())
+    return bits[low >> 6] & (uint64_t{1} << (low & 63));
+  return std::binary_search(array.begin(), array.end(), low);
+}
+
+void RoaringBitmap::Container::ToWords(uint64_t *words) const {
+  if (IsBitset()) {
+    std::memcpy(words, bits.data(), kChunkWords * sizeof(uint64_t));
+    return;
+  }
+  std::memset(words, 0, kChunkWords * sizeof(uint64_t));
+  for (uint16_t v : array) {
+    words[v >> 6] |= uint64_t{1} << (v & 63);
+  }
+}
+
+size_t RoaringBitmap::Container::MemoryBytes() const {
+  return sizeof(Container) + array.capacity() * sizeof(uint16_t) +
+         bits.capacity() * sizeof(uint64_t);
+}
+
+size_t RoaringBitmap::Find(uint16_t key) const {
+  const auto it = std::lower_bound(keys.begin(), keys.end(), key);
+  if (it == keys.end() || *it != key)
+    return keys.size();
+  return static_cast<size_t>(it - keys.begin());
+}
+
+void RoaringBitmap::Add(uint32_t id) {
+  const auto key = static_cast<uint16_t>(id >> 16);
+  const auto low = static_cast<uint16_t>(id & 0xffff);
+  size_t i;
+  if (!keys.empty() && keys.back() == key) {
+    i = keys.size() - 1;
+  } else {
+    const auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    i = static_cast<size_t>(it - keys.begin());
+    if (it == keys.end() || *it != key) {
+      keys.insert(it, key);
+      containers.insert(containers.begin() + static_cast<ptrdiff_t>(i),
+                        Container{});
+    }
+  }
+  containers[i].Add(low);
+}
+
+void RoaringBitmap::Remove(uint32_t id) {
+  const size_t i = Find(static_cast<uint16_t>(id >> 16));
+  if (i == keys.size())
+    return;
+  containers[i].Remove(static_cast<uint16_t>(id & 0xffff));
+  if (containers[i].cardinality == 0) {
+    keys.erase(keys.begin() + static_cast<ptrdiff_t>(i));
+    containers.erase(containers.begin() + static_cast<ptrdiff_t>(i));
+  }
+}
+
+bool RoaringBitmap::Contains(uint32_t id) const {
+  const size_t i = Find(static_cast<uint16_t>(id >> 16));
+  return i != keys.size() &&
+         containers[i].Contains(static_cast<uint16_t>(id & 0xffff));
+}
+
+uint64_t RoaringBitmap::Cardinality() const {
+  uint64_t n = 0;
+  for (const auto &c : containers) {
+    n += c.cardinality;
+  }
+  return n;
+}
+
+size_t RoaringBitmap::MemoryBytes() const {
+  size_t n = keys.capacity() * sizeof(uint16_t);
+  for (const auto &c : containers) {
+    n += c.MemoryBytes();
+  }
+  return n + (containers.capacity() - containers.size()) * sizeof(Container);
+}
+
+bool RoaringBitmap::ChunkWords(uint16_t key, uint64_t *words) const {
+  const size_t i = Find(key);
+  if (i == keys.size()) {
+    std::memset(words, 0, kChunkWords * sizeof(uint64_t));
+    return false;
+  }
+  containers[i].ToWords(words);
+  return true;
+}
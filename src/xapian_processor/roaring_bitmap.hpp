@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compressed set of 32-bit ids in the roaring layout: ids are grouped by
+// their high 16 bits into chunks, and each chunk stores its low 16 bits as
+// a sorted uint16 array while small or as a 65536-bit bitset once dense.
+class RoaringBitmap {
+public:
+  static constexpr size_t kChunkWords = 1024; // 65536 bits
+
+  void Add(uint32_t id);
+  void Remove(uint32_t id);
+  bool Contains(uint32_t id) const;
+  uint64_t Cardinality() const;
+  size_t MemoryBytes() const;
+  size_t ChunkCount() const { return keys.size(); }
+
+  // Chunk keys (high 16 bits) in ascending order.
+  const std::vector<uint16_t> &ChunkKeys() const { return keys; }
+  // Writes the chunk with `key` as kChunkWords words; all zero if absent.
+  // Returns false when absent.
+  bool ChunkWords(uint16_t key, uint64_t *words) const;
+
+private:
+  // Above this many ids an array container is converted to a bitset (both
+  // then take 8 KiB).
+  static constexpr size_t kArrayMax = 4096;
+
+  struct Container {
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> bits;
+    uint32_t cardinality = 0;
+
+    bool IsBitset() const { return !bits.empty(); }
+    void Add(uint16_t low);
+    bool Remove(uint16_t low);
+    bool Contains(uint16_t low) const;
+    void ToWords(uint64_t *words) const;
+    size_t MemoryBytes() const;
+  };
+
+  // Index of the chunk for key, or keys.size() if absent.
+  size_t Find(uint16_t key) const;
+
+  std::vector<uint16_t> keys;
+  std::vector<Container> containers;
+};
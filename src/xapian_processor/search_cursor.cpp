@@ -0,0 +1,138 @@
+#include "xapian_processor/search_cursor.hpp"
+
+#include "xapian_processor/result_cache.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+constexpr char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Full precision: paging must not mix up neighbouring positions.
+constexpr int kFingerprintGeoPrecision = 6;
+
+std::array<int8_t, 256> MakeDecodeTable() {
+  std::array<int8_t, 256> table{};
+  table.fill(-1);
+  for (int i = 0; i < 64; ++i) {
+    table[static_cast<unsigned char>(kAlphabet[i])] = static_cast<int8_t>(i);
+  }
+  return table;
+}
+} // namespace
+
+uint64_t QueryFingerprint(const DSearchRequest &request) {
+  // FNV-1a
+  uint64_t h = 1469598103934665603ULL;
+  for (unsigned char c : MakeQueryKey(request, kFingerprintGeoPrecision)) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+std::optional<SearchPage> ResolvePage(const DSearchRequest &request,
+                                      const PagingLimits &limits) {
+  SearchPage page;
+  page.fingerprint = QueryFingerprint(request);
+  page.limit = limits.default_limit;
+  if (request.has_limit() && request.limit() > 0)
+    page.limit = static_cast<Xapian::doccount>(request.limit());
+  page.limit = std::min(page.limit, limits.max_limit);
+
+  if (!request.cursor().empty()) {
+    const auto cursor = DecodeCursor(request.cursor());
+    if (!cursor || cursor->fingerprint() != page.fingerprint)
+      return std::nullopt;
+    page.position = cursor->position();
+    if (!cursor->sort_key().empty()) {
+      page.search_after = true;
+      page.after_key = cursor->sort_key();
+      page.after_docid = cursor->docid();
+    }
+    if (cursor->sample_seed() != 0) {
+      page.has_sample = true;
+      page.sample_domain = cursor->sample_domain();
+      page.sample_state = cursor->sample_state();
+      page.sample_seed = cursor->sample_seed();
+    }
+  } else if (request.has_offset()) {
+    if (request.offset() < 0)
+      return std::nullopt;
+    page.position = static_cast<Xapian::doccount>(request.offset());
+  } else {
+    page.position = limits.default_offset;
+  }
+  // Search-after and sampling pages cost the same at any depth.
+  if (!page.search_after && !page.has_sample &&
+      page.position > limits.max_offset)
+    return std::nullopt;
+  return page;
+}
+
+std::string NextCursor(const SearchPage &page, Xapian::doccount returned,
+                       const std::string &last_key, Xapian::docid last_docid) {
+  DSearchCursor cursor;
+  cursor.set_fingerprint(page.fingerprint);
+  cursor.set_position(page.position + returned);
+  if (!last_key.empty()) {
+    cursor.set_sort_key(last_key);
+    cursor.set_docid(last_docid);
+  }
+  return EncodeCursor(cursor);
+}
+
+std::string NextSampleCursor(const SearchPage &page, Xapian::doccount returned,
+                             Xapian::docid domain, uint64_t state,
+                             uint64_t seed) {
+  DSearchCursor cursor;
+  cursor.set_fingerprint(page.fingerprint);
+  cursor.set_position(page.position + returned);
+  cursor.set_sample_domain(domain);
+  cursor.set_sample_state(state);
+  cursor.set_sample_seed(seed);
+  return EncodeCursor(cursor);
+}
+
+std::string EncodeCursor(const DSearchCursor &cursor) {
+  const std::string raw = cursor.SerializeAsString();
+  std::string out;
+  out.reserve((raw.size() * 4 + 2) / 3);
+  uint32_t acc = 0;
+  int bits = 0;
+  for (unsigned char c : raw) {
+    acc = (acc << 8) | c;
+    bits += 8;
+    while (bits >= 6) {
+      bits -= 6;
+      out += kAlphabet[(acc >> bits) & 0x3f];
+    }
+  }
+  if (bits > 0)
+    out += kAlphabet[(acc << (6 - bits)) & 0x3f];
+  return out;
+}
+
+std::optional<DSearchCursor> DecodeCursor(const std::string &text) {
+  static const std::array<int8_t, 256> kDecode = MakeDecodeTable();
+  std::string raw;
+  raw.reserve(text.size() * 3 / 4);
+  uint32_t acc = 0;
+  int bits = 0;
+  for (unsigned char c : text) {
+    const int8_t v = kDecode[c];
+    if (v < 0)
+      return std::nullopt;
+    acc = (acc << 6) | static_cast<uint32_t>(v);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      raw += static_cast<char>((acc >> bits) & 0xff);
+    }
+  }
+  DSearchCursor cursor;
+  if (!cursor.ParseFromString(raw))
+    return std::nullopt;
+  return cursor;
+}
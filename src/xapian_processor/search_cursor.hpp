@@ -0,0 +1,55 @@
+#pragma once
+#include <xapian.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "DSRequest.pb.h"
+
+// Page of a search, resolved from the request's offset/limit/cursor.
+struct SearchPage {
+  uint64_t fingerprint = 0;
+  // Hits returned before this page; the MSet offset unless search_after.
+  Xapian::doccount position = 0;
+  Xapian::doccount limit = 0;
+  // Sorted queries resume strictly after (after_key, after_docid) instead
+  // of matching and discarding `position` documents.
+  bool search_after = false;
+  std::string after_key;
+  Xapian::docid after_docid = 0;
+  // Random sampling state carried by the cursor (see DSearchCursor).
+  bool has_sample = false;
+  Xapian::docid sample_domain = 0;
+  uint64_t sample_state = 0;
+  uint64_t sample_seed = 0;
+};
+
+struct PagingLimits {
+  Xapian::doccount default_offset = 0;
+  Xapian::doccount default_limit = 0;
+  Xapian::doccount max_limit = 0;
+  Xapian::doccount max_offset = 0;
+};
+
+// Stable across processes, so cursors survive restarts.
+uint64_t QueryFingerprint(const DSearchRequest &request);
+
+// Empty if the cursor is malformed, belongs to another query, or the
+// offset is beyond limits.max_offset. Limits above max_limit are clamped.
+std::optional<SearchPage> ResolvePage(const DSearchRequest &request,
+                                      const PagingLimits &limits);
+
+// Cursor for the page after one that returned `returned` hits. last_key and
+// last_docid describe the final hit and are only used by sorted queries.
+std::string NextCursor(const SearchPage &page, Xapian::doccount returned,
+                       const std::string &last_key = {},
+                       Xapian::docid last_docid = 0);
+
+std::string NextSampleCursor(const SearchPage &page, Xapian::doccount returned,
+                             Xapian::docid domain, uint64_t state,
+                             uint64_t seed);
+
+// base64url (no padding) of a serialised DSearchCursor.
+std::string EncodeCursor(const DSearchCursor &cursor);
+std::optional<DSearchCursor> DecodeCursor(const std::string &text);
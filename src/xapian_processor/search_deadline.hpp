@@ -0,0 +1,46 @@
+#pragma once
+#include <xapian.h>
+
+#include <chrono>
+#include <cstdint>
+
+// When a search has to answer by; default-constructed, it never passes.
+struct SearchDeadline {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point at = Clock::time_point::max();
+
+  bool Limited() const { return at != Clock::time_point::max(); }
+  bool Passed() const { return Limited() && Clock::now() >= at; }
+};
+
+// Cuts a match short at the deadline: from then on every candidate is
+// rejected, so get_mset() returns the best hits among the documents seen
+// before it. (Enquire::set_time_limit() only stops check_at_least work,
+// it does not bound the match.) The clock is read every few candidates.
+// Wraps the request's own decider, if any; one per get_mset() and thread.
+class DeadlineDecider : public Xapian::MatchDecider {
+public:
+  DeadlineDecider(const SearchDeadline &deadline,
+                  const Xapian::MatchDecider *next)
+      : deadline(deadline), next(next) {}
+
+  // What to pass to get_mset(): this, or just next without a deadline.
+  const Xapian::MatchDecider *Get() const {
+    return deadline.Limited() ? this : next;
+  }
+  bool Expired() const { return expired; }
+
+  bool operator()(const Xapian::Document &doc) const override {
+    if (!expired && ++calls % kCheckEvery == 0 && deadline.Passed())
+      expired = true;
+    return !expired && (!next || (*next)(doc));
+  }
+
+private:
+  static constexpr uint32_t kCheckEvery = 32;
+
+  const SearchDeadline deadline;
+  const Xapian::MatchDecider *next;
+  mutable uint32_t calls = 0;
+  mutable bool expired = false;
+};
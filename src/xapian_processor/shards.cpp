@@ -0,0 +1,96 @@
+#include "xapian_processor/shards.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+const std::string kShardDirPrefix = "shard_";
+
+std::string ShardDirName(size_t shard) {
+  std::string digits = std::to_string(shard);
+  if (digits.size() < 3)
+    digits.insert(0, 3 - digits.size(), '0');
+  return kShardDirPrefix + digits;
+}
+
+// Every Xapian backend marks its directory with an "iam<backend>" file.
+bool HoldsDatabase(const fs::path &dir) {
+  std::error_code ec;
+  for (fs::directory_iterator it(dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->path().filename().string().rfind("iam", 0) == 0)
+      return true;
+  }
+  return false;
+}
+
+size_t CountShardDirs(const fs::path &dir) {
+  size_t n = 0;
+  std::error_code ec;
+  for (fs::directory_iterator it(dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->is_directory(ec) &&
+        it->path().filename().string().rfind(kShardDirPrefix, 0) == 0)
+      ++n;
+  }
+  return n;
+}
+} // namespace
+
+size_t ShardForTask(const std::string &task_id, size_t shard_count) {
+  if (shard_count <= 1)
+    return 0;
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : task_id) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return static_cast<size_t>(hash % shard_count);
+}
+
+std::vector<std::string> ShardPaths(const std::string &db_path,
+                                    size_t shard_count) {
+  if (shard_count <= 1)
+    return {db_path};
+  std::vector<std::string> paths;
+  paths.reserve(shard_count);
+  for (size_t i = 0; i < shard_count; ++i)
+    paths.push_back((fs::path(db_path) / ShardDirName(i)).string());
+  return paths;
+}
+
+size_t DetectShardCount(const std::string &db_path) {
+  const size_t found = CountShardDirs(db_path);
+  if (found > 0)
+    return found;
+  return HoldsDatabase(db_path) ? 1 : 0;
+}
+
+void CheckShardLayout(const std::string &db_path, size_t shard_count) {
+  const size_t found = CountShardDirs(db_path);
+  const bool single = HoldsDatabase(db_path);
+  std::string problem;
+  if (shard_count <= 1 && found > 0) {
+    problem = "holds " + std::to_string(found) + " shards";
+  } else if (shard_count > 1 && single) {
+    problem = "holds an unsharded database";
+  } else if (shard_count > 1 && found > 0 && found != shard_count) {
+    problem = "holds " + std::to_string(found) + " shards, not " +
+              std::to_string(shard_count);
+  }
+  if (!problem.empty())
+    throw std::invalid_argument(db_path + " " + problem +
+                                "; convert it with dobrika_reshard");
+}
+
+Xapian::Database OpenCombined(const std::vector<std::string> &paths) {
+  if (paths.size() == 1)
+    return Xapian::Database(paths.front());
+  Xapian::Database db;
+  for (const auto &path : paths)
+    db.add_database(Xapian::Database(path));
+  return db;
+}
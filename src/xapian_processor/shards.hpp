@@ -0,0 +1,43 @@
+#pragma once
+#include <xapian.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Hash partitioning of tasks over N shard databases.
+//
+// Shards live in <db>/shard_NNN; a single database (N <= 1) stays at <db>
+// itself. Reads go through all shards combined into one Xapian::Database,
+// whose docids interleave the shards': shard s's docid d is combined docid
+// (d - 1) * N + s + 1. Side tables (task ids, tag bitmaps) and cursors use
+// the combined numbering.
+
+// Stable across builds and platforms (FNV-1a), so a task always lands on
+// the same shard.
+size_t ShardForTask(const std::string &task_id, size_t shard_count);
+
+// Database directories in shard order.
+std::vector<std::string> ShardPaths(const std::string &db_path,
+                                    size_t shard_count);
+
+// Shard count of what db_path holds: 1 for a single database, 0 if
+// nothing.
+size_t DetectShardCount(const std::string &db_path);
+
+// Throws std::invalid_argument if db_path holds a database laid out for a
+// different shard count.
+void CheckShardLayout(const std::string &db_path, size_t shard_count);
+
+// Read-only view of all shards as one database.
+Xapian::Database OpenCombined(const std::vector<std::string> &paths);
+
+// Maps the docids of one shard to the combined numbering.
+struct ShardDocidMap {
+  size_t shard = 0;
+  size_t count = 1;
+
+  Xapian::docid operator()(Xapian::docid docid) const {
+    return static_cast<Xapian::docid>((docid - 1) * count + shard + 1);
+  }
+};
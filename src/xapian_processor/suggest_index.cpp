@@ -0,0 +1,420 @@
+#include "xapian_processor/suggest_index.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <queue>
+#include <unordered_set>
+
+#include "tools/dse_tools.hpp"
+#include "xapian_processor/query_context.hpp"
+
+namespace {
+// Keys are the word or name behind one of these bytes, so both live in one
+// trie and share the key id space.
+constexpr char kWordKey = 'w';
+constexpr char kNameKey = 'n';
+// Longer terms are not words anyone types.
+constexpr size_t kMaxWordBytes = 64;
+constexpr size_t kMaxNameBytes = 256;
+// Word candidates fetched per requested suggestion, before inflections
+// are folded together.
+constexpr size_t kWordCandidates = 4;
+
+// Unprefixed terms; prefixed ones (T, Z, TAG, ID, geo cells, ...) start
+// with an upper case ASCII letter.
+bool IsPrefixed(const std::string &term) {
+  return !term.empty() && term[0] >= 'A' && term[0] <= 'Z';
+}
+
+bool IsWord(const std::string &term) {
+  return !term.empty() && term.size() <= kMaxWordBytes && !IsPrefixed(term);
+}
+
+std::string NameText(const Xapian::Document &doc) {
+  std::string name = NormaliseQueryText(GetField(doc.get_data(), 0));
+  return name.size() <= kMaxNameBytes ? name : std::string();
+}
+
+std::string Key(char kind, std::string_view text) {
+  std::string key(1, kind);
+  key += text;
+  return key;
+}
+
+Xapian::Stem &RussianStemmer() {
+  // Xapian::Stem is not safe to share between threads.
+  thread_local Xapian::Stem stem("russian");
+  return stem;
+}
+} // namespace
+
+SuggestIndex::SuggestIndex(size_t max_bytes) : max_bytes(max_bytes) {}
+
+uint64_t SuggestIndex::Footprint(const State &state) {
+  return state.bytes + state.doc_keys.capacity() * sizeof(uint32_t) +
+         state.doc_spans.capacity() * sizeof(Span);
+}
+
+uint32_t SuggestIndex::Insert(State &state, std::string_view key) {
+  auto &nodes = state.nodes;
+  auto child_at = [&nodes](uint32_t parent, unsigned char c) {
+    const auto &children = nodes[parent].children;
+    return static_cast<size_t>(
+        std::lower_bound(children.begin(), children.end(), c,
+                         [&nodes](uint32_t id, unsigned char v) {
+                           return static_cast<unsigned char>(
+                                      nodes[id].label[0]) < v;
+                         }) -
+        children.begin());
+  };
+  uint32_t n = 0;
+  size_t i = 0;
+  while (i < key.size()) {
+    const size_t pos = child_at(n, static_cast<unsigned char>(key[i]));
+    const auto &children = nodes[n].children;
+    if (pos == children.size() || nodes[children[pos]].label[0] != key[i]) {
+      const uint64_t cost =
+          sizeof(Node) + (key.size() - i) + sizeof(uint32_t);
+      if (Footprint(state) + cost > max_bytes)
+        return kNoKey;
+      const auto leaf = static_cast<uint32_t>(nodes.size());
+      Node node;
+      node.label = std::string(key.substr(i));
+      node.parent = n;
+      nodes[n].children.insert(nodes[n].children.begin() + pos, leaf);
+      nodes.push_back(std::move(node));
+      state.bytes += cost;
+      return leaf;
+    }
+    uint32_t child = children[pos];
+    const std::string &label = nodes[child].label;
+    size_t common = 1;
+    while (common < label.size() && i + common < key.size() &&
+           label[common] == key[i + common])
+      ++common;
+    if (common < label.size()) {
+      // Split the edge; the child keeps its id, which may be a key id.
+      const uint64_t cost = sizeof(Node) + common + sizeof(uint32_t);
+      if (Footprint(state) + cost > max_bytes)
+        return kNoKey;
+      const auto mid = static_cast<uint32_t>(nodes.size());
+      Node node;
+      node.label = label.substr(0, common);
+      node.parent = n;
+      node.children.push_back(child);
+      node.best = nodes[child].best;
+      nodes[child].label.erase(0, common);
+      nodes[child].parent = mid;
+      nodes[n].children[pos] = mid;
+      nodes.push_back(std::move(node));
+      state.bytes += cost;
+      child = mid;
+    }
+    n = child;
+    i += common;
+  }
+  return n;
+}
+
+void SuggestIndex::AddWeight(State &state, uint32_t node, int64_t delta) {
+  Node &key = state.nodes[node];
+  const bool was_key = key.weight > 0;
+  key.weight = static_cast<uint32_t>(
+      std::max<int64_t>(0, static_cast<int64_t>(key.weight) + delta));
+  if (was_key != (key.weight > 0)) {
+    uint64_t &count = state.names.count(node) ? state.name_count : state.words;
+    count = key.weight > 0 ? count + 1 : count - 1;
+  }
+  for (uint32_t n = node;; n = state.nodes[n].parent) {
+    Node &x = state.nodes[n];
+    uint32_t best = x.weight;
+    for (const uint32_t c : x.children)
+      best = std::max(best, state.nodes[c].best);
+    if (best == x.best && n != node)
+      break;
+    x.best = best;
+    if (n == 0)
+      break;
+  }
+}
+
+void SuggestIndex::Rebuild(const Xapian::Database &db) {
+  struct Candidate {
+    Xapian::doccount weight;
+    std::string key;
+    std::string name; // original spelling, names only
+  };
+  std::vector<Candidate> candidates;
+  for (Xapian::TermIterator t = db.allterms_begin();
+       t != db.allterms_end();) {
+    const std::string term = *t;
+    if (IsPrefixed(term)) {
+      t.skip_to("["); // past 'Z'
+      continue;
+    }
+    if (IsWord(term))
+      candidates.push_back({t.get_termfreq(), Key(kWordKey, term), {}});
+    ++t;
+  }
+  // Names have no term of their own; count them from the documents.
+  std::vector<uint32_t> doc_name(db.get_lastdocid() + 1, kNoKey);
+  {
+    std::unordered_map<std::string, uint32_t> name_ids;
+    for (auto p = db.postlist_begin(""); p != db.postlist_end(""); ++p) {
+      const std::string name = NameText(db.get_document(*p));
+      if (name.empty())
+        continue;
+      const auto [it, inserted] = name_ids.emplace(
+          Key(kNameKey, Xapian::Unicode::tolower(name)),
+          static_cast<uint32_t>(candidates.size()));
+      if (inserted)
+        candidates.push_back({0, it->first, name});
+      ++candidates[it->second].weight;
+      doc_name[*p] = it->second;
+    }
+  }
+
+  // Heaviest first, so the budget keeps the most useful keys.
+  std::vector<uint32_t> order(candidates.size());
+  for (uint32_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return candidates[a].weight > candidates[b].weight;
+  });
+  State fresh;
+  uint64_t dropped = 0;
+  // Per-document key ids still to be laid out.
+  uint64_t reserved = 0;
+  std::vector<uint32_t> key_of(candidates.size(), kNoKey);
+  for (const uint32_t i : order) {
+    const Candidate &c = candidates[i];
+    const uint64_t doc_bytes = uint64_t{c.weight} * sizeof(uint32_t);
+    const uint32_t id = Footprint(fresh) + reserved + doc_bytes <= max_bytes
+                            ? Insert(fresh, c.key)
+                            : kNoKey;
+    if (id == kNoKey) {
+      ++dropped;
+      continue;
+    }
+    reserved += doc_bytes;
+    key_of[i] = id;
+    if (!c.name.empty()) {
+      fresh.names.emplace(id, c.name);
+      fresh.bytes += sizeof(std::string) * 2 + c.name.size();
+    }
+  }
+
+  std::vector<std::vector<uint32_t>> per_doc(doc_name.size());
+  for (uint32_t i = 0; i < candidates.size(); ++i) {
+    if (key_of[i] == kNoKey)
+      continue;
+    AddWeight(fresh, key_of[i], candidates[i].weight);
+    if (candidates[i].name.empty()) {
+      const std::string term = candidates[i].key.substr(1);
+      for (auto p = db.postlist_begin(term); p != db.postlist_end(term); ++p)
+        per_doc[*p].push_back(key_of[i]);
+    }
+  }
+  for (size_t docid = 0; docid < doc_name.size(); ++docid) {
+    if (doc_name[docid] != kNoKey && key_of[doc_name[docid]] != kNoKey)
+      per_doc[docid].push_back(key_of[doc_name[docid]]);
+  }
+  fresh.doc_spans.resize(per_doc.size());
+  for (size_t docid = 0; docid < per_doc.size(); ++docid) {
+    fresh.doc_spans[docid] = Span{
+        fresh.doc_keys.size(), static_cast<uint32_t>(per_doc[docid].size())};
+    fresh.doc_keys.insert(fresh.doc_keys.end(), per_doc[docid].begin(),
+                          per_doc[docid].end());
+  }
+
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  std::swap(state, fresh);
+  dropped_total += dropped;
+}
+
+void SuggestIndex::Update(
+    const std::vector<std::pair<Xapian::docid, const Xapian::Document *>>
+        &docs) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  for (const auto &[docid, doc] : docs)
+    UpdateLocked(docid, *doc);
+}
+
+void SuggestIndex::Remove(Xapian::docid docid) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  RemoveLocked(docid);
+}
+
+void SuggestIndex::UpdateLocked(Xapian::docid docid,
+                                const Xapian::Document &doc) {
+  RemoveLocked(docid);
+  std::vector<uint32_t> keys;
+  for (auto t = doc.termlist_begin(); t != doc.termlist_end(); ++t) {
+    const std::string term = *t;
+    if (!IsWord(term))
+      continue;
+    const uint32_t id = Insert(state, Key(kWordKey, term));
+    if (id == kNoKey)
+      ++dropped_total;
+    else
+      keys.push_back(id);
+  }
+  const std::string name = NameText(doc);
+  if (!name.empty()) {
+    const uint32_t id =
+        Insert(state, Key(kNameKey, Xapian::Unicode::tolower(name)));
+    if (id == kNoKey) {
+      ++dropped_total;
+    } else {
+      if (state.names.emplace(id, name).second)
+        state.bytes += sizeof(std::string) * 2 + name.size();
+      keys.push_back(id);
+    }
+  }
+  for (const uint32_t id : keys)
+    AddWeight(state, id, 1);
+  if (state.doc_spans.size() <= docid)
+    state.doc_spans.resize(docid + 1);
+  state.doc_spans[docid] =
+      Span{state.doc_keys.size(), static_cast<uint32_t>(keys.size())};
+  state.doc_keys.insert(state.doc_keys.end(), keys.begin(), keys.end());
+}
+
+void SuggestIndex::RemoveLocked(Xapian::docid docid) {
+  if (docid >= state.doc_spans.size())
+    return;
+  Span &span = state.doc_spans[docid];
+  for (uint32_t i = 0; i < span.length; ++i)
+    AddWeight(state, state.doc_keys[span.offset + i], -1);
+  span = Span{};
+}
+
+uint32_t SuggestIndex::Locate(std::string_view prefix,
+                              std::string &path) const {
+  const auto &nodes = state.nodes;
+  uint32_t n = 0;
+  size_t i = 0;
+  path.clear();
+  while (i < prefix.size()) {
+    const auto &children = nodes[n].children;
+    const auto it = std::lower_bound(
+        children.begin(), children.end(),
+        static_cast<unsigned char>(prefix[i]),
+        [&nodes](uint32_t id, unsigned char v) {
+          return static_cast<unsigned char>(nodes[id].label[0]) < v;
+        });
+    if (it == children.end())
+      return kNoKey;
+    const std::string &label = nodes[*it].label;
+    const size_t m = std::min(label.size(), prefix.size() - i);
+    if (prefix.substr(i, m) != std::string_view(label).substr(0, m))
+      return kNoKey;
+    path += label;
+    n = *it;
+    i += m;
+  }
+  return n;
+}
+
+std::vector<SuggestIndex::Hit>
+SuggestIndex::Top(std::string_view prefix, size_t limit) const {
+  const auto &nodes = state.nodes;
+  std::vector<Hit> hits;
+  std::string path;
+  const uint32_t n = Locate(prefix, path);
+  if (n == kNoKey)
+    return hits;
+
+  struct Item {
+    uint32_t priority;
+    bool key; // the node itself rather than its subtree
+    uint32_t node;
+    std::string text;
+    bool operator<(const Item &other) const {
+      return priority < other.priority;
+    }
+  };
+  std::priority_queue<Item> queue;
+  queue.push({nodes[n].best, false, n, std::move(path)});
+  while (!queue.empty() && hits.size() < limit) {
+    Item item = queue.top();
+    queue.pop();
+    if (item.priority == 0)
+      break;
+    const Node &node = nodes[item.node];
+    if (item.key) {
+      hits.push_back({std::move(item.text), item.node, node.weight});
+      continue;
+    }
+    if (node.weight > 0)
+      queue.push({node.weight, true, item.node, item.text});
+    for (const uint32_t c : node.children) {
+      if (nodes[c].best > 0)
+        queue.push({nodes[c].best, false, c, item.text + nodes[c].label});
+    }
+  }
+  return hits;
+}
+
+Suggestions SuggestIndex::Suggest(std::string_view query, size_t limit) const {
+  Suggestions out;
+  const std::string text = Xapian::Unicode::tolower(NormaliseQueryText(query));
+  if (text.empty() || limit == 0)
+    return out;
+  const size_t split = text.rfind(' ') + 1; // 0 without a space
+  const std::string head = text.substr(0, split);
+  const std::string last = text.substr(split);
+  Xapian::Stem &stem = RussianStemmer();
+  const std::string root = stem(last);
+
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  for (auto &hit : Top(Key(kNameKey, text), limit)) {
+    const auto it = state.names.find(hit.node);
+    out.names.push_back(
+        {it != state.names.end() ? it->second : hit.key.substr(1),
+         hit.weight});
+  }
+
+  const std::string key = Key(kWordKey, last);
+  std::vector<Hit> hits = Top(key, limit * kWordCandidates);
+  // A complete word also completes its stem, which may not share the
+  // typed ending.
+  std::string path;
+  const uint32_t exact = Locate(key, path);
+  if (!root.empty() && root.size() < last.size() && exact != kNoKey &&
+      path == key && state.nodes[exact].weight > 0) {
+    for (auto &hit : Top(Key(kWordKey, root), limit * kWordCandidates))
+      hits.push_back(std::move(hit));
+    std::stable_sort(hits.begin(), hits.end(),
+                     [](const Hit &a, const Hit &b) {
+                       return a.weight > b.weight;
+                     });
+  }
+  lock.unlock();
+
+  std::unordered_set<uint32_t> seen;
+  std::unordered_map<std::string, size_t> by_stem;
+  for (const Hit &hit : hits) {
+    if (!seen.insert(hit.node).second)
+      continue;
+    const std::string word = hit.key.substr(1);
+    const auto [it, inserted] = by_stem.emplace(stem(word), out.words.size());
+    if (inserted)
+      out.words.push_back({head + word, hit.weight});
+    else
+      out.words[it->second].weight += hit.weight;
+  }
+  std::stable_sort(out.words.begin(), out.words.end(),
+                   [](const Suggestion &a, const Suggestion &b) {
+                     return a.weight > b.weight;
+                   });
+  if (out.words.size() > limit)
+    out.words.resize(limit);
+  return out;
+}
+
+SuggestStats SuggestIndex::GetStats() const {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  return {state.words, state.name_count, Footprint(state), max_bytes,
+          dropped_total};
+}
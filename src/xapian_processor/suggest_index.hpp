@@ -0,0 +1,111 @@
+#pragma once
+#include <xapian.h>
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct Suggestion {
+  std::string text;
+  // Documents holding the word (summed over its inflections) or tasks with
+  // the name.
+  uint32_t weight = 0;
+};
+
+struct Suggestions {
+  std::vector<Suggestion> words; // the query with its last word completed
+  std::vector<Suggestion> names; // task names starting with the query
+};
+
+struct SuggestStats {
+  uint64_t words = 0;
+  uint64_t names = 0;
+  uint64_t bytes = 0;
+  uint64_t max_bytes = 0;
+  // Keys left out because the index was at max_bytes.
+  uint64_t dropped_total = 0;
+};
+
+// RAM radix trie over the indexed words (unprefixed terms, as the
+// TermGenerator lowercased them) and lowercased task names, each weighted
+// by the number of documents holding it. Every node keeps the best weight
+// below it, so the top completions of a prefix are found best-first
+// without visiting the rest of its subtree.
+//
+// Russian inflections are folded together: completions that share a stem
+// are reported once, as their most frequent form, and a complete word also
+// completes its stem ("курьеров" finds "курьерам").
+//
+// Loaded from the database on startup and kept current from the commit
+// hook. Like TermBitmapIndex it keeps each document's key ids to undo
+// replaced and deleted documents; nodes of keys whose weight dropped to 0
+// stay until Rebuild().
+class SuggestIndex {
+public:
+  explicit SuggestIndex(size_t max_bytes);
+
+  // Most frequent keys first while the budget lasts.
+  void Rebuild(const Xapian::Database &db);
+  // (Re)indexes the documents, replacing earlier versions.
+  void Update(
+      const std::vector<std::pair<Xapian::docid, const Xapian::Document *>>
+          &docs);
+  void Remove(Xapian::docid docid);
+
+  // Up to limit words and limit names for the text typed so far.
+  Suggestions Suggest(std::string_view query, size_t limit) const;
+
+  SuggestStats GetStats() const;
+
+private:
+  static constexpr uint32_t kNoKey = ~uint32_t{0};
+
+  struct Node {
+    std::string label; // edge from the parent
+    std::vector<uint32_t> children; // by first label byte
+    uint32_t parent = 0;
+    uint32_t weight = 0; // 0: not a key (any more)
+    uint32_t best = 0;   // max weight in the subtree
+  };
+  struct Span {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+  };
+  struct Hit {
+    std::string key;
+    uint32_t node;
+    uint32_t weight;
+  };
+  struct State {
+    std::vector<Node> nodes = std::vector<Node>(1); // [0] is the root
+    // Original spelling of name keys, by node.
+    std::unordered_map<uint32_t, std::string> names;
+    // docid -> key ids; replaced spans are not reclaimed until Rebuild().
+    std::vector<uint32_t> doc_keys;
+    std::vector<Span> doc_spans;
+    uint64_t words = 0;
+    uint64_t name_count = 0;
+    uint64_t bytes = 0;
+  };
+
+  static uint64_t Footprint(const State &state);
+  // Node of key, created if the budget allows; kNoKey otherwise.
+  uint32_t Insert(State &state, std::string_view key);
+  void AddWeight(State &state, uint32_t node, int64_t delta);
+  void UpdateLocked(Xapian::docid docid, const Xapian::Document &doc);
+  void RemoveLocked(Xapian::docid docid);
+  // Topmost node whose key starts with prefix, with that key in path;
+  // kNoKey if there is none.
+  uint32_t Locate(std::string_view prefix, std::string &path) const;
+  // Keys starting with prefix, heaviest first.
+  std::vector<Hit> Top(std::string_view prefix, size_t limit) const;
+
+  const size_t max_bytes;
+  mutable std::shared_mutex mutex;
+  State state;
+  uint64_t dropped_total = 0;
+};
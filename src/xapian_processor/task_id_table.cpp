@@ -0,0 +1,75 @@
+#include "xapian_processor/task_id_table.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+std::string_view TaskIdTable::View::Find(Xapian::docid docid) const {
+  if (docid >= table.spans.size())
+    return {};
+  const Span &span = table.spans[docid];
+  return std::string_view(table.arena).substr(span.offset, span.length);
+}
+
+void TaskIdTable::Rebuild(const Xapian::Database &db, Xapian::valueno slot) {
+  std::string new_arena;
+  std::vector<Span> new_spans(db.get_lastdocid() + 1);
+  size_t new_size = 0;
+  for (auto it = db.valuestream_begin(slot); it != db.valuestream_end(slot);
+       ++it) {
+    const std::string id = *it;
+    new_spans[it.get_docid()] = Span{new_arena.size(),
+                                     static_cast<uint32_t>(id.size())};
+    new_arena += id;
+    ++new_size;
+  }
+  new_arena.shrink_to_fit();
+
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  arena.swap(new_arena);
+  spans.swap(new_spans);
+  size = new_size;
+}
+
+void TaskIdTable::Insert(
+    const std::vector<std::pair<Xapian::docid, std::string>> &ids) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  for (const auto &[docid, task_id] : ids) {
+    InsertLocked(docid, task_id);
+  }
+}
+
+void TaskIdTable::Erase(const std::vector<Xapian::docid> &docids) {
+  if (docids.empty())
+    return;
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  for (const Xapian::docid docid : docids) {
+    if (docid < spans.size() && spans[docid].length != 0) {
+      spans[docid] = Span{};
+      --size;
+    }
+  }
+}
+
+void TaskIdTable::InsertLocked(Xapian::docid docid, std::string_view task_id) {
+  if (docid >= spans.size())
+    spans.resize(std::max<size_t>(docid + 1, spans.size() * 3 / 2));
+  Span &span = spans[docid];
+  // Re-indexing a task replaces its document in place; nothing to do.
+  if (span.length != 0 &&
+      std::string_view(arena).substr(span.offset, span.length) == task_id)
+    return;
+  if (span.length == 0 && !task_id.empty())
+    ++size;
+  span = Span{arena.size(), static_cast<uint32_t>(task_id.size())};
+  arena += task_id;
+}
+
+size_t TaskIdTable::Size() const {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  return size;
+}
+
+size_t TaskIdTable::MemoryBytes() const {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  return arena.capacity() + spans.capacity() * sizeof(Span);
+}
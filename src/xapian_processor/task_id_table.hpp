@@ -0,0 +1,57 @@
+#pragma once
+#include <xapian.h>
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// In-memory docid -> task_id map, so search results come straight from
+// MSet docids without loading and parsing each document. Ids live in one
+// contiguous arena indexed by docid.
+//
+// A document keeps its docid and task_id for its whole life (replaces go
+// through the unique "ID" term), so readers on an older revision can share
+// the table with newer ones. Erased docids just read as unknown, which
+// sends such readers to the value slot.
+class TaskIdTable {
+public:
+  // Holds the table's read lock; keep it only while iterating one MSet.
+  class View {
+  public:
+    explicit View(const TaskIdTable &table)
+        : table(table), lock(table.mutex) {}
+    // Empty if the docid is not known (yet).
+    std::string_view Find(Xapian::docid docid) const;
+
+  private:
+    const TaskIdTable &table;
+    std::shared_lock<std::shared_mutex> lock;
+  };
+
+  // Replaces the contents with the task_id value slot of every document.
+  void Rebuild(const Xapian::Database &db, Xapian::valueno slot);
+  void Insert(const std::vector<std::pair<Xapian::docid, std::string>> &ids);
+  // Forgets deleted documents. Their arena bytes stay until the next
+  // Rebuild().
+  void Erase(const std::vector<Xapian::docid> &docids);
+
+  View Read() const { return View(*this); }
+  size_t Size() const;
+  size_t MemoryBytes() const;
+
+private:
+  struct Span {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  void InsertLocked(Xapian::docid docid, std::string_view task_id);
+
+  mutable std::shared_mutex mutex;
+  std::string arena;
+  std::vector<Span> spans; // indexed by docid
+  size_t size = 0;
+};
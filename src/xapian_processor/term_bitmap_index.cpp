@@ -0,0 +1,281 @@
+#include "xapian_processor/term_bitmap_index.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+namespace {
+constexpr size_t kWords = RoaringBitmap::kChunkWords;
+
+// Bit-sliced counters: planes[p] holds bit p of every id's count.
+void AddToCounters(const uint64_t *words, std::vector<uint64_t *> &planes) {
+  for (size_t w = 0; w < kWords; ++w) {
+    uint64_t carry = words[w];
+    for (size_t p = 0; p < planes.size() && carry; ++p) {
+      const uint64_t next = planes[p][w] & carry;
+      planes[p][w] ^= carry;
+      carry = next;
+    }
+  }
+}
+} // namespace
+
+TermBitmapIndex::TermBitmapIndex(std::vector<std::string> prefixes)
+    : prefixes(std::move(prefixes)) {}
+
+bool TermBitmapIndex::Indexed(const std::string &term) const {
+  for (const auto &prefix : prefixes) {
+    if (term.compare(0, prefix.size(), prefix) == 0)
+      return true;
+  }
+  return false;
+}
+
+uint32_t TermBitmapIndex::TermId(const std::string &term) {
+  const auto [it, inserted] =
+      term_ids.emplace(term, static_cast<uint32_t>(bitmaps.size()));
+  if (inserted)
+    bitmaps.emplace_back();
+  return it->second;
+}
+
+void TermBitmapIndex::Rebuild(const Xapian::Database &db) {
+  std::unordered_map<std::string, uint32_t> new_ids;
+  std::vector<RoaringBitmap> new_bitmaps;
+  std::vector<std::vector<uint32_t>> per_doc(db.get_lastdocid() + 1);
+  for (const auto &prefix : prefixes) {
+    for (auto t = db.allterms_begin(prefix); t != db.allterms_end(prefix);
+         ++t) {
+      const auto id = static_cast<uint32_t>(new_bitmaps.size());
+      new_ids.emplace(*t, id);
+      RoaringBitmap &bitmap = new_bitmaps.emplace_back();
+      for (auto p = db.postlist_begin(*t); p != db.postlist_end(*t); ++p) {
+        bitmap.Add(*p);
+        per_doc[*p].push_back(id);
+      }
+    }
+  }
+  std::vector<uint32_t> new_doc_terms;
+  std::vector<Span> new_spans(per_doc.size());
+  for (size_t docid = 0; docid < per_doc.size(); ++docid) {
+    new_spans[docid] = Span{new_doc_terms.size(),
+                            static_cast<uint32_t>(per_doc[docid].size())};
+    new_doc_terms.insert(new_doc_terms.end(), per_doc[docid].begin(),
+                         per_doc[docid].end());
+  }
+
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  term_ids.swap(new_ids);
+  bitmaps.swap(new_bitmaps);
+  doc_terms.swap(new_doc_terms);
+  doc_spans.swap(new_spans);
+}
+
+void TermBitmapIndex::Update(
+    const std::vector<std::pair<Xapian::docid, const Xapian::Document *>>
+        &docs) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  for (const auto &[docid, doc] : docs) {
+    UpdateLocked(docid, *doc);
+  }
+}
+
+void TermBitmapIndex::Remove(Xapian::docid docid) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  RemoveLocked(docid);
+}
+
+void TermBitmapIndex::RemoveLocked(Xapian::docid docid) {
+  if (docid >= doc_spans.size())
+    return;
+  Span &span = doc_spans[docid];
+  for (uint32_t i = 0; i < span.length; ++i) {
+    bitmaps[doc_terms[span.offset + i]].Remove(docid);
+  }
+  span = Span{};
+}
+
+void TermBitmapIndex::UpdateLocked(Xapian::docid docid,
+                                   const Xapian::Document &doc) {
+  RemoveLocked(docid);
+  if (docid >= doc_spans.size())
+    doc_spans.resize(std::max<size_t>(docid + 1, doc_spans.size() * 3 / 2));
+  Span span{doc_terms.size(), 0};
+  for (auto t = doc.termlist_begin(); t != doc.termlist_end(); ++t) {
+    const std::string term = *t;
+    if (!Indexed(term))
+      continue;
+    const uint32_t id = TermId(term);
+    bitmaps[id].Add(docid);
+    doc_terms.push_back(id);
+    ++span.length;
+  }
+  doc_spans[docid] = span;
+}
+
+BitmapPage TermBitmapIndex::Search(const BitmapQuery &query, uint64_t offset,
+                                   uint32_t limit) const {
+  BitmapPage page;
+  std::shared_lock<std::shared_mutex> lock(mutex);
+
+  auto lookup = [&](const std::vector<std::string> &terms, bool required,
+                    std::vector<const RoaringBitmap *> &out) {
+    for (const auto &term : terms) {
+      const auto it = term_ids.find(term);
+      if (it != term_ids.end()) {
+        out.push_back(&bitmaps[it->second]);
+      } else if (required) {
+        return false;
+      }
+    }
+    return true;
+  };
+  std::vector<const RoaringBitmap *> any, all, none;
+  if (!lookup(query.all, true, all))
+    return page;
+  lookup(query.any, false, any);
+  lookup(query.none, false, none);
+  if (any.empty() && all.empty())
+    return page;
+  if (!query.any.empty() && any.empty())
+    return page; // none of the any-terms exists
+
+  // Chunks that can hold matches: those of the smallest all-bitmap, else
+  // the union over the any-bitmaps.
+  std::vector<uint16_t> keys;
+  if (!all.empty()) {
+    const RoaringBitmap *smallest = *std::min_element(
+        all.begin(), all.end(), [](const auto *a, const auto *b) {
+          return a->ChunkCount() < b->ChunkCount();
+        });
+    keys = smallest->ChunkKeys();
+  } else {
+    for (const auto *b : any) {
+      keys.insert(keys.end(), b->ChunkKeys().begin(), b->ChunkKeys().end());
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  }
+
+  // Count levels: how many any-terms matched (1..any.size()); a single
+  // level when there are none.
+  size_t plane_count = 0;
+  while ((size_t{1} << plane_count) <= any.size()) {
+    ++plane_count;
+  }
+  const size_t levels = std::max<size_t>(any.size(), 1);
+  std::vector<uint64_t> scratch((plane_count + 3) * kWords);
+  uint64_t *match = scratch.data();
+  uint64_t *tmp = match + kWords;
+  uint64_t *level_words = tmp + kWords;
+  std::vector<uint64_t *> planes;
+  for (size_t p = 0; p < plane_count; ++p) {
+    planes.push_back(level_words + (p + 1) * kWords);
+  }
+
+  // Fills match (and the count planes) for one chunk; false if empty.
+  auto compute_chunk = [&](uint16_t key) {
+    std::fill(match, match + kWords, ~uint64_t{0});
+    for (const auto *b : all) {
+      if (!b->ChunkWords(key, tmp))
+        return false;
+      for (size_t w = 0; w < kWords; ++w)
+        match[w] &= tmp[w];
+    }
+    if (!any.empty()) {
+      for (auto *plane : planes)
+        std::fill(plane, plane + kWords, 0);
+      for (const auto *b : any) {
+        if (b->ChunkWords(key, tmp))
+          AddToCounters(tmp, planes);
+      }
+      // count > 0  <=>  some plane bit set
+      for (size_t w = 0; w < kWords; ++w) {
+        uint64_t nonzero = 0;
+        for (auto *plane : planes)
+          nonzero |= plane[w];
+        match[w] &= nonzero;
+      }
+    }
+    for (const auto *b : none) {
+      if (b->ChunkWords(key, tmp)) {
+        for (size_t w = 0; w < kWords; ++w)
+          match[w] &= ~tmp[w];
+      }
+    }
+    return true;
+  };
+  // Ids in the chunk with exactly `level` matched any-terms.
+  auto select_level = [&](size_t level) {
+    for (size_t w = 0; w < kWords; ++w) {
+      uint64_t eq = match[w];
+      if (!any.empty()) {
+        for (size_t p = 0; p < plane_count; ++p)
+          eq &= (level >> p) & 1 ? planes[p][w] : ~planes[p][w];
+      }
+      level_words[w] = eq;
+    }
+  };
+
+  // Pass 1: matches per level.
+  std::vector<uint64_t> per_level(levels + 1, 0);
+  for (uint16_t key : keys) {
+    if (!compute_chunk(key))
+      continue;
+    for (size_t level = 1; level <= levels; ++level) {
+      select_level(level);
+      for (size_t w = 0; w < kWords; ++w)
+        per_level[level] += __builtin_popcountll(level_words[w]);
+    }
+  }
+  for (size_t level = 1; level <= levels; ++level)
+    page.total += per_level[level];
+
+  // Pass 2: walk levels best first, newest docid first within a level,
+  // touching only the levels the page overlaps.
+  uint64_t skip = offset;
+  for (size_t level = levels; level >= 1 && page.docids.size() < limit;
+       --level) {
+    if (skip >= per_level[level]) {
+      skip -= per_level[level];
+      continue;
+    }
+    for (auto k = keys.rbegin(); k != keys.rend() && page.docids.size() < limit;
+         ++k) {
+      if (!compute_chunk(*k))
+        continue;
+      select_level(level);
+      for (size_t w = kWords; w-- > 0 && page.docids.size() < limit;) {
+        uint64_t bits = level_words[w];
+        const auto in_word = static_cast<uint64_t>(__builtin_popcountll(bits));
+        if (skip >= in_word) {
+          skip -= in_word;
+          continue;
+        }
+        while (bits && page.docids.size() < limit) {
+          const int top = 63 - __builtin_clzll(bits);
+          bits &= ~(uint64_t{1} << top);
+          if (skip > 0) {
+            --skip;
+            continue;
+          }
+          page.docids.push_back((static_cast<Xapian::docid>(*k) << 16) |
+                                static_cast<Xapian::docid>(w * 64 + top));
+        }
+      }
+    }
+  }
+  return page;
+}
+
+TermBitmapStats TermBitmapIndex::GetStats() const {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  TermBitmapStats stats;
+  stats.terms = bitmaps.size();
+  for (const auto &b : bitmaps) {
+    stats.chunks += b.ChunkCount();
+    stats.bitmap_bytes += b.MemoryBytes();
+  }
+  stats.doc_terms_bytes = doc_terms.capacity() * sizeof(uint32_t) +
+                          doc_spans.capacity() * sizeof(Span);
+  return stats;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <xapian.h>
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "xapian_processor/roaring_bitmap.hpp"
+
+// Boolean query over indexed terms (full terms, prefix included).
+struct BitmapQuery {
+  std::vector<std::string> any;  // at least one; ranks by how many match
+  std::vector<std::string> all;  // every one
+  std::vector<std::string> none; // none of these
+};
+
+struct BitmapPage {
+  // Ordered by matched `any` terms (desc), then newest docid first.
+  std::vector<Xapian::docid> docids;
+  uint64_t total = 0; // exact number of matches
+};
+
+struct TermBitmapStats {
+  uint64_t terms = 0;
+  uint64_t chunks = 0;
+  uint64_t bitmap_bytes = 0;
+  // Per-document term lists kept to undo replaced documents.
+  uint64_t doc_terms_bytes = 0;
+};
+
+// RAM index of one roaring bitmap per boolean filter term (the terms with
+// one of the given prefixes, e.g. "TAG" and "TYPE"). Answers tag-style
+// queries and their top-K without running the Xapian matcher. Loaded from
+// the database on startup and kept current from the commit hook.
+class TermBitmapIndex {
+public:
+  explicit TermBitmapIndex(std::vector<std::string> prefixes);
+
+  void Rebuild(const Xapian::Database &db);
+  // (Re)indexes the documents' prefixed terms, replacing earlier versions.
+  void Update(
+      const std::vector<std::pair<Xapian::docid, const Xapian::Document *>>
+          &docs);
+  void Remove(Xapian::docid docid);
+
+  BitmapPage Search(const BitmapQuery &query, uint64_t offset,
+                    uint32_t limit) const;
+
+  TermBitmapStats GetStats() const;
+
+private:
+  struct Span {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  bool Indexed(const std::string &term) const;
+  uint32_t TermId(const std::string &term);
+  void UpdateLocked(Xapian::docid docid, const Xapian::Document &doc);
+  void RemoveLocked(Xapian::docid docid);
+
+  const std::vector<std::string> prefixes;
+
+  mutable std::shared_mutex mutex;
+  std::unordered_map<std::string, uint32_t> term_ids;
+  std::vector<RoaringBitmap> bitmaps; // by term id
+  // docid -> term ids, so a replaced document can be taken out of the
+  // bitmaps it was in. Replaced spans are not reclaimed until Rebuild().
+  std::vector<uint32_t> doc_terms;
+  std::vector<Span> doc_spans;
+};
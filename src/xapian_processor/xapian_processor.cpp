@@ -1,83 +1,966 @@
 #include "xapian_processor.hpp"
 
 #include "static.hpp"
+#include "tools/geo_cells.hpp"
+#include "xapian_processor/random_sampler.hpp"
 #include <algorithm>
 #include <chrono>
 #include <filesystem>
+#include <functional>
+#include <iterator>
 #include <map>
+#include <numeric>
 #include <optional>
-#include <set>
+#include <random>
+#include <stdexcept>
 #include <sstream>
 
 namespace fs = std::filesystem;
 
 using OptionalGeoData = std::optional<std::pair<double, double>>;
 
-XapianLayer::XapianLayer(const DobrikaServerConfig &config) {
-  SearchConfigProto = config.sc();
+namespace {
+constexpr int kDefaultCommitBatchDocs = 256;
+constexpr int kDefaultCommitBatchMs = 5;
+constexpr int kDefaultResultCacheMb = 64;
+constexpr int kDefaultResultCacheShards = 16;
+constexpr int kDefaultResultCacheGeoPrecision = 3;
+constexpr int kDefaultSearchMaxLimit = 1000;
+constexpr int kDefaultSearchMaxOffset = 10000;
+constexpr int kDefaultBackupKeep = 3;
+constexpr int kDefaultQueryCacheEntries = 256;
+constexpr int kDefaultExpirySweepSec = 60;
+constexpr int kDefaultExpirySweepBatch = 1000;
+constexpr int kDefaultCompactionCheckSec = 600;
+constexpr int kDefaultCompactionDeletedPct = 25;
+constexpr int kDefaultCompactionFragmentationPct = 100;
+constexpr int kDefaultSuggestMb = 64;
+constexpr int kDefaultSearchDeadlineMs = 2000;
+// Replayed ingest log records are re-submitted in chunks of this size.
+constexpr size_t kReplayChunk = 1024;
+// Tasks without usable geo_data are placed here.
+constexpr std::pair<double, double> kDefaultGeo{55.45, 37.65};
 
-  try {
-    database = Xapian::Database(SearchConfigProto.db_file_name());
-  } catch (...) {
-    Xapian::WritableDatabase wdb(SearchConfigProto.db_file_name(),
-                                 Xapian::DB_CREATE_OR_OPEN);
-    wdb.commit();
-    database = Xapian::Database(SearchConfigProto.db_file_name());
+// Bumped whenever documents gain new index structures; older databases are
+// upgraded in place on startup by UpgradeIndexFormat().
+//  1 - original layout
+//  2 - geo cell terms
+//  3 - task_id value slot
+constexpr int kIndexFormat = 3;
+const std::string kIndexFormatKey = "dobrika_index_format";
+
+// QT_RandomTasks: the docid permutation is only used while a filter is
+// expected to match at least one in kMaxProbesPerHit docids; sparser
+// filters are sampled from their posting lists instead.
+constexpr uint64_t kMaxProbesPerHit = 16;
+// Probes a permutation page may spend before giving up on that path.
+constexpr uint64_t kProbeBudgetPerHit = 64;
+
+// Value slot holding the raw task_id, read by TaskIdTable::Rebuild() and as
+// the per-hit fallback.
+constexpr Xapian::valueno kTaskIdSlot = 10;
+// sortable_serialise(expires_at), only on tasks that expire.
+constexpr Xapian::valueno kExpirySlot = 11;
+const std::string kIdTermPrefix = "ID";
+const std::string kTagPrefix = "TAG";
+// Boolean term per known task type: "TYPE" + "TT_OnlineTask" etc.
+const std::string kTaskTypePrefix = "TYPE";
+// Longest term the glass backend stores; add_term() accepts longer ones
+// and the commit then fails with InvalidArgumentError.
+constexpr size_t kMaxTermBytes = 245;
+
+// Parsed queries kept per reader handle: 0 picks the default, negative
+// disables the cache.
+size_t QueryCacheEntries(const SearchConfig &config) {
+  if (config.query_cache_entries() < 0)
+    return 0;
+  return static_cast<size_t>(config.query_cache_entries() == 0
+                                 ? kDefaultQueryCacheEntries
+                                 : config.query_cache_entries());
+}
+} // namespace
+
+XapianLayer::XapianLayer(const DobrikaServerConfig &config)
+    : SearchConfigProto(config.sc()),
+      shard_paths(ShardPaths(
+          SearchConfigProto.db_file_name(),
+          static_cast<size_t>(std::max(1, SearchConfigProto.shards())))),
+      readers(shard_paths, QueryCacheEntries(SearchConfigProto)),
+      query_build_latency(search_stages.WithLabels({"query_build"})),
+      match_latency(search_stages.WithLabels({"match"})),
+      materialise_latency(search_stages.WithLabels({"materialise"})) {
+  if (SearchConfigProto.commit_batch_docs() <= 0)
+    SearchConfigProto.set_commit_batch_docs(kDefaultCommitBatchDocs);
+  if (SearchConfigProto.commit_batch_ms() <= 0)
+    SearchConfigProto.set_commit_batch_ms(kDefaultCommitBatchMs);
+  if (SearchConfigProto.result_cache_max_mb() == 0)
+    SearchConfigProto.set_result_cache_max_mb(kDefaultResultCacheMb);
+  if (SearchConfigProto.result_cache_shards() <= 0)
+    SearchConfigProto.set_result_cache_shards(kDefaultResultCacheShards);
+  if (SearchConfigProto.result_cache_geo_precision() <= 0)
+    SearchConfigProto.set_result_cache_geo_precision(
+        kDefaultResultCacheGeoPrecision);
+  if (SearchConfigProto.result_cache_max_stale_ms() < 0)
+    SearchConfigProto.set_result_cache_max_stale_ms(0);
+  if (SearchConfigProto.search_max_limit() <= 0)
+    SearchConfigProto.set_search_max_limit(kDefaultSearchMaxLimit);
+  if (SearchConfigProto.search_max_offset() <= 0)
+    SearchConfigProto.set_search_max_offset(kDefaultSearchMaxOffset);
+  if (SearchConfigProto.search_deadline_ms() == 0)
+    SearchConfigProto.set_search_deadline_ms(kDefaultSearchDeadlineMs);
+  if (SearchConfigProto.search_geo_index() == static_cast<int>(kTaskIdSlot)) {
+    throw std::invalid_argument("search_geo_index " +
+                                std::to_string(kTaskIdSlot) +
+                                " is reserved for task_id");
+  }
+  if (SearchConfigProto.search_geo_index() == static_cast<int>(kExpirySlot)) {
+    throw std::invalid_argument("search_geo_index " +
+                                std::to_string(kExpirySlot) +
+                                " is reserved for expires_at");
+  }
+  if (SearchConfigProto.expiry_sweep_sec() == 0)
+    SearchConfigProto.set_expiry_sweep_sec(kDefaultExpirySweepSec);
+  if (SearchConfigProto.expiry_sweep_batch() <= 0)
+    SearchConfigProto.set_expiry_sweep_batch(kDefaultExpirySweepBatch);
+  if (SearchConfigProto.compaction_check_sec() == 0)
+    SearchConfigProto.set_compaction_check_sec(kDefaultCompactionCheckSec);
+  if (SearchConfigProto.compaction_deleted_pct() == 0)
+    SearchConfigProto.set_compaction_deleted_pct(kDefaultCompactionDeletedPct);
+  if (SearchConfigProto.compaction_fragmentation_pct() == 0)
+    SearchConfigProto.set_compaction_fragmentation_pct(
+        kDefaultCompactionFragmentationPct);
+  if (SearchConfigProto.tag_bitmap_index() >= 0) {
+    tag_bitmaps = std::make_unique<TermBitmapIndex>(
+        std::vector<std::string>{kTagPrefix, kTaskTypePrefix});
+  }
+  if (SearchConfigProto.suggest_max_mb() == 0)
+    SearchConfigProto.set_suggest_max_mb(kDefaultSuggestMb);
+  if (SearchConfigProto.suggest_max_mb() > 0) {
+    suggest = std::make_unique<SuggestIndex>(
+        static_cast<size_t>(SearchConfigProto.suggest_max_mb()) << 20);
+  }
+  const size_t shard_count = shard_paths.size();
+  CheckShardLayout(SearchConfigProto.db_file_name(), shard_count);
+  if (shard_count > 1) {
+    fs::create_directories(SearchConfigProto.db_file_name());
+    fan_out = std::make_unique<FanOutPool>(
+        std::max(1u, std::thread::hardware_concurrency()));
+  }
+  std::vector<BackupPart> backup_parts;
+  for (size_t s = 0; s < shard_count; ++s) {
+    shard_mutexes.emplace_back();
+    backup_parts.push_back(
+        {shard_count > 1 ? fs::path(shard_paths[s]).filename() : fs::path(),
+         &shard_mutexes[s]});
+  }
+  if (SearchConfigProto.backup_keep() <= 0)
+    SearchConfigProto.set_backup_keep(kDefaultBackupKeep);
+  BackupOptions backup_options;
+  backup_options.keep = static_cast<size_t>(SearchConfigProto.backup_keep());
+  if (SearchConfigProto.backup_max_mb_per_sec() > 0)
+    backup_options.max_bytes_per_sec =
+        static_cast<uint64_t>(SearchConfigProto.backup_max_mb_per_sec()) << 20;
+  backups = std::make_unique<DatabaseBackup>(
+      SearchConfigProto.db_file_name(), std::move(backup_parts),
+      backup_options);
+  if (SearchConfigProto.replication_log_mb() > 0) {
+    if (IsFollower())
+      throw std::invalid_argument(
+          "replication_log_mb: a read replica can't serve replicas itself");
+    replication_log = std::make_unique<ReplicationLog>(
+        static_cast<size_t>(SearchConfigProto.replication_log_mb()) << 20);
+  }
+  if (SearchConfigProto.result_cache_max_mb() > 0) {
+    result_cache = std::make_unique<ResultCache>(
+        static_cast<size_t>(SearchConfigProto.result_cache_max_mb()) << 20,
+        static_cast<size_t>(SearchConfigProto.result_cache_shards()),
+        std::chrono::milliseconds(
+            SearchConfigProto.result_cache_max_stale_ms()));
+  }
+
+  // Writers create their databases on first start; readers are opened
+  // lazily on the first search.
+  touched.resize(shard_count);
+  for (size_t s = 0; s < shard_count; ++s) {
+    RecoverCompaction(shard_paths[s]);
+    writers.push_back(std::make_unique<IndexWriter>(
+        shard_paths[s], shard_mutexes[s],
+        static_cast<size_t>(SearchConfigProto.commit_batch_docs()),
+        std::chrono::milliseconds(SearchConfigProto.commit_batch_ms()),
+        [this, s](const std::vector<CommittedDocument> &committed,
+                  uint64_t log_position) {
+          OnShardCommit(s, committed, log_position);
+        }));
+  }
+  UpgradeIndexFormat();
+  for (const auto &writer : writers)
+    log_committed.push_back(writer->CommittedLogPosition());
+  log_submitted = log_committed;
+  // A replica's writes come from the leader, which keeps its own log.
+  if (SearchConfigProto.ingest_log() >= 0 && !IsFollower()) {
+    if (SearchConfigProto.ingest_log_dir().empty())
+      SearchConfigProto.set_ingest_log_dir(SearchConfigProto.db_file_name() +
+                                           "_wal");
+    ingest_log = std::make_unique<IngestLog>(
+        SearchConfigProto.ingest_log_dir(),
+        *std::min_element(log_committed.begin(), log_committed.end()),
+        *std::max_element(log_committed.begin(), log_committed.end()));
+    ReplayIngestLog();
+  }
+  ReaderPool::Lease lease = readers.Acquire();
+  task_ids.Rebuild(lease.db(), kTaskIdSlot);
+  if (tag_bitmaps)
+    tag_bitmaps->Rebuild(lease.db());
+  if (suggest)
+    suggest->Rebuild(lease.db());
+}
+
+void XapianLayer::UpgradeIndexFormat() {
+  const auto upgrade = [this](Xapian::WritableDatabase &wdb) {
+    const std::string stored = wdb.get_metadata(kIndexFormatKey);
+    // A database without the key is either brand new or predates it.
+    const int format =
+        stored.empty() ? (wdb.get_doccount() == 0 ? kIndexFormat : 1)
+                       : std::stoi(stored);
+    if (format >= kIndexFormat) {
+      if (stored.empty())
+        wdb.set_metadata(kIndexFormatKey, std::to_string(kIndexFormat));
+      return;
+    }
+
+    std::vector<Xapian::docid> docids;
+    docids.reserve(wdb.get_doccount());
+    for (auto it = wdb.postlist_begin(""); it != wdb.postlist_end("");
+         ++it) {
+      docids.push_back(*it);
+    }
+    constexpr size_t kCommitEvery = 10000;
+    for (size_t i = 0; i < docids.size(); ++i) {
+      Xapian::Document doc = wdb.get_document(docids[i]);
+      if (format < 2) {
+        Xapian::LatLongCoords coords;
+        coords.unserialise(
+            doc.get_value(SearchConfigProto.search_geo_index()));
+        if (!coords.empty()) {
+          const Xapian::LatLongCoord &c = *coords.begin();
+          for (const auto &cell :
+               GeoCellTermsForPoint(c.latitude, c.longitude)) {
+            doc.add_boolean_term(cell);
+          }
+        }
+      }
+      if (format < 3) {
+        doc.add_value(kTaskIdSlot, GetField(doc.get_data(), 2));
+      }
+      wdb.replace_document(docids[i], doc);
+      if ((i + 1) % kCommitEvery == 0)
+        wdb.commit();
+    }
+    wdb.set_metadata(kIndexFormatKey, std::to_string(kIndexFormat));
+  };
+  // Not atomic: the upgrade commits every kCommitEvery documents, and
+  // re-running an interrupted one redoes the same changes.
+  for (const auto &writer : writers)
+    writer->RunExclusive(upgrade, false);
+}
+
+void XapianLayer::ReplayIngestLog() {
+  struct ShardReplay {
+    std::vector<PendingDocument> docs;
+    uint64_t last_seq = 0;
+  };
+  std::vector<ShardReplay> shards(writers.size());
+  // The log replays from the oldest shard checkpoint; newer shards skip
+  // what they already hold.
+  const std::vector<uint64_t> checkpoints = log_committed;
+  std::vector<std::future<void>> pending;
+  auto flush = [&](size_t shard) {
+    ShardReplay &r = shards[shard];
+    if (r.docs.empty())
+      return;
+    NoteLogSubmitted(shard, r.last_seq);
+    pending.push_back(writers[shard]->Submit(std::move(r.docs), r.last_seq));
+    r.docs.clear();
+  };
+  ingest_log->Replay([&](uint64_t seq, std::string_view payload) {
+    DSIndexTask task;
+    // The checksum matched, so this only skips records of an incompatible
+    // build.
+    if (!task.ParseFromArray(payload.data(), static_cast<int>(payload.size())))
+      return;
+    const size_t shard = ShardOf(task);
+    if (seq <= checkpoints[shard])
+      return;
+    // Logged before /index checked term lengths; it could never commit.
+    if (UnindexableTask(task))
+      return;
+    ShardReplay &r = shards[shard];
+    r.docs.emplace_back(kIdTermPrefix + task.task_id(), MakeDocument(task));
+    r.last_seq = seq;
+    if (r.docs.size() >= kReplayChunk)
+      flush(shard);
+  });
+  for (size_t shard = 0; shard < shards.size(); ++shard)
+    flush(shard);
+  // A record the writer rejected is skipped (its future carries the error);
+  // transient failures are retried by the writer, never reported here.
+  for (auto &f : pending) {
+    try {
+      f.get();
+    } catch (...) {
+    }
+  }
+}
+
+void XapianLayer::NoteLogSubmitted(size_t shard, uint64_t log_position) {
+  std::lock_guard<std::mutex> lk(log_progress_mutex);
+  log_submitted[shard] = log_position;
+}
+
+void XapianLayer::NoteLogCommitted(size_t shard, uint64_t log_position) {
+  uint64_t applied = 0;
+  {
+    std::lock_guard<std::mutex> lk(log_progress_mutex);
+    log_committed[shard] = std::max(log_committed[shard], log_position);
+    // Every record routed to a shard that has caught up is applied; the
+    // ones before the oldest position a lagging shard committed are too.
+    uint64_t lagging = ~uint64_t{0};
+    for (size_t s = 0; s < log_committed.size(); ++s) {
+      applied = std::max(applied, log_submitted[s]);
+      if (log_committed[s] < log_submitted[s])
+        lagging = std::min(lagging, log_committed[s]);
+    }
+    applied = std::min(applied, lagging);
+  }
+  ingest_log->MarkApplied(applied);
+}
+
+void XapianLayer::OnShardCommit(
+    size_t shard, const std::vector<CommittedDocument> &committed,
+    uint64_t log_position) {
+  // Final state per docid; a batch may index and delete the same task.
+  std::map<Xapian::docid, const Xapian::Document *> changed;
+  std::vector<Xapian::docid> docids;
+  docids.reserve(committed.size());
+  uint64_t deleted = 0;
+  for (const auto &c : committed) {
+    const auto &doc = c.doc->second;
+    changed[c.docid] = doc ? &*doc : nullptr;
+    docids.push_back(c.docid);
+    if (!doc)
+      ++deleted;
+  }
+  NoteTouched(shard, docids);
+  deleted_api.fetch_add(deleted, std::memory_order_relaxed);
+  // Publish the new ids (and then tag bitmaps, which only hold docids
+  // already in task_ids) before readers can reopen onto them.
+  UpdateSideTables(shard, changed);
+  readers.BumpGeneration();
+  if (ingest_log && log_position != 0)
+    NoteLogCommitted(shard, log_position);
+  // After the bump, so a follower that saw this changeset and then reads a
+  // snapshot page gets a reader that holds it.
+  if (replication_log && !committed.empty()) {
+    std::vector<Changeset::Entry> entries;
+    entries.reserve(committed.size());
+    for (const auto &c : committed) {
+      const auto &doc = c.doc->second;
+      entries.push_back({c.docid, doc ? doc->serialise() : std::string()});
+    }
+    PublishChangeset(shard, std::move(entries));
+  }
+}
+
+void XapianLayer::UpdateSideTables(
+    size_t shard,
+    const std::map<Xapian::docid, const Xapian::Document *> &changed) {
+  const ShardDocidMap combined{shard, writers.size()};
+  std::vector<std::pair<Xapian::docid, std::string>> ids;
+  std::vector<std::pair<Xapian::docid, const Xapian::Document *>> docs;
+  std::vector<Xapian::docid> removed;
+  for (const auto &[docid, doc] : changed) {
+    if (!doc) {
+      removed.push_back(combined(docid));
+      continue;
+    }
+    ids.emplace_back(combined(docid), doc->get_value(kTaskIdSlot));
+    docs.emplace_back(combined(docid), doc);
+  }
+  if (!removed.empty())
+    task_ids.Erase(removed);
+  task_ids.Insert(ids);
+  if (tag_bitmaps) {
+    for (const Xapian::docid docid : removed)
+      tag_bitmaps->Remove(docid);
+    tag_bitmaps->Update(docs);
+  }
+  if (suggest) {
+    for (const Xapian::docid docid : removed)
+      suggest->Remove(docid);
+    suggest->Update(docs);
+  }
+}
+
+void XapianLayer::PublishChangeset(size_t shard,
+                                   std::vector<Changeset::Entry> entries) {
+  Changeset changeset;
+  changeset.shard = static_cast<uint32_t>(shard);
+  changeset.commit_unix_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  changeset.entries = std::move(entries);
+  replication_log->Publish(std::move(changeset));
+}
+
+void XapianLayer::NoteTouched(size_t shard,
+                              const std::vector<Xapian::docid> &docids) {
+  std::lock_guard<std::mutex> lk(touched_mutex);
+  if (touched[shard])
+    touched[shard]->insert(touched[shard]->end(), docids.begin(),
+                           docids.end());
+}
+
+XapianLayer::~XapianLayer() {
+  StopMaintenance();
+  StopBackupScheduler();
+  // Stop appending before the writers drain, so every acknowledged record
+  // is either committed or left in the log for the next start.
+  if (ingest_log)
+    ingest_log->Stop();
+  for (const auto &writer : writers)
+    writer->Stop();
+}
+
+ReadModeChooser::Mode XapianLayer::ChooseReadMode(size_t plan) {
+  return fan_out ? read_modes.Choose(plan) : ReadModeChooser::Mode::Combined;
+}
+
+void XapianLayer::RecordReadMode(
+    size_t plan, ReadModeChooser::Mode mode,
+    std::chrono::steady_clock::time_point started) {
+  if (fan_out)
+    read_modes.Record(plan, mode, std::chrono::steady_clock::now() - started);
+}
+
+std::vector<XapianLayer::ReadModeCount> XapianLayer::GetReadModeCounts() const {
+  std::vector<ReadModeCount> counts;
+  if (!fan_out)
+    return counts;
+  for (const auto &[plan, name] :
+       {std::pair<size_t, const char *>{kGeoReads, "geo"},
+        std::pair<size_t, const char *>{kFilterReads, "filter"}}) {
+    counts.push_back({name, "combined",
+                      read_modes.Count(plan, ReadModeChooser::Mode::Combined)});
+    counts.push_back({name, "fan_out",
+                      read_modes.Count(plan, ReadModeChooser::Mode::FanOut)});
+  }
+  return counts;
+}
+
+namespace {
+Xapian::doccount CountCandidates(const Xapian::Database &db,
+                                 const std::vector<std::string> &terms) {
+  Xapian::doccount n = 0;
+  for (const auto &term : terms) {
+    n += db.get_termfreq(term);
+  }
+  return n;
+}
+
+// Query() (empty) from these helpers means "no constraint".
+
+// Any-of (weighted OR, more matched tags rank higher) or all-of.
+Xapian::Query TagQuery(const DSearchRequest &request) {
+  std::vector<Xapian::Query> terms;
+  for (const auto &tag : request.user_tags()) {
+    if (!tag.empty()) {
+      terms.emplace_back(kTagPrefix + tag);
+    }
+  }
+  if (terms.empty())
+    return Xapian::Query();
+  return Xapian::Query(request.all_tags() ? Xapian::Query::OP_AND
+                                          : Xapian::Query::OP_OR,
+                       terms.begin(), terms.end());
+}
+
+// context must be the one bound to the database the query runs against.
+Xapian::Query TextQuery(QueryContext &context, const DSearchRequest &request) {
+  if (request.user_query().empty())
+    return Xapian::Query();
+  return context.Parse(request.user_query());
+}
+
+Xapian::Query TypeFilter(const DSearchRequest &request) {
+  const auto it = kTaskTypeByString.find(request.task_type());
+  if (it == kTaskTypeByString.end())
+    return Xapian::Query();
+  return Xapian::Query(kTaskTypePrefix + it->first);
+}
+
+// Tag/type constraints of a random sample, checked per candidate docid
+// against its termlist. Terms are sorted so one termlist pass answers all.
+struct SampleFilter {
+  enum class Kind { kTag, kType, kExcluded };
+  std::vector<std::pair<std::string, Kind>> terms;
+  bool all_tags = false;
+  bool has_tags = false;
+  bool has_type = false;
+
+  explicit SampleFilter(const DSearchRequest &request)
+      : all_tags(request.all_tags()) {
+    for (const auto &tag : request.user_tags()) {
+      if (!tag.empty())
+        terms.emplace_back(kTagPrefix + tag, Kind::kTag);
+    }
+    has_tags = !terms.empty();
+    if (kTaskTypeByString.count(request.task_type())) {
+      terms.emplace_back(kTaskTypePrefix + request.task_type(), Kind::kType);
+      has_type = true;
+    }
+    for (const auto &tag : request.exclude_tags()) {
+      if (!tag.empty())
+        terms.emplace_back(kTagPrefix + tag, Kind::kExcluded);
+    }
+    std::sort(terms.begin(), terms.end());
+  }
+
+  bool Empty() const { return terms.empty(); }
+
+  bool Matches(const Xapian::Database &db, Xapian::docid docid) const {
+    size_t tags_seen = 0;
+    size_t tags_wanted = 0;
+    bool type_seen = false;
+    Xapian::TermIterator it = db.termlist_begin(docid);
+    const Xapian::TermIterator end = db.termlist_end(docid);
+    for (const auto &[term, kind] : terms) {
+      if (kind == Kind::kTag)
+        ++tags_wanted;
+      it.skip_to(term);
+      if (it == end || *it != term)
+        continue;
+      switch (kind) {
+      case Kind::kTag:
+        ++tags_seen;
+        break;
+      case Kind::kType:
+        type_seen = true;
+        break;
+      case Kind::kExcluded:
+        return false;
+      }
+    }
+    if (has_type && !type_seen)
+      return false;
+    if (!has_tags)
+      return true;
+    return all_tags ? tags_seen == tags_wanted : tags_seen > 0;
+  }
+
+  // Upper bound on the number of matching documents.
+  Xapian::doccount Estimate(const Xapian::Database &db) const {
+    Xapian::doccount bound = db.get_doccount();
+    Xapian::doccount tag_sum = 0;
+    Xapian::doccount tag_min = bound;
+    for (const auto &[term, kind] : terms) {
+      const Xapian::doccount freq = db.get_termfreq(term);
+      if (kind == Kind::kTag) {
+        tag_sum += freq;
+        tag_min = std::min(tag_min, freq);
+      } else if (kind == Kind::kType) {
+        bound = std::min(bound, freq);
+      }
+    }
+    if (has_tags)
+      bound = std::min(bound, all_tags ? tag_min : tag_sum);
+    return bound;
+  }
+};
+
+Xapian::Query ExcludeQuery(const DSearchRequest &request) {
+  std::vector<Xapian::Query> terms;
+  for (const auto &tag : request.exclude_tags()) {
+    if (!tag.empty()) {
+      terms.emplace_back(kTagPrefix + tag);
+    }
+  }
+  if (terms.empty())
+    return Xapian::Query();
+  return Xapian::Query(Xapian::Query::OP_OR, terms.begin(), terms.end());
+}
+
+// Splits one search into consecutive stages; Lap() records the time since
+// the previous lap (or construction) into the stage's histogram.
+class StageClock {
+public:
+  void Lap(LatencyHistogram &stage) {
+    const auto now = std::chrono::steady_clock::now();
+    stage.Observe(now - last);
+    last = now;
+  }
+
+private:
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+};
+
+// Exact great-circle radius test on the stored position.
+class RadiusDecider : public Xapian::MatchDecider {
+public:
+  RadiusDecider(Xapian::valueno slot, const std::pair<double, double> &centre,
+                double radius_km)
+      : slot(slot), centre(centre), radius_km(radius_km) {}
+
+  bool operator()(const Xapian::Document &doc) const override {
+    Xapian::LatLongCoords coords;
+    coords.unserialise(doc.get_value(slot));
+    if (coords.empty())
+      return false;
+    const Xapian::LatLongCoord &c = *coords.begin();
+    return GreatCircleKm(centre.first, centre.second, c.latitude,
+                         c.longitude) <= radius_km;
+  }
+
+private:
+  Xapian::valueno slot;
+  std::pair<double, double> centre;
+  double radius_km;
+};
+
+// Accepts only documents sorting strictly after a cursor's last hit, in the
+// (sort key, combined docid) order Xapian uses for set_sort_by_key.
+class SearchAfterDecider : public Xapian::MatchDecider {
+public:
+  SearchAfterDecider(const Xapian::KeyMaker &keymaker, const SearchPage &page,
+                     ShardDocidMap combined)
+      : keymaker(keymaker), page(page), combined(combined) {}
+
+  bool operator()(const Xapian::Document &doc) const override {
+    const std::string key = keymaker(doc);
+    if (key != page.after_key)
+      return key > page.after_key;
+    return combined(doc.get_docid()) > page.after_docid;
+  }
+
+private:
+  const Xapian::KeyMaker &keymaker;
+  const SearchPage &page;
+  const ShardDocidMap combined;
+};
+
+struct GeoRequest {
+  const DSearchRequest &request;
+  std::pair<double, double> centre;
+  double radius_km;
+  const SearchPage &page;
+  Xapian::valueno slot;
+};
+
+// Closest-first hits as (distance sort key, combined docid).
+struct GeoHits {
+  std::vector<std::pair<std::string, Xapian::docid>> hits;
+  Xapian::doccount estimated = 0;
+  // Cut short by the deadline.
+  bool partial = false;
+};
+
+// Hits [first, first + limit) of a geo request in db (one shard, or all of
+// them combined), parsing text with db's context. With a clock, the query
+// build time is lapped into build_stage. Past the deadline the cover stops
+// growing and the hits found so far are returned.
+GeoHits MatchGeo(const Xapian::Database &db, QueryContext &context,
+                 ShardDocidMap combined, const GeoRequest &geo,
+                 Xapian::doccount first, Xapian::doccount limit,
+                 const SearchDeadline &deadline, StageClock *clock,
+                 LatencyHistogram *build_stage) {
+  const SearchPage &page = geo.page;
+  // Grow rings of cells around the user until they hold enough documents
+  // for the requested page (or cover the whole radius). Exact distances
+  // are only computed for documents inside the cover.
+  GeoCellCover cover(geo.centre.first, geo.centre.second);
+  auto covers_radius = [&] {
+    return geo.radius_km > 0 && cover.BoundKm() >= geo.radius_km;
+  };
+  auto grow_to = [&](Xapian::doccount wanted) {
+    while (!cover.Exhausted() && !covers_radius() && !deadline.Passed() &&
+           CountCandidates(db, cover.Terms()) < wanted) {
+      cover.Grow();
+    }
+  };
+  grow_to(page.position + page.limit);
+
+  // Text, tags and task type narrow the cells inside the same match.
+  std::vector<Xapian::Query> filters;
+  for (Xapian::Query q : {TextQuery(context, geo.request),
+                          TagQuery(geo.request), TypeFilter(geo.request)}) {
+    if (!q.empty())
+      filters.push_back(std::move(q));
+  }
+
+  const Xapian::Query excluded = ExcludeQuery(geo.request);
+
+  Xapian::LatLongDistanceKeyMaker keymaker(
+      geo.slot, Xapian::LatLongCoord(geo.centre.first, geo.centre.second),
+      Xapian::GreatCircleMetric());
+  SearchAfterDecider after(keymaker, page, combined);
+  DeadlineDecider in_time(deadline, page.search_after ? &after : nullptr);
+  if (clock)
+    clock->Lap(*build_stage);
+  Xapian::MSet mset;
+  bool partial = false;
+  while (true) {
+    Xapian::Enquire enq(db);
+    enq.set_weighting_scheme(Xapian::BoolWeight());
+    Xapian::Query cells(Xapian::Query::OP_OR, cover.Terms().begin(),
+                        cover.Terms().end());
+    if (!filters.empty()) {
+      cells = Xapian::Query(Xapian::Query::OP_FILTER, cells,
+                            Xapian::Query(Xapian::Query::OP_AND,
+                                          filters.begin(), filters.end()));
+    }
+    if (!excluded.empty()) {
+      cells = Xapian::Query(Xapian::Query::OP_AND_NOT, cells, excluded);
+    }
+    enq.set_query(cells);
+    enq.set_sort_by_key(&keymaker, false);
+    mset = enq.get_mset(first, limit, 0, nullptr, in_time.Get());
+    if (cover.Exhausted() || covers_radius()) {
+      break;
+    }
+    // Widening needs another match; out of time, keep what was found.
+    const bool out_of_time = in_time.Expired() || deadline.Passed();
+    if (mset.size() < limit) {
+      if (out_of_time) {
+        partial = true;
+        break;
+      }
+      // Short page: the rest of it, if any, lies outside the cover.
+      const Xapian::doccount had = CountCandidates(db, cover.Terms());
+      cover.Grow();
+      grow_to(2 * had);
+      continue;
+    }
+    // A document outside the cover may still beat the page's farthest
+    // hit; widen until nothing outside can be closer, then rerun once.
+    std::string last_key;
+    for (Xapian::MSetIterator mit = mset.begin(); mit != mset.end(); ++mit) {
+      last_key = mit.get_sort_key();
+    }
+    const double farthest_km = Xapian::sortable_unserialise(last_key) / 1000.0;
+    if (cover.BoundKm() >= farthest_km) {
+      break;
+    }
+    if (out_of_time) {
+      partial = true;
+      break;
+    }
+    while (!cover.Exhausted() && cover.BoundKm() < farthest_km) {
+      cover.Grow();
+    }
+  }
+
+  GeoHits out;
+  out.hits.reserve(mset.size());
+  for (Xapian::MSetIterator mit = mset.begin(); mit != mset.end(); ++mit) {
+    out.hits.emplace_back(mit.get_sort_key(), combined(*mit));
+  }
+  out.estimated = mset.get_matches_estimated();
+  out.partial = partial || in_time.Expired();
+  return out;
+}
+
+// Hits [first, first + limit) of the union of per-shard results, each
+// holding that shard's first + limit closest.
+GeoHits MergeGeoHits(std::vector<GeoHits> &parts, Xapian::doccount first,
+                     Xapian::doccount limit) {
+  GeoHits out;
+  for (auto &part : parts) {
+    out.estimated += part.estimated;
+    out.partial = out.partial || part.partial;
+    std::move(part.hits.begin(), part.hits.end(),
+              std::back_inserter(out.hits));
   }
+  std::sort(out.hits.begin(), out.hits.end());
+  const size_t begin = std::min<size_t>(first, out.hits.size());
+  const size_t end = std::min<size_t>(size_t{first} + limit, out.hits.size());
+  out.hits.erase(out.hits.begin() + static_cast<std::ptrdiff_t>(end),
+                 out.hits.end());
+  out.hits.erase(out.hits.begin(),
+                 out.hits.begin() + static_cast<std::ptrdiff_t>(begin));
+  return out;
 }
-XapianLayer::~XapianLayer() { StopBackupScheduler(); }
+} // namespace
 
-std::unique_ptr<Xapian::LatLongDistanceKeyMaker>
-XapianLayer::SetupGeoQuery(const std::pair<double, double> &userPos) {
-  Xapian::LatLongCoord centre(userPos.first, userPos.second);
-  Xapian::GreatCircleMetric metric;
-  return std::make_unique<Xapian::LatLongDistanceKeyMaker>(
-      SearchConfigProto.search_geo_index(), centre, metric);
+std::optional<SearchPage>
+XapianLayer::ResolveSearchPage(const DSearchRequest &request) const {
+  PagingLimits limits;
+  limits.default_offset =
+      static_cast<Xapian::doccount>(std::max(0, SearchConfigProto.search_offset()));
+  limits.default_limit =
+      static_cast<Xapian::doccount>(std::max(0, SearchConfigProto.search_limit()));
+  limits.max_limit =
+      static_cast<Xapian::doccount>(SearchConfigProto.search_max_limit());
+  limits.max_offset =
+      static_cast<Xapian::doccount>(SearchConfigProto.search_max_offset());
+  return ResolvePage(request, limits);
 }
 
-DSearchResult XapianLayer::DoGeoSearch(const DSearchRequest &user_query) {
+DSearchResult XapianLayer::DoGeoSearch(const DSearchRequest &user_query,
+                                       const SearchDeadline &deadline) {
   DSearchResult result;
-  Xapian::Enquire enq(database);
   OptionalGeoData geo = ParseGeo(user_query.geo_data());
   if (!geo.has_value()) {
     result.set_status(GetSearchStatus(DSearchStatus::DSUnknownTaskType));
     return result;
   }
-  enq.set_query(Xapian::Query::MatchAll);
+  const std::optional<SearchPage> page = ResolveSearchPage(user_query);
+  if (!page) {
+    result.set_status(GetSearchStatus(DSearchStatus::DSInvalidPaging));
+    return result;
+  }
+  const double radius_km = std::max(0.0, user_query.radius_km());
+  // With a cursor, the skipped hits are filtered by the decider instead of
+  // being matched, sorted and dropped.
+  const Xapian::doccount first = page->search_after ? 0 : page->position;
+  const Xapian::doccount limit = page->limit;
 
-  auto keymaker = SetupGeoQuery(*geo);
-  enq.set_sort_by_key(keymaker.get(), false);
-  Xapian::MSet mset = enq.get_mset(SearchConfigProto.search_offset(),
-                                   SearchConfigProto.search_limit());
-  for (Xapian::MSetIterator mit = mset.begin(); mit != mset.end(); ++mit) {
-    const std::string &data = mit.get_document().get_data();
-    const std::string task_id = GetField(data, 2); // task_id is at index 2
-    if (!task_id.empty()) {
-      result.add_task_id(task_id);
+  const GeoRequest request{
+      user_query, *geo, radius_km, *page,
+      static_cast<Xapian::valueno>(SearchConfigProto.search_geo_index())};
+  const ReadModeChooser::Mode mode = ChooseReadMode(kGeoReads);
+  const auto started = std::chrono::steady_clock::now();
+
+  WithLease([&](ReaderPool::Lease &lease) {
+    result.Clear();
+    Xapian::Database &db = lease.db();
+    StageClock clock;
+    GeoHits matched;
+    if (mode == ReadModeChooser::Mode::FanOut) {
+      // Sorting by (distance, combined docid) is total, so the page is cut
+      // exactly from the shards' own first + limit closest.
+      std::vector<Xapian::Database> &shards = lease.shards();
+      std::vector<GeoHits> parts(shards.size());
+      fan_out->ParallelFor(shards.size(), [&](size_t s) {
+        parts[s] = MatchGeo(shards[s], lease.shard_context(s),
+                            ShardDocidMap{s, shards.size()}, request, 0,
+                            first + limit, deadline, nullptr, nullptr);
+      });
+      matched = MergeGeoHits(parts, first, limit);
+    } else {
+      matched = MatchGeo(db, lease.context(), ShardDocidMap{}, request, first,
+                         limit, deadline, &clock, &query_build_latency);
     }
-  }
+    clock.Lap(match_latency);
+
+    const TaskIdTable::View ids = task_ids.Read();
+    bool cut_by_radius = false;
+    std::string last_key;
+    Xapian::docid last_docid = 0;
+    Xapian::doccount returned = 0;
+    for (const auto &[key, docid] : matched.hits) {
+      if (radius_km > 0 &&
+          Xapian::sortable_unserialise(key) / 1000.0 > radius_km) {
+        cut_by_radius = true;
+        break; // sorted by distance, the rest is farther
+      }
+      AppendTaskId(db, ids, docid, result);
+      last_key = key;
+      last_docid = docid;
+      ++returned;
+    }
+
+    // Every document carries a position, so without a radius all of them
+    // match; with one, the cover's estimate is the best cheap guess (the
+    // decider leaves out the hits before the cursor).
+    result.set_estimated_total(
+        radius_km > 0
+            ? (page->search_after ? page->position : 0) + matched.estimated
+            : db.get_doccount());
+    // A partial page may have skipped closer hits, so it ends the paging.
+    result.set_partial(matched.partial);
+    if (!matched.partial && !cut_by_radius && returned == limit &&
+        limit > 0 && page->position + returned < db.get_doccount()) {
+      result.set_next_cursor(
+          NextCursor(*page, returned, last_key, last_docid));
+    }
+    clock.Lap(materialise_latency);
+  });
+  RecordReadMode(kGeoReads, mode, started);
   result.set_status(GetSearchStatus(DSearchStatus::DSOk));
   return result;
 }
 
-DSearchResult XapianLayer::DoSearch(const DSearchRequest &user_request) {
+DSearchResult XapianLayer::DoSearch(const DSearchRequest &user_request,
+                                    const SearchDeadline &deadline) {
+  // A seedless random request gets a fresh sample every time.
+  const bool fresh_random =
+      GetTaskType(user_request) == DSQueryTypeEnum::SRandomTasks &&
+      user_request.seed() == 0 && user_request.cursor().empty();
+  if (!result_cache || fresh_random)
+    return DispatchSearch(user_request, deadline);
+
+  const int precision = SearchConfigProto.result_cache_geo_precision();
+  const std::string key = MakeResultCacheKey(user_request, precision);
+  // Read before searching: a commit landing mid-search leaves the entry
+  // tagged with the older generation, so it is never served as fresh.
+  const uint64_t generation = GetWriteGeneration();
+  if (auto cached = result_cache->Get(key, generation))
+    return std::move(*cached);
+
+  // Run the rounded request so every caller sharing the key would have got
+  // the same answer.
+  DSearchRequest normalized = user_request;
+  RoundRequestGeo(normalized, precision);
+  DSearchResult result = DispatchSearch(normalized, deadline);
+  // A partial page depends on timing, not just on the request.
+  if (result.status() == GetSearchStatus(DSearchStatus::DSOk) &&
+      !result.partial())
+    result_cache->Put(key, generation, result);
+  return result;
+}
+
+SearchDeadline
+XapianLayer::DeadlineFor(const DSearchRequest &request,
+                         SearchDeadline::Clock::time_point received) const {
+  std::chrono::milliseconds budget = std::chrono::milliseconds::max();
+  if (SearchConfigProto.search_deadline_ms() > 0)
+    budget = std::chrono::milliseconds(SearchConfigProto.search_deadline_ms());
+  if (request.timeout_ms() > 0)
+    budget = std::min(budget, std::chrono::milliseconds(request.timeout_ms()));
+  SearchDeadline deadline;
+  if (budget != std::chrono::milliseconds::max())
+    deadline.at = received + budget;
+  return deadline;
+}
+
+ResultCacheStats XapianLayer::GetResultCacheStats() const {
+  return result_cache ? result_cache->GetStats() : ResultCacheStats{};
+}
+
+DSearchResult XapianLayer::DispatchSearch(const DSearchRequest &user_request,
+                                          const SearchDeadline &deadline) {
   const auto query_type = GetTaskType(user_request);
   DSearchResult result;
+  // Queued past it: nobody is waiting for the answer any more.
+  if (deadline.Passed()) {
+    result.set_status(GetSearchStatus(DSearchStatus::DSDeadlineExceeded));
+    return result;
+  }
   switch (query_type) {
   case DSQueryTypeEnum::SOnlyOnlineTasks:
-    result.set_status(GetSearchStatus((DSearchStatus::DSNotImplemented)));
-    return result;
+    return DoOnlineSearch(user_request, deadline);
   case DSQueryTypeEnum::SGeoTasks:
-    return DoGeoSearch(user_request);
+    return DoGeoSearch(user_request, deadline);
   case DSQueryTypeEnum::SRandomTasks:
-    result.set_status(GetSearchStatus((DSearchStatus::DSNotImplemented)));
-    return result;
+    // Bounded by K samples; no deadline needed.
+    return DoRandomSearch(user_request);
   case DSQueryTypeEnum::STagTasks:
-    return DoTagSearch(user_request);
+    return DoTagSearch(user_request, deadline);
   case DSQueryTypeEnum::SUnknown:
     // Fallback: if user provided a textual query, perform text search
+    // (tags, task type and radius still apply as filters).
     if (!user_request.user_query().empty()) {
-      return DoTextSearch(user_request);
+      return DoTextSearch(user_request, deadline);
     }
     result.set_status(GetSearchStatus(DSearchStatus::DSUnknownTaskType));
     return result;
@@ -86,37 +969,187 @@ DSearchResult XapianLayer::DoSearch(const DSearchRequest &user_request) {
   return result;
 }
 
-DSearchResult XapianLayer::DoTextSearch(const DSearchRequest &user_request) {
-  DSearchResult result;
+DSearchResult XapianLayer::DoTextSearch(const DSearchRequest &user_request,
+                                        const SearchDeadline &deadline) {
   if (user_request.user_query().empty()) {
+    DSearchResult result;
     result.set_status(GetSearchStatus(DSearchStatus::DSUnknownTaskType));
     return result;
   }
+  return DoComposedSearch(user_request, deadline);
+}
 
-  try {
-    Xapian::Enquire enq(database);
-    // Ensure BM25 is used explicitly
-    enq.set_weighting_scheme(Xapian::BM25Weight());
+DSearchResult XapianLayer::DoTagSearch(const DSearchRequest &user_request,
+                                       const SearchDeadline &deadline) {
+  if (TagQuery(user_request).empty()) {
+    DSearchResult result;
+    result.set_status(GetSearchStatus(DSearchStatus::DSUnknownTaskType));
+    return result;
+  }
+  // Purely boolean requests never need the matcher.
+  if (tag_bitmaps && user_request.user_query().empty() &&
+      user_request.radius_km() <= 0) {
+    return DoBitmapTagSearch(user_request);
+  }
+  return DoComposedSearch(user_request, deadline);
+}
+
+DSearchResult
+XapianLayer::DoBitmapTagSearch(const DSearchRequest &user_request) {
+  DSearchResult result;
+  const std::optional<SearchPage> page = ResolveSearchPage(user_request);
+  if (!page) {
+    result.set_status(GetSearchStatus(DSearchStatus::DSInvalidPaging));
+    return result;
+  }
+  StageClock clock;
+  BitmapQuery query;
+  for (const auto &tag : user_request.user_tags()) {
+    if (!tag.empty())
+      (user_request.all_tags() ? query.all : query.any)
+          .push_back(kTagPrefix + tag);
+  }
+  for (const auto &tag : user_request.exclude_tags()) {
+    if (!tag.empty())
+      query.none.push_back(kTagPrefix + tag);
+  }
+  if (kTaskTypeByString.count(user_request.task_type()))
+    query.all.push_back(kTaskTypePrefix + user_request.task_type());
+
+  clock.Lap(query_build_latency);
+  const BitmapPage hits =
+      tag_bitmaps->Search(query, page->position, page->limit);
+  clock.Lap(match_latency);
+  {
+    // Bitmaps are only updated after task_ids, so every hit resolves.
+    const TaskIdTable::View ids = task_ids.Read();
+    for (Xapian::docid docid : hits.docids) {
+      const std::string_view id = ids.Find(docid);
+      if (!id.empty())
+        result.add_task_id(id.data(), id.size());
+    }
+  }
+  const auto returned = static_cast<Xapian::doccount>(hits.docids.size());
+  result.set_estimated_total(hits.total);
+  if (returned == page->limit && returned > 0 &&
+      page->position + returned < hits.total) {
+    result.set_next_cursor(NextCursor(*page, returned));
+  }
+  clock.Lap(materialise_latency);
+  result.set_status(GetSearchStatus(DSearchStatus::DSOk));
+  return result;
+}
 
-    Xapian::QueryParser qp;
-    qp.set_stemmer(Xapian::Stem("russian"));
-    qp.set_stemming_strategy(Xapian::QueryParser::STEM_SOME);
-    qp.set_database(database);
+TermBitmapStats XapianLayer::GetTagBitmapStats() const {
+  return tag_bitmaps ? tag_bitmaps->GetStats() : TermBitmapStats{};
+}
 
-    Xapian::Query query =
-        qp.parse_query(user_request.user_query(), Xapian::QueryParser::FLAG_DEFAULT);
-    enq.set_query(query);
+DSearchResult XapianLayer::DoOnlineSearch(const DSearchRequest &user_request,
+                                          const SearchDeadline &deadline) {
+  DSearchRequest online = user_request;
+  online.set_task_type("TT_OnlineTask");
+  return DoComposedSearch(online, deadline);
+}
+
+DSearchResult XapianLayer::DoRandomSearch(const DSearchRequest &user_request) {
+  DSearchResult result;
+  const std::optional<SearchPage> page = ResolveSearchPage(user_request);
+  if (!page) {
+    result.set_status(GetSearchStatus(DSearchStatus::DSInvalidPaging));
+    return result;
+  }
+  uint64_t seed = page->has_sample ? page->sample_seed : user_request.seed();
+  while (seed == 0) {
+    seed = (uint64_t{std::random_device{}()} << 32) ^ std::random_device{}();
+  }
+  const SampleFilter filter(user_request);
+  const Xapian::doccount limit = page->limit;
 
-    Xapian::MSet mset = enq.get_mset(SearchConfigProto.search_offset(),
-                                     SearchConfigProto.search_limit());
+  try {
+    WithReader([&](Xapian::Database &db) {
+      result.Clear();
+      StageClock clock;
+      const TaskIdTable::View ids = task_ids.Read();
+      const Xapian::doccount estimate = filter.Empty() ? db.get_doccount()
+                                                       : filter.Estimate(db);
+      result.set_estimated_total(estimate);
 
-    for (Xapian::MSetIterator mit = mset.begin(); mit != mset.end(); ++mit) {
-      const std::string &data = mit.get_document().get_data();
-      const std::string task_id = GetField(data, 2); // task_id is at index 2
-      if (!task_id.empty()) {
-        result.add_task_id(task_id);
+      // The docid space is pinned by the first page so later pages walk
+      // the same permutation; newer documents join the next session.
+      Xapian::docid domain =
+          page->has_sample ? page->sample_domain : db.get_lastdocid();
+      bool use_postings =
+          page->has_sample
+              ? page->sample_domain == 0
+              : !filter.Empty() && estimate * kMaxProbesPerHit < domain;
+      clock.Lap(query_build_latency);
+
+      if (!use_postings) {
+        DocidPermutation perm(domain, seed);
+        uint64_t index = page->has_sample ? page->sample_state : 0;
+        uint64_t budget = kProbeBudgetPerHit * (limit + 1);
+        Xapian::doccount found = 0;
+        while (found < limit && index < perm.Span() && budget > 0) {
+          --budget;
+          const std::optional<uint64_t> slot = perm.At(index++);
+          if (!slot)
+            continue;
+          const Xapian::docid docid = static_cast<Xapian::docid>(*slot + 1);
+          // Deleted docids (and ones with no task_id) are not in the table.
+          if (ids.Find(docid).empty())
+            continue;
+          if (!filter.Empty() && !filter.Matches(db, docid))
+            continue;
+          AppendTaskId(db, ids, docid, result);
+          ++found;
+        }
+        // Probing and resolving hits are interleaved; all of it is match.
+        clock.Lap(match_latency);
+        if (found < limit && index < perm.Span() && !page->has_sample &&
+            !filter.Empty()) {
+          // The filter is sparser than its estimate promised.
+          result.clear_task_id();
+          use_postings = true;
+        } else {
+          if (index < perm.Span() && limit > 0) {
+            result.set_next_cursor(
+                NextSampleCursor(*page, found, domain, index, seed));
+          }
+          return;
+        }
       }
-    }
+
+      BottomKSampler sampler(seed, limit,
+                             page->has_sample ? page->sample_state : 0);
+      std::vector<Xapian::Query> terms;
+      for (Xapian::Query q : {TagQuery(user_request), TypeFilter(user_request)}) {
+        if (!q.empty())
+          terms.push_back(std::move(q));
+      }
+      Xapian::Enquire enq(db);
+      enq.set_weighting_scheme(Xapian::BoolWeight());
+      Xapian::Query sampled(Xapian::Query::OP_AND, terms.begin(), terms.end());
+      if (Xapian::Query excluded = ExcludeQuery(user_request);
+          !excluded.empty()) {
+        sampled = Xapian::Query(Xapian::Query::OP_AND_NOT, sampled, excluded);
+      }
+      enq.set_query(sampled);
+      clock.Lap(query_build_latency);
+      // The sampler rejects every candidate, so the matcher walks the whole
+      // (selective) posting list and the MSet stays empty.
+      enq.get_mset(0, 1, db.get_doccount(), nullptr, &sampler);
+      const auto sample = sampler.Take();
+      clock.Lap(match_latency);
+      for (const auto &[hash, docid] : sample) {
+        AppendTaskId(db, ids, docid, result);
+      }
+      if (sample.size() == limit && limit > 0) {
+        result.set_next_cursor(NextSampleCursor(
+            *page, static_cast<Xapian::doccount>(sample.size()), 0,
+            sample.back().first, seed));
+      }
+      clock.Lap(materialise_latency);
+    });
 
     result.set_status(GetSearchStatus(DSearchStatus::DSOk));
     return result;
@@ -126,47 +1159,154 @@ DSearchResult XapianLayer::DoTextSearch(const DSearchRequest &user_request) {
   }
 }
 
-DSearchResult XapianLayer::DoTagSearch(const DSearchRequest &user_request) {
+DSearchResult XapianLayer::DoComposedSearch(const DSearchRequest &user_request,
+                                            const SearchDeadline &deadline) {
   DSearchResult result;
-
-  if (user_request.user_tags().empty()) {
-    result.set_status(GetSearchStatus(DSearchStatus::DSUnknownTaskType));
+  // Relevance order has no stable sort key, so these cursors carry an
+  // offset only.
+  const std::optional<SearchPage> page = ResolveSearchPage(user_request);
+  if (!page) {
+    result.set_status(GetSearchStatus(DSearchStatus::DSInvalidPaging));
     return result;
   }
+  const OptionalGeoData geo = ParseGeo(user_request.geo_data());
+  const double radius_km = geo ? std::max(0.0, user_request.radius_km()) : 0.0;
+  // Only the pure filter (newest first) merges exactly across shards;
+  // relevance needs collection-wide statistics.
+  const bool pure_filter =
+      user_request.user_query().empty() && TagQuery(user_request).empty();
+  const ReadModeChooser::Mode mode = pure_filter
+                                         ? ChooseReadMode(kFilterReads)
+                                         : ReadModeChooser::Mode::Combined;
+  const auto started = std::chrono::steady_clock::now();
 
   try {
-    Xapian::Enquire enq(database);
-
-    std::vector<Xapian::Query> queries;
-
-    for (const auto &tag : user_request.user_tags()) {
-      if (!tag.empty()) {
-        queries.push_back(Xapian::Query("TAG" + tag));
+    WithLease([&](ReaderPool::Lease &lease) {
+      Xapian::Database &db = lease.db();
+      StageClock clock;
+      std::vector<std::string> cells;
+      std::unique_ptr<RadiusDecider> in_radius;
+      if (radius_km > 0) {
+        GeoCellCover cover(geo->first, geo->second);
+        while (!cover.Exhausted() && cover.BoundKm() < radius_km) {
+          cover.Grow();
+        }
+        cells = cover.Terms();
+        // Cells are coarser than the circle; the exact test runs inside the
+        // match so paging and counts stay right.
+        in_radius = std::make_unique<RadiusDecider>(
+            SearchConfigProto.search_geo_index(), *geo, radius_km);
       }
-    }
 
-    if (queries.empty()) {
-      result.set_status(GetSearchStatus(DSearchStatus::DSUnknownTaskType));
-      return result;
-    }
+      // Xapian::Query handles share a non-atomic refcount, so each fan-out
+      // thread composes its own instead of copying one built here.
+      auto compose = [&](const Xapian::Query &text) {
+        const Xapian::Query tags = TagQuery(user_request);
+        // Everything but the ranking part is a boolean filter, so the match
+        // only ever yields rows that satisfy the whole request.
+        std::vector<Xapian::Query> filters;
+        if (Xapian::Query type = TypeFilter(user_request); !type.empty())
+          filters.push_back(std::move(type));
+        if (!text.empty() && !tags.empty())
+          filters.push_back(tags);
+        if (!cells.empty())
+          filters.emplace_back(Xapian::Query::OP_OR, cells.begin(),
+                               cells.end());
 
-    Xapian::Query combined_query(Xapian::Query::OP_OR, queries.begin(),
-                                 queries.end());
-    enq.set_query(combined_query);
+        Xapian::Query query = !text.empty() ? text : tags;
+        if (query.empty()) {
+          // Pure filter (e.g. all online tasks): newest first.
+          query = Xapian::Query::MatchAll;
+        }
+        if (!filters.empty()) {
+          query = Xapian::Query(Xapian::Query::OP_FILTER, query,
+                                Xapian::Query(Xapian::Query::OP_AND,
+                                              filters.begin(), filters.end()));
+        }
+        if (Xapian::Query excluded = ExcludeQuery(user_request);
+            !excluded.empty()) {
+          query = Xapian::Query(Xapian::Query::OP_AND_NOT, query, excluded);
+        }
+        // Any-of tags next to a text query: matching more of them ranks
+        // higher.
+        if (!text.empty() && !tags.empty() && !user_request.all_tags()) {
+          query = Xapian::Query(Xapian::Query::OP_AND_MAYBE, query, tags);
+        }
+        return query;
+      };
+      auto enquire = [&](const Xapian::Database &target,
+                         const Xapian::Query &query) {
+        Xapian::Enquire enq(target);
+        if (pure_filter) {
+          enq.set_weighting_scheme(Xapian::BoolWeight());
+          enq.set_docid_order(Xapian::Enquire::DESCENDING);
+        } else {
+          enq.set_weighting_scheme(Xapian::BM25Weight());
+        }
+        enq.set_query(query);
+        return enq;
+      };
+      const Xapian::Query query =
+          mode == ReadModeChooser::Mode::FanOut
+              ? Xapian::Query()
+              : compose(TextQuery(lease.context(), user_request));
+      clock.Lap(query_build_latency);
 
-    Xapian::MSet mset = enq.get_mset(SearchConfigProto.search_offset(),
-                                     SearchConfigProto.search_limit());
-
-    // Use a set to deduplicate results
-    std::set<std::string> seen_task_ids;
-    for (Xapian::MSetIterator mit = mset.begin(); mit != mset.end(); ++mit) {
-      const std::string &data = mit.get_document().get_data();
-      const std::string task_id = GetField(data, 2); // task_id is at index 2
-      if (!task_id.empty() && seen_task_ids.find(task_id) == seen_task_ids.end()) {
-        result.add_task_id(task_id);
-        seen_task_ids.insert(task_id);
+      // No dedup needed: the "ID" term keeps one document per task_id.
+      if (mode == ReadModeChooser::Mode::FanOut) {
+        // Combined docids keep each shard's order, so the newest hits
+        // overall are among every shard's newest position + limit.
+        std::vector<Xapian::Database> &shards = lease.shards();
+        std::vector<std::vector<Xapian::docid>> heads(shards.size());
+        std::vector<Xapian::doccount> estimates(shards.size());
+        std::vector<char> expired(shards.size(), 0);
+        fan_out->ParallelFor(shards.size(), [&](size_t s) {
+          const DeadlineDecider in_time(deadline, in_radius.get());
+          // Fan-out only runs pure filters, which have no text part.
+          const Xapian::MSet mset =
+              enquire(shards[s], compose(Xapian::Query()))
+                  .get_mset(0, page->position + page->limit, 0, nullptr,
+                            in_time.Get());
+          expired[s] = in_time.Expired();
+          const ShardDocidMap combined{s, shards.size()};
+          for (Xapian::MSetIterator mit = mset.begin(); mit != mset.end();
+               ++mit) {
+            heads[s].push_back(combined(*mit));
+          }
+          estimates[s] = mset.get_matches_estimated();
+        });
+        std::vector<Xapian::docid> docids;
+        for (const auto &head : heads)
+          docids.insert(docids.end(), head.begin(), head.end());
+        std::sort(docids.begin(), docids.end(),
+                  std::greater<Xapian::docid>());
+        const size_t begin = std::min<size_t>(page->position, docids.size());
+        const size_t end =
+            std::min<size_t>(begin + page->limit, docids.size());
+        docids = std::vector<Xapian::docid>(
+            docids.begin() + static_cast<std::ptrdiff_t>(begin),
+            docids.begin() + static_cast<std::ptrdiff_t>(end));
+        clock.Lap(match_latency);
+        FillPage(db, docids,
+                 std::accumulate(estimates.begin(), estimates.end(),
+                                 Xapian::doccount{0}),
+                 *page, result);
+        result.set_partial(std::find(expired.begin(), expired.end(), 1) !=
+                           expired.end());
+      } else {
+        const DeadlineDecider in_time(deadline, in_radius.get());
+        const Xapian::MSet mset = enquire(db, query).get_mset(
+            page->position, page->limit, 0, nullptr, in_time.Get());
+        clock.Lap(match_latency);
+        FillPage(db, mset, *page, result);
+        result.set_partial(in_time.Expired());
       }
-    }
+      // Later pages of a partial one would be cut differently.
+      if (result.partial())
+        result.clear_next_cursor();
+      clock.Lap(materialise_latency);
+    });
+    RecordReadMode(kFilterReads, mode, started);
 
     result.set_status(GetSearchStatus(DSearchStatus::DSOk));
     return result;
@@ -176,11 +1316,27 @@ DSearchResult XapianLayer::DoTagSearch(const DSearchRequest &user_request) {
   }
 }
 
-void XapianLayer::AddTaskToDB(const DSIndexTask &task) {
-  std::unique_lock<std::shared_mutex> lock(db_mutex);
-  Xapian::WritableDatabase wdb(SearchConfigProto.db_file_name(),
-                               Xapian::DB_CREATE_OR_OPEN);
+std::optional<std::string> UnindexableTaskId(const std::string &task_id) {
+  if (kIdTermPrefix.size() + task_id.size() > kMaxTermBytes)
+    return "task_id longer than " +
+           std::to_string(kMaxTermBytes - kIdTermPrefix.size()) + " bytes";
+  return std::nullopt;
+}
+
+std::optional<std::string> UnindexableTask(const DSIndexTask &task) {
+  if (auto reason = UnindexableTaskId(task.task_id()))
+    return reason;
+  for (const auto &tag : task.task_tags()) {
+    if (kTagPrefix.size() + tag.size() > kMaxTermBytes)
+      return "tag longer than " +
+             std::to_string(kMaxTermBytes - kTagPrefix.size()) + " bytes";
+  }
+  return std::nullopt;
+}
 
+Xapian::Document XapianLayer::MakeDocument(const DSIndexTask &task) const {
+  if (auto reason = UnindexableTask(task))
+    throw std::invalid_argument(*reason);
   Xapian::Document doc;
   {
     std::ostringstream data;
@@ -195,9 +1351,15 @@ void XapianLayer::AddTaskToDB(const DSIndexTask &task) {
     doc.set_data(data.str());
   }
 
-  Xapian::TermGenerator termgen;
+  // One generator (and stemmer) per indexing thread. It must not keep the
+  // document: that goes to a writer thread, and Xapian refcounts are not
+  // atomic.
+  thread_local Xapian::TermGenerator termgen = [] {
+    Xapian::TermGenerator t;
+    t.set_stemmer(Xapian::Stem("russian"));
+    return t;
+  }();
   termgen.set_document(doc);
-  termgen.set_stemmer(Xapian::Stem("russian"));
 
   if (!task.task_name().empty()) {
     termgen.index_text(task.task_name(), 1, "T");
@@ -210,39 +1372,304 @@ void XapianLayer::AddTaskToDB(const DSIndexTask &task) {
     termgen.index_text(task.task_desc(), 1, "T");
     termgen.index_text(task.task_desc());
   }
+  termgen.set_document(Xapian::Document());
 
   for (const auto &tag : task.task_tags()) {
     if (!tag.empty()) {
-      doc.add_term("TAG" + tag);
+      doc.add_term(kTagPrefix + tag);
     }
   }
 
-  Xapian::LatLongCoords coords;
-  if (OptionalGeoData geo = ParseGeo(task.geo_data())) {
-    coords.append(Xapian::LatLongCoord(geo->first, geo->second));
-  } else {
-    coords.append(Xapian::LatLongCoord(55.45, 37.65));
+  doc.add_value(kTaskIdSlot, task.task_id());
+  if (task.expires_at() > 0) {
+    doc.add_value(kExpirySlot, Xapian::sortable_serialise(
+                                   static_cast<double>(task.expires_at())));
   }
+  if (GetTaskFromRequest(task) != DSTaskTypeEnum::TUnknown) {
+    doc.add_boolean_term(kTaskTypePrefix + task.task_type());
+  }
+
+  const auto [lat, lon] = ParseGeo(task.geo_data()).value_or(kDefaultGeo);
+  Xapian::LatLongCoords coords;
+  coords.append(Xapian::LatLongCoord(lat, lon));
   doc.add_value(SearchConfigProto.search_geo_index(), coords.serialise());
+  for (const auto &cell : GeoCellTermsForPoint(lat, lon)) {
+    doc.add_boolean_term(cell);
+  }
+  return doc;
+}
+
+void XapianLayer::FillPage(const Xapian::Database &db, const Xapian::MSet &mset,
+                           const SearchPage &page,
+                           DSearchResult &result) const {
+  std::vector<Xapian::docid> docids;
+  docids.reserve(mset.size());
+  for (Xapian::MSetIterator mit = mset.begin(); mit != mset.end(); ++mit) {
+    docids.push_back(*mit);
+  }
+  FillPage(db, docids, mset.get_matches_estimated(), page, result);
+}
+
+void XapianLayer::FillPage(const Xapian::Database &db,
+                           const std::vector<Xapian::docid> &docids,
+                           Xapian::doccount estimated, const SearchPage &page,
+                           DSearchResult &result) const {
+  result.clear_task_id();
+  result.clear_next_cursor();
+  const TaskIdTable::View ids = task_ids.Read();
+  for (Xapian::docid docid : docids) {
+    AppendTaskId(db, ids, docid, result);
+  }
+  const auto returned = static_cast<Xapian::doccount>(docids.size());
+  result.set_estimated_total(estimated);
+  if (returned == page.limit && returned > 0 &&
+      page.position + returned < estimated) {
+    result.set_next_cursor(NextCursor(page, returned));
+  }
+}
+
+void XapianLayer::AppendTaskId(const Xapian::Database &db,
+                               const TaskIdTable::View &ids,
+                               Xapian::docid docid,
+                               DSearchResult &result) const {
+  const std::string_view id = ids.Find(docid);
+  if (!id.empty()) {
+    result.add_task_id(id.data(), id.size());
+    return;
+  }
+  const std::string slot =
+      db.get_document(docid, Xapian::DOC_ASSUME_VALID).get_value(kTaskIdSlot);
+  if (!slot.empty()) {
+    result.add_task_id(slot);
+  }
+}
 
-  // Use replace_document with task_id as unique identifier to avoid duplicates
-  wdb.replace_document("ID" + task.task_id(), doc);
-  wdb.commit();
-  database.reopen();
+void XapianLayer::CheckWritable() const {
+  if (IsFollower())
+    throw std::logic_error("read replica of " +
+                           SearchConfigProto.replicate_from() +
+                           " does not accept writes");
+}
+
+std::future<void> XapianLayer::AddTaskToDBAsync(const DSIndexTask &task) {
+  CheckWritable();
+  // Term generation runs on the caller's thread; only the write itself is
+  // serialised through the shard's group-commit writer. The task_id term
+  // keeps replace_document idempotent for re-indexed tasks, and a task
+  // always hashes to the same shard.
+  return writers[ShardOf(task)]->Submit(
+      {kIdTermPrefix + task.task_id(), MakeDocument(task)});
+}
+
+std::future<void>
+XapianLayer::AddTasksToDBAsync(const std::vector<DSIndexTask> &tasks) {
+  CheckWritable();
+  std::vector<std::vector<PendingDocument>> docs(writers.size());
+  for (const auto &task : tasks) {
+    docs[ShardOf(task)].emplace_back(kIdTermPrefix + task.task_id(),
+                                     MakeDocument(task));
+  }
+  std::vector<std::future<void>> parts;
+  for (size_t shard = 0; shard < writers.size(); ++shard) {
+    if (!docs[shard].empty() || writers.size() == 1)
+      parts.push_back(writers[shard]->Submit(std::move(docs[shard])));
+  }
+  if (parts.size() == 1)
+    return std::move(parts.front());
+  // Waits for every shard's commit and rethrows the first failure.
+  return std::async(std::launch::deferred,
+                    [parts = std::move(parts)]() mutable {
+                      for (auto &part : parts)
+                        part.get();
+                    });
+}
+
+void XapianLayer::AddTaskToDB(const DSIndexTask &task) {
+  AddTaskToDBAsync(task).get();
+}
+
+void XapianLayer::DeleteTask(const std::string &task_id) {
+  CheckWritable();
+  if (auto reason = UnindexableTaskId(task_id))
+    throw std::invalid_argument(*reason);
+  writers[ShardForTask(task_id, writers.size())]
+      ->Submit({kIdTermPrefix + task_id, std::nullopt})
+      .get();
+}
+
+void XapianLayer::IngestTask(const DSIndexTask &task, bool wait_visible) {
+  CheckWritable();
+  if (!ingest_log) {
+    AddTaskToDB(task);
+    return;
+  }
+  std::vector<PendingDocument> docs;
+  docs.emplace_back(kIdTermPrefix + task.task_id(), MakeDocument(task));
+  std::future<void> visible;
+  // Submitting under the log's lock keeps each writer's log positions in
+  // order.
+  const size_t shard = ShardOf(task);
+  const uint64_t seq = ingest_log->Append(
+      {task.SerializeAsString()}, [&](uint64_t last) {
+        NoteLogSubmitted(shard, last);
+        visible = writers[shard]->Submit(std::move(docs), last);
+      });
+  ingest_log->WaitDurable(seq);
+  if (wait_visible)
+    visible.get();
+}
+
+IngestLogStats XapianLayer::GetIngestLogStats() const {
+  return ingest_log ? ingest_log->GetStats() : IngestLogStats{};
+}
+
+WriterStats XapianLayer::GetWriterStats() const {
+  WriterStats total;
+  for (const auto &writer : writers) {
+    const WriterStats s = writer->GetStats();
+    total.commits_total += s.commits_total;
+    total.commit_failures_total += s.commit_failures_total;
+    total.rejected_docs_total += s.rejected_docs_total;
+    total.committed_docs_total += s.committed_docs_total;
+    total.commit_latency_us_total += s.commit_latency_us_total;
+    total.last_batch_size = std::max(total.last_batch_size, s.last_batch_size);
+    total.pending_docs += s.pending_docs;
+  }
+  return total;
+}
+
+std::vector<WriterStats> XapianLayer::GetShardWriterStats() const {
+  std::vector<WriterStats> stats;
+  for (const auto &writer : writers)
+    stats.push_back(writer->GetStats());
+  return stats;
+}
+
+HistogramSnapshot XapianLayer::GetCommitLatency() const {
+  HistogramSnapshot merged;
+  for (const auto &writer : writers)
+    merged.Merge(writer->GetCommitLatency());
+  return merged;
+}
+
+bool XapianLayer::ReadSnapshotPage(size_t shard, Xapian::docid after,
+                                   size_t limit, Changeset &page) {
+  bool done = true;
+  WithLease([&](ReaderPool::Lease &lease) {
+    const Xapian::Database &db = lease.shards()[shard];
+    page.shard = static_cast<uint32_t>(shard);
+    page.entries.clear();
+    done = true;
+    Xapian::PostingIterator it = db.postlist_begin("");
+    it.skip_to(after + 1);
+    for (; it != db.postlist_end(""); ++it) {
+      if (page.entries.size() >= limit) {
+        done = false;
+        break;
+      }
+      page.entries.push_back({*it, db.get_document(*it).serialise()});
+    }
+  });
+  return done;
+}
+
+void XapianLayer::ApplyChangesets(const std::vector<Changeset> &changesets) {
+  std::vector<std::vector<const Changeset::Entry *>> per_shard(writers.size());
+  for (const auto &changeset : changesets) {
+    if (changeset.shard >= writers.size())
+      throw std::invalid_argument(
+          "changeset for shard " + std::to_string(changeset.shard) +
+          ", this node has " + std::to_string(writers.size()));
+    for (const auto &entry : changeset.entries)
+      per_shard[changeset.shard].push_back(&entry);
+  }
+  for (size_t shard = 0; shard < per_shard.size(); ++shard) {
+    if (!per_shard[shard].empty())
+      ApplyReplicated(shard, per_shard[shard], std::nullopt);
+  }
+}
+
+void XapianLayer::ApplySnapshotPage(const Changeset &page,
+                                    Xapian::docid after, Xapian::docid upto) {
+  if (page.shard >= writers.size())
+    throw std::invalid_argument(
+        "snapshot of shard " + std::to_string(page.shard) +
+        ", this node has " + std::to_string(writers.size()));
+  std::vector<const Changeset::Entry *> entries;
+  entries.reserve(page.entries.size());
+  for (const auto &entry : page.entries)
+    entries.push_back(&entry);
+  ApplyReplicated(page.shard, entries, std::make_pair(after, upto));
+}
+
+void XapianLayer::ApplyReplicated(
+    size_t shard, const std::vector<const Changeset::Entry *> &entries,
+    std::optional<std::pair<Xapian::docid, Xapian::docid>> sweep) {
+  // Final state per docid; null if deleted.
+  std::map<Xapian::docid, std::optional<Xapian::Document>> changed;
+  writers[shard]->RunExclusive([&](Xapian::WritableDatabase &wdb) {
+    if (sweep) {
+      std::vector<Xapian::docid> keep;
+      keep.reserve(entries.size());
+      for (const auto *entry : entries)
+        keep.push_back(entry->docid);
+      std::sort(keep.begin(), keep.end());
+      const auto [after, upto] = *sweep;
+      std::vector<Xapian::docid> stale;
+      Xapian::PostingIterator it = wdb.postlist_begin("");
+      it.skip_to(after + 1);
+      for (; it != wdb.postlist_end("") && (upto == 0 || *it <= upto); ++it) {
+        if (!std::binary_search(keep.begin(), keep.end(), *it))
+          stale.push_back(*it);
+      }
+      for (const Xapian::docid docid : stale) {
+        wdb.delete_document(docid);
+        changed[docid] = std::nullopt;
+      }
+    }
+    for (const auto *entry : entries) {
+      if (entry->document.empty()) {
+        try {
+          wdb.delete_document(entry->docid);
+        } catch (const Xapian::DocNotFoundError &) {
+        }
+        changed[entry->docid] = std::nullopt;
+        continue;
+      }
+      Xapian::Document doc = Xapian::Document::unserialise(entry->document);
+      wdb.replace_document(entry->docid, doc);
+      changed[entry->docid] = std::move(doc);
+    }
+    std::vector<Xapian::docid> docids;
+    docids.reserve(changed.size());
+    for (const auto &entry : changed)
+      docids.push_back(entry.first);
+    NoteTouched(shard, docids);
+  });
+
+  // RunExclusive already let readers reopen; until the tables catch up
+  // hits fall back to the value slot, as after a leader commit.
+  std::map<Xapian::docid, const Xapian::Document *> tables;
+  for (const auto &[docid, doc] : changed)
+    tables[docid] = doc ? &*doc : nullptr;
+  UpdateSideTables(shard, tables);
+  // Drops results cached before the tables caught up.
+  readers.BumpGeneration();
+}
+
+bool XapianLayer::RunBackup(BackupKind kind, const std::string &backup_root) {
+  // A backup copying files that a compaction swaps out would mix
+  // revisions.
+  std::lock_guard<std::mutex> lk(maintenance_mutex);
+  return backups->Run(kind, backup_root, stop_backups);
 }
 
 bool XapianLayer::PerformColdBackup(const std::string &backup_root) {
-  std::unique_lock<std::shared_mutex> lock(db_mutex);
-  const fs::path src{SearchConfigProto.db_file_name()};
-  fs::path dst = fs::path(backup_root) / "cold";
-  return CopyDirRecursive(src, dst);
+  return RunBackup(BackupKind::Cold, backup_root);
 }
 
 bool XapianLayer::PerformHotBackup(const std::string &backup_root) {
-  std::unique_lock<std::shared_mutex> lock(db_mutex);
-  const fs::path src{SearchConfigProto.db_file_name()};
-  fs::path dst = fs::path(backup_root) / "hot";
-  return CopyDirRecursive(src, dst);
+  return RunBackup(BackupKind::Hot, backup_root);
 }
 
 void XapianLayer::StartBackupScheduler(const std::string &backup_root) {
@@ -252,36 +1679,32 @@ void XapianLayer::StartBackupScheduler(const std::string &backup_root) {
     backup_root_path = backup_root;
     stop_backups = false;
   }
-  cold_thread = std::thread([this]() {
-    std::unique_lock<std::mutex> lk(this->sched_mutex);
-    while (!this->stop_backups.load()) {
-      if (this->sched_cv.wait_for(
-              lk,
-              std::chrono::minutes(SearchConfigProto.cold_backup_timer_min()),
-              [this] { return this->stop_backups.load(); })) {
-        break;
+  auto schedule = [this](int period_min, BackupKind kind) {
+    const std::chrono::seconds period =
+        SearchConfigProto.backup_timer_sec() > 0
+            ? std::chrono::seconds(SearchConfigProto.backup_timer_sec())
+            : std::chrono::minutes(period_min);
+    return std::thread([this, period, kind]() {
+      std::unique_lock<std::mutex> lk(this->sched_mutex);
+      while (!this->stop_backups.load()) {
+        if (this->sched_cv.wait_for(
+                lk, period,
+                [this] { return this->stop_backups.load(); })) {
+          break;
+        }
+        auto root = this->backup_root_path;
+        lk.unlock();
+        (void)this->RunBackup(kind, root);
+        lk.lock();
       }
-      auto root = this->backup_root_path;
-      lk.unlock();
-      (void)this->PerformColdBackup(root);
-      lk.lock();
-    }
-  });
-  hot_thread = std::thread([this]() {
-    std::unique_lock<std::mutex> lk(this->sched_mutex);
-    while (!this->stop_backups.load()) {
-      if (this->sched_cv.wait_for(
-              lk,
-              std::chrono::minutes(SearchConfigProto.hot_backup_timer_min()),
-              [this] { return this->stop_backups.load(); })) {
-        break;
-      }
-      auto root = this->backup_root_path;
-      lk.unlock();
-      (void)this->PerformHotBackup(root);
-      lk.lock();
-    }
-  });
+    });
+  };
+  if (SearchConfigProto.cold_backup_timer_min() > 0)
+    cold_thread =
+        schedule(SearchConfigProto.cold_backup_timer_min(), BackupKind::Cold);
+  if (SearchConfigProto.hot_backup_timer_min() > 0)
+    hot_thread =
+        schedule(SearchConfigProto.hot_backup_timer_min(), BackupKind::Hot);
 }
 
 void XapianLayer::StopBackupScheduler() {
@@ -295,3 +1718,260 @@ void XapianLayer::StopBackupScheduler() {
   if (hot_thread.joinable())
     hot_thread.join();
 }
+
+XapianLayer::DeletionStats XapianLayer::GetDeletionStats() const {
+  return {deleted_api.load(std::memory_order_relaxed),
+          deleted_expired.load(std::memory_order_relaxed),
+          expiry_sweeps.load(std::memory_order_relaxed)};
+}
+
+CompactionStats XapianLayer::GetCompactionStats() const {
+  std::lock_guard<std::mutex> lk(compaction_stats_mutex);
+  return compaction_stats;
+}
+
+DatabaseFootprint XapianLayer::GetIndexFootprint() {
+  DatabaseFootprint total;
+  WithLease([&](ReaderPool::Lease &lease) {
+    total = DatabaseFootprint{};
+    for (const Xapian::Database &shard : lease.shards()) {
+      total.documents += shard.get_doccount();
+      total.last_docid = std::max(total.last_docid, shard.get_lastdocid());
+    }
+  });
+  total.bytes = index_size_bytes.load(std::memory_order_relaxed);
+  return total;
+}
+
+void XapianLayer::RefreshIndexSize() {
+  uint64_t bytes = 0;
+  for (const std::string &path : shard_paths)
+    bytes += DatabaseBytes(path);
+  index_size_bytes.store(bytes, std::memory_order_relaxed);
+}
+
+size_t XapianLayer::SweepExpired(size_t shard, size_t limit) {
+  CheckWritable();
+  const std::string now = Xapian::sortable_serialise(static_cast<double>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count()));
+  size_t total = 0;
+  while (true) {
+    // Candidates come from a reader, so the scan does not hold up
+    // commits. The value stream covers only tasks that expire at all.
+    std::vector<Xapian::docid> candidates;
+    WithLease([&](ReaderPool::Lease &lease) {
+      candidates.clear();
+      const Xapian::Database &db = lease.shards()[shard];
+      const std::string lowest = db.get_value_lower_bound(kExpirySlot);
+      if (lowest.empty() || lowest > now)
+        return;
+      for (Xapian::ValueIterator it = db.valuestream_begin(kExpirySlot);
+           it != db.valuestream_end(kExpirySlot) && candidates.size() < limit;
+           ++it) {
+        if (*it <= now)
+          candidates.push_back(it.get_docid());
+      }
+    });
+    if (candidates.empty())
+      return total;
+
+    std::vector<Xapian::docid> deleted;
+    writers[shard]->RunExclusive([&](Xapian::WritableDatabase &wdb) {
+      for (const Xapian::docid docid : candidates) {
+        // Re-indexed since the scan, possibly with a later expiry.
+        try {
+          const std::string expiry =
+              wdb.get_document(docid).get_value(kExpirySlot);
+          if (expiry.empty() || expiry > now)
+            continue;
+        } catch (const Xapian::DocNotFoundError &) {
+          continue;
+        }
+        wdb.delete_document(docid);
+        deleted.push_back(docid);
+      }
+      NoteTouched(shard, deleted);
+    });
+    std::map<Xapian::docid, const Xapian::Document *> changed;
+    std::vector<Changeset::Entry> entries;
+    for (const Xapian::docid docid : deleted) {
+      changed[docid] = nullptr;
+      entries.push_back({docid, std::string()});
+    }
+    UpdateSideTables(shard, changed);
+    readers.BumpGeneration();
+    if (replication_log && !entries.empty())
+      PublishChangeset(shard, std::move(entries));
+    deleted_expired.fetch_add(deleted.size(), std::memory_order_relaxed);
+    total += deleted.size();
+    // A full batch may have left more behind.
+    if (candidates.size() < limit || deleted.empty() || stop_maintenance)
+      return total;
+  }
+}
+
+bool XapianLayer::CompactShard(size_t shard, bool force) {
+  std::lock_guard<std::mutex> maintenance(maintenance_mutex);
+  const std::string &path = shard_paths[shard];
+  const std::string staging = CompactionStagingPath(path);
+  const auto started = std::chrono::steady_clock::now();
+  auto stop_tracking = [&] {
+    std::lock_guard<std::mutex> lk(touched_mutex);
+    std::vector<Xapian::docid> docids;
+    if (touched[shard])
+      docids.swap(*touched[shard]);
+    touched[shard].reset();
+    return docids;
+  };
+  {
+    // Before the copy's revision is fixed, so no change falls between.
+    std::lock_guard<std::mutex> lk(touched_mutex);
+    touched[shard].emplace();
+  }
+  CompactionStats run;
+  try {
+    DatabaseFootprint before;
+    {
+      Xapian::Database source(path);
+      before = MeasureDatabase(path, source);
+      const CompactionPolicy policy{
+          SearchConfigProto.compaction_deleted_pct() / 100.0,
+          SearchConfigProto.compaction_fragmentation_pct() / 100.0};
+      if (!force && CompactionReason(source, before, policy).empty()) {
+        stop_tracking();
+        return false;
+      }
+      fs::remove_all(staging);
+      CompactCopy(source, staging, stop_maintenance);
+    }
+
+    DatabaseFootprint after;
+    std::chrono::steady_clock::time_point locked;
+    writers[shard]->SwapDatabase(
+        [&](Xapian::WritableDatabase &live) {
+          locked = std::chrono::steady_clock::now();
+          Xapian::WritableDatabase out(staging, Xapian::DB_OPEN);
+          // Carry over what was committed during the copy.
+          std::vector<Xapian::docid> docids = stop_tracking();
+          std::sort(docids.begin(), docids.end());
+          docids.erase(std::unique(docids.begin(), docids.end()),
+                       docids.end());
+          for (const Xapian::docid docid : docids) {
+            try {
+              out.replace_document(docid, live.get_document(docid));
+              continue;
+            } catch (const Xapian::DocNotFoundError &) {
+            }
+            try {
+              out.delete_document(docid);
+            } catch (const Xapian::DocNotFoundError &) {
+            }
+          }
+          for (auto it = live.metadata_keys_begin();
+               it != live.metadata_keys_end(); ++it)
+            out.set_metadata(*it, live.get_metadata(*it));
+          // Docids must never be handed out twice: followers, cursors and
+          // side tables key on them.
+          const Xapian::docid last = live.get_lastdocid();
+          if (out.get_lastdocid() < last) {
+            out.replace_document(last, Xapian::Document());
+            out.delete_document(last);
+          }
+          out.commit();
+          after = MeasureDatabase(staging, out);
+          StoreCompactionBaseline(out, after);
+          out.commit();
+          out.close();
+        },
+        [&] {
+          SwapInCompacted(path);
+          // Docids and documents are unchanged, so the side tables are
+          // still right; readers just need to open the new files.
+          readers.DropHandles();
+        });
+
+    const auto finished = std::chrono::steady_clock::now();
+    run.last_duration_sec =
+        std::chrono::duration<double>(finished - started).count();
+    run.last_lock_sec =
+        std::chrono::duration<double>(finished - locked).count();
+    run.last_size_before_bytes = before.bytes;
+    run.last_size_after_bytes = after.bytes;
+    run.last_documents = after.documents;
+    run.last_success_unix = std::chrono::duration_cast<std::chrono::seconds>(
+                                std::chrono::system_clock::now()
+                                    .time_since_epoch())
+                                .count();
+  } catch (...) {
+    stop_tracking();
+    std::error_code ec;
+    fs::remove_all(staging, ec);
+    std::lock_guard<std::mutex> lk(compaction_stats_mutex);
+    ++compaction_stats.failures_total;
+    throw;
+  }
+  std::lock_guard<std::mutex> lk(compaction_stats_mutex);
+  run.runs_total = compaction_stats.runs_total + 1;
+  run.failures_total = compaction_stats.failures_total;
+  compaction_stats = run;
+  return true;
+}
+
+void XapianLayer::StartMaintenance() {
+  StopMaintenance();
+  stop_maintenance = false;
+  // Failures are counted in the stats and retried next period.
+  auto schedule = [this](int period_sec, std::function<void()> task) {
+    return std::thread([this, period_sec, task = std::move(task)]() {
+      std::unique_lock<std::mutex> lk(maintenance_sched_mutex);
+      while (!maintenance_cv.wait_for(
+          lk, std::chrono::seconds(period_sec),
+          [this] { return stop_maintenance.load(); })) {
+        lk.unlock();
+        try {
+          task();
+        } catch (...) {
+        }
+        lk.lock();
+      }
+    });
+  };
+  if (SearchConfigProto.expiry_sweep_sec() > 0 && !IsFollower()) {
+    expiry_thread = schedule(SearchConfigProto.expiry_sweep_sec(), [this] {
+      for (size_t s = 0; s < writers.size() && !stop_maintenance; ++s)
+        SweepExpired(s, static_cast<size_t>(
+                            SearchConfigProto.expiry_sweep_batch()));
+      expiry_sweeps.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+  RefreshIndexSize();
+  const bool compact = SearchConfigProto.compaction_check_sec() > 0;
+  compaction_thread = schedule(
+      compact ? SearchConfigProto.compaction_check_sec()
+              : kDefaultCompactionCheckSec,
+      [this, compact] {
+        // One shard at a time keeps the extra disk space to one shard.
+        for (size_t s = 0; compact && s < writers.size() && !stop_maintenance;
+             ++s) {
+          try {
+            CompactShard(s, false);
+          } catch (...) {
+          }
+        }
+        RefreshIndexSize();
+      });
+}
+
+void XapianLayer::StopMaintenance() {
+  {
+    std::lock_guard<std::mutex> lk(maintenance_sched_mutex);
+    stop_maintenance = true;
+  }
+  maintenance_cv.notify_all();
+  if (expiry_thread.joinable())
+    expiry_thread.join();
+  if (compaction_thread.joinable())
+    compaction_thread.join();
+}
@@ -2,17 +2,39 @@
 #include <xapian.h>
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <shared_mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "DSRequest.pb.h"
 #include "DSResponse.pb.h"
 #include "DServer.pb.h"
 
 #include "tools/dse_tools.hpp"
+#include "tools/latency_histogram.hpp"
+#include "xapian_processor/db_backup.hpp"
+#include "xapian_processor/db_compaction.hpp"
+#include "xapian_processor/fan_out.hpp"
+#include "xapian_processor/index_writer.hpp"
+#include "xapian_processor/ingest_log.hpp"
+#include "xapian_processor/reader_pool.hpp"
+#include "xapian_processor/replication_log.hpp"
+#include "xapian_processor/result_cache.hpp"
+#include "xapian_processor/search_cursor.hpp"
+#include "xapian_processor/search_deadline.hpp"
+#include "xapian_processor/shards.hpp"
+#include "xapian_processor/suggest_index.hpp"
+#include "xapian_processor/task_id_table.hpp"
+#include "xapian_processor/term_bitmap_index.hpp"
 
 class XapianLayer {
 public:
@@ -23,26 +45,267 @@ public:
   ~XapianLayer();
 
 public:
-  DSearchResult DoSearch(const DSearchRequest &user_query);
-  DSearchResult DoGeoSearch(const DSearchRequest &user_query);
-  DSearchResult DoTagSearch(const DSearchRequest &user_query);
-  DSearchResult DoTextSearch(const DSearchRequest &user_query);
+  // With a deadline, a match still running when it passes is cut short
+  // and its page flagged partial; one already passed before matching
+  // gets DSDeadlineExceeded.
+  DSearchResult DoSearch(const DSearchRequest &user_query,
+                         const SearchDeadline &deadline = {});
+  DSearchResult DoGeoSearch(const DSearchRequest &user_query,
+                            const SearchDeadline &deadline = {});
+  DSearchResult DoTagSearch(const DSearchRequest &user_query,
+                            const SearchDeadline &deadline = {});
+  DSearchResult DoTextSearch(const DSearchRequest &user_query,
+                             const SearchDeadline &deadline = {});
+  DSearchResult DoOnlineSearch(const DSearchRequest &user_query,
+                               const SearchDeadline &deadline = {});
+  // K random tasks (K = page limit), optionally restricted by tags and
+  // task type; cost depends on K and filter density, not corpus size.
+  DSearchResult DoRandomSearch(const DSearchRequest &user_query);
+  // Blocks until the task is committed; throws if the commit failed.
+  // Writes throw std::logic_error on a read replica.
   void AddTaskToDB(const DSIndexTask &task);
+  // Returns once the task is durable: fsynced in the ingest log, after
+  // which it becomes searchable with the next group commit, or committed
+  // if the log is disabled. wait_visible also waits for that commit
+  // (read-your-writes). Throws if the task could not be made durable.
+  void IngestTask(const DSIndexTask &task, bool wait_visible);
+  // Queues the task for the next group commit of its shard. The future
+  // completes once the task is durable and visible to searches.
+  std::future<void> AddTaskToDBAsync(const DSIndexTask &task);
+  // Queues all tasks as one unit per shard; each shard makes its part
+  // durable in one commit.
+  std::future<void> AddTasksToDBAsync(const std::vector<DSIndexTask> &tasks);
+  // Deletes the task if it is indexed; a missing one is not an error.
+  // Queued behind earlier writes to its shard, so a task indexed and then
+  // deleted stays deleted. Returns once the deletion is committed.
+  void DeleteTask(const std::string &task_id);
+  // Summed over shards (last_batch_size is the largest).
+  WriterStats GetWriterStats() const;
+  size_t ShardCount() const { return writers.size(); }
+  std::vector<WriterStats> GetShardWriterStats() const;
+  struct ReadModeCount {
+    std::string plan; // "geo" or "filter"
+    std::string mode; // "combined" or "fan_out"
+    uint64_t queries = 0;
+  };
+  // Empty without shards.
+  std::vector<ReadModeCount> GetReadModeCounts() const;
+  // All zeros when the ingest log is disabled.
+  IngestLogStats GetIngestLogStats() const;
+  HistogramSnapshot GetCommitLatency() const;
+  HistogramSnapshot GetReopenLatency() const { return readers.GetReopenLatency(); }
+  // Search time by "stage" label. The layer records query_build, match and
+  // materialise; the HTTP layer adds its own parse and serialise stages.
+  LatencyHistogramFamily &SearchStageLatency() { return search_stages; }
+  // Deadline of a search received at `received`: search_deadline_ms,
+  // shortened by the request's timeout_ms.
+  SearchDeadline DeadlineFor(const DSearchRequest &request,
+                             SearchDeadline::Clock::time_point received) const;
+  // Bumped after every commit; results computed at an older generation may
+  // be stale.
+  uint64_t GetWriteGeneration() const { return readers.Generation(); }
+  size_t GetReaderHandleCount() const { return readers.HandleCount(); }
+  // All zeros when the cache is disabled.
+  ResultCacheStats GetResultCacheStats() const;
+  QueryCacheStats GetQueryCacheStats() const {
+    return readers.GetQueryCacheStats();
+  }
+  size_t GetTaskIdTableSize() const { return task_ids.Size(); }
+  size_t GetTaskIdTableBytes() const { return task_ids.MemoryBytes(); }
+  // All zeros when the bitmap index is disabled.
+  TermBitmapStats GetTagBitmapStats() const;
+  // Completions for a search box; see SuggestIndex. Only with
+  // HasSuggest().
+  bool HasSuggest() const { return suggest != nullptr; }
+  Suggestions Suggest(std::string_view query, size_t limit) const {
+    return suggest->Suggest(query, limit);
+  }
+  SuggestStats GetSuggestStats() const {
+    return suggest ? suggest->GetStats() : SuggestStats{};
+  }
+  struct DeletionStats {
+    uint64_t api_total = 0;     // removed by DeleteTask()
+    uint64_t expired_total = 0; // removed by the expiry sweeper
+    uint64_t expiry_sweeps_total = 0;
+  };
+  DeletionStats GetDeletionStats() const;
+  CompactionStats GetCompactionStats() const;
+  // Summed over shards, as seen by a reader; bytes as of the last
+  // RefreshIndexSize().
+  DatabaseFootprint GetIndexFootprint();
+  // Walks the shard directories for GetIndexFootprint().bytes. Run at
+  // StartMaintenance() and after every compaction check, not per scrape.
+  void RefreshIndexSize();
+
+  // Read replica (SearchConfig.replicate_from): documents arrive only
+  // through ApplyChangesets() and ApplySnapshotPage().
+  bool IsFollower() const {
+    return !SearchConfigProto.replicate_from().empty();
+  }
+  // Changesets kept for followers; null unless replication_log_mb > 0.
+  const ReplicationLog *GetReplicationLog() const {
+    return replication_log.get();
+  }
+  // Leader: up to limit documents of the shard with docids above `after`,
+  // into page. Returns true if the page reaches the end of the shard.
+  bool ReadSnapshotPage(size_t shard, Xapian::docid after, size_t limit,
+                        Changeset &page);
+  // Follower: applies the leader's changesets in order, one transaction
+  // per shard.
+  void ApplyChangesets(const std::vector<Changeset> &changesets);
+  // Follower: makes the shard's docids in (after, upto] equal to the page,
+  // deleting the ones it lacks; upto 0 means up to the end of the shard.
+  void ApplySnapshotPage(const Changeset &page, Xapian::docid after,
+                         Xapian::docid upto);
 
 private:
-  std::unique_ptr<Xapian::LatLongDistanceKeyMaker>
-  SetupGeoQuery(const std::pair<double, double> &userPos);
+  // Query kinds whose per-shard results merge exactly; each picks its
+  // ReadModeChooser mode separately.
+  static constexpr size_t kGeoReads = 0;
+  static constexpr size_t kFilterReads = 1;
+  static constexpr size_t kReadPlans = 2;
+
+  // Runs fn against a leased reader. A handle that fell more than one
+  // revision behind mid-query (DatabaseModifiedError) is reopened and the
+  // query retried once.
+  template <typename Fn> void WithLease(Fn &&fn) {
+    for (int attempt = 0;; ++attempt) {
+      ReaderPool::Lease lease = readers.Acquire();
+      try {
+        fn(lease);
+        return;
+      } catch (const Xapian::DatabaseModifiedError &) {
+        lease.Invalidate();
+        if (attempt > 0)
+          throw;
+      }
+    }
+  }
+  template <typename Fn> void WithReader(Fn &&fn) {
+    WithLease([&](ReaderPool::Lease &lease) { fn(lease.db()); });
+  }
+  // Combined unless the index is sharded.
+  ReadModeChooser::Mode ChooseReadMode(size_t plan);
+  void RecordReadMode(size_t plan, ReadModeChooser::Mode mode,
+                      std::chrono::steady_clock::time_point started);
+  size_t ShardOf(const DSIndexTask &task) const {
+    return ShardForTask(task.task_id(), writers.size());
+  }
+
+  DSearchResult DispatchSearch(const DSearchRequest &user_request,
+                               const SearchDeadline &deadline);
+  // QT_TagTasks without text or radius, answered from tag_bitmaps.
+  DSearchResult DoBitmapTagSearch(const DSearchRequest &user_request);
+  // Relevance-ranked search combining text, tags (any/all), task type and
+  // radius into one OP_FILTER / OP_AND_MAYBE query.
+  DSearchResult DoComposedSearch(const DSearchRequest &user_request,
+                                 const SearchDeadline &deadline);
+  Xapian::Document MakeDocument(const DSIndexTask &task) const;
+  // Paging for the request; nullopt if the cursor or offset is rejected.
+  std::optional<SearchPage> ResolveSearchPage(const DSearchRequest &request) const;
+  // Fills task_ids, estimated_total and next_cursor for relevance-ordered
+  // queries (offset cursors).
+  void FillPage(const Xapian::Database &db, const Xapian::MSet &mset,
+                const SearchPage &page, DSearchResult &result) const;
+  // Same for a page merged from several shards.
+  void FillPage(const Xapian::Database &db,
+                const std::vector<Xapian::docid> &docids,
+                Xapian::doccount estimated, const SearchPage &page,
+                DSearchResult &result) const;
+  // Adds the hit's task_id to result: from the side table, or from the
+  // document's value slot if the table has not caught up with this reader.
+  void AppendTaskId(const Xapian::Database &db, const TaskIdTable::View &ids,
+                    Xapian::docid docid, DSearchResult &result) const;
+  void UpgradeIndexFormat();
+  // Re-submits log records their shard has not committed yet and waits
+  // for them.
+  void ReplayIngestLog();
+  // Track which ingest log positions each shard was handed and committed,
+  // to tell the log how far every shard has applied it.
+  void NoteLogSubmitted(size_t shard, uint64_t log_position);
+  void NoteLogCommitted(size_t shard, uint64_t log_position);
+  void CheckWritable() const;
+  // Commit hook of the shard's writer.
+  void OnShardCommit(size_t shard,
+                     const std::vector<CommittedDocument> &committed,
+                     uint64_t log_position);
+  // Brings task_ids and tag_bitmaps in line with the shard's changed
+  // documents (null if deleted).
+  void UpdateSideTables(
+      size_t shard,
+      const std::map<Xapian::docid, const Xapian::Document *> &changed);
+  void PublishChangeset(size_t shard, std::vector<Changeset::Entry> entries);
+  // Records docids changed while CompactShard() copies the shard; called
+  // with the shard's lock held.
+  void NoteTouched(size_t shard, const std::vector<Xapian::docid> &docids);
+  // Backups and compactions take turns.
+  bool RunBackup(BackupKind kind, const std::string &backup_root);
+  // Writes replicated entries to the shard in order (after deleting the
+  // docids in *sweep that they lack), then updates the side tables.
+  void ApplyReplicated(
+      size_t shard, const std::vector<const Changeset::Entry *> &entries,
+      std::optional<std::pair<Xapian::docid, Xapian::docid>> sweep);
 
 public:
+  // Rewrites the shard's database compactly if CompactionReason() finds a
+  // reason to (always with force) and returns whether it did. Writes to
+  // the shard wait only while documents changed during the copy are
+  // carried over and the files are swapped; searches never wait. Throws on
+  // failure, leaving the database as it was.
+  bool CompactShard(size_t shard, bool force);
+  // Deletes the shard's tasks whose expires_at has passed, up to limit per
+  // commit, and returns how many it deleted. Leader only.
+  size_t SweepExpired(size_t shard, size_t limit);
+  // Background expiry sweeps (leader) and compaction checks, every
+  // expiry_sweep_sec / compaction_check_sec. The index size is refreshed
+  // on that period even with compaction disabled.
+  void StartMaintenance();
+  void StopMaintenance();
+
+  // One backup generation under backup_root; see DatabaseBackup. Commits
+  // are blocked only while the final re-sync runs.
   bool PerformColdBackup(const std::string &backup_root);
   bool PerformHotBackup(const std::string &backup_root);
+  // Runs cold and hot backups every cold_backup_timer_min /
+  // hot_backup_timer_min minutes; a kind with a period <= 0 is not
+  // scheduled.
   void StartBackupScheduler(const std::string &backup_root);
   void StopBackupScheduler();
+  BackupStats GetBackupStats(BackupKind kind) const {
+    return backups->GetStats(kind);
+  }
 
 private:
-  Xapian::Database database;
-  mutable std::shared_mutex db_mutex;
+  SearchConfig SearchConfigProto;
+  // One database per shard (just db_file_name when unsharded).
+  const std::vector<std::string> shard_paths;
+  // Per shard: held exclusively by its commits and shared by backups;
+  // searches never take them.
+  std::deque<std::shared_mutex> shard_mutexes;
+  ReaderPool readers;
+  // Per shard; shards commit independently and in parallel.
+  std::vector<std::unique_ptr<IndexWriter>> writers;
+  // Null when disabled by config.
+  std::unique_ptr<IngestLog> ingest_log;
+  std::mutex log_progress_mutex;
+  std::vector<uint64_t> log_submitted;
+  std::vector<uint64_t> log_committed;
+  std::unique_ptr<ReplicationLog> replication_log;
+  // Null when unsharded.
+  std::unique_ptr<FanOutPool> fan_out;
+  ReadModeChooser read_modes{kReadPlans};
+  std::unique_ptr<ResultCache> result_cache;
+  TaskIdTable task_ids;
+  // TAG and TYPE terms; null when disabled by config.
+  std::unique_ptr<TermBitmapIndex> tag_bitmaps;
+  // Null when disabled by config.
+  std::unique_ptr<SuggestIndex> suggest;
+  LatencyHistogramFamily search_stages{std::vector<std::string>{"stage"}};
+  LatencyHistogram &query_build_latency;
+  LatencyHistogram &match_latency;
+  LatencyHistogram &materialise_latency;
 
+  std::unique_ptr<DatabaseBackup> backups;
   std::thread cold_thread;
   std::thread hot_thread;
   std::atomic<bool> stop_backups{false};
@@ -50,5 +313,27 @@ private:
   std::mutex sched_mutex;
   std::condition_variable sched_cv;
 
-  SearchConfig SearchConfigProto;
-};
\ No newline at end of file
+  std::atomic<uint64_t> deleted_api{0};
+  std::atomic<uint64_t> deleted_expired{0};
+  std::atomic<uint64_t> expiry_sweeps{0};
+  std::mutex maintenance_mutex;
+  // Per shard; set while CompactShard() copies it.
+  std::mutex touched_mutex;
+  std::vector<std::optional<std::vector<Xapian::docid>>> touched;
+  mutable std::mutex compaction_stats_mutex;
+  CompactionStats compaction_stats;
+  std::atomic<uint64_t> index_size_bytes{0};
+  std::thread expiry_thread;
+  std::thread compaction_thread;
+  // Also cancels a running compaction.
+  std::atomic<bool> stop_maintenance{false};
+  std::mutex maintenance_sched_mutex;
+  std::condition_variable maintenance_cv;
+};
+
+// Why Xapian would refuse the task or a deletion of task_id (a term over
+// its length limit), or nothing if it would not. The writer commits many
+// tasks in one transaction, so these are checked before a task is logged
+// or queued.
+std::optional<std::string> UnindexableTask(const DSIndexTask &task);
+std::optional<std::string> UnindexableTaskId(const std::string &task_id);